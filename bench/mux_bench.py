@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""
+Сравнение mux-режима с прямым и сжатия (-z) без него на одной машине.
+
+Поднимает локальный источник данных и для каждой конфигурации — свои экземпляры
+CLIProxyServer:
+  direct    один прокси, туннели идут прямо к источнику;
+  mux       edge (-M) -> core (-m), туннели — потоки внутри постоянных линков;
+  mux -z    то же со сжатием на обеих сторонах.
+
+Для каждой меряет:
+  setup     время от connect() клиента до первого байта ответа через новый туннель
+            (SOCKS5-рукопожатие, OPEN/OPEN_OK по линку, connect к источнику), медиана и p90;
+  json      скачивание сжимаемых данных (JSON-строки), MB/s;
+  random    скачивание несжимаемых данных (случайные байты), MB/s;
+  link      сколько байт ушло в линк на байт JSON: запись core (direct — прокси) в сокеты
+            по /proc/<pid>/io, так что замер на loopback не тормозит лишний ретранслятор.
+
+Задержку WAN можно добавить на loopback: tc qdisc add dev lo root netem delay 20ms
+(и убрать: tc qdisc del dev lo root).
+
+    python3 bench/mux_bench.py ./CLIProxyServer [--size MiB] [--tunnels N] [--streams N]
+"""
+import argparse
+import os
+import random
+import socket
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HOST = '127.0.0.1'
+SECRET = 'bench'
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind((HOST, 0))
+        return s.getsockname()[1]
+
+
+def make_json(size):
+    """Похоже на API-ответы и логи: сжимается zlib примерно в 5 раз"""
+    rnd = random.Random(1)
+    words = ['alpha', 'beta', 'gamma', 'delta', 'status', 'ok', 'error', 'user', 'region', 'eu-west']
+    out = bytearray()
+    n = 0
+    while len(out) < size:
+        out += ('{"id":%d,"user":"%s%d","status":"%s","region":"%s","latency_ms":%d,"tags":["%s","%s"]}\n' % (
+            n, rnd.choice(words), rnd.randrange(1000), rnd.choice(words), rnd.choice(words),
+            rnd.randrange(5000), rnd.choice(words), rnd.choice(words))).encode()
+        n += 1
+    return bytes(out[:size])
+
+
+class Origin:
+    """
+    Источник: клиент шлёт один байт команды —
+    'p' — ответить одним байтом (замер setup), 'j' — отдать JSON, 'r' — случайные байты
+    """
+
+    def __init__(self, size):
+        self.payload = {b'j': make_json(size), b'r': os.urandom(size)}
+        self.sock = socket.socket()
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind((HOST, 0))
+        self.sock.listen(128)
+        self.port = self.sock.getsockname()[1]
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    def accept(self):
+        while True:
+            conn, _ = self.sock.accept()
+            threading.Thread(target=self.serve, args=(conn,), daemon=True).start()
+
+    def serve(self, conn):
+        with conn:
+            cmd = conn.recv(1)
+            if cmd == b'p':
+                conn.sendall(b'p')
+            elif cmd in self.payload:
+                conn.sendall(self.payload[cmd])
+            # Ждём, пока клиент дочитает и закроет туннель
+            while conn.recv(65536):
+                pass
+
+
+def socks_connect(port, dst_port, timeout=10):
+    s = socket.create_connection((HOST, port), timeout=timeout)
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    s.sendall(b'\x05\x01\x00')
+    if s.recv(2) != b'\x05\x00':
+        raise RuntimeError('SOCKS5 greeting refused')
+    s.sendall(b'\x05\x01\x00\x01' + socket.inet_aton(HOST) + struct.pack('>H', dst_port))
+    reply = b''
+    while len(reply) < 10:
+        d = s.recv(10 - len(reply))
+        if not d:
+            raise RuntimeError('proxy closed the connection')
+        reply += d
+    if reply[1] != 0:
+        s.close()
+        raise RuntimeError('CONNECT refused (%d)' % reply[1])
+    return s
+
+
+def recv_count(s, size):
+    """
+    Читаем ровно size байт: EOF источника прокси клиенту не передаёт, он только
+    закрывает свою сторону к источнику
+    """
+    total = 0
+    while total < size:
+        d = s.recv(1 << 20)
+        if not d:
+            break
+        total += len(d)
+    return total
+
+
+class Proxy:
+    def __init__(self, binary, logdir, name, args):
+        self.port = free_port()
+        self.log = os.path.join(logdir, name + '.log')
+        self.proc = subprocess.Popen([binary, '-a', HOST, '-p', str(self.port), '-o', self.log] + args,
+                                     stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL,
+                                     stderr=subprocess.STDOUT)
+
+    def written(self):
+        with open('/proc/%d/io' % self.proc.pid) as f:
+            for line in f:
+                if line.startswith('wchar:'):
+                    return int(line.split()[1])
+        return 0
+
+    def stop(self):
+        self.proc.terminate()
+        try:
+            self.proc.wait(5)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+            self.proc.wait()
+
+
+def wait_ready(port, origin_port, timeout=10):
+    """Прокси слушает и (для edge) линки к core подняты: пробный туннель проходит"""
+    deadline = time.monotonic() + timeout
+    while True:
+        try:
+            s = socks_connect(port, origin_port, timeout=2)
+            s.sendall(b'p')
+            ok = s.recv(1) == b'p'
+            s.close()
+            if ok:
+                return
+        except (OSError, RuntimeError):
+            pass
+        if time.monotonic() > deadline:
+            raise RuntimeError('proxy on port %d is not ready' % port)
+        time.sleep(0.1)
+
+
+def measure_setup(port, origin_port, tunnels):
+    times = []
+    for _ in range(tunnels):
+        t0 = time.perf_counter()
+        s = socks_connect(port, origin_port)
+        s.sendall(b'p')
+        if s.recv(1) != b'p':
+            raise RuntimeError('bad ping reply')
+        times.append(time.perf_counter() - t0)
+        s.close()
+    times.sort()
+    return statistics.median(times) * 1e3, times[int(len(times) * 0.9)] * 1e3
+
+
+def measure_download(port, origin_port, kind, size, streams):
+    got = [0] * streams
+
+    def one(i):
+        s = socks_connect(port, origin_port, timeout=60)
+        s.sendall(kind)
+        got[i] = recv_count(s, size)
+        s.close()
+
+    threads = [threading.Thread(target=one, args=(i,)) for i in range(streams)]
+    t0 = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - t0
+    if got != [size] * streams:
+        raise RuntimeError('short download: %s of %d' % (got, size))
+    return size * streams / elapsed / 1e6
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Compare direct, mux and mux -z throughput and tunnel setup latency')
+    ap.add_argument('binary', help='path to CLIProxyServer')
+    ap.add_argument('--size', type=int, default=64, help='MiB per download (default 64)')
+    ap.add_argument('--tunnels', type=int, default=200, help='short tunnels for setup latency (default 200)')
+    ap.add_argument('--streams', type=int, default=1, help='parallel downloads (default 1)')
+    opts = ap.parse_args()
+
+    size = opts.size << 20
+    origin = Origin(size)
+    logdir = tempfile.mkdtemp(prefix='mux_bench.')
+    configs = [
+        ('direct', []),
+        ('mux', []),
+        ('mux -z', ['-z']),
+    ]
+
+    print('%-8s %12s %12s %10s %10s %10s' % ('', 'setup p50 ms', 'setup p90 ms', 'json MB/s', 'json link', 'random MB/s'))
+    for name, extra in configs:
+        procs = []
+        try:
+            if name == 'direct':
+                front = Proxy(opts.binary, logdir, 'direct', ['-A', '0'])
+                procs.append(front)
+                sender = front
+            else:
+                tag = name.replace(' ', '').replace('-', '_')
+                core = Proxy(opts.binary, logdir, tag + '_core', ['-A', '0', '-m', '-X', SECRET] + extra)
+                procs.append(core)
+                sender = core
+                wait_ready(core.port, origin.port)
+                front = Proxy(opts.binary, logdir, tag + '_edge',
+                              ['-A', '0', '-M', '%s:%d' % (HOST, core.port), '-X', SECRET] + extra)
+                procs.append(front)
+            wait_ready(front.port, origin.port)
+
+            p50, p90 = measure_setup(front.port, origin.port, opts.tunnels)
+            before = sender.written()
+            json_rate = measure_download(front.port, origin.port, b'j', size, opts.streams)
+            link = (sender.written() - before) / (size * opts.streams)
+            random_rate = measure_download(front.port, origin.port, b'r', size, opts.streams)
+            print('%-8s %12.3f %12.3f %10.1f %9.0f%% %10.1f' % (name, p50, p90, json_rate, link * 100, random_rate))
+            sys.stdout.flush()
+        finally:
+            for p in reversed(procs):
+                p.stop()
+
+    print('logs: %s' % logdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scan.h"
+
+/*
+ * Микробенчмарк scan_head_end: поиск конца HTTP-заголовка реализациями avx2, sse2
+ * и scalar против strstr (как было до scan.c) на заголовках ответа разной длины,
+ * плюс кусок текстового тела — старый путь (isalpha x4 + strstr) против
+ * scan_http_start. Перед замером каждая реализация сверяется с memmem.
+ *
+ *   cliproxy-bench-scan [итераций на замер, по умолчанию 1000000]
+ */
+
+#define HEAD_SIZES_MAX 16384  // Самый длинный заголовок в замере
+#define BODY_CHUNK     16384  // Кусок тела: столько туннель читает за раз
+
+static const size_t head_sizes[] = { 225, 1041, 8032 };
+
+static const char *impl_names[] = { "avx2", "sse2", "scalar" };
+
+// strstr через указатель: компилятор не свернёт вызов на константной строке
+static char *(*volatile strstr_fn)(const char *, const char *) = strstr;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Заголовок ответа длиной ровно size (с "\r\n\r\n"), за ним начало тела и '\0'
+ */
+static size_t make_head(char *buf, size_t size)
+{
+    size_t len = (size_t)sprintf(buf, "HTTP/1.1 200 OK\r\nServer: nginx\r\n");
+    size_t n   = 0;
+    while (len + 64 < size)
+    {
+        len += (size_t)sprintf(buf + len, "X-Header-%zu: value-%zu-abcdefghijklmnop\r\n", n, n * 7);
+        n++;
+    }
+    // Добиваем последнюю строку до нужной длины
+    len += (size_t)sprintf(buf + len, "X-Pad: ");
+    while (len + 4 < size)
+    {
+        buf[len++] = 'p';
+    }
+    memcpy(buf + len, "\r\n\r\nbody", 9);
+    return len + 4;
+}
+
+/*
+ * Сверка с memmem на случайных буферах из "\r\nab" и случайных смещениях from
+ */
+static int check(void)
+{
+    uint8_t buf[512];
+    for (int it = 0; it < 200000; ++it)
+    {
+        size_t len = (size_t)rand() % sizeof(buf);
+        for (size_t i = 0; i < len; ++i)
+        {
+            buf[i] = (uint8_t)"\r\nab"[rand() % 4];
+        }
+        uint8_t *at     = memmem(buf, len, "\r\n\r\n", 4);
+        size_t   expect = at != NULL ? (size_t)(at - buf) + 4 : 0;
+        // Резюм с from корректен, только если в первых from байтах разделителя не было
+        size_t   from   = len != 0 ? (size_t)rand() % len : 0;
+        if (expect != 0 && expect <= from)
+        {
+            from = 0;
+        }
+        size_t got = scan_head_end(buf, len, from);
+        if (got != expect)
+        {
+            fprintf(stderr, "%s: len=%zu from=%zu: got %zu, expected %zu\n",
+                    scan_impl_name(), len, from, got, expect);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long iters = argc > 1 ? atol(argv[1]) : 1000000;
+    if (iters <= 0)
+    {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    scan_init();
+    printf("default implementation: %s, %ld iterations per cell, ns per call\n\n", scan_impl_name(), iters);
+
+    static char head[HEAD_SIZES_MAX + 16];
+    volatile size_t sink = 0;
+
+    printf("%-14s %9s", "", "strstr");
+    for (size_t k = 0; k < sizeof(impl_names) / sizeof(impl_names[0]); ++k)
+    {
+        printf(" %9s", impl_names[k]);
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(head_sizes) / sizeof(head_sizes[0]); ++s)
+    {
+        size_t len = make_head(head, head_sizes[s]);
+
+        double t0 = now();
+        for (long i = 0; i < iters; ++i)
+        {
+            __asm__ volatile("" : : "r"(head) : "memory");
+            char *end = strstr_fn(head, "\r\n\r\n");
+            sink += end != NULL ? (size_t)(end - head) : 0;
+        }
+        printf("head %6zu B %9.1f", len, (now() - t0) / (double)iters * 1e9);
+
+        for (size_t k = 0; k < sizeof(impl_names) / sizeof(impl_names[0]); ++k)
+        {
+            if (scan_select(impl_names[k]) < 0)
+            {
+                printf(" %9s", "-");
+                continue;
+            }
+            if (check() < 0 || scan_head_end((const uint8_t *)head, len, 0) != len)
+            {
+                return EXIT_FAILURE;
+            }
+            t0 = now();
+            for (long i = 0; i < iters; ++i)
+            {
+                __asm__ volatile("" : : "r"(head) : "memory");
+                sink += scan_head_end((const uint8_t *)head, len, 0);
+            }
+            printf(" %9.1f", (now() - t0) / (double)iters * 1e9);
+        }
+        printf("\n");
+    }
+
+    // Текстовое тело: раньше каждый кусок, начинающийся с четырёх букв, уходил в strstr до конца
+    static char body[BODY_CHUNK + 1];
+    for (size_t i = 0; i < BODY_CHUNK; ++i)
+    {
+        body[i] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit. "[i % 57];
+    }
+    scan_init();
+
+    double t0 = now();
+    for (long i = 0; i < iters; ++i)
+    {
+        __asm__ volatile("" : : "r"(body) : "memory");
+        if (isalpha((unsigned char)body[0]) && isalpha((unsigned char)body[1])
+            && isalpha((unsigned char)body[2]) && isalpha((unsigned char)body[3]))
+        {
+            char *end = strstr_fn(body, "\r\n\r\n");
+            sink += end != NULL ? (size_t)(end - body) : 1;
+        }
+    }
+    double t1 = now();
+    for (long i = 0; i < iters; ++i)
+    {
+        __asm__ volatile("" : : "r"(body) : "memory");
+        if (scan_http_start((const uint8_t *)body, BODY_CHUNK) != SCAN_HTTP_NO)
+        {
+            sink += scan_head_end((const uint8_t *)body, BODY_CHUNK, 0);
+        }
+    }
+    double t2 = now();
+    printf("\nbody chunk %d B: isalpha x4 + strstr %.1f ns, scan_http_start %.1f ns\n",
+           BODY_CHUNK, (t1 - t0) / (double)iters * 1e9, (t2 - t1) / (double)iters * 1e9);
+
+    (void)sink;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tls.h"
+
+/*
+ * Проверка и замер парсера ClientHello (tls.c) на корпусе из bench/tls_corpus.py
+ * плюс синтетическом Chrome-подобном ClientHello (GREASE, key share 1.2 KB, две записи):
+ *  - каждый ClientHello целиком даёт ожидаемые SNI, ALPN и версии;
+ *  - то же при случайной нарезке на куски (по 1-3 байта и крупнее);
+ *  - любой префикс — TLS_MORE, а не TLS_NOT;
+ *  - фаззинг: испорченные и обрезанные ClientHello кусками (запускать и под ASan/UBSan);
+ *  - замер: нс на ClientHello вместе с tls_parser_init.
+ *
+ *   cliproxy-bench-tls [corpus.bin [раундов фаззинга, по умолчанию 300000]]
+ */
+
+#define HELLOS_MAX    4096
+#define RESULT_MAX    (TLS_SNI_MAX + TLS_ALPN_MAX + 64)
+#define SPLITS        50       // Случайных нарезок на ClientHello
+#define BENCH_ROUNDS  200000
+
+typedef struct hello
+{
+    const uint8_t  *data;
+    size_t          len;
+    char            expected[RESULT_MAX];
+} hello_t;
+
+static hello_t hellos[HELLOS_MAX];
+static size_t  nhellos = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * "sni|alpn|версии" — в том же виде, что пишет tls_corpus.py
+ */
+static void result_format(const tls_parser_t *p, char *out, size_t size)
+{
+    int  n = snprintf(out, size, "%s|%s|", p->hello.sni, p->hello.alpn);
+    char name[16];
+    for (unsigned i = 0; i < p->hello.nversions && n > 0 && (size_t)n < size; ++i)
+    {
+        n += snprintf(out + n, size - (size_t)n, "%s%s", i != 0 ? "," : "",
+                      tls_version_name(p->hello.versions[i], name, sizeof(name)));
+    }
+}
+
+/*
+ * Кормит парсер data[0..len) кусками случайной длины 1..max_chunk. Каждый кусок —
+ * отдельная копия в куче: ASan поймает чтение за его край
+ */
+static tls_result_t feed_split(tls_parser_t *p, const uint8_t *data, size_t len, size_t max_chunk)
+{
+    tls_result_t r  = TLS_MORE;
+    size_t       at = 0;
+    tls_parser_init(p);
+    while (at < len && r == TLS_MORE)
+    {
+        size_t n = 1 + (size_t)rand() % max_chunk;
+        if (n > len - at)
+        {
+            n = len - at;
+        }
+        uint8_t *chunk = malloc(n);
+        if (chunk == NULL)
+        {
+            abort();
+        }
+        memcpy(chunk, data + at, n);
+        r = tls_parser_feed(p, chunk, n);
+        free(chunk);
+        at += n;
+    }
+    return r;
+}
+
+static size_t put16(uint8_t *b, size_t v)
+{
+    b[0] = (uint8_t)(v >> 8);
+    b[1] = (uint8_t)v;
+    return 2;
+}
+
+/*
+ * Chrome-подобный ClientHello: GREASE в шифрах, расширениях и версиях, key share
+ * на 1216 байт, тело разрезано на две записи
+ */
+static size_t synth_chrome(uint8_t *out)
+{
+    static const char host[] = "www.chrome-like.example";
+    size_t  hl = sizeof(host) - 1;
+    uint8_t hs[4096];
+    size_t  n  = 4;
+
+    n += put16(hs + n, 0x0303);
+    memset(hs + n, 7, 32);
+    n += 32;
+    hs[n++] = 32;
+    memset(hs + n, 9, 32);
+    n += 32;
+    n += put16(hs + n, 34);
+    for (int i = 0; i < 17; ++i)
+    {
+        n += put16(hs + n, i == 0 ? 0x2a2a : 0x1301 + i);
+    }
+    hs[n++] = 1;
+    hs[n++] = 0;
+
+    size_t ext = n;
+    n += 2;
+    n += put16(hs + n, 0x3a3a);
+    n += put16(hs + n, 0);
+    n += put16(hs + n, 0);
+    n += put16(hs + n, hl + 5);
+    n += put16(hs + n, hl + 3);
+    hs[n++] = 0;
+    n += put16(hs + n, hl);
+    memcpy(hs + n, host, hl);
+    n += hl;
+    n += put16(hs + n, 51);
+    n += put16(hs + n, 1216 + 6);
+    n += put16(hs + n, 1216 + 4);
+    n += put16(hs + n, 0x11ec);
+    n += put16(hs + n, 1216);
+    memset(hs + n, 5, 1216);
+    n += 1216;
+    n += put16(hs + n, 16);
+    n += put16(hs + n, 14);
+    n += put16(hs + n, 12);
+    hs[n++] = 2;
+    memcpy(hs + n, "h2", 2);
+    n += 2;
+    hs[n++] = 8;
+    memcpy(hs + n, "http/1.1", 8);
+    n += 8;
+    n += put16(hs + n, 43);
+    n += put16(hs + n, 7);
+    hs[n++] = 6;
+    n += put16(hs + n, 0x7a7a);
+    n += put16(hs + n, 0x0304);
+    n += put16(hs + n, 0x0303);
+    put16(hs + ext, n - ext - 2);
+    hs[0] = 1;
+    hs[1] = (uint8_t)((n - 4) >> 16);
+    put16(hs + 2, n - 4);
+
+    // Первая запись — 700 байт тела, вторая — остальное
+    size_t first = 700;
+    size_t len   = 0;
+    out[len++] = 0x16;
+    len += put16(out + len, 0x0301);
+    len += put16(out + len, first);
+    memcpy(out + len, hs, first);
+    len += first;
+    out[len++] = 0x16;
+    len += put16(out + len, 0x0303);
+    len += put16(out + len, n - first);
+    memcpy(out + len, hs + first, n - first);
+    return len + n - first;
+}
+
+static int load_corpus(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    uint8_t head[4];
+    while (nhellos < HELLOS_MAX - 1 && fread(head, 1, 2, f) == 2)
+    {
+        hello_t *h   = &hellos[nhellos];
+        size_t   len = (size_t)head[0] << 8 | head[1];
+        if (len >= sizeof(h->expected) || fread(h->expected, 1, len, f) != len || fread(head, 1, 4, f) != 4)
+        {
+            break;
+        }
+        h->expected[len] = '\0';
+        h->len = (size_t)head[0] << 24 | (size_t)head[1] << 16 | (size_t)head[2] << 8 | head[3];
+        uint8_t *data = malloc(h->len != 0 ? h->len : 1);
+        if (data == NULL || fread(data, 1, h->len, f) != h->len)
+        {
+            free(data);
+            break;
+        }
+        h->data = data;
+        nhellos++;
+    }
+    int bad = ferror(f) || !feof(f);
+    fclose(f);
+    if (bad)
+    {
+        fprintf(stderr, "%s: truncated or malformed corpus\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Целиком, нарезками и префиксами — число расхождений
+ */
+static int check(void)
+{
+    int bad = 0;
+    for (size_t i = 0; i < nhellos; ++i)
+    {
+        const hello_t *h = &hellos[i];
+        tls_parser_t   p;
+        char           got[RESULT_MAX];
+
+        tls_parser_init(&p);
+        tls_result_t r = tls_parser_feed(&p, h->data, h->len);
+        result_format(&p, got, sizeof(got));
+        if (r != TLS_DONE || strcmp(got, h->expected) != 0)
+        {
+            fprintf(stderr, "hello %zu: result %d \"%s\", expected \"%s\"\n", i, r, got, h->expected);
+            bad++;
+            continue;
+        }
+
+        for (int s = 0; s < SPLITS; ++s)
+        {
+            r = feed_split(&p, h->data, h->len, s < 10 ? 3 : 300);
+            result_format(&p, got, sizeof(got));
+            if (r != TLS_DONE || strcmp(got, h->expected) != 0)
+            {
+                fprintf(stderr, "hello %zu: split %d gives %d \"%s\"\n", i, s, r, got);
+                bad++;
+                break;
+            }
+        }
+
+        for (size_t k = 1; k < h->len; ++k)
+        {
+            uint8_t *prefix = malloc(k);
+            if (prefix == NULL)
+            {
+                abort();
+            }
+            memcpy(prefix, h->data, k);
+            tls_parser_init(&p);
+            r = tls_parser_feed(&p, prefix, k);
+            free(prefix);
+            if (r == TLS_NOT)
+            {
+                fprintf(stderr, "hello %zu: prefix of %zu bytes rejected\n", i, k);
+                bad++;
+                break;
+            }
+            if (r == TLS_DONE)
+            {
+                // Хвост после ClientHello (ещё записи) парсеру уже не нужен
+                break;
+            }
+        }
+    }
+    return bad;
+}
+
+/*
+ * 1-4 испорченных байта, половина ещё и обрезана. Ищем падения (под ASan) и
+ * переполнение полей результата
+ */
+static int fuzz(long rounds)
+{
+    unsigned long results[3] = { 0 };
+    int           bad        = 0;
+    for (long it = 0; it < rounds; ++it)
+    {
+        const hello_t *h   = &hellos[(size_t)rand() % nhellos];
+        uint8_t       *buf = malloc(h->len);
+        if (buf == NULL)
+        {
+            abort();
+        }
+        memcpy(buf, h->data, h->len);
+        for (int m = 1 + rand() % 4; m > 0; --m)
+        {
+            buf[(size_t)rand() % h->len] = (uint8_t)rand();
+        }
+        size_t       len = rand() % 2 != 0 ? h->len : (size_t)rand() % h->len;
+        tls_parser_t p;
+        tls_result_t r   = feed_split(&p, buf, len, 200);
+        free(buf);
+        results[r]++;
+        if (strnlen(p.hello.sni, sizeof(p.hello.sni)) == sizeof(p.hello.sni)
+            || strnlen(p.hello.alpn, sizeof(p.hello.alpn)) == sizeof(p.hello.alpn)
+            || p.hello.nversions > TLS_VERSIONS_MAX)
+        {
+            fprintf(stderr, "fuzz round %ld: result fields overflow\n", it);
+            bad++;
+        }
+    }
+    printf("fuzz: %ld rounds, more %lu, done %lu, not %lu\n",
+           rounds, results[TLS_MORE], results[TLS_DONE], results[TLS_NOT]);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    long rounds = argc > 2 ? atol(argv[2]) : 300000;
+    if (argc > 3 || rounds < 0)
+    {
+        fprintf(stderr, "Usage: %s [corpus.bin [fuzz_rounds]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 1 && load_corpus(argv[1]) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    static uint8_t chrome[8192];
+    hellos[nhellos].data = chrome;
+    hellos[nhellos].len  = synth_chrome(chrome);
+    snprintf(hellos[nhellos].expected, RESULT_MAX, "www.chrome-like.example|h2,http/1.1|TLS1.3,TLS1.2");
+    nhellos++;
+
+    srand(1);
+    int bad = check();
+    printf("check: %zu ClientHellos, whole, %d random splits and every prefix: %d bad\n", nhellos, SPLITS, bad);
+    bad += fuzz(rounds);
+
+    size_t total = 0;
+    for (size_t i = 0; i < nhellos; ++i)
+    {
+        total += hellos[i].len;
+    }
+    volatile unsigned sink = 0;
+    double t0 = now();
+    for (long k = 0; k < BENCH_ROUNDS; ++k)
+    {
+        const hello_t *h = &hellos[(size_t)k % nhellos];
+        tls_parser_t   p;
+        tls_parser_init(&p);
+        sink += tls_parser_feed(&p, h->data, h->len);
+        sink += (unsigned char)p.hello.sni[0];
+    }
+    printf("bench: %.0f ns per ClientHello (average %zu bytes), init included\n",
+           (now() - t0) / BENCH_ROUNDS * 1e9, total / nhellos);
+
+    (void)sink;
+    return bad == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Корпус ClientHello для cliproxy-bench-tls: настоящие первые полёты клиента OpenSSL
+(модуль ssl, MemoryBIO — без сети) для всех сочетаний SNI, ALPN и диапазона версий.
+
+Запись в файле: u16 длина ожидаемого результата, сам результат "sni|alpn|версии"
+(как его печатает бенчмарк), u32 длина ClientHello, байты ClientHello. Всё big-endian.
+
+    python3 bench/tls_corpus.py tls_corpus.bin
+"""
+import ssl
+import struct
+import sys
+
+HOSTS = [
+    'example.com',
+    'api.internal.corp',
+    'a.b.c.d.e.f.very-long-subdomain-name-for-testing.example.org',
+    'x.io',
+    'cdn.static.net',
+]
+
+ALPNS = [
+    [],
+    ['h2', 'http/1.1'],
+    ['http/1.1'],
+    ['h2'],
+    ['spdy/3.1', 'h2', 'http/1.1'],
+    ['grpc-exp', 'h2'],
+]
+
+# (min, max) и что должно оказаться в supported_versions: TLS 1.2 без 1.3 его не шлёт
+VERSIONS = [
+    (ssl.TLSVersion.TLSv1_2, ssl.TLSVersion.TLSv1_3, 'TLS1.3,TLS1.2'),
+    (ssl.TLSVersion.TLSv1_2, ssl.TLSVersion.TLSv1_2, ''),
+    (ssl.TLSVersion.TLSv1_3, ssl.TLSVersion.TLSv1_3, 'TLS1.3'),
+]
+
+
+def client_hello(host, alpn, lo, hi):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+    ctx.minimum_version = lo
+    ctx.maximum_version = hi
+    if alpn:
+        ctx.set_alpn_protocols(alpn)
+    incoming, outgoing = ssl.MemoryBIO(), ssl.MemoryBIO()
+    conn = ctx.wrap_bio(incoming, outgoing, server_hostname=host)
+    try:
+        conn.do_handshake()
+    except ssl.SSLWantReadError:
+        pass
+    return outgoing.read()
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('Usage: %s <corpus.bin>' % sys.argv[0])
+    count = 0
+    with open(sys.argv[1], 'wb') as out:
+        for host in HOSTS:
+            for alpn in ALPNS:
+                for lo, hi, versions in VERSIONS:
+                    hello = client_hello(host, alpn, lo, hi)
+                    expected = ('%s|%s|%s' % (host, ','.join(alpn), versions)).encode()
+                    out.write(struct.pack('>H', len(expected)) + expected)
+                    out.write(struct.pack('>I', len(hello)) + hello)
+                    count += 1
+    print('%d ClientHellos (%s)' % (count, ssl.OPENSSL_VERSION))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,738 @@
+#define _GNU_SOURCE  // accept4
+
+#include "admin.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "buffer.h"
+#include "sock.h"
+#include "server.h"
+#include "stats.h"
+#include "freeze.h"
+#include "logger.h"
+#include "protocol.h"
+
+
+#define ADMIN_CLIENTS_MAX  64          // Одновременных клиентов
+#define ADMIN_LINE_MAX     1024        // Длина одной команды
+#define ADMIN_OUT_MAX      (16u << 20) // Неотданного ответа больше — клиента отключаем
+#define ADMIN_QUEUE        64          // Команд в очереди до event loop'а
+#define ADMIN_NICE         10          // Приоритет потока админки
+
+/*
+ * Команда, которую выполняет event loop
+ */
+typedef enum admin_op
+{
+    ADMIN_KILL,   // Прибить туннель id
+    ADMIN_AUTH    // Сменить логин/пароль SOCKS5 (пустые — без аутентификации)
+} admin_op_t;
+
+typedef struct admin_cmd
+{
+    admin_op_t          op;
+    unsigned long long  id;
+    char                username[255];
+    char                passwd[255];
+} admin_cmd_t;
+
+/*
+ * Клиент сокета: недочитанная строка и неотданный ответ
+ */
+typedef struct admin_client
+{
+    int       fd;
+    char      line[ADMIN_LINE_MAX];
+    size_t    len;
+    int       overflow;  // Строка длиннее ADMIN_LINE_MAX — пропускаем до '\n'
+    int       eof;       // Клиент закрыл запись: больше не читаем, дописываем ответ и закрываем
+    buffer_t *out;
+} admin_client_t;
+
+/*
+ * Команда клиента, текстовая или JSON — после разбора одинаковая
+ */
+typedef struct admin_req
+{
+    int   json;
+    char  cmd[32];
+    char  arg[512];   // id, селектор, spec или логин
+    char  arg2[256];  // пароль
+} admin_req_t;
+
+
+static const char *state_names[] = {"open", "auth", "request", "connecting", "connected"};
+
+static char            socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int             listen_fd = -1;
+static admin_client_t  clients[ADMIN_CLIENTS_MAX];
+static int             nclients;
+
+// Очередь команд: кладёт поток админки, разбирает event loop
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static admin_cmd_t     queue[ADMIN_QUEUE];
+static int             nqueue;
+static int             wake_fd = -1;
+
+
+/*
+ * Дальше — event loop
+ */
+
+/*
+ * eventfd сработал: забираем команды и выполняем
+ */
+static void admin_wake_handle(int fd, void *ud)
+{
+    admin_cmd_t cmds[ADMIN_QUEUE];
+    uint64_t    count;
+    (void)ud;
+
+    if (read(fd, &count, sizeof(count)) < 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&queue_lock);
+    int n = nqueue;
+    memcpy(cmds, queue, sizeof(cmds[0]) * (size_t)n);
+    nqueue = 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    for (int i = 0; i < n; ++i)
+    {
+        admin_cmd_t *cmd = &cmds[i];
+        if (cmd->op == ADMIN_KILL)
+        {
+            tunnel_t *tunnel = stats_tunnel_find(cmd->id);
+            if (tunnel != NULL)
+            {
+                LOG_WARN("Admin → kill tunnel %llu", cmd->id);
+                tunnel_close_reason(tunnel, close_killed);
+                tunnel_abort(tunnel);
+            }
+        }
+        else
+        {
+            snprintf(SERVER.username, sizeof(SERVER.username), "%s", cmd->username);
+            snprintf(SERVER.passwd, sizeof(SERVER.passwd), "%s", cmd->passwd);
+            LOG_WARN("Admin → credentials changed (user=%s)", SERVER.username[0] ? SERVER.username : "<none>");
+        }
+    }
+}
+
+static int admin_post(const admin_cmd_t *cmd)
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&queue_lock);
+    int full = nqueue == ADMIN_QUEUE;
+    if (!full)
+    {
+        queue[nqueue++] = *cmd;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    if (full || write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Дальше — поток админки
+ */
+
+static void out_printf(admin_client_t *client, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void out_printf(admin_client_t *client, const char *fmt, ...)
+{
+    char    text[1024];
+    char   *big = NULL;
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    // Строка туннеля с длинными подписями в стек не влезла
+    if (len >= (int)sizeof(text) && (big = malloc((size_t)len + 1)) != NULL)
+    {
+        va_start(args, fmt);
+        vsnprintf(big, (size_t)len + 1, fmt, args);
+        va_end(args);
+    }
+    if (len > 0 && (len < (int)sizeof(text) || big != NULL))
+    {
+        buffer_write(client->out, big != NULL ? big : text, (size_t)len);
+    }
+    free(big);
+}
+
+/*
+ * Строка для JSON: кавычки, обратный слэш и управляющие символы экранируются
+ */
+static const char *json_escape(char *dst, size_t size, const char *src)
+{
+    size_t len = 0;
+    for (; *src != '\0' && len + 7 < size; ++src)
+    {
+        unsigned char c = (unsigned char)*src;
+        if (c == '"' || c == '\\')
+        {
+            dst[len++] = '\\';
+            dst[len++] = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            len += (size_t)snprintf(dst + len, size - len, "\\u%04x", c);
+        }
+        else
+        {
+            dst[len++] = (char)c;
+        }
+    }
+    dst[len] = '\0';
+    return dst;
+}
+
+/*
+ * Строка для текстового ответа: пробелы и управляющие символы не должны
+ * ломать разбор "ключ=значение" и строки
+ */
+static const char *text_escape(char *dst, size_t size, const char *src)
+{
+    size_t len = 0;
+    for (; *src != '\0' && len + 1 < size; ++src)
+    {
+        dst[len++] = (unsigned char)*src <= ' ' ? '_' : *src;
+    }
+    dst[len] = '\0';
+    return dst;
+}
+
+/*
+ * Значение ключа key плоского JSON-объекта: строка (с экранированием) или
+ * голое значение до ',' / '}'. 0 — нашли, <0 — нет ключа или кривое значение
+ */
+static int json_get(const char *json, const char *key, char *out, size_t size)
+{
+    size_t      klen = strlen(key);
+    const char *p    = json;
+    while ((p = strchr(p, '"')) != NULL)
+    {
+        ++p;
+        if (strncmp(p, key, klen) != 0 || p[klen] != '"')
+        {
+            // Не тот ключ (или строковое значение) — перескакиваем строку целиком
+            while (*p != '\0' && *p != '"')
+            {
+                p += (*p == '\\' && p[1] != '\0') ? 2 : 1;
+            }
+            p += *p == '"';
+            continue;
+        }
+        p += klen + 1;
+        p += strspn(p, " \t");
+        if (*p != ':')
+        {
+            continue;
+        }
+        ++p;
+        p += strspn(p, " \t");
+
+        size_t len = 0;
+        if (*p == '"')
+        {
+            for (++p; *p != '"'; ++p)
+            {
+                if (*p == '\0' || len + 1 >= size)
+                {
+                    return -1;
+                }
+                if (*p == '\\')
+                {
+                    ++p;
+                    char c = *p == 'n' ? '\n' : *p == 't' ? '\t' : *p;
+                    if (c == '\0' || c == 'u')
+                    {
+                        return -1;  // \uXXXX в командах не нужен
+                    }
+                    out[len++] = c;
+                    continue;
+                }
+                out[len++] = *p;
+            }
+        }
+        else
+        {
+            len = strcspn(p, ",} \t");
+            if (len == 0 || len >= size)
+            {
+                return -1;
+            }
+            memcpy(out, p, len);
+        }
+        out[len] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Строка клиента -> admin_req_t. Текст: "команда аргумент [аргумент2]"
+ */
+static void req_parse(const char *line, admin_req_t *req)
+{
+    memset(req, 0, sizeof(*req));
+    line += strspn(line, " \t");
+    if (*line == '{')
+    {
+        req->json = 1;
+        json_get(line, "cmd", req->cmd, sizeof(req->cmd));
+        const char *key = strcmp(req->cmd, "kill") == 0 ? "id"
+                        : strcmp(req->cmd, "level") == 0 ? "spec"
+                        : strcmp(req->cmd, "auth") == 0 ? "user" : "selector";
+        json_get(line, key, req->arg, sizeof(req->arg));
+        json_get(line, "pass", req->arg2, sizeof(req->arg2));
+        return;
+    }
+    size_t len = strcspn(line, " \t");
+    snprintf(req->cmd, sizeof(req->cmd), "%.*s", (int)len, line);
+    line += len;
+    line += strspn(line, " \t");
+    len = strcmp(req->cmd, "auth") == 0 ? strcspn(line, " \t") : strlen(line);
+    snprintf(req->arg, sizeof(req->arg), "%.*s", (int)len, line);
+    line += len;
+    line += strspn(line, " \t");
+    snprintf(req->arg2, sizeof(req->arg2), "%s", line);
+}
+
+static void reply_ok(admin_client_t *client, const admin_req_t *req)
+{
+    out_printf(client, req->json ? "{\"ok\":true}\n" : "ok\n");
+}
+
+static void reply_error(admin_client_t *client, const admin_req_t *req, const char *error)
+{
+    if (req->json)
+    {
+        out_printf(client, "{\"ok\":false,\"error\":\"%s\"}\n", error);
+    }
+    else
+    {
+        out_printf(client, "error %s\n", error);
+    }
+}
+
+static void cmd_stats(admin_client_t *client, const admin_req_t *req)
+{
+    stats_summary_t sum;
+    stats_summary(&sum);
+
+    if (req->json)
+    {
+        out_printf(client, "{\"ok\":true,\"tunnels_open\":%llu,\"tunnels_opened\":%llu,\"tunnels_closed\":%llu,"
+                   "\"states\":{\"open\":%u,\"auth\":%u,\"request\":%u,\"connecting\":%u,\"connected\":%u},"
+                   "\"client_rx_bytes\":%llu,\"remote_rx_bytes\":%llu,\"buffer_bytes\":%lld}\n",
+                   sum.opened - sum.closed, sum.opened, sum.closed,
+                   sum.states[open_state], sum.states[auth_state], sum.states[request_state],
+                   sum.states[connecting_state], sum.states[connected_state],
+                   sum.rx[1], sum.rx[0], sum.buffer_mem);
+        return;
+    }
+    out_printf(client, "tunnels_open %llu\ntunnels_opened %llu\ntunnels_closed %llu\n",
+               sum.opened - sum.closed, sum.opened, sum.closed);
+    for (int state = open_state; state <= connected_state; ++state)
+    {
+        out_printf(client, "state_%s %u\n", state_names[state], sum.states[state]);
+    }
+    out_printf(client, "client_rx_bytes %llu\nremote_rx_bytes %llu\nbuffer_bytes %lld\nok\n",
+               sum.rx[1], sum.rx[0], sum.buffer_mem);
+}
+
+static void cmd_tunnels(admin_client_t *client, const admin_req_t *req)
+{
+    stats_tunnel_t *tunnels;
+    size_t          n = stats_tunnels(&tunnels);
+    char            peer[sizeof(tunnels->peer) * 6];
+    char            user[sizeof(tunnels->user) * 6];
+    char            target[sizeof(tunnels->target) * 6];
+
+    if (req->json)
+    {
+        out_printf(client, "{\"ok\":true,\"tunnels\":[");
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        const stats_tunnel_t *t = &tunnels[i];
+        const char *(*escape)(char *, size_t, const char *) = req->json ? json_escape : text_escape;
+        escape(peer, sizeof(peer), t->peer);
+        escape(user, sizeof(user), t->user);
+        escape(target, sizeof(target), t->target);
+        if (req->json)
+        {
+            out_printf(client, "%s{\"id\":%llu,\"state\":\"%s\",\"peer\":\"%s\",\"user\":\"%s\",\"target\":\"%s\","
+                       "\"client_rx_bytes\":%llu,\"remote_rx_bytes\":%llu,\"age_ms\":%llu}",
+                       i > 0 ? "," : "", t->id, state_names[t->state], peer, user, target,
+                       t->rx[1], t->rx[0], t->age_ms);
+        }
+        else
+        {
+            out_printf(client, "id=%llu state=%s peer=%s user=%s target=%s client_rx_bytes=%llu"
+                       " remote_rx_bytes=%llu age_ms=%llu\n",
+                       t->id, state_names[t->state], peer, user, target, t->rx[1], t->rx[0], t->age_ms);
+        }
+    }
+    free(tunnels);
+    out_printf(client, req->json ? "]}\n" : "ok\n");
+}
+
+static void cmd_kill(admin_client_t *client, const admin_req_t *req)
+{
+    admin_cmd_t cmd = {.op = ADMIN_KILL};
+    char       *end;
+
+    cmd.id = strtoull(req->arg, &end, 10);
+    if (req->arg[0] == '\0' || *end != '\0')
+    {
+        reply_error(client, req, "bad tunnel id");
+        return;
+    }
+    // Есть ли такой — смотрим по слепку; закрыться сам он может и после
+    stats_tunnel_t *tunnels;
+    size_t          n     = stats_tunnels(&tunnels);
+    int             found = 0;
+    for (size_t i = 0; i < n && !found; ++i)
+    {
+        found = tunnels[i].id == cmd.id;
+    }
+    free(tunnels);
+    if (!found)
+    {
+        reply_error(client, req, "no such tunnel");
+    }
+    else if (admin_post(&cmd) < 0)
+    {
+        reply_error(client, req, "queue full");
+    }
+    else
+    {
+        reply_ok(client, req);
+    }
+}
+
+static void cmd_freeze(admin_client_t *client, const admin_req_t *req, freeze_op_t op)
+{
+    if (freeze_request(op, req->arg) < 0)
+    {
+        reply_error(client, req, "bad freeze selector");
+        return;
+    }
+    reply_ok(client, req);
+}
+
+static void cmd_level(admin_client_t *client, const admin_req_t *req)
+{
+    char spec[LOG_SPEC_MAX];
+    char levels[512];
+
+    if (req->arg[0] != '\0' && log_set_levels(req->arg) < 0)
+    {
+        reply_error(client, req, "bad log levels");
+        return;
+    }
+    log_get_levels(spec, sizeof(spec));
+    if (req->json)
+    {
+        out_printf(client, "{\"ok\":true,\"levels\":\"%s\"}\n", json_escape(levels, sizeof(levels), spec));
+    }
+    else
+    {
+        out_printf(client, "levels %s\nok\n", spec);
+    }
+}
+
+static void cmd_auth(admin_client_t *client, const admin_req_t *req)
+{
+    admin_cmd_t cmd = {.op = ADMIN_AUTH};
+    int         off = req->arg[0] == '\0' || (!req->json && strcmp(req->arg, "off") == 0);
+
+    if (!off && req->arg2[0] == '\0')
+    {
+        reply_error(client, req, "need user and password, or off");
+        return;
+    }
+    // Длиннее SOCKS5-логин не пропустит — с такими данными не вошёл бы никто
+    if (!off && (strlen(req->arg) > MAX_UNAME_LEN || strlen(req->arg2) > MAX_PASSWD_LEN))
+    {
+        char error[64];
+        snprintf(error, sizeof(error), "user must be at most %d bytes, password at most %d",
+                 MAX_UNAME_LEN, MAX_PASSWD_LEN);
+        reply_error(client, req, error);
+        return;
+    }
+    if (!off)
+    {
+        memcpy(cmd.username, req->arg, strlen(req->arg) + 1);
+        memcpy(cmd.passwd, req->arg2, strlen(req->arg2) + 1);
+    }
+    if (admin_post(&cmd) < 0)
+    {
+        reply_error(client, req, "queue full");
+        return;
+    }
+    reply_ok(client, req);
+}
+
+static void client_command(admin_client_t *client, const char *line)
+{
+    admin_req_t req;
+    req_parse(line, &req);
+
+    if (req.cmd[0] == '\0' && !req.json)
+    {
+        return;  // Пустая строка
+    }
+    if (strcmp(req.cmd, "stats") == 0)
+    {
+        cmd_stats(client, &req);
+    }
+    else if (strcmp(req.cmd, "tunnels") == 0)
+    {
+        cmd_tunnels(client, &req);
+    }
+    else if (strcmp(req.cmd, "kill") == 0)
+    {
+        cmd_kill(client, &req);
+    }
+    else if (strcmp(req.cmd, "freeze") == 0)
+    {
+        cmd_freeze(client, &req, FREEZE_ON);
+    }
+    else if (strcmp(req.cmd, "unfreeze") == 0)
+    {
+        cmd_freeze(client, &req, FREEZE_OFF);
+    }
+    else if (strcmp(req.cmd, "level") == 0)
+    {
+        cmd_level(client, &req);
+    }
+    else if (strcmp(req.cmd, "auth") == 0)
+    {
+        cmd_auth(client, &req);
+    }
+    else
+    {
+        reply_error(client, &req, "unknown command (stats, tunnels, kill, freeze, unfreeze, level, auth)");
+    }
+}
+
+static void client_close(int i)
+{
+    close(clients[i].fd);
+    buffer_release(clients[i].out);
+    clients[i] = clients[--nclients];
+}
+
+/*
+ * Дочитывает клиента и выполняет пришедшие строки. <0 — клиента пора закрыть
+ */
+static int client_read(admin_client_t *client)
+{
+    char chunk[4096];
+    for (;;)
+    {
+        ssize_t n = read(client->fd, chunk, sizeof(chunk));
+        if (n == 0)
+        {
+            // echo stats | socat ...: ответ ещё в out — закроем, когда допишем.
+            // Последняя строка без '\n' — тоже команда
+            if (client->len > 0 && !client->overflow)
+            {
+                client->line[client->len - (client->line[client->len - 1] == '\r')] = '\0';
+                client_command(client, client->line);
+            }
+            client->len = 0;
+            client->eof = 1;
+            return 0;
+        }
+        if (n < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            char c = chunk[i];
+            if (c == '\n')
+            {
+                if (client->overflow)
+                {
+                    out_printf(client, "error line too long\n");
+                }
+                else
+                {
+                    client->line[client->len - (client->len > 0 && client->line[client->len - 1] == '\r')] = '\0';
+                    client_command(client, client->line);
+                }
+                client->len      = 0;
+                client->overflow = 0;
+            }
+            else if (client->len + 1 < sizeof(client->line))
+            {
+                client->line[client->len++] = c;
+            }
+            else
+            {
+                client->overflow = 1;
+            }
+        }
+        if (buffer_readable(client->out) > ADMIN_OUT_MAX)
+        {
+            return -1;  // Спрашивает, но не читает ответы
+        }
+    }
+}
+
+static void client_accept(void)
+{
+    for (;;)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        buffer_t *out = nclients < ADMIN_CLIENTS_MAX ? buffer_create(4096) : NULL;
+        if (out == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        clients[nclients++] = (admin_client_t){.fd = fd, .out = out};
+    }
+}
+
+/*
+ * Поток админки: poll по слушающему сокету и клиентам
+ */
+static void *admin_thread(void *arg)
+{
+    struct pollfd fds[1 + ADMIN_CLIENTS_MAX];
+    (void)arg;
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), ADMIN_NICE);
+
+    for (;;)
+    {
+        int n = nclients;
+        fds[0] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+        for (int i = 0; i < n; ++i)
+        {
+            fds[1 + i] = (struct pollfd){
+                .fd     = clients[i].fd,
+                .events = (short)((clients[i].eof ? 0 : POLLIN) | (buffer_readable(clients[i].out) > 0 ? POLLOUT : 0))
+            };
+        }
+        if (poll(fds, (nfds_t)(1 + n), -1) < 0)
+        {
+            continue;
+        }
+        // С конца: client_close переносит последнего клиента на место закрытого
+        for (int i = n - 1; i >= 0; --i)
+        {
+            admin_client_t *client = &clients[i];
+            short           events = fds[1 + i].revents;
+            if (!client->eof && (events & (POLLIN | POLLHUP | POLLERR)) && client_read(client) < 0)
+            {
+                client_close(i);
+                continue;
+            }
+            if (buffer_readable(client->out) > 0 && buffer_writefd(client->out, client->fd) < 0
+                && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                client_close(i);
+                continue;
+            }
+            if (client->eof && buffer_readable(client->out) == 0)
+            {
+                client_close(i);
+            }
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            client_accept();
+        }
+    }
+    return NULL;
+}
+
+static void admin_atexit(void)
+{
+    unlink(socket_path);
+}
+
+int admin_init(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct stat        st;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        LOG_ERROR("Admin: socket path too long: %s", path);
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    snprintf(socket_path, sizeof(socket_path), "%s", path);
+
+    // Сокет от прошлого запуска мешает bind'у — удаляем, но только сокет
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || chmod(path, 0600) < 0 || listen(listen_fd, 16) < 0)
+    {
+        LOG_ERROR("Admin: cannot listen on %s: %m", path);
+        return -1;
+    }
+    atexit(admin_atexit);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sock_t *wake_sock = wake_fd >= 0 ? sock_create(wake_fd, sock_connected, 0, NULL) : NULL;
+    if (wake_sock == NULL)
+    {
+        LOG_ERROR("Admin: cannot create eventfd");
+        return -1;
+    }
+    wake_sock->read_handle = admin_wake_handle;
+    if (epoll_add(wake_sock) < 0)
+    {
+        LOG_ERROR("Admin: cannot add eventfd to epoll");
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, admin_thread, NULL) != 0)
+    {
+        LOG_ERROR("Admin: failed to launch thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    LOG_INFO("Admin socket on %s", path);
+    return 0;
+}
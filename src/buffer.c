@@ -3,14 +3,95 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "buffer.h"
+#include "stats.h"
+#include "metrics.h"
 
 
 #define ERROR_RETURN -1
 #define OK_RETURN 0
 
 
+/*
+ * Память буфера: счётчик ссылок (сам буфер + живые снимки) и байты
+ */
+struct buffer_block
+{
+    atomic_uint refs;
+    size_t      size;   // Сколько выделено вместе с заголовком — для stats
+    char        data[];
+};
+
+static buffer_block_t *block_alloc(size_t capacity)
+{
+    buffer_block_t *block = malloc(sizeof(*block) + capacity);
+    if (block != NULL)
+    {
+        atomic_init(&block->refs, 1);
+        block->size = sizeof(*block) + capacity;
+        stats_buffer_mem((ssize_t)block->size);
+    }
+    return block;
+}
+
+static void block_put(buffer_block_t *block)
+{
+    if (atomic_fetch_sub_explicit(&block->refs, 1, memory_order_acq_rel) == 1)
+    {
+        stats_buffer_mem(-(ssize_t)block->size);
+        free(block);
+    }
+}
+
+/*
+ * На блок смотрит кто-то кроме буфера — байты в нём трогать нельзя
+ */
+static bool buffer_shared(buffer_t *buffer)
+{
+    return atomic_load_explicit(&buffer->block->refs, memory_order_acquire) > 1;
+}
+
+/*
+ * Переезд в новый блок ёмкостью capacity: непрочитанное копируется в начало,
+ * старый блок остаётся снимкам
+ */
+static int buffer_detach(buffer_t *buffer, size_t capacity)
+{
+    size_t          readable = buffer->write_index - buffer->read_index;
+    buffer_block_t *block    = block_alloc(capacity);
+    if (block == NULL)
+    {
+        return ERROR_RETURN;
+    }
+    memcpy(block->data, buffer->data + buffer->read_index, readable);
+    block_put(buffer->block);
+    buffer->block       = block;
+    buffer->data        = block->data;
+    buffer->cap         = capacity;
+    buffer->read_index  = 0;
+    buffer->write_index = readable;
+    return OK_RETURN;
+}
+
+/*
+ * Сдвигаем непрочитанное в начало, чтобы освободить хвост
+ */
+static int buffer_compact(buffer_t *buffer)
+{
+    if (buffer_shared(buffer))
+    {
+        return buffer_detach(buffer, buffer->cap);
+    }
+    size_t readable = buffer->write_index - buffer->read_index;
+    memmove(buffer->data, buffer->data + buffer->read_index, readable);
+    buffer->read_index  = 0;
+    buffer->write_index = readable;
+    return OK_RETURN;
+}
+
+
 /*
  * Инициализируем буфер с запасом в capacity байт
  * чтобы сразу можно было жёстко стартануть с нужным размером.
@@ -27,8 +108,8 @@ buffer_t *buffer_create(size_t capacity)
     memset(buffer, 0, sizeof(*buffer));
 
     // Резервим память под сам массив данных — чтоб туда паковать весь наш трафик без тормозов.
-    char *data = malloc(capacity);
-    if (data == NULL)
+    buffer_block_t *block = block_alloc(capacity);
+    if (block == NULL)
     {
         // Если что пошло не так — чистим память, чтобы не было утечек, и не ломаем систему.
         free(buffer);
@@ -39,7 +120,8 @@ buffer_t *buffer_create(size_t capacity)
     buffer->write_index = 0;
     buffer->read_index  = 0;
     buffer->cap         = capacity;
-    buffer->data        = data;
+    buffer->block       = block;
+    buffer->data        = block->data;
 
     return buffer;
 }
@@ -53,7 +135,7 @@ void buffer_release(buffer_t *buffer)
     {
         return;
     }
-    free(buffer->data);
+    block_put(buffer->block);
     free(buffer);
 }
 
@@ -87,16 +169,25 @@ static int buffer_expand(buffer_t *buffer)
     {
         return ERROR_RETURN;
     }
-    int   newcap  = buffer->cap * 2;   // новая ёмкость в 2 раза больше
-    char *newdata = realloc(buffer->data, newcap); // попытка расширения
-    if (newdata == NULL)
+    size_t newcap = buffer->cap * 2;   // новая ёмкость в 2 раза больше
+    if (buffer_shared(buffer))
+    {
+        // realloc мог бы освободить блок из-под снимков — переезжаем копией
+        return buffer_detach(buffer, newcap);
+    }
+    buffer_block_t *newblock = realloc(buffer->block, sizeof(*newblock) + newcap); // попытка расширения
+    if (newblock == NULL)
     {
         return ERROR_RETURN;
     }
 
+    stats_buffer_mem((ssize_t)(sizeof(*newblock) + newcap) - (ssize_t)newblock->size);
+    newblock->size = sizeof(*newblock) + newcap;
+
     // Обновляем структуру буфера
-    buffer->cap  = newcap;
-    buffer->data = newdata;
+    buffer->cap   = newcap;
+    buffer->block = newblock;
+    buffer->data  = newblock->data;
     return OK_RETURN;
 }
 
@@ -106,6 +197,15 @@ static int buffer_expand(buffer_t *buffer)
 int buffer_readfd(buffer_t *buffer, int fd)
 {
     size_t writable = buffer_writable(buffer);
+    if (writable == 0 && buffer_prependable(buffer) > 0)
+    {
+        // Хвост забит, но в начале есть уже прочитанное место — сдвигаем данные туда
+        if (buffer_compact(buffer) == ERROR_RETURN)
+        {
+            return ERROR_RETURN;
+        }
+        writable = buffer_writable(buffer);
+    }
     if (writable == 0)
     {
         // Нет места: пробуем расширить
@@ -118,6 +218,7 @@ int buffer_readfd(buffer_t *buffer, int fd)
 
     // Считываем не более writable байт
     ssize_t n = read(fd, buffer->data + buffer->write_index, writable);
+    metrics_add(METRIC_SYS_READ, 1);
     if (n <= 0)
     {
         // n == 0 — EOF, n < 0 — ошибка
@@ -136,6 +237,7 @@ int buffer_writefd(buffer_t *buffer, int fd)
 {
     size_t  readable = buffer_readable(buffer);
     ssize_t n        = write(fd, buffer->data + buffer->read_index, readable);
+    metrics_add(METRIC_SYS_WRITE, 1);
     if (n <= 0)
     {
         // n == 0 — не пашет, n < 0 — ошибка
@@ -189,10 +291,10 @@ int buffer_write(buffer_t *buffer, void *src, size_t size)
         if (prependable + writable >= size)
         {
             // Можно подвинуть данные в начало и освободить место
-            size_t readable = buffer_readable(buffer);
-            memmove(buffer->data, buffer->data + buffer->read_index, readable);
-            buffer->read_index  = 0;
-            buffer->write_index = readable;
+            if (buffer_compact(buffer) == ERROR_RETURN)
+            {
+                return ERROR_RETURN;
+            }
             break;
         }
 
@@ -224,6 +326,35 @@ int buffer_concat(buffer_t *front, buffer_t *rear)
  */
 void buffer_clear(buffer_t *buffer)
 {
+    if (buffer_shared(buffer))
+    {
+        // Старые байты ещё смотрят снимки — просто считаем их прочитанными,
+        // а в новый блок переедем, только если понадобится место (снимки к тому
+        // времени обычно уже отпущены)
+        buffer->read_index = buffer->write_index;
+        return;
+    }
     buffer->write_index = 0;
     buffer->read_index  = 0;
 }
+
+/*
+ * Снимок куска непрочитанного: просто ещё одна ссылка на блок
+ */
+void buffer_view(buffer_t *buffer, size_t offset, size_t len, buffer_view_t *view)
+{
+    assert(offset + len <= buffer_readable(buffer));
+    atomic_fetch_add_explicit(&buffer->block->refs, 1, memory_order_relaxed);
+    view->block = buffer->block;
+    view->data  = buffer->data + buffer->read_index + offset;
+    view->len   = len;
+}
+
+void buffer_view_release(buffer_view_t *view)
+{
+    if (view->block != NULL)
+    {
+        block_put(view->block);
+        view->block = NULL;
+    }
+}
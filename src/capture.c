@@ -0,0 +1,916 @@
+#define _GNU_SOURCE  // fallocate
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "capture.h"
+#include "buffer.h"
+#include "sock.h"
+#include "server.h"
+#include "logger.h"
+
+
+#define CAPTURE_RING        8192               // Слотов в кольце потока записи (степень двойки)
+#define CAPTURE_INFLIGHT    (64 * 1024 * 1024) // Сколько байт снимков может ждать записи
+#define CAPTURE_SPIN        64                 // Сколько раз уступить CPU на пустом кольце перед сном
+#define CAPTURE_IDLE_MS     100                // Сон пустого потока без сигнала (страховка)
+#define CAPTURE_STATS_MS    60000              // Раз в столько пишем в лог счётчики
+#define CAPTURE_RULES_MAX   16                 // Селекторов каждого вида
+#define CAPTURE_MSS         32768              // Нагрузка одного синтезированного сегмента
+#define CAPTURE_SIZE        (64ULL << 20)      // Размер файла-сегмента по умолчанию
+#define CAPTURE_SIZE_MIN    (1ULL << 20)
+#define CAPTURE_COMMENT_MAX 640                // Комментарий к SYN: номер, пользователь, назначение
+
+// pcapng
+#define PCAPNG_SHB          0x0A0D0D0Au
+#define PCAPNG_IDB          0x00000001u
+#define PCAPNG_EPB          0x00000006u
+#define PCAPNG_MAGIC        0x1A2B3C4Du
+#define PCAPNG_OPT_COMMENT  1
+#define PCAPNG_SHB_USERAPPL 4
+#define LINKTYPE_RAW        101                // Сразу IP-заголовок, v4 или v6 по версии
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+
+/*
+ * Селекторы -W: туннель пишется, если подошёл хоть один (или их нет совсем)
+ */
+typedef struct capture_policy
+{
+    char               base[256];                        // file=: путь без "-000001.pcapng"
+    unsigned long long size;                             // Размер одного файла
+    unsigned           files;                            // Сколько последних файлов держать, 0 — все
+    unsigned           nusers;
+    char               users[CAPTURE_RULES_MAX][256];
+    unsigned           nhosts;
+    char               hosts[CAPTURE_RULES_MAX][256];    // Имя или ".суффикс"
+    unsigned           nports;
+    unsigned           ports[CAPTURE_RULES_MAX];
+    unsigned           ntunnels;
+    unsigned long long tunnels[CAPTURE_RULES_MAX];
+} capture_policy_t;
+
+/*
+ * Состояние записи туннеля. Ссылки: туннель + каждое событие в кольце.
+ * gap трогает только event loop, seq и opened — только поток записи,
+ * остальное заполняется при создании и дальше не меняется
+ */
+struct capture_flow
+{
+    atomic_uint         refs;
+    unsigned long long  id;
+    int                 v6;          // Хоть один адрес IPv6 — пишем IPv6 (v4 как ::ffff:a.b.c.d)
+    uint8_t             addr[2][16]; // [0] назначение, [1] клиент; v4 — в последних 4 байтах
+    uint16_t            port[2];
+    uint32_t            gap[2];      // Выброшено байт направления с прошлого опубликованного куска
+    uint32_t            seq[2];      // Следующий seq направления
+    int                 opened;      // SYN-ы уже записаны
+    char                comment[CAPTURE_COMMENT_MAX];
+};
+
+typedef struct capture_event
+{
+    capture_flow_t *flow;
+    buffer_view_t   view;       // Пусто у закрытия
+    uint64_t        ts_us;      // Когда прочитано
+    uint32_t        gap[2];     // Сколько байт направлений пропало перед этим событием
+    uint8_t         is_client;
+    uint8_t         close;
+} capture_event_t;
+
+/*
+ * SPSC-кольцо: пишет только event loop (head), читает только поток записи (tail)
+ */
+typedef struct capture_ring
+{
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_size_t    inflight;  // Байт в снимках, ждущих записи
+    atomic_int       sleeping;  // Поток ждёт на wake — продюсеру надо разбудить
+    atomic_int       stop;      // Выход: дописать кольцо, обрезать файл и завершиться
+    pthread_mutex_t  lock;
+    pthread_cond_t   wake;
+    pthread_t        thread;
+    capture_event_t  slots[CAPTURE_RING];
+} capture_ring_t;
+
+/*
+ * Текущий файл: отображён в память целиком, used — сколько уже записано блоками.
+ * Трогает только поток записи (до его запуска — capture_init)
+ */
+typedef struct capture_file
+{
+    int            fd;
+    uint8_t       *map;
+    size_t         size;
+    atomic_size_t  used;
+    unsigned       number;
+} capture_file_t;
+
+
+static capture_policy_t  policy;
+static capture_ring_t   *ring;
+static capture_file_t    out = { .fd = -1 };
+static uint16_t          ip_id;
+
+// Счётчики event loop
+static unsigned long long tunnels;
+static unsigned long long dropped;
+static unsigned long long logged;
+
+// Счётчики потока записи
+static atomic_ullong packets;
+static atomic_ullong bytes;
+static atomic_ullong files;
+
+
+static void flow_put(capture_flow_t *flow)
+{
+    if (atomic_fetch_sub_explicit(&flow->refs, 1, memory_order_acq_rel) == 1)
+    {
+        free(flow);
+    }
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/*
+ * Блоки pcapng — в порядке байтов хоста (читатель узнаёт его по magic в SHB)
+ */
+static void host32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+}
+
+static size_t pad4(size_t n)
+{
+    return (n + 3) & ~(size_t)3;
+}
+
+/*
+ * Опция pcapng: код, длина, значение с выравниванием. Возвращает длину опции
+ */
+static size_t put_option(uint8_t *p, uint16_t code, const void *value, size_t len)
+{
+    memcpy(p, &code, 2);
+    uint16_t l = (uint16_t)len;
+    memcpy(p + 2, &l, 2);
+    memcpy(p + 4, value, len);
+    memset(p + 4 + len, 0, pad4(len) - len);
+    return 4 + pad4(len);
+}
+
+/*
+ * Начало файла: Section Header и Interface Description
+ */
+static size_t put_header(uint8_t *p)
+{
+    static const char appl[] = "CLIProxyServer";
+    size_t at = 0;
+
+    // SHB: тип, длина, magic, версия 1.0, длина секции -1 (не знаем), опции, длина
+    size_t shb = 28 + 4 + pad4(sizeof(appl) - 1) + 4;
+    host32(p, PCAPNG_SHB);
+    host32(p + 4, (uint32_t)shb);
+    host32(p + 8, PCAPNG_MAGIC);
+    uint16_t major = 1, minor = 0;
+    memcpy(p + 12, &major, 2);
+    memcpy(p + 14, &minor, 2);
+    memset(p + 16, 0xff, 8);
+    at = 24 + put_option(p + 24, PCAPNG_SHB_USERAPPL, appl, sizeof(appl) - 1);
+    memset(p + at, 0, 4);  // opt_endofopt
+    at += 4;
+    host32(p + at, (uint32_t)shb);
+    at += 4;
+
+    // IDB: linktype RAW, snaplen 0 (без ограничения), метки времени в микросекундах
+    uint8_t *idb = p + at;
+    host32(idb, PCAPNG_IDB);
+    host32(idb + 4, 20);
+    uint16_t linktype = LINKTYPE_RAW, reserved = 0;
+    memcpy(idb + 8, &linktype, 2);
+    memcpy(idb + 10, &reserved, 2);
+    host32(idb + 12, 0);
+    host32(idb + 16, 20);
+    return at + 20;
+}
+
+/*
+ * Текущий файл закончен: обрезаем по записанному. rotate — будет следующий,
+ * тогда старые сверх files удаляем
+ */
+static void file_close(bool rotate)
+{
+    if (out.fd < 0)
+    {
+        return;
+    }
+    size_t used = atomic_load(&out.used);
+    munmap(out.map, out.size);
+    if (ftruncate(out.fd, (off_t)used) < 0)
+    {
+        LOG_WARN("Capture: failed to trim %s-%06u.pcapng: %s", policy.base, out.number, strerror(errno));
+    }
+    close(out.fd);
+    out.fd  = -1;
+    out.map = NULL;
+    // Вместе со следующим файлом должно остаться files штук
+    if (rotate && policy.files > 0 && out.number + 1 > policy.files)
+    {
+        char old[300];
+        snprintf(old, sizeof(old), "%s-%06u.pcapng", policy.base, out.number + 1 - policy.files);
+        unlink(old);
+    }
+}
+
+/*
+ * Следующий файл: выделяем место под весь сегмент сразу и отображаем его в память
+ */
+static int file_open(void)
+{
+    char path[300];
+    unsigned number = out.number + 1;
+    snprintf(path, sizeof(path), "%s-%06u.pcapng", policy.base, number);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0)
+    {
+        LOG_ERROR("Capture: cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    // fallocate выделяет блоки сразу (потом не будет ENOSPC посреди записи в map);
+    // файловая система не умеет — хватит и дырявого файла
+    if (fallocate(fd, 0, 0, (off_t)policy.size) < 0 && ftruncate(fd, (off_t)policy.size) < 0)
+    {
+        LOG_ERROR("Capture: cannot size %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, policy.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("Capture: cannot map %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    out.fd     = fd;
+    out.map    = map;
+    out.size   = policy.size;
+    out.number = number;
+    atomic_store(&out.used, put_header(map));
+    atomic_fetch_add_explicit(&files, 1, memory_order_relaxed);
+    LOG_INFO("Capture: writing %s", path);
+    return 0;
+}
+
+/*
+ * Место под блок длиной len: в текущем файле или в следующем. NULL — писать некуда
+ */
+static uint8_t *file_reserve(size_t len)
+{
+    if (out.fd >= 0 && atomic_load_explicit(&out.used, memory_order_relaxed) + len > out.size)
+    {
+        file_close(true);
+    }
+    if (out.fd < 0 && file_open() < 0)
+    {
+        return NULL;
+    }
+    return out.map + atomic_load_explicit(&out.used, memory_order_relaxed);
+}
+
+static uint16_t ip_checksum(const uint8_t *p, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+    {
+        sum += (uint32_t)p[i] << 8 | p[i + 1];
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/*
+ * Один синтезированный сегмент направления from (1 — от клиента) в Enhanced Packet Block.
+ * Контрольную сумму TCP не считаем (Wireshark по умолчанию её и не проверяет)
+ */
+static void write_segment(capture_flow_t *flow, int from, uint8_t flags, const uint8_t *data, size_t len,
+                          uint64_t ts_us, const char *comment)
+{
+    size_t   iplen   = (flow->v6 ? 40 : 20) + 20 + len;
+    size_t   optlen  = comment != NULL ? 4 + pad4(strlen(comment)) + 4 : 0;
+    size_t   block   = 28 + pad4(iplen) + optlen + 4;
+    uint8_t *p       = file_reserve(block);
+    if (p == NULL)
+    {
+        return;
+    }
+
+    host32(p, PCAPNG_EPB);
+    host32(p + 4, (uint32_t)block);
+    host32(p + 8, 0);
+    host32(p + 12, (uint32_t)(ts_us >> 32));
+    host32(p + 16, (uint32_t)ts_us);
+    host32(p + 20, (uint32_t)iplen);
+    host32(p + 24, (uint32_t)iplen);
+
+    uint8_t *ip  = p + 28;
+    uint8_t *src = flow->addr[from];
+    uint8_t *dst = flow->addr[!from];
+    uint8_t *tcp;
+    if (flow->v6)
+    {
+        put32(ip, 0x60000000u);
+        put16(ip + 4, (uint16_t)(20 + len));
+        ip[6] = 6;
+        ip[7] = 64;
+        memcpy(ip + 8, src, 16);
+        memcpy(ip + 24, dst, 16);
+        tcp = ip + 40;
+    }
+    else
+    {
+        ip[0] = 0x45;
+        ip[1] = 0;
+        put16(ip + 2, (uint16_t)iplen);
+        put16(ip + 4, ip_id++);
+        put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = 6;
+        put16(ip + 10, 0);
+        memcpy(ip + 12, src + 12, 4);
+        memcpy(ip + 16, dst + 12, 4);
+        put16(ip + 10, ip_checksum(ip, 20));
+        tcp = ip + 20;
+    }
+    put16(tcp, flow->port[from]);
+    put16(tcp + 2, flow->port[!from]);
+    put32(tcp + 4, flow->seq[from]);
+    put32(tcp + 8, flags & TCP_ACK ? flow->seq[!from] : 0);
+    tcp[12] = 5 << 4;
+    tcp[13] = flags;
+    put16(tcp + 14, 65535);
+    put32(tcp + 16, 0);
+    if (len > 0)
+    {
+        memcpy(tcp + 20, data, len);
+    }
+    memset(ip + iplen, 0, pad4(iplen) - iplen);
+
+    size_t at = 28 + pad4(iplen);
+    if (comment != NULL)
+    {
+        at += put_option(p + at, PCAPNG_OPT_COMMENT, comment, strlen(comment));
+        memset(p + at, 0, 4);
+        at += 4;
+    }
+    host32(p + at, (uint32_t)block);
+
+    flow->seq[from] += (uint32_t)len + ((flags & (TCP_SYN | TCP_FIN)) ? 1 : 0);
+    atomic_fetch_add_explicit(&out.used, block, memory_order_release);
+    atomic_fetch_add_explicit(&packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes, len, memory_order_relaxed);
+}
+
+/*
+ * Одно событие кольца: первые данные туннеля предваряются рукопожатием,
+ * пропавшие байты сдвигают seq, закрытие — FIN с обеих сторон
+ */
+static void capture_event(const capture_event_t *ev)
+{
+    capture_flow_t *flow = ev->flow;
+    if (!flow->opened)
+    {
+        flow->opened = 1;
+        // ISN от номера туннеля: в одном файле потоки не путаются
+        flow->seq[1] = (uint32_t)(flow->id * 2654435761u);
+        flow->seq[0] = flow->seq[1] ^ 0x5bd1e995u;
+        write_segment(flow, 1, TCP_SYN, NULL, 0, ev->ts_us, flow->comment);
+        write_segment(flow, 0, TCP_SYN | TCP_ACK, NULL, 0, ev->ts_us, NULL);
+        write_segment(flow, 1, TCP_ACK, NULL, 0, ev->ts_us, NULL);
+    }
+    flow->seq[0] += ev->gap[0];
+    flow->seq[1] += ev->gap[1];
+
+    if (ev->close)
+    {
+        write_segment(flow, 1, TCP_FIN | TCP_ACK, NULL, 0, ev->ts_us, NULL);
+        write_segment(flow, 0, TCP_FIN | TCP_ACK, NULL, 0, ev->ts_us, NULL);
+        write_segment(flow, 1, TCP_ACK, NULL, 0, ev->ts_us, NULL);
+        return;
+    }
+
+    const uint8_t *data = (const uint8_t *)ev->view.data;
+    size_t         len  = ev->view.len;
+    for (size_t at = 0; at < len; at += CAPTURE_MSS)
+    {
+        size_t n = len - at < CAPTURE_MSS ? len - at : CAPTURE_MSS;
+        write_segment(flow, ev->is_client, TCP_PSH | TCP_ACK, data + at, n, ev->ts_us, NULL);
+    }
+}
+
+/*
+ * Пустое кольцо: спим, пока продюсер не разбудит (как у потоков анализа)
+ */
+static void ring_wait(size_t tail)
+{
+    pthread_mutex_lock(&ring->lock);
+    atomic_store(&ring->sleeping, 1);
+    if (atomic_load(&ring->head) == tail && !atomic_load(&ring->stop))
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += CAPTURE_IDLE_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ring->wake, &ring->lock, &ts);
+    }
+    atomic_store(&ring->sleeping, 0);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void *capture_thread(void *arg)
+{
+    size_t   tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned idle = 0;
+
+    (void)arg;
+    for (;;)
+    {
+        // stop читаем до head: всё, что опубликовано до выхода, будет дописано
+        int    stop = atomic_load(&ring->stop);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head == tail && !stop)
+        {
+            if (++idle < CAPTURE_SPIN)
+            {
+                sched_yield();
+                continue;
+            }
+            ring_wait(tail);
+            continue;
+        }
+        idle = 0;
+        while (tail != head)
+        {
+            capture_event_t ev = ring->slots[tail & (CAPTURE_RING - 1)];
+            atomic_store_explicit(&ring->tail, ++tail, memory_order_release);
+
+            capture_event(&ev);
+            atomic_fetch_sub_explicit(&ring->inflight, ev.view.len, memory_order_relaxed);
+            if (ev.view.block != NULL)
+            {
+                buffer_view_release(&ev.view);
+            }
+            flow_put(ev.flow);
+        }
+        if (stop)
+        {
+            break;
+        }
+    }
+    // Обрезаем здесь же: блок, который пишется в map, не окажется за концом файла (SIGBUS)
+    file_close(false);
+    return NULL;
+}
+
+/*
+ * Выход из процесса (stop, SIGINT): поток записи дописывает кольцо и обрезает файл
+ * по последнему целому блоку, иначе в хвосте останутся нули до конца сегмента
+ */
+static void capture_atexit(void)
+{
+    if (ring == NULL)
+    {
+        file_close(false);
+        return;
+    }
+    atomic_store(&ring->stop, 1);
+    // Сигнал мог перебить event loop внутри ring_push с захваченным lock:
+    // тогда не будим, поток проснётся сам по CAPTURE_IDLE_MS
+    if (pthread_mutex_trylock(&ring->lock) == 0)
+    {
+        pthread_cond_signal(&ring->wake);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    pthread_join(ring->thread, NULL);
+}
+
+static bool host_matches(const char *rule, const char *host)
+{
+    size_t rlen = strlen(rule);
+    size_t hlen = strlen(host);
+    if (rule[0] != '.')
+    {
+        return strcasecmp(rule, host) == 0;
+    }
+    return (hlen >= rlen && strcasecmp(host + hlen - rlen, rule) == 0) || strcasecmp(rule + 1, host) == 0;
+}
+
+/*
+ * Пишем ли туннель: без селекторов — да, иначе хоть один должен подойти
+ */
+static bool policy_wants(const tunnel_t *tunnel)
+{
+    if (policy.nusers + policy.nhosts + policy.nports + policy.ntunnels == 0)
+    {
+        return true;
+    }
+    for (unsigned i = 0; i < policy.ntunnels; ++i)
+    {
+        if (policy.tunnels[i] == tunnel->id)
+        {
+            return true;
+        }
+    }
+    unsigned port = (unsigned)atoi(tunnel->dst_port);
+    for (unsigned i = 0; i < policy.nports; ++i)
+    {
+        if (policy.ports[i] == port)
+        {
+            return true;
+        }
+    }
+    for (unsigned i = 0; i < policy.nhosts; ++i)
+    {
+        if (host_matches(policy.hosts[i], tunnel->dst_host))
+        {
+            return true;
+        }
+    }
+    const auth_protocol_t *ap = &tunnel->ap;
+    for (unsigned i = 0; i < policy.nusers; ++i)
+    {
+        if (strlen(policy.users[i]) == ap->ulen && memcmp(policy.users[i], ap->uname, ap->ulen) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Адрес стороны из сокета; сокета нет (сторона — стрим мультиплексора) или
+ * это не IP — синтетический 10.<сторона>.x.y с номером туннеля
+ */
+static void flow_addr(capture_flow_t *flow, int side, const sock_t *sock, unsigned fallback_port)
+{
+    struct sockaddr_storage ss;
+    socklen_t               len = sizeof(ss);
+    uint8_t                *a   = flow->addr[side];
+
+    memset(a, 0, 16);
+    a[10] = a[11] = 0xff;
+    if (sock != NULL && getpeername(sock->fd, (struct sockaddr *)&ss, &len) == 0)
+    {
+        if (ss.ss_family == AF_INET)
+        {
+            const struct sockaddr_in *in = (const struct sockaddr_in *)&ss;
+            memcpy(a + 12, &in->sin_addr, 4);
+            flow->port[side] = ntohs(in->sin_port);
+            return;
+        }
+        if (ss.ss_family == AF_INET6)
+        {
+            const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&ss;
+            memcpy(a, &in6->sin6_addr, 16);
+            flow->port[side] = ntohs(in6->sin6_port);
+            // v4-mapped так и остаётся v4
+            flow->v6 |= !(memcmp(a, "\0\0\0\0\0\0\0\0\0\0\xff\xff", 12) == 0);
+            return;
+        }
+    }
+    a[12] = 10;
+    a[13] = (uint8_t)side;
+    a[14] = (uint8_t)(flow->id >> 8);
+    a[15] = (uint8_t)flow->id;
+    flow->port[side] = side ? (uint16_t)(1024 + flow->id % 64511) : (uint16_t)fallback_port;
+}
+
+/*
+ * Событие в кольцо. false — места нет (или поток записи не успевает)
+ */
+static bool ring_push(capture_flow_t *flow, buffer_t *buffer, size_t offset, size_t len, int is_client, int close)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == CAPTURE_RING
+        || atomic_load_explicit(&ring->inflight, memory_order_relaxed) + len > CAPTURE_INFLIGHT)
+    {
+        ++dropped;
+        return false;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    capture_event_t *ev = &ring->slots[head & (CAPTURE_RING - 1)];
+    atomic_fetch_add_explicit(&flow->refs, 1, memory_order_relaxed);
+    ev->flow      = flow;
+    ev->ts_us     = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+    ev->gap[0]    = flow->gap[0];
+    ev->gap[1]    = flow->gap[1];
+    ev->is_client = (uint8_t)is_client;
+    ev->close     = (uint8_t)close;
+    flow->gap[0]  = 0;
+    flow->gap[1]  = 0;
+    if (buffer != NULL)
+    {
+        buffer_view(buffer, offset, len, &ev->view);
+    }
+    else
+    {
+        memset(&ev->view, 0, sizeof(ev->view));
+    }
+    atomic_fetch_add_explicit(&ring->inflight, len, memory_order_relaxed);
+    atomic_store(&ring->head, head + 1);
+
+    if (atomic_load(&ring->sleeping))
+    {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->wake);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    return true;
+}
+
+void capture_publish(tunnel_t *tunnel, int is_client, size_t fresh)
+{
+    if (ring == NULL)
+    {
+        tunnel->capture_off = 1;
+        return;
+    }
+    sock_t   *sock   = is_client ? tunnel->client_sock : tunnel->remote_sock;
+    buffer_t *buffer = sock->read_buffer;
+    size_t    length = buffer_readable(buffer);
+    if (fresh > length)
+    {
+        fresh = length;
+    }
+    if (fresh == 0)
+    {
+        return;
+    }
+
+    capture_flow_t *flow = tunnel->capture;
+    if (flow == NULL)
+    {
+        if (!policy_wants(tunnel))
+        {
+            tunnel->capture_off = 1;
+            return;
+        }
+        flow = calloc(1, sizeof(*flow));
+        if (flow == NULL)
+        {
+            ++dropped;
+            return;
+        }
+        atomic_init(&flow->refs, 1);
+        flow->id = tunnel->id;
+        flow_addr(flow, 1, tunnel->client_sock, 0);
+        flow_addr(flow, 0, tunnel->remote_sock, (unsigned)atoi(tunnel->dst_port));
+        snprintf(flow->comment, sizeof(flow->comment), "tunnel=%llu user=%.*s target=%s:%s", tunnel->id,
+                 tunnel->ap.ulen > 0 ? (int)tunnel->ap.ulen : 1, tunnel->ap.ulen > 0 ? tunnel->ap.uname : "-",
+                 tunnel->dst_host, tunnel->dst_port);
+        tunnel->capture = flow;
+        ++tunnels;
+        LOG_INFO("Capture: tunnel %llu to %s:%s", tunnel->id, tunnel->dst_host, tunnel->dst_port);
+    }
+
+    if (!ring_push(flow, buffer, length - fresh, fresh, is_client, 0))
+    {
+        // Не успеваем — в захвате будет дыра в seq на месте этих байт
+        flow->gap[is_client ? 1 : 0] += (uint32_t)fresh;
+    }
+}
+
+void capture_flow_release(capture_flow_t *flow)
+{
+    // Закрытие не влезло — FIN-ов в захвате не будет, и только
+    ring_push(flow, NULL, 0, 0, 0, 1);
+    flow_put(flow);
+}
+
+void capture_get_stats(capture_stats_t *stats)
+{
+    stats->tunnels = tunnels;
+    stats->packets = atomic_load_explicit(&packets, memory_order_relaxed);
+    stats->bytes   = atomic_load_explicit(&bytes, memory_order_relaxed);
+    stats->dropped = dropped;
+    stats->files   = atomic_load_explicit(&files, memory_order_relaxed);
+}
+
+static void capture_stats_tick(void *ud)
+{
+    (void)ud;
+    capture_stats_t st;
+    capture_get_stats(&st);
+    if (st.packets != logged)
+    {
+        logged = st.packets;
+        LOG_INFO("Capture: %llu tunnels, %llu packets, %llu payload bytes in %llu files, %llu chunks dropped",
+                 st.tunnels, st.packets, st.bytes, st.files, st.dropped);
+    }
+}
+
+/*
+ * Размер с суффиксом K/M/G. <0 — не размер (strtoull пропустил бы пробелы, минус и мусор в хвосте)
+ */
+static int parse_size(const char *s, unsigned long long *out)
+{
+    char     *end;
+    unsigned  shift = 0;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': shift = 10; ++end; break;
+        case 'm': case 'M': shift = 20; ++end; break;
+        case 'g': case 'G': shift = 30; ++end; break;
+    }
+    if (s[0] < '0' || s[0] > '9' || *end != '\0' || errno == ERANGE || n > ULLONG_MAX >> shift)
+    {
+        return -1;
+    }
+    *out = n << shift;
+    return 0;
+}
+
+/*
+ * Число селектора: только десятичные цифры и не больше max, иначе <0
+ */
+static int policy_number(const char *key, const char *value, unsigned long long max, unsigned long long *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (value[0] < '0' || value[0] > '9' || *end != '\0' || errno == ERANGE || n > max)
+    {
+        LOG_ERROR("Capture: bad %s \"%s\", expected 0..%llu", key, value, max);
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+/*
+ * Разбор -W: "file=PATH,size=N,files=K,user=U,host=H,port=P,tunnel=ID"
+ */
+static int policy_parse(const char *spec)
+{
+    char  copy[4096];
+    char *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", spec);
+    policy.size = CAPTURE_SIZE;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        if (value == NULL || value[1] == '\0')
+        {
+            LOG_ERROR("Capture: \"%s\" is not key=value", item);
+            return -1;
+        }
+        *value++ = '\0';
+        unsigned long long n;
+        if (strcmp(item, "file") == 0)
+        {
+            snprintf(policy.base, sizeof(policy.base), "%s", value);
+        }
+        else if (strcmp(item, "size") == 0)
+        {
+            if (parse_size(value, &policy.size) < 0)
+            {
+                LOG_ERROR("Capture: bad size \"%s\", expected N[K|M|G]", value);
+                return -1;
+            }
+        }
+        else if (strcmp(item, "files") == 0)
+        {
+            if (policy_number(item, value, UINT_MAX, &n) < 0)
+            {
+                return -1;
+            }
+            policy.files = (unsigned)n;
+        }
+        else if (strcmp(item, "user") == 0 && policy.nusers < CAPTURE_RULES_MAX)
+        {
+            snprintf(policy.users[policy.nusers++], sizeof(policy.users[0]), "%s", value);
+        }
+        else if (strcmp(item, "host") == 0 && policy.nhosts < CAPTURE_RULES_MAX)
+        {
+            snprintf(policy.hosts[policy.nhosts++], sizeof(policy.hosts[0]), "%s", value);
+        }
+        else if (strcmp(item, "port") == 0 && policy.nports < CAPTURE_RULES_MAX)
+        {
+            if (policy_number(item, value, 65535, &n) < 0)
+            {
+                return -1;
+            }
+            policy.ports[policy.nports++] = (unsigned)n;
+        }
+        else if (strcmp(item, "tunnel") == 0 && policy.ntunnels < CAPTURE_RULES_MAX)
+        {
+            if (policy_number(item, value, ULLONG_MAX, &policy.tunnels[policy.ntunnels]) < 0)
+            {
+                return -1;
+            }
+            ++policy.ntunnels;
+        }
+        else
+        {
+            LOG_ERROR("Capture: unknown key \"%s\" (or more than %d selectors)", item, CAPTURE_RULES_MAX);
+            return -1;
+        }
+    }
+    if (policy.base[0] == '\0')
+    {
+        LOG_ERROR("Capture: file= is required");
+        return -1;
+    }
+    if (policy.size < CAPTURE_SIZE_MIN)
+    {
+        policy.size = CAPTURE_SIZE_MIN;
+    }
+    return 0;
+}
+
+int capture_init(const char *spec)
+{
+    if (spec == NULL || spec[0] == '\0')
+    {
+        return 0;
+    }
+    if (policy_parse(spec) < 0)
+    {
+        return -1;
+    }
+    // Первый файл открываем сразу: ошибка пути видна при старте, а не на первом туннеле
+    if (file_open() < 0)
+    {
+        return -1;
+    }
+    atexit(capture_atexit);
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL)
+    {
+        LOG_ERROR("Failed to allocate capture ring");
+        return -1;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->inflight, 0);
+    atomic_init(&ring->sleeping, 0);
+    atomic_init(&ring->stop, 0);
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->wake, NULL);
+    if (pthread_create(&ring->thread, NULL, capture_thread, NULL) != 0)
+    {
+        LOG_ERROR("Failed to launch capture thread");
+        free(ring);
+        ring = NULL;
+        return -1;
+    }
+    LOG_INFO("Capture: %llu MiB files%s, %u/%u/%u/%u selectors (user/host/port/tunnel)",
+             policy.size >> 20, policy.files > 0 ? ", rotating" : "",
+             policy.nusers, policy.nhosts, policy.nports, policy.ntunnels);
+    return server_timer_add(CAPTURE_STATS_MS, capture_stats_tick, NULL);
+}
@@ -0,0 +1,179 @@
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "codec.h"
+#include "logger.h"
+
+
+#define CODEC_LEVEL       1                  // Быстрый уровень: нам важнее CPU, чем последние проценты
+#define CODEC_WBITS       14                 // Окно 16 KiB: ~96 KiB на deflate-поток вместо 256 KiB
+#define CODEC_MEMLEVEL    6
+#define CODEC_SAMPLE      (32 * 1024)        // Проба в начале стрима и после пропуска
+#define CODEC_RECHECK     (256 * 1024)       // Пока жмём — переоцениваем выигрыш с таким шагом
+#define CODEC_SKIP_MIN    (1024 * 1024)      // Первый пропуск несжимаемого
+#define CODEC_SKIP_MAX    (64 * 1024 * 1024) // Дальше интервал удваивается до этого предела
+
+
+/*
+ * Что кодек делает с исходящими данными сейчас
+ */
+typedef enum codec_mode
+{
+    CODEC_SAMPLING,  // Жмём на пробу
+    CODEC_ON,        // Жмём, выигрыш есть
+    CODEC_SKIP       // Несжимаемое — шлём как есть до конца интервала
+} codec_mode_t;
+
+struct codec
+{
+    z_stream      tx;
+    z_stream      rx;
+    int           tx_ready;
+    int           rx_ready;
+    codec_mode_t  mode;
+    size_t        win_in;     // Сколько отдали в deflate в текущем окне оценки
+    size_t        win_out;    // Сколько из этого получилось
+    size_t        skip_left;  // Сколько ещё пропустить в CODEC_SKIP
+    size_t        skip_len;   // Длина следующего пропуска (бэкофф)
+};
+
+
+static codec_stats_t stats;
+
+
+codec_t *codec_create(void)
+{
+    codec_t *codec = malloc(sizeof(*codec));
+    if (codec == NULL)
+    {
+        return NULL;
+    }
+    memset(codec, 0, sizeof(*codec));
+    codec->mode     = CODEC_SAMPLING;
+    codec->skip_len = CODEC_SKIP_MIN;
+    return codec;
+}
+
+void codec_release(codec_t *codec)
+{
+    if (codec->tx_ready)
+    {
+        deflateEnd(&codec->tx);
+    }
+    if (codec->rx_ready)
+    {
+        inflateEnd(&codec->rx);
+    }
+    free(codec);
+}
+
+/*
+ * Окно оценки закончилось: решаем, жать дальше или пропускать
+ */
+static void codec_judge(codec_t *codec)
+{
+    // Выигрыш меньше 10% — CPU тратится впустую
+    if (codec->win_out * 10 > codec->win_in * 9)
+    {
+        codec->mode      = CODEC_SKIP;
+        codec->skip_left = codec->skip_len;
+        codec->skip_len  = codec->skip_len * 2 > CODEC_SKIP_MAX ? CODEC_SKIP_MAX : codec->skip_len * 2;
+    }
+    else
+    {
+        codec->mode     = CODEC_ON;
+        codec->skip_len = CODEC_SKIP_MIN;
+    }
+    codec->win_in  = 0;
+    codec->win_out = 0;
+}
+
+int codec_encode(codec_t *codec, const uint8_t *src, size_t len, uint8_t *out, size_t outcap)
+{
+    if (codec->mode == CODEC_SKIP)
+    {
+        if (codec->skip_left > len)
+        {
+            codec->skip_left -= len;
+            stats.skipped    += len;
+            return 0;
+        }
+        // Интервал кончился — пробуем снова (поток мог смениться, например, после апгрейда)
+        codec->mode = CODEC_SAMPLING;
+    }
+
+    if (!codec->tx_ready)
+    {
+        if (deflateInit2(&codec->tx, CODEC_LEVEL, Z_DEFLATED, CODEC_WBITS, CODEC_MEMLEVEL,
+                         Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return -1;
+        }
+        codec->tx_ready = 1;
+    }
+
+    codec->tx.next_in   = (Bytef *)src;
+    codec->tx.avail_in  = (uInt)len;
+    codec->tx.next_out  = out;
+    codec->tx.avail_out = (uInt)outcap;
+
+    // SYNC_FLUSH: всё, что отдали, выходит целиком и распаковывается без следующих фреймов
+    int ret = deflate(&codec->tx, Z_SYNC_FLUSH);
+    if (ret != Z_OK || codec->tx.avail_in != 0 || codec->tx.avail_out == 0)
+    {
+        LOG_ERROR("Failed codec_encode, ret=%d len=%zu", ret, len);
+        return -1;
+    }
+
+    size_t produced = outcap - codec->tx.avail_out;
+    stats.raw_in     += len;
+    stats.packed_out += produced;
+    codec->win_in    += len;
+    codec->win_out   += produced;
+
+    if (codec->win_in >= (codec->mode == CODEC_SAMPLING ? CODEC_SAMPLE : CODEC_RECHECK))
+    {
+        codec_judge(codec);
+    }
+    return (int)produced;
+}
+
+int codec_decode(codec_t *codec, const uint8_t *src, size_t len, buffer_t *dst)
+{
+    if (!codec->rx_ready)
+    {
+        if (inflateInit2(&codec->rx, 15) != Z_OK)
+        {
+            return -1;
+        }
+        codec->rx_ready = 1;
+    }
+
+    // Отправитель жмёт не больше CODEC_MAX_INPUT за фрейм — больше на выходе быть не может
+    // (заодно защита от zip-бомбы)
+    uint8_t out[CODEC_MAX_INPUT + 1];
+    codec->rx.next_in   = (Bytef *)src;
+    codec->rx.avail_in  = (uInt)len;
+    codec->rx.next_out  = out;
+    codec->rx.avail_out = sizeof(out);
+
+    int ret = inflate(&codec->rx, Z_SYNC_FLUSH);
+    size_t produced = sizeof(out) - codec->rx.avail_out;
+    if ((ret != Z_OK && ret != Z_BUF_ERROR) || codec->rx.avail_in != 0 || produced > CODEC_MAX_INPUT)
+    {
+        LOG_ERROR("Failed codec_decode, ret=%d len=%zu", ret, len);
+        return -1;
+    }
+
+    if (produced > 0 && buffer_write(dst, out, produced) < 0)
+    {
+        return -1;
+    }
+    return (int)produced;
+}
+
+void codec_get_stats(codec_stats_t *out)
+{
+    *out = stats;
+}
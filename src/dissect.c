@@ -0,0 +1,206 @@
+#include <string.h>
+
+#include "dissect.h"
+
+
+static const dissector_t *registry[DISSECT_MAX];
+static unsigned           nregistry;
+static uint32_t           decision[2][256];  // Направление, первый байт → маска кандидатов
+
+
+int dissect_register(const dissector_t *d)
+{
+    if (nregistry == DISSECT_MAX)
+    {
+        return -1;
+    }
+    uint32_t bit = 1u << nregistry;
+    for (int dir = 0; dir < 2; ++dir)
+    {
+        for (int b = 0; b < 256; ++b)
+        {
+            if (d->first((uint8_t)b, dir))
+            {
+                decision[dir][b] |= bit;
+            }
+        }
+    }
+    registry[nregistry++] = d;
+    return 0;
+}
+
+const char *dissect_name(const dissect_flow_t *flow)
+{
+    return flow->dissector != NULL ? flow->dissector->name : "-";
+}
+
+void dissect_flow_init(dissect_flow_t *flow, uint16_t port)
+{
+    // peek значим только до peek_len
+    memset(flow, 0, offsetof(dissect_flow_t, peek));
+    flow->state = DISSECT_CLASSIFY;
+    for (unsigned i = 0; i < nregistry && port != 0; ++i)
+    {
+        for (int k = 0; k < DISSECT_PORTS; ++k)
+        {
+            if (registry[i]->ports[k] == port)
+            {
+                flow->hinted |= 1u << i;
+            }
+        }
+    }
+}
+
+/*
+ * Кандидаты по очереди: сначала те, чей порт совпал. Первый YES — ответ;
+ * *more — кто-то ещё не решил
+ */
+static int classify(const dissect_flow_t *flow, const uint8_t *p, size_t len, int dir, int *more)
+{
+    uint32_t mask     = decision[dir][p[0]];
+    uint32_t order[2] = { mask & flow->hinted, mask & ~flow->hinted };
+    *more = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (uint32_t m = order[pass]; m != 0; m &= m - 1)
+        {
+            int              i = __builtin_ctz(m);
+            dissect_match_t  r = registry[i]->match(p, len, dir, pass == 0);
+            if (r == DISSECT_YES)
+            {
+                return i;
+            }
+            // С полным peek сомневаться уже поздно
+            *more |= r == DISSECT_MORE && len < DISSECT_PEEK;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Диссектор выбран: отдаём ему всё, что копилось в peek (сначала направление,
+ * которое заговорило раньше), потом сам кусок
+ */
+static dissect_result_t bind(dissect_flow_t *flow, int index, int dir, const uint8_t *data, size_t len,
+                             size_t peeked)
+{
+    const dissector_t *d = registry[index];
+    flow->dissector = d;
+    flow->ctx       = d->create != NULL ? d->create() : NULL;
+    if (d->create != NULL && flow->ctx == NULL)
+    {
+        flow->state = DISSECT_FINISHED;
+        return DISSECT_DONE;
+    }
+    flow->state = DISSECT_BOUND;
+
+    bool more = true;
+    if (flow->peek_len[!dir] > 0)
+    {
+        more = d->feed(flow->ctx, flow->peek[!dir], flow->peek_len[!dir], !dir);
+    }
+    if (more && peeked > 0)
+    {
+        more = d->feed(flow->ctx, flow->peek[dir], peeked, dir);
+    }
+    if (more)
+    {
+        more = d->feed(flow->ctx, data, len, dir);
+    }
+    if (!more)
+    {
+        flow->state = DISSECT_FINISHED;
+        return DISSECT_DONE;
+    }
+    return DISSECT_OK;
+}
+
+dissect_result_t dissect_feed(dissect_flow_t *flow, const uint8_t *data, size_t len, int is_client)
+{
+    int dir = is_client ? 1 : 0;
+    if (len == 0)
+    {
+        return DISSECT_OK;
+    }
+
+    switch (flow->state)
+    {
+    case DISSECT_BOUND:
+        if (!flow->dissector->feed(flow->ctx, data, len, dir))
+        {
+            flow->state = DISSECT_FINISHED;
+            return DISSECT_DONE;
+        }
+        return DISSECT_OK;
+
+    case DISSECT_FINISHED:
+        return DISSECT_DONE;
+
+    case DISSECT_NONE:
+        // Незнакомый протокол: показываем только первый кусок каждого направления
+        if (flow->shown[dir])
+        {
+            return flow->shown[!dir] ? DISSECT_DONE : DISSECT_OK;
+        }
+        flow->shown[dir] = 1;
+        return DISSECT_RAW;
+
+    case DISSECT_CLASSIFY:
+        break;
+    }
+
+    // Сигнатуре нужны подряд идущие байты: если начало уже в peek, докладываем туда
+    size_t         peeked = flow->peek_len[dir];
+    const uint8_t *p      = data;
+    size_t         plen   = len < DISSECT_PEEK ? len : DISSECT_PEEK;
+    if (peeked > 0)
+    {
+        size_t add = len < DISSECT_PEEK - peeked ? len : DISSECT_PEEK - peeked;
+        memcpy(flow->peek[dir] + peeked, data, add);
+        p    = flow->peek[dir];
+        plen = peeked + add;
+    }
+
+    int more  = 0;
+    int index = classify(flow, p, plen, dir, &more);
+    if (index >= 0)
+    {
+        return bind(flow, index, dir, data, len, peeked);
+    }
+    if (more)
+    {
+        if (peeked == 0)
+        {
+            memcpy(flow->peek[dir], data, plen);
+        }
+        flow->peek_len[dir] = plen;
+        return DISSECT_OK;
+    }
+    if (flow->peek_len[!dir] > 0)
+    {
+        // Другая сторона ещё не договорила свою сигнатуру — решать будет она
+        return DISSECT_RAW;
+    }
+    // Никто не подошёл — решение на весь туннель
+    flow->state      = DISSECT_NONE;
+    flow->shown[dir] = 1;
+    return DISSECT_RAW;
+}
+
+unsigned dissect_messages(const dissect_flow_t *flow)
+{
+    if (flow->ctx == NULL || flow->dissector->messages == NULL)
+    {
+        return 0;
+    }
+    return flow->dissector->messages(flow->ctx);
+}
+
+void dissect_flow_free(dissect_flow_t *flow)
+{
+    if (flow->ctx != NULL && flow->dissector->destroy != NULL)
+    {
+        flow->dissector->destroy(flow->ctx);
+        flow->ctx = NULL;
+    }
+}
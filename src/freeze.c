@@ -0,0 +1,378 @@
+#include "freeze.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "sock.h"
+#include "logger.h"
+
+
+#define FREEZE_RULES_MAX  32  // Селекторов заморозки одновременно
+#define FREEZE_QUEUE      16  // Команд в очереди до event loop'а
+
+/*
+ * Селектор заморозки
+ */
+typedef enum freeze_kind
+{
+    FREEZE_ALL,
+    FREEZE_TUNNEL,
+    FREEZE_USER,
+    FREEZE_HOST,
+    FREEZE_PORT
+} freeze_kind_t;
+
+typedef struct freeze_rule
+{
+    freeze_kind_t       kind;
+    unsigned long long  number;      // tunnel= и port=
+    char                value[256];  // user= и host=
+} freeze_rule_t;
+
+/*
+ * Команда для event loop'а
+ */
+typedef struct freeze_cmd
+{
+    freeze_op_t    op;
+    freeze_rule_t  rule;
+} freeze_cmd_t;
+
+
+static const char *kind_names[] = {"all", "tunnel", "user", "host", "port"};
+
+// Очередь команд: кладёт кто угодно, разбирает event loop
+static pthread_mutex_t  queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static freeze_cmd_t     queue[FREEZE_QUEUE];
+static int              nqueue;
+static atomic_int       wake_fd = -1;
+
+// Дальше — только event loop
+static sock_t          *wake_sock;
+static freeze_rule_t    rules[FREEZE_RULES_MAX];
+static int              nrules;
+static sock_t          *frozen;    // Сокеты, поставленные на паузу заморозкой
+static unsigned         nfrozen;
+
+
+/*
+ * "user=alice" -> правило; NULL или "" — весь прокси
+ */
+static int rule_parse(const char *selector, freeze_rule_t *rule)
+{
+    memset(rule, 0, sizeof(*rule));
+    if (selector == NULL || selector[0] == '\0' || strcmp(selector, "all") == 0)
+    {
+        rule->kind = FREEZE_ALL;
+        return 0;
+    }
+    const char *value = strchr(selector, '=');
+    if (value == NULL || value[1] == '\0' || strlen(value + 1) >= sizeof(rule->value))
+    {
+        return -1;
+    }
+    size_t key = (size_t)(value - selector);
+    ++value;
+    for (int kind = FREEZE_TUNNEL; kind <= FREEZE_PORT; ++kind)
+    {
+        if (strlen(kind_names[kind]) == key && strncmp(selector, kind_names[kind], key) == 0)
+        {
+            rule->kind = (freeze_kind_t)kind;
+            if (kind == FREEZE_TUNNEL || kind == FREEZE_PORT)
+            {
+                char *end;
+                rule->number = strtoull(value, &end, 10);
+                return *end == '\0' ? 0 : -1;
+            }
+            snprintf(rule->value, sizeof(rule->value), "%s", value);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static bool rule_same(const freeze_rule_t *a, const freeze_rule_t *b)
+{
+    return a->kind == b->kind && a->number == b->number && strcmp(a->value, b->value) == 0;
+}
+
+static bool host_matches(const char *rule, const char *host)
+{
+    size_t rlen = strlen(rule);
+    size_t hlen = strlen(host);
+    if (rule[0] != '.')
+    {
+        return strcasecmp(rule, host) == 0;
+    }
+    // ".example.com" — сам домен и все поддомены
+    return strcasecmp(rule + 1, host) == 0
+        || (hlen > rlen && strcasecmp(host + hlen - rlen, rule) == 0);
+}
+
+static bool rule_matches(const freeze_rule_t *rule, const tunnel_t *tunnel)
+{
+    switch (rule->kind)
+    {
+        case FREEZE_ALL:
+        {
+            return true;
+        }
+        case FREEZE_TUNNEL:
+        {
+            return rule->number == tunnel->id;
+        }
+        case FREEZE_USER:
+        {
+            return strlen(rule->value) == tunnel->ap.ulen
+                && memcmp(rule->value, tunnel->ap.uname, tunnel->ap.ulen) == 0;
+        }
+        case FREEZE_HOST:
+        {
+            return host_matches(rule->value, tunnel->dst_host);
+        }
+        case FREEZE_PORT:
+        {
+            return rule->number == strtoull(tunnel->dst_port, NULL, 10);
+        }
+    }
+    return false;
+}
+
+static bool tunnel_frozen(const tunnel_t *tunnel)
+{
+    for (int i = 0; i < nrules; ++i)
+    {
+        if (rule_matches(&rules[i], tunnel))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int rule_find(const freeze_rule_t *rule)
+{
+    for (int i = 0; i < nrules; ++i)
+    {
+        if (rule_same(&rules[i], rule))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Применяет команду к правилам
+ */
+static void cmd_apply(const freeze_cmd_t *cmd)
+{
+    int at = rule_find(&cmd->rule);
+    if (cmd->op == FREEZE_OFF && cmd->rule.kind == FREEZE_ALL)
+    {
+        // "unfreeze" без селектора — снимаем всё
+        nrules = 0;
+        return;
+    }
+    if (cmd->op == FREEZE_OFF || (cmd->op == FREEZE_TOGGLE && at >= 0))
+    {
+        if (at >= 0)
+        {
+            rules[at] = rules[--nrules];
+        }
+        return;
+    }
+    if (at < 0 && nrules < FREEZE_RULES_MAX)
+    {
+        rules[nrules++] = cmd->rule;
+    }
+}
+
+/*
+ * Снимает паузу с сокетов, чьи туннели больше не подходят ни под одно правило.
+ * Возвращает, сколько отпустили
+ */
+static unsigned frozen_thaw(void)
+{
+    unsigned thawed = 0;
+    sock_t  *sock   = frozen;
+    while (sock != NULL)
+    {
+        sock_t *next = sock->frozen_next;
+        if (!tunnel_frozen(sock->tunnel))
+        {
+            freeze_forget(sock);
+            sock_resume(sock, SOCK_PAUSE_FREEZE);
+            ++thawed;
+        }
+        sock = next;
+    }
+    return thawed;
+}
+
+/*
+ * Что сейчас заморожено — в консоль. Сокеты встают на паузу на своём следующем
+ * чтении, так что при заморозке считать нечего; при разморозке — сколько отпустили
+ */
+static void rules_report(unsigned thawed)
+{
+    char text[1024];
+    int  len = 0;
+    for (int i = 0; i < nrules && len < (int)sizeof(text) - 1; ++i)
+    {
+        const freeze_rule_t *rule = &rules[i];
+        const char          *sep  = i > 0 ? ", " : "";
+        if (rule->kind == FREEZE_ALL)
+        {
+            len += snprintf(text + len, sizeof(text) - (size_t)len, "%sall", sep);
+        }
+        else if (rule->kind == FREEZE_TUNNEL || rule->kind == FREEZE_PORT)
+        {
+            len += snprintf(text + len, sizeof(text) - (size_t)len, "%s%s=%llu", sep, kind_names[rule->kind],
+                            rule->number);
+        }
+        else
+        {
+            len += snprintf(text + len, sizeof(text) - (size_t)len, "%s%s=%s", sep, kind_names[rule->kind],
+                            rule->value);
+        }
+    }
+    EXTRA_LOG_WARN("Freeze → %s (%u sockets resumed, %u still paused)", nrules > 0 ? text : "OFF", thawed, nfrozen);
+}
+
+/*
+ * eventfd сработал: забираем команды, применяем, размораживаем, что отпустили
+ */
+static void freeze_wake_handle(int fd, void *ud)
+{
+    freeze_cmd_t cmds[FREEZE_QUEUE];
+    uint64_t     count;
+    (void)ud;
+
+    if (read(fd, &count, sizeof(count)) < 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&queue_lock);
+    int n = nqueue;
+    memcpy(cmds, queue, sizeof(cmds[0]) * (size_t)n);
+    nqueue = 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    for (int i = 0; i < n; ++i)
+    {
+        cmd_apply(&cmds[i]);
+    }
+    rules_report(frozen_thaw());
+}
+
+static void freeze_signal(void)
+{
+    uint64_t one = 1;
+    int      fd  = atomic_load(&wake_fd);
+    if (fd >= 0 && write(fd, &one, sizeof(one)) < 0)
+    {
+        LOG_ERROR("Freeze: failed to wake the event loop");
+    }
+}
+
+int freeze_init(void)
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_ERROR("Freeze: cannot create eventfd");
+        return -1;
+    }
+    wake_sock = sock_create(fd, sock_connected, 0, NULL);
+    if (wake_sock == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    wake_sock->read_handle = freeze_wake_handle;
+    if (epoll_add(wake_sock) < 0)
+    {
+        LOG_ERROR("Freeze: cannot add eventfd to epoll");
+        return -1;
+    }
+    atomic_store(&wake_fd, fd);
+
+    // Команды могли прийти раньше, чем завёлся цикл
+    pthread_mutex_lock(&queue_lock);
+    int pending = nqueue;
+    pthread_mutex_unlock(&queue_lock);
+    if (pending > 0)
+    {
+        freeze_signal();
+    }
+    return 0;
+}
+
+int freeze_request(freeze_op_t op, const char *selector)
+{
+    freeze_cmd_t cmd = {.op = op};
+    if (rule_parse(selector, &cmd.rule) < 0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&queue_lock);
+    int full = nqueue == FREEZE_QUEUE;
+    if (!full)
+    {
+        queue[nqueue++] = cmd;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    if (full)
+    {
+        return -1;
+    }
+    freeze_signal();
+    return 0;
+}
+
+bool freeze_check(tunnel_t *tunnel, sock_t *sock)
+{
+    if (nrules == 0 || !tunnel_frozen(tunnel))
+    {
+        return false;
+    }
+    if (!(sock->paused & SOCK_PAUSE_FREEZE))
+    {
+        sock->frozen_prev = NULL;
+        sock->frozen_next = frozen;
+        if (frozen != NULL)
+        {
+            frozen->frozen_prev = sock;
+        }
+        frozen = sock;
+        ++nfrozen;
+        sock_pause(sock, SOCK_PAUSE_FREEZE);
+    }
+    return true;
+}
+
+void freeze_forget(sock_t *sock)
+{
+    if (sock->frozen_prev != NULL)
+    {
+        sock->frozen_prev->frozen_next = sock->frozen_next;
+    }
+    else
+    {
+        frozen = sock->frozen_next;
+    }
+    if (sock->frozen_next != NULL)
+    {
+        sock->frozen_next->frozen_prev = sock->frozen_prev;
+    }
+    sock->frozen_prev = NULL;
+    sock->frozen_next = NULL;
+    --nfrozen;
+}
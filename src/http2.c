@@ -0,0 +1,912 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "http2.h"
+
+
+#define H2_TABLE_DEFAULT 4096   // Размер динамической таблицы, пока энкодер не прислал другой
+
+static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+
+/*
+ * Статическая таблица HPACK (RFC 7541, приложение A), индексы с 1
+ */
+typedef struct h2_static
+{
+    const char *name;
+    size_t      nlen;
+    const char *value;
+    size_t      vlen;
+} h2_static_t;
+
+#define S(n, v) { n, sizeof(n) - 1, v, sizeof(v) - 1 }
+static const h2_static_t static_table[] =
+{
+    S(":authority", ""), S(":method", "GET"), S(":method", "POST"), S(":path", "/"),
+    S(":path", "/index.html"), S(":scheme", "http"), S(":scheme", "https"),
+    S(":status", "200"), S(":status", "204"), S(":status", "206"), S(":status", "304"),
+    S(":status", "400"), S(":status", "404"), S(":status", "500"),
+    S("accept-charset", ""), S("accept-encoding", "gzip, deflate"), S("accept-language", ""),
+    S("accept-ranges", ""), S("accept", ""), S("access-control-allow-origin", ""),
+    S("age", ""), S("allow", ""), S("authorization", ""), S("cache-control", ""),
+    S("content-disposition", ""), S("content-encoding", ""), S("content-language", ""),
+    S("content-length", ""), S("content-location", ""), S("content-range", ""),
+    S("content-type", ""), S("cookie", ""), S("date", ""), S("etag", ""), S("expect", ""),
+    S("expires", ""), S("from", ""), S("host", ""), S("if-match", ""),
+    S("if-modified-since", ""), S("if-none-match", ""), S("if-range", ""),
+    S("if-unmodified-since", ""), S("last-modified", ""), S("link", ""), S("location", ""),
+    S("max-forwards", ""), S("proxy-authenticate", ""), S("proxy-authorization", ""),
+    S("range", ""), S("referer", ""), S("refresh", ""), S("retry-after", ""), S("server", ""),
+    S("set-cookie", ""), S("strict-transport-security", ""), S("transfer-encoding", ""),
+    S("user-agent", ""), S("vary", ""), S("via", ""), S("www-authenticate", "")
+};
+#undef S
+
+#define STATIC_COUNT (sizeof(static_table) / sizeof(static_table[0]))
+
+/*
+ * Код Huffman'а HPACK (приложение B) канонический: достаточно числа кодов каждой
+ * длины и символов по возрастанию (длина, символ). EOS (256) — последний
+ * 30-битный код, в huff_sym его нет: встретился в данных — ошибка
+ */
+static const uint8_t huff_count[31] =
+{
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint8_t huff_sym[256] =
+{
+     48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,  45,  46,  47,  51,
+     52,  53,  54,  55,  56,  57,  61,  65,  95,  98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117,  58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+     77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89, 106, 107, 113, 118,
+    119, 120, 121, 122,  38,  42,  44,  59,  88,  90,  33,  34,  40,  41,  63,  39,
+     43, 124,  35,  62,   0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239,   9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+      2,   3,   4,   5,   6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+     21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220, 249,  10,  13,  22
+};
+
+/*
+ * Коды до 8 бит по старшему байту: длина << 8 | символ, 0 — код длиннее.
+ * Промахнулись — по битам с 9-го: первый 9-битный код и сколько символов короче
+ */
+static const uint16_t huff_fast[256] =
+{
+    0x0530, 0x0530, 0x0530, 0x0530, 0x0530, 0x0530, 0x0530, 0x0530,
+    0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531,
+    0x0532, 0x0532, 0x0532, 0x0532, 0x0532, 0x0532, 0x0532, 0x0532,
+    0x0561, 0x0561, 0x0561, 0x0561, 0x0561, 0x0561, 0x0561, 0x0561,
+    0x0563, 0x0563, 0x0563, 0x0563, 0x0563, 0x0563, 0x0563, 0x0563,
+    0x0565, 0x0565, 0x0565, 0x0565, 0x0565, 0x0565, 0x0565, 0x0565,
+    0x0569, 0x0569, 0x0569, 0x0569, 0x0569, 0x0569, 0x0569, 0x0569,
+    0x056f, 0x056f, 0x056f, 0x056f, 0x056f, 0x056f, 0x056f, 0x056f,
+    0x0573, 0x0573, 0x0573, 0x0573, 0x0573, 0x0573, 0x0573, 0x0573,
+    0x0574, 0x0574, 0x0574, 0x0574, 0x0574, 0x0574, 0x0574, 0x0574,
+    0x0620, 0x0620, 0x0620, 0x0620, 0x0625, 0x0625, 0x0625, 0x0625,
+    0x062d, 0x062d, 0x062d, 0x062d, 0x062e, 0x062e, 0x062e, 0x062e,
+    0x062f, 0x062f, 0x062f, 0x062f, 0x0633, 0x0633, 0x0633, 0x0633,
+    0x0634, 0x0634, 0x0634, 0x0634, 0x0635, 0x0635, 0x0635, 0x0635,
+    0x0636, 0x0636, 0x0636, 0x0636, 0x0637, 0x0637, 0x0637, 0x0637,
+    0x0638, 0x0638, 0x0638, 0x0638, 0x0639, 0x0639, 0x0639, 0x0639,
+    0x063d, 0x063d, 0x063d, 0x063d, 0x0641, 0x0641, 0x0641, 0x0641,
+    0x065f, 0x065f, 0x065f, 0x065f, 0x0662, 0x0662, 0x0662, 0x0662,
+    0x0664, 0x0664, 0x0664, 0x0664, 0x0666, 0x0666, 0x0666, 0x0666,
+    0x0667, 0x0667, 0x0667, 0x0667, 0x0668, 0x0668, 0x0668, 0x0668,
+    0x066c, 0x066c, 0x066c, 0x066c, 0x066d, 0x066d, 0x066d, 0x066d,
+    0x066e, 0x066e, 0x066e, 0x066e, 0x0670, 0x0670, 0x0670, 0x0670,
+    0x0672, 0x0672, 0x0672, 0x0672, 0x0675, 0x0675, 0x0675, 0x0675,
+    0x073a, 0x073a, 0x0742, 0x0742, 0x0743, 0x0743, 0x0744, 0x0744,
+    0x0745, 0x0745, 0x0746, 0x0746, 0x0747, 0x0747, 0x0748, 0x0748,
+    0x0749, 0x0749, 0x074a, 0x074a, 0x074b, 0x074b, 0x074c, 0x074c,
+    0x074d, 0x074d, 0x074e, 0x074e, 0x074f, 0x074f, 0x0750, 0x0750,
+    0x0751, 0x0751, 0x0752, 0x0752, 0x0753, 0x0753, 0x0754, 0x0754,
+    0x0755, 0x0755, 0x0756, 0x0756, 0x0757, 0x0757, 0x0759, 0x0759,
+    0x076a, 0x076a, 0x076b, 0x076b, 0x0771, 0x0771, 0x0776, 0x0776,
+    0x0777, 0x0777, 0x0778, 0x0778, 0x0779, 0x0779, 0x077a, 0x077a,
+    0x0826, 0x082a, 0x082c, 0x083b, 0x0858, 0x085a, 0x0000, 0x0000
+};
+
+#define HUFF_FIRST9 508
+#define HUFF_INDEX9 74
+
+
+void h2_flow_init(h2_flow_t *h2)
+{
+    // Кольца таблиц, block, text и field значимы только до своих длин
+    for (int d = 0; d < 2; ++d)
+    {
+        h2_dir_t *s = &h2->dir[d];
+        memset(s, 0, offsetof(h2_dir_t, table));
+        memset(&s->table, 0, offsetof(h2_table_t, ent));
+        s->table.max = H2_TABLE_DEFAULT;
+        s->state     = d == 1 ? H2_PREFACE : H2_HEADER;
+    }
+    memset(h2->streams, 0, sizeof(h2->streams));
+}
+
+dissect_match_t h2_signature(const uint8_t *p, size_t len, int is_client)
+{
+    if (is_client)
+    {
+        size_t n = len < sizeof(preface) - 1 ? len : sizeof(preface) - 1;
+        if (memcmp(p, preface, n) != 0)
+        {
+            return DISSECT_NO;
+        }
+        return n == sizeof(preface) - 1 ? DISSECT_YES : DISSECT_MORE;
+    }
+    // SETTINGS без флагов на потоке 0, параметры по 6 байт
+    static const uint8_t head[] = { 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    if (len < 3)
+    {
+        return p[0] == 0 ? DISSECT_MORE : DISSECT_NO;
+    }
+    size_t length = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+    size_t n      = len - 3 < sizeof(head) ? len - 3 : sizeof(head);
+    if (length % 6 != 0 || length > 16384 || memcmp(p + 3, head, n) != 0)
+    {
+        return DISSECT_NO;
+    }
+    return n == sizeof(head) ? DISSECT_YES : DISSECT_MORE;
+}
+
+static uint32_t be32(const uint8_t *b)
+{
+    return (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+}
+
+/*
+ * Huffman → dst (пишется не больше cap, но считается всё).
+ * Коды до 8 бит (почти весь ASCII заголовков) — одним взглядом в huff_fast по
+ * старшему байту; длиннее — канонический декодер по битам, продолжая с 9-го:
+ * code — прочитанные биты, first — первый код текущей длины, index — сколько
+ * символов у более коротких длин.
+ * Возвращает длину декодированной строки или -1
+ */
+static long huff_decode(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+    size_t   out  = 0;
+    size_t   i    = 0;
+    uint64_t acc  = 0;  // Непрочитанные биты, выровненные по старшему
+    unsigned bits = 0;
+
+    for (;;)
+    {
+        while (bits <= 56 && i < n)
+        {
+            acc  |= (uint64_t)src[i++] << (56 - bits);
+            bits += 8;
+        }
+        if (bits == 0)
+        {
+            break;
+        }
+
+        unsigned e   = huff_fast[acc >> 56];
+        unsigned len = e >> 8;
+        int      sym;
+        if (e != 0 && len <= bits)
+        {
+            sym = e & 0xff;
+        }
+        else if (bits < 8)
+        {
+            // Хвост — не больше 7 бит, и только единицы (начало EOS)
+            if (acc >> (64 - bits) != (1u << bits) - 1)
+            {
+                return -1;
+            }
+            break;
+        }
+        else
+        {
+            uint32_t code  = (uint32_t)(acc >> 56) << 1;
+            uint32_t first = HUFF_FIRST9;
+            unsigned index = HUFF_INDEX9;
+            sym = -1;
+            for (len = 9; len <= 30 && len <= bits; ++len)
+            {
+                code |= (uint32_t)(acc >> (64 - len)) & 1;
+                uint32_t count = huff_count[len];
+                if (code - first < count)
+                {
+                    unsigned k = index + (code - first);
+                    // EOS в данных — ошибка
+                    sym = k < sizeof(huff_sym) ? huff_sym[k] : -1;
+                    break;
+                }
+                index += count;
+                first  = (first + count) << 1;
+                code <<= 1;
+            }
+            if (sym < 0)
+            {
+                return -1;
+            }
+        }
+        if (out < cap)
+        {
+            dst[out] = (uint8_t)sym;
+        }
+        ++out;
+        acc  <<= len;
+        bits  -= len;
+    }
+    return (long)out;
+}
+
+/*
+ * Целое с prefix-битным префиксом (RFC 7541, 5.1)
+ */
+static int hpack_int(const uint8_t **p, const uint8_t *end, unsigned prefix, uint32_t *out)
+{
+    uint32_t mask = (1u << prefix) - 1;
+    uint32_t v    = *(*p)++ & mask;
+    if (v == mask)
+    {
+        for (unsigned shift = 0; ; shift += 7)
+        {
+            if (*p == end || shift > 21)
+            {
+                return -1;
+            }
+            uint8_t b = *(*p)++;
+            v += (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+            {
+                break;
+            }
+        }
+    }
+    *out = v;
+    return 0;
+}
+
+/*
+ * Строка (RFC 7541, 5.2) → dst (пишется не больше cap).
+ * Возвращает полную длину строки или -1
+ */
+static long hpack_str(const uint8_t **p, const uint8_t *end, uint8_t *dst, size_t cap)
+{
+    if (*p == end)
+    {
+        return -1;
+    }
+    int      huff = (**p & 0x80) != 0;
+    uint32_t n;
+    if (hpack_int(p, end, 7, &n) < 0 || n > (size_t)(end - *p))
+    {
+        return -1;
+    }
+    const uint8_t *s = *p;
+    *p += n;
+    if (huff)
+    {
+        return huff_decode(s, n, dst, cap);
+    }
+    memcpy(dst, s, n < cap ? n : cap);
+    return n;
+}
+
+/*
+ * Кусок кольца динамической таблицы (может переходить через конец)
+ */
+static void ring_copy(const h2_table_t *t, size_t off, size_t len, uint8_t *dst)
+{
+    size_t k = H2_TABLE_MAX - off < len ? H2_TABLE_MAX - off : len;
+    memcpy(dst, t->bytes + off, k);
+    memcpy(dst + k, t->bytes, len - k);
+}
+
+static void table_evict(h2_table_t *t, size_t need)
+{
+    while (t->count > 0 && t->size + need > t->max)
+    {
+        const h2_entry_t *e = &t->ent[t->first];
+        t->size  -= e->nlen + e->vlen + 32;
+        t->first  = (t->first + 1) % H2_TABLE_ENTRIES;
+        t->count--;
+    }
+}
+
+/*
+ * Вставка новой записи (RFC 7541, 4.4): больше предела — таблица просто пустеет
+ */
+static void table_add(h2_table_t *t, const uint8_t *name, size_t nlen, const uint8_t *value, size_t vlen)
+{
+    size_t size = nlen + vlen + 32;
+    if (size > t->max)
+    {
+        t->count = 0;
+        t->size  = 0;
+        return;
+    }
+    table_evict(t, size);
+
+    h2_entry_t *e = &t->ent[(t->first + t->count) % H2_TABLE_ENTRIES];
+    e->off  = (uint32_t)t->head;
+    e->nlen = (uint32_t)nlen;
+    e->vlen = (uint32_t)vlen;
+    for (int part = 0; part < 2; ++part)
+    {
+        const uint8_t *src = part == 0 ? name : value;
+        size_t         n   = part == 0 ? nlen : vlen;
+        size_t         k   = H2_TABLE_MAX - t->head < n ? H2_TABLE_MAX - t->head : n;
+        memcpy(t->bytes + t->head, src, k);
+        memcpy(t->bytes, src + k, n - k);
+        t->head = (t->head + n) % H2_TABLE_MAX;
+    }
+    t->count++;
+    t->size += size;
+}
+
+/*
+ * Запись динамической таблицы по индексу HPACK (STATIC_COUNT + 1 — самая новая)
+ */
+static const h2_entry_t *table_get(const h2_table_t *t, uint32_t index)
+{
+    size_t d = index - STATIC_COUNT - 1;
+    if (d >= t->count)
+    {
+        return NULL;
+    }
+    return &t->ent[(t->first + t->count - 1 - d) % H2_TABLE_ENTRIES];
+}
+
+/*
+ * Дописывает в текст для лога; в именах и значениях (clean) управляющие
+ * символы заменяются на '?'
+ */
+static void text_put(h2_flow_t *h2, h2_headers_t *h, const uint8_t *s, size_t n, int clean)
+{
+    size_t room = H2_TEXT_MAX - h->text_len;
+    if (n > room)
+    {
+        n            = room;
+        h->truncated = 1;
+    }
+    char *out = h2->text + h->text_len;
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = clean && (s[i] < 0x20 || s[i] == 0x7f) ? '?' : (char)s[i];
+    }
+    h->text_len += n;
+}
+
+/*
+ * Одно поле в текст: "name: value\n". Имя и значение из таблицы копируются в field
+ */
+static void text_field(h2_flow_t *h2, h2_headers_t *h, const uint8_t *name, size_t nlen,
+                       const uint8_t *value, size_t vlen)
+{
+    text_put(h2, h, name, nlen, 1);
+    text_put(h2, h, (const uint8_t *)": ", 2, 0);
+    text_put(h2, h, value, vlen, 1);
+    text_put(h2, h, (const uint8_t *)"\n", 1, 0);
+    h->count++;
+}
+
+/*
+ * Имя (или имя и значение) поля по индексу в field. Возвращает 0 или -1
+ */
+static int field_index(h2_flow_t *h2, const h2_table_t *t, uint32_t index, int with_value,
+                       size_t *nlen, size_t *vlen)
+{
+    if (index == 0)
+    {
+        return -1;
+    }
+    if (index <= STATIC_COUNT)
+    {
+        const h2_static_t *s = &static_table[index - 1];
+        memcpy(h2->field, s->name, s->nlen);
+        *nlen = s->nlen;
+        *vlen = 0;
+        if (with_value)
+        {
+            memcpy(h2->field + s->nlen, s->value, s->vlen);
+            *vlen = s->vlen;
+        }
+        return 0;
+    }
+    const h2_entry_t *e = table_get(t, index);
+    if (e == NULL)
+    {
+        return -1;
+    }
+    // В таблице записи меньше H2_TABLE_MAX, field такого же размера
+    ring_copy(t, e->off, e->nlen, h2->field);
+    *nlen = e->nlen;
+    *vlen = 0;
+    if (with_value)
+    {
+        ring_copy(t, (e->off + e->nlen) % H2_TABLE_MAX, e->vlen, h2->field + e->nlen);
+        *vlen = e->vlen;
+    }
+    return 0;
+}
+
+/*
+ * Декодирует собранный блок заголовков направления в текст для лога.
+ * Возвращает NULL или что пошло не так (таблица после этого недостоверна)
+ */
+static const char *hpack_decode(h2_flow_t *h2, h2_dir_t *s, h2_headers_t *h)
+{
+    h2_table_t    *t   = &s->table;
+    const uint8_t *p   = s->block;
+    const uint8_t *end = s->block + s->block_len;
+    int            any = 0;
+
+    while (p < end)
+    {
+        uint8_t  b = *p;
+        uint32_t index;
+        size_t   nlen;
+        size_t   vlen;
+
+        if (b & 0x80)
+        {
+            // Indexed Header Field
+            if (hpack_int(&p, end, 7, &index) < 0 || field_index(h2, t, index, 1, &nlen, &vlen) < 0)
+            {
+                return "bad HPACK index";
+            }
+            text_field(h2, h, h2->field, nlen, h2->field + nlen, vlen);
+            any = 1;
+            continue;
+        }
+        if ((b & 0xe0) == 0x20)
+        {
+            // Dynamic Table Size Update — только в начале блока
+            if (any || hpack_int(&p, end, 5, &index) < 0)
+            {
+                return "bad HPACK table size update";
+            }
+            if (index > H2_TABLE_MAX)
+            {
+                return "HPACK table larger than supported";
+            }
+            t->max = index;
+            table_evict(t, 0);
+            continue;
+        }
+
+        // Literal: с индексацией (01), без (0000) или never indexed (0001)
+        int incremental = (b & 0xc0) == 0x40;
+        if (hpack_int(&p, end, incremental ? 6 : 4, &index) < 0)
+        {
+            return "bad HPACK literal";
+        }
+        long n;
+        if (index == 0)
+        {
+            n = hpack_str(&p, end, h2->field, sizeof(h2->field));
+            if (n < 0)
+            {
+                return "bad HPACK name";
+            }
+            nlen = (size_t)n;
+        }
+        else if (field_index(h2, t, index, 0, &nlen, &vlen) < 0)
+        {
+            return "bad HPACK index";
+        }
+        size_t room = nlen < sizeof(h2->field) ? sizeof(h2->field) - nlen : 0;
+        n = hpack_str(&p, end, h2->field + sizeof(h2->field) - room, room);
+        if (n < 0)
+        {
+            return "bad HPACK value";
+        }
+        vlen = (size_t)n;
+        // Поле длиннее field больше любой допустимой таблицы — вставка её только опустошает
+        int whole = nlen + vlen <= sizeof(h2->field);
+        if (incremental)
+        {
+            if (whole)
+            {
+                table_add(t, h2->field, nlen, h2->field + nlen, vlen);
+            }
+            else
+            {
+                t->count = 0;
+                t->size  = 0;
+            }
+        }
+        size_t shown_n = nlen < sizeof(h2->field) ? nlen : sizeof(h2->field);
+        text_field(h2, h, h2->field, shown_n, h2->field + shown_n, whole ? vlen : room);
+        any = 1;
+    }
+    return NULL;
+}
+
+/*
+ * Поток по id; create — завести, если нет. NULL — нет и мест нет
+ */
+static h2_stream_t *stream_get(h2_flow_t *h2, uint32_t id, int create)
+{
+    h2_stream_t *empty = NULL;
+    for (size_t i = 0; i < H2_STREAMS_MAX; ++i)
+    {
+        if (h2->streams[i].id == id)
+        {
+            return &h2->streams[i];
+        }
+        if (empty == NULL && h2->streams[i].id == 0)
+        {
+            empty = &h2->streams[i];
+        }
+    }
+    if (!create || empty == NULL)
+    {
+        return NULL;
+    }
+    memset(empty, 0, sizeof(*empty));
+    empty->id = id;
+    return empty;
+}
+
+static void stream_end(h2_flow_t *h2, int d, uint32_t id, const h2_flow_cb_t *cb, void *ud)
+{
+    h2_stream_t *st = stream_get(h2, id, 0);
+    h2->dir[d].messages++;
+    cb->on_stream_end(ud, d, id, st != NULL ? st->data[d] : H2_DATA_UNKNOWN);
+    if (st != NULL)
+    {
+        st->ended[d] = 1;
+        if (st->ended[0] && st->ended[1])
+        {
+            st->id = 0;
+        }
+    }
+}
+
+static void broken(h2_dir_t *s, int is_client, const char *what, const h2_flow_cb_t *cb, void *ud)
+{
+    s->state = H2_BROKEN;
+    cb->on_error(ud, is_client, what);
+}
+
+/*
+ * Блок заголовков целиком (END_HEADERS): декодируем и отдаём наружу
+ */
+static void block_done(h2_flow_t *h2, int d, const h2_flow_cb_t *cb, void *ud)
+{
+    h2_dir_t    *s = &h2->dir[d];
+    h2_headers_t h;
+    memset(&h, 0, sizeof(h));
+    h.type       = s->block_type;
+    h.stream     = s->block_stream;
+    h.promised   = s->block_promised;
+    h.end_stream = s->block_end;
+    h.wire_len   = s->block_wire;
+    h.text       = h2->text;
+    s->in_block  = 0;
+
+    if (!s->hpack_off)
+    {
+        const char *err = hpack_decode(h2, s, &h);
+        if (err != NULL)
+        {
+            s->hpack_off = 1;
+            cb->on_error(ud, d, err);
+        }
+        else
+        {
+            h.decoded = 1;
+        }
+    }
+    if (!h.decoded)
+    {
+        h.count     = 0;
+        h.text_len  = 0;
+        h.truncated = 0;
+    }
+
+    if (s->block_type == H2_PUSH_PROMISE)
+    {
+        // Обещанный поток от клиента ничего не получит — его сторона сразу закрыта
+        h2_stream_t *st = stream_get(h2, s->block_promised, 1);
+        if (st != NULL)
+        {
+            st->ended[1] = 1;
+        }
+    }
+    else
+    {
+        stream_get(h2, s->block_stream, 1);
+    }
+    cb->on_headers(ud, d, &h);
+    if (s->block_end)
+    {
+        stream_end(h2, d, s->block_stream, cb, ud);
+    }
+}
+
+/*
+ * Заголовок фрейма собран: проверяем и решаем, сколько префикса ждать. Возвращает 0 или <0
+ */
+static int frame_begin(h2_dir_t *s, int is_client, const h2_flow_cb_t *cb, void *ud)
+{
+    const uint8_t *h = s->hdr;
+    s->length  = (uint32_t)h[0] << 16 | (uint32_t)h[1] << 8 | h[2];
+    s->type    = h[3];
+    s->flags   = h[4];
+    s->stream  = be32(h + 5) & 0x7fffffff;
+    s->hdr_len = 0;
+
+    if (s->in_block != (s->type == H2_CONTINUATION) || (s->in_block && s->stream != s->block_stream))
+    {
+        broken(s, is_client, s->in_block ? "expected CONTINUATION" : "CONTINUATION without HEADERS", cb, ud);
+        return -1;
+    }
+
+    int padded = 0;
+    s->prefix_want = 0;
+    if (s->type == H2_DATA || s->type == H2_HEADERS || s->type == H2_PUSH_PROMISE)
+    {
+        if (s->stream == 0)
+        {
+            broken(s, is_client, "stream frame on stream 0", cb, ud);
+            return -1;
+        }
+        padded = (s->flags & H2_FLAG_PADDED) != 0;
+        s->prefix_want = (size_t)padded
+                         + (s->type == H2_HEADERS && (s->flags & H2_FLAG_PRIORITY) ? 5 : 0)
+                         + (s->type == H2_PUSH_PROMISE ? 4 : 0);
+    }
+    if (s->prefix_want > s->length)
+    {
+        broken(s, is_client, "frame shorter than its padding/priority", cb, ud);
+        return -1;
+    }
+    s->prefix_len = 0;
+    s->left       = s->length - (uint32_t)s->prefix_want;
+    s->pad        = 0;
+    return 0;
+}
+
+/*
+ * Префикс (если был) собран: паддинг, начало блока заголовков
+ */
+static int payload_begin(h2_dir_t *s, int is_client, const h2_flow_cb_t *cb, void *ud)
+{
+    size_t at = 0;
+    if (s->prefix_want > 0 && (s->flags & H2_FLAG_PADDED))
+    {
+        s->pad = s->prefix[at++];
+        if (s->pad > s->left)
+        {
+            broken(s, is_client, "padding longer than the frame", cb, ud);
+            return -1;
+        }
+        s->left -= s->pad;
+    }
+    s->body     = s->left;
+    s->ctrl_len = 0;
+    if (s->type == H2_HEADERS || s->type == H2_PUSH_PROMISE)
+    {
+        s->in_block       = 1;
+        s->block_type     = s->type;
+        s->block_stream   = s->stream;
+        s->block_promised = s->type == H2_PUSH_PROMISE ? be32(s->prefix + at) & 0x7fffffff : 0;
+        s->block_end      = s->type == H2_HEADERS && (s->flags & H2_FLAG_END_STREAM);
+        s->block_len      = 0;
+        s->block_wire     = 0;
+    }
+    s->state = H2_PAYLOAD;
+    return 0;
+}
+
+/*
+ * Фрейм кончился (вместе с паддингом)
+ */
+static void frame_end(h2_flow_t *h2, int d, const h2_flow_cb_t *cb, void *ud)
+{
+    h2_dir_t *s = &h2->dir[d];
+    s->state = H2_HEADER;
+    s->frames++;
+
+    switch (s->type)
+    {
+        case H2_DATA:
+        {
+            h2_stream_t *st = stream_get(h2, s->stream, 1);
+            if (st != NULL)
+            {
+                st->data[d] += s->body;
+            }
+            if (s->flags & H2_FLAG_END_STREAM)
+            {
+                stream_end(h2, d, s->stream, cb, ud);
+            }
+            break;
+        }
+        case H2_HEADERS:
+        case H2_PUSH_PROMISE:
+        case H2_CONTINUATION:
+        {
+            if (s->flags & H2_FLAG_END_HEADERS)
+            {
+                block_done(h2, d, cb, ud);
+            }
+            break;
+        }
+        case H2_RST_STREAM:
+        {
+            h2_stream_t *st = stream_get(h2, s->stream, 0);
+            if (st != NULL)
+            {
+                st->id = 0;
+            }
+            cb->on_control(ud, d, s->type, s->flags, s->stream, s->ctrl, s->ctrl_len, s->body);
+            break;
+        }
+        case H2_SETTINGS:
+        case H2_GOAWAY:
+        {
+            cb->on_control(ud, d, s->type, s->flags, s->stream, s->ctrl, s->ctrl_len, s->body);
+            break;
+        }
+        default:
+        {
+            // PRIORITY, PING, WINDOW_UPDATE и неизвестные типы — только считаем
+            break;
+        }
+    }
+}
+
+void h2_flow_feed(h2_flow_t *h2, const uint8_t *data, size_t len, int is_client,
+                  const h2_flow_cb_t *cb, void *ud)
+{
+    int       d = is_client ? 1 : 0;
+    h2_dir_t *s = &h2->dir[d];
+
+    while (len > 0)
+    {
+        switch (s->state)
+        {
+            case H2_BROKEN:
+            {
+                return;
+            }
+            case H2_PREFACE:
+            {
+                size_t n = sizeof(preface) - 1 - s->preface;
+                n = len < n ? len : n;
+                if (memcmp(data, preface + s->preface, n) != 0)
+                {
+                    broken(s, is_client, "bad connection preface", cb, ud);
+                    return;
+                }
+                s->preface += n;
+                data       += n;
+                len        -= n;
+                if (s->preface == sizeof(preface) - 1)
+                {
+                    s->state = H2_HEADER;
+                }
+                break;
+            }
+            case H2_HEADER:
+            {
+                size_t n = sizeof(s->hdr) - s->hdr_len;
+                n = len < n ? len : n;
+                memcpy(s->hdr + s->hdr_len, data, n);
+                s->hdr_len += n;
+                data       += n;
+                len        -= n;
+                if (s->hdr_len < sizeof(s->hdr))
+                {
+                    return;
+                }
+                if (frame_begin(s, is_client, cb, ud) < 0)
+                {
+                    return;
+                }
+                s->state = H2_PREFIX;
+                if (s->prefix_want == 0)
+                {
+                    if (payload_begin(s, is_client, cb, ud) < 0)
+                    {
+                        return;
+                    }
+                    if (s->left == 0)
+                    {
+                        frame_end(h2, d, cb, ud);
+                    }
+                }
+                break;
+            }
+            case H2_PREFIX:
+            {
+                size_t n = s->prefix_want - s->prefix_len;
+                n = len < n ? len : n;
+                memcpy(s->prefix + s->prefix_len, data, n);
+                s->prefix_len += n;
+                data          += n;
+                len           -= n;
+                if (s->prefix_len < s->prefix_want)
+                {
+                    return;
+                }
+                if (payload_begin(s, is_client, cb, ud) < 0)
+                {
+                    return;
+                }
+                if (s->left == 0)
+                {
+                    s->state = s->pad > 0 ? H2_PADDING : H2_HEADER;
+                    if (s->pad == 0)
+                    {
+                        frame_end(h2, d, cb, ud);
+                    }
+                }
+                break;
+            }
+            case H2_PAYLOAD:
+            {
+                size_t n = len < s->left ? len : s->left;
+                if (s->type == H2_HEADERS || s->type == H2_PUSH_PROMISE || s->type == H2_CONTINUATION)
+                {
+                    s->block_wire += n;
+                    if (!s->hpack_off)
+                    {
+                        if (s->block_len + n > sizeof(s->block))
+                        {
+                            // Не соберём — таблица энкодера уйдёт от нашей
+                            s->hpack_off = 1;
+                            cb->on_error(ud, is_client, "header block too long, HPACK off");
+                        }
+                        else
+                        {
+                            memcpy(s->block + s->block_len, data, n);
+                            s->block_len += n;
+                        }
+                    }
+                }
+                else if (s->type == H2_SETTINGS || s->type == H2_RST_STREAM || s->type == H2_GOAWAY)
+                {
+                    size_t c = sizeof(s->ctrl) - s->ctrl_len;
+                    c = n < c ? n : c;
+                    memcpy(s->ctrl + s->ctrl_len, data, c);
+                    s->ctrl_len += c;
+                }
+                // DATA и прочее — только отсчитываем
+                s->left -= (uint32_t)n;
+                data    += n;
+                len     -= n;
+                if (s->left == 0)
+                {
+                    s->state = s->pad > 0 ? H2_PADDING : H2_HEADER;
+                    if (s->pad == 0)
+                    {
+                        frame_end(h2, d, cb, ud);
+                    }
+                }
+                break;
+            }
+            case H2_PADDING:
+            {
+                size_t n = len < s->pad ? len : s->pad;
+                s->pad -= (uint32_t)n;
+                data   += n;
+                len    -= n;
+                if (s->pad == 0)
+                {
+                    frame_end(h2, d, cb, ud);
+                }
+                break;
+            }
+        }
+    }
+}
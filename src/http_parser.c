@@ -0,0 +1,448 @@
+#include <string.h>
+#include <strings.h>
+
+#include "http_parser.h"
+#include "scan.h"
+
+
+size_t http_body_feed(http_body_t *b, const char *p, size_t len)
+{
+    size_t i = 0;
+    while (i < len && b->state != HTTP_BODY_DONE)
+    {
+        switch (b->state)
+        {
+            case HTTP_BODY_CLOSE:
+            {
+                return len;
+            }
+            case HTTP_BODY_LENGTH:
+            case HTTP_BODY_CHUNK_DATA:
+            {
+                size_t n = len - i < b->left ? len - i : (size_t)b->left;
+                i       += n;
+                b->left -= n;
+                if (b->left == 0)
+                {
+                    b->state = b->state == HTTP_BODY_LENGTH ? HTTP_BODY_DONE : HTTP_BODY_CHUNK_CRLF;
+                }
+                break;
+            }
+            case HTTP_BODY_CHUNK_SIZE:
+            {
+                char c = p[i++];
+                int  d = c >= '0' && c <= '9' ? c - '0'
+                       : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                       : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                if (d >= 0)
+                {
+                    if (b->left >> 56)
+                    {
+                        // Чанк в эксабайты — границ больше не знаем, дальше только до закрытия
+                        b->state = HTTP_BODY_CLOSE;
+                        return len;
+                    }
+                    b->left = b->left * 16 + d;
+                }
+                else if (c == '\n')
+                {
+                    b->state      = b->left == 0 ? HTTP_BODY_TRAILER : HTTP_BODY_CHUNK_DATA;
+                    b->line_start = 1;
+                }
+                else
+                {
+                    b->state = HTTP_BODY_CHUNK_EXT;
+                }
+                break;
+            }
+            case HTTP_BODY_CHUNK_EXT:
+            {
+                if (p[i++] == '\n')
+                {
+                    b->state      = b->left == 0 ? HTTP_BODY_TRAILER : HTTP_BODY_CHUNK_DATA;
+                    b->line_start = 1;
+                }
+                break;
+            }
+            case HTTP_BODY_CHUNK_CRLF:
+            {
+                if (p[i++] == '\n')
+                {
+                    b->state = HTTP_BODY_CHUNK_SIZE;
+                    b->left  = 0;
+                }
+                break;
+            }
+            case HTTP_BODY_TRAILER:
+            {
+                char c = p[i++];
+                if (c == '\n')
+                {
+                    if (b->line_start)
+                    {
+                        b->state = HTTP_BODY_DONE;
+                    }
+                    b->line_start = 1;
+                }
+                else if (c != '\r')
+                {
+                    b->line_start = 0;
+                }
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+/*
+ * Есть ли токен tok в списке через запятую (регистр не важен)
+ */
+static int header_has_token(const char *v, size_t vlen, const char *tok)
+{
+    size_t tlen = strlen(tok);
+    for (size_t i = 0; i + tlen <= vlen; ++i)
+    {
+        if (strncasecmp(v + i, tok, tlen) == 0
+            && (i == 0 || v[i - 1] == ',' || v[i - 1] == ' ')
+            && (i + tlen == vlen || v[i + tlen] == ',' || v[i + tlen] == ' '))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int header_is(const char *name, size_t nlen, const char *want)
+{
+    return nlen == strlen(want) && strncasecmp(name, want, nlen) == 0;
+}
+
+size_t http_header_parse(http_headers_t *h, const char *line, size_t len,
+                         const char **value, size_t *vlen)
+{
+    const char *colon = memchr(line, ':', len);
+    if (colon == NULL || colon == line)
+    {
+        return 0;
+    }
+    size_t      nlen = colon - line;
+    const char *v    = colon + 1;
+    size_t      n    = len - nlen - 1;
+    while (n > 0 && (*v == ' ' || *v == '\t'))
+    {
+        ++v;
+        --n;
+    }
+    while (n > 0 && (v[n - 1] == ' ' || v[n - 1] == '\t'))
+    {
+        --n;
+    }
+    *value = v;
+    *vlen  = n;
+
+    if (header_is(line, nlen, "Content-Length"))
+    {
+        uint64_t length = 0;
+        for (size_t i = 0; i < n && v[i] >= '0' && v[i] <= '9' && length >> 56 == 0; ++i)
+        {
+            length = length * 10 + (uint64_t)(v[i] - '0');
+        }
+        h->has_length = 1;
+        h->length     = length;
+    }
+    else if (header_is(line, nlen, "Transfer-Encoding"))
+    {
+        h->chunked = header_has_token(v, n, "chunked");
+    }
+    else if (header_is(line, nlen, "Connection") || header_is(line, nlen, "Proxy-Connection"))
+    {
+        h->conn_close     |= header_has_token(v, n, "close");
+        h->conn_keepalive |= header_has_token(v, n, "keep-alive");
+        h->conn_upgrade   |= header_has_token(v, n, "upgrade");
+    }
+    else if (header_is(line, nlen, "Upgrade"))
+    {
+        h->upgrade_ws  = header_has_token(v, n, "websocket");
+        h->upgrade_h2c = header_has_token(v, n, "h2c");
+    }
+    else if (header_is(line, nlen, "Host"))
+    {
+        h->has_host = 1;
+    }
+    return nlen;
+}
+
+void http_flow_init(http_flow_t *flow)
+{
+    // spill'ы не трогаем: их содержимое значимо только до spill_len
+    for (int d = 0; d < 2; ++d)
+    {
+        http_stream_t *s = &flow->dir[d];
+        s->state     = HTTP_STREAM_START;
+        memset(&s->body, 0, sizeof(s->body));
+        s->body_len  = 0;
+        s->messages  = 0;
+        s->spill_len = 0;
+        s->scanned   = 0;
+        s->raw_next  = 0;
+    }
+    flow->pending_head = 0;
+    flow->pending_conn = 0;
+    flow->pending      = 0;
+    flow->upgraded     = 0;
+    flow->websocket    = 0;
+    flow->h2c          = 0;
+}
+
+/*
+ * Сообщение направления кончилось
+ */
+static void message_done(http_flow_t *flow, http_stream_t *s, int is_client,
+                         const http_flow_cb_t *cb, void *ud)
+{
+    cb->on_message(ud, is_client, s->body_len);
+    s->messages++;
+    s->body_len = 0;
+    s->state    = flow->upgraded || s->raw_next ? HTTP_STREAM_RAW : HTTP_STREAM_START;
+}
+
+/*
+ * Заголовок сообщения целиком: отдаём наружу и выставляем фреймер тела
+ */
+static void head_done(http_flow_t *flow, http_stream_t *s, int is_client,
+                      const char *head, size_t len, const http_flow_cb_t *cb, void *ud)
+{
+    cb->on_head(ud, is_client, head, len);
+
+    const char    *eol = memchr(head, '\n', len);
+    http_headers_t h;
+    memset(&h, 0, sizeof(h));
+    for (const char *line = eol + 1; line < head + len - 2; )
+    {
+        const char *next = memchr(line, '\n', head + len - line);
+        size_t      n    = next - line;
+        const char *v;
+        size_t      vlen;
+        http_header_parse(&h, line, n > 0 && line[n - 1] == '\r' ? n - 1 : n, &v, &vlen);
+        line = next + 1;
+    }
+
+    memset(&s->body, 0, sizeof(s->body));
+    s->body.state = HTTP_BODY_DONE;
+
+    if (is_client)
+    {
+        int is_head    = len > 5 && memcmp(head, "HEAD ", 5) == 0;
+        int is_connect = len > 8 && memcmp(head, "CONNECT ", 8) == 0;
+        if (flow->pending < 64)
+        {
+            flow->pending_head |= (uint64_t)is_head << flow->pending;
+            flow->pending_conn |= (uint64_t)is_connect << flow->pending;
+            flow->pending++;
+        }
+        // После CONNECT клиент шлёт уже не HTTP (обычно TLS), не дожидаясь ответа
+        s->raw_next = is_connect;
+        if (h.chunked)
+        {
+            s->body.state = HTTP_BODY_CHUNK_SIZE;
+        }
+        else if (h.has_length && h.length > 0)
+        {
+            s->body.state = HTTP_BODY_LENGTH;
+            s->body.left  = h.length;
+        }
+    }
+    else
+    {
+        int status = (head[9] - '0') * 100 + (head[10] - '0') * 10 + (head[11] - '0');
+        if (status >= 100 && status < 200)
+        {
+            // 101 — дальше другой протокол; остальные 1xx — промежуточные, ответ ещё будет
+            if (status == 101)
+            {
+                flow->upgraded  = 1;
+                flow->websocket = h.upgrade_ws;
+                flow->h2c       = h.upgrade_h2c;
+                message_done(flow, s, is_client, cb, ud);
+            }
+            else
+            {
+                s->state = HTTP_STREAM_START;
+            }
+            return;
+        }
+
+        int is_head    = 0;
+        int is_connect = 0;
+        if (flow->pending > 0)
+        {
+            is_head    = flow->pending_head & 1;
+            is_connect = flow->pending_conn & 1;
+            flow->pending_head >>= 1;
+            flow->pending_conn >>= 1;
+            flow->pending--;
+        }
+        if (is_connect && status < 300)
+        {
+            flow->upgraded = 1;
+        }
+        else if (is_head || status == 204 || status == 304)
+        {
+            // Тела нет, даже если заявлен Content-Length
+        }
+        else if (h.chunked)
+        {
+            s->body.state = HTTP_BODY_CHUNK_SIZE;
+        }
+        else if (h.has_length)
+        {
+            s->body.state = h.length > 0 ? HTTP_BODY_LENGTH : HTTP_BODY_DONE;
+            s->body.left  = h.length;
+        }
+        else
+        {
+            s->body.state = HTTP_BODY_CLOSE;
+        }
+    }
+
+    if (s->body.state == HTTP_BODY_DONE)
+    {
+        message_done(flow, s, is_client, cb, ud);
+    }
+    else
+    {
+        s->state = HTTP_STREAM_BODY;
+    }
+}
+
+size_t http_flow_feed(http_flow_t *flow, const uint8_t *data, size_t len, int is_client,
+                    const http_flow_cb_t *cb, void *ud)
+{
+    http_stream_t *s = &flow->dir[is_client ? 1 : 0];
+    const char    *p = (const char *)data;
+    size_t         total = len;
+
+    if (flow->upgraded && s->state == HTTP_STREAM_START)
+    {
+        s->state = HTTP_STREAM_RAW;
+    }
+
+    while (len > 0)
+    {
+        switch (s->state)
+        {
+            case HTTP_STREAM_RAW:
+            {
+                return total - len;
+            }
+            case HTTP_STREAM_START:
+            {
+                // Стартовая строка могла прийти по кусочку — тогда её начало в spill
+                scan_http_t kind;
+                if (s->spill_len > 0)
+                {
+                    size_t n = len < sizeof(s->spill) - s->spill_len ? len : sizeof(s->spill) - s->spill_len;
+                    memcpy(s->spill + s->spill_len, p, n);
+                    kind = scan_http_start((const uint8_t *)s->spill, s->spill_len + n);
+                    if (kind == SCAN_HTTP_MORE)
+                    {
+                        s->spill_len += n;
+                        return total;
+                    }
+                }
+                else
+                {
+                    kind = scan_http_start(data, len);
+                    if (kind == SCAN_HTTP_MORE)
+                    {
+                        memcpy(s->spill, p, len);
+                        s->spill_len = len;
+                        return total;
+                    }
+                }
+                if (kind == SCAN_HTTP_NO || (kind == SCAN_HTTP_REQUEST) != (is_client != 0))
+                {
+                    // Не HTTP (или рассинхронизировались) — дальше не разбираем
+                    s->state     = HTTP_STREAM_RAW;
+                    s->spill_len = 0;
+                    return total - len;
+                }
+                // Склейку в spill делает HEAD — там же, где и для заголовка на стыке
+                s->state   = HTTP_STREAM_HEAD;
+                s->scanned = 0;
+                break;
+            }
+            case HTTP_STREAM_HEAD:
+            {
+                if (s->spill_len == 0)
+                {
+                    // Частый случай: заголовок целиком в этом чтении — разбираем на месте
+                    size_t end = scan_head_end(data, len, 0);
+                    if (end > 0)
+                    {
+                        head_done(flow, s, is_client, p, end, cb, ud);
+                        p    += end;
+                        data += end;
+                        len  -= end;
+                        break;
+                    }
+                    if (len > sizeof(s->spill))
+                    {
+                        s->state = HTTP_STREAM_RAW;
+                        return total;
+                    }
+                    memcpy(s->spill, p, len);
+                    s->spill_len = len;
+                    s->scanned   = len;
+                    return total;
+                }
+
+                size_t old = s->spill_len;
+                size_t n   = len < sizeof(s->spill) - old ? len : sizeof(s->spill) - old;
+                memcpy(s->spill + old, p, n);
+                size_t end = scan_head_end((const uint8_t *)s->spill, old + n, s->scanned);
+                if (end > 0)
+                {
+                    size_t used  = end - old;
+                    s->spill_len = 0;
+                    s->scanned   = 0;
+                    head_done(flow, s, is_client, s->spill, end, cb, ud);
+                    p    += used;
+                    data += used;
+                    len  -= used;
+                    break;
+                }
+                if (old + n == sizeof(s->spill))
+                {
+                    // Заголовок длиннее HTTP_FLOW_HEAD_MAX — границ не знаем, бросаем разбор
+                    s->state     = HTTP_STREAM_RAW;
+                    s->spill_len = 0;
+                    return total;
+                }
+                s->spill_len = old + n;
+                s->scanned   = old + n;
+                return total;
+            }
+            case HTTP_STREAM_BODY:
+            {
+                // Тело не смотрим: длина или строки чанков, O(1) на кусок данных
+                size_t n = http_body_feed(&s->body, p, len);
+                s->body_len += n;
+                p    += n;
+                data += n;
+                len  -= n;
+                if (s->body.state == HTTP_BODY_DONE)
+                {
+                    message_done(flow, s, is_client, cb, ud);
+                }
+                break;
+            }
+        }
+    }
+    return total;
+}
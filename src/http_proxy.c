@@ -0,0 +1,804 @@
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "http_proxy.h"
+#include "buffer.h"
+#include "logger.h"
+#include "server.h"
+#include "sock.h"
+#include "mux.h"
+#include "scan.h"
+#include "http_parser.h"
+
+
+#define HTTP_MAX_HEAD      16384  // Больше — 431 клиенту / обрыв origin'у
+#define HTTP_KEY_LEN       280
+#define HTTP_POOL_MAX      64     // Простаивающих keep-alive соединений на весь процесс
+#define HTTP_POOL_IDLE_MS  30000  // Сколько соединение может простоять в пуле
+#define HTTP_POOL_TICK_MS  1000
+
+
+/*
+ * Что фронт делает с туннелем
+ */
+typedef enum http_mode
+{
+    HTTP_MODE_HEAD,     // Ещё не разобрали первый запрос
+    HTTP_MODE_TUNNEL,   // CONNECT: дальше сырой туннель
+    HTTP_MODE_FORWARD   // Обычные запросы: разбираем сообщения сами
+} http_mode_t;
+
+struct http_front
+{
+    http_mode_t  mode;
+    size_t       head_left;      // Сколько байт переписанного заголовка запроса ещё отдать
+    http_body_t  req;            // Тело текущего запроса
+    http_body_t  resp;           // Тело текущего ответа
+    int          resp_head;      // Заголовок ответа уже разобран
+    size_t       req_scanned;    // Сколько байт заголовка запроса уже просмотрели без "\r\n\r\n"
+    size_t       resp_scanned;   // То же для заголовка ответа
+    int          is_head;        // Текущий запрос — HEAD (у ответа нет тела)
+    int          keepalive;      // Клиент готов к следующему запросу
+    int          remote_reuse;   // Origin готов к следующему запросу
+    unsigned     requests;       // Сколько запросов обслужили по этому клиентскому соединению
+};
+
+/*
+ * Простаивающее keep-alive соединение с origin'ом
+ */
+typedef struct http_idle
+{
+    sock_t              *sock;
+    char                 key[HTTP_KEY_LEN];
+    unsigned long long   deadline;
+    struct http_idle    *next;
+} http_idle_t;
+
+
+static http_idle_t *pool       = NULL;
+static int          pool_count = 0;
+static int          pool_timer = 0;
+
+
+static void http_idle_read_handle(int fd, void *ud);
+
+static void http_idle_write_handle(int fd, void *ud);
+
+
+bool http_sniff(uint8_t first)
+{
+    return first >= 'A' && first <= 'Z';
+}
+
+http_front_t *http_front_create(void)
+{
+    http_front_t *http = malloc(sizeof(*http));
+    if (http == NULL)
+    {
+        return NULL;
+    }
+    memset(http, 0, sizeof(*http));
+    return http;
+}
+
+void http_front_release(http_front_t *http)
+{
+    free(http);
+}
+
+bool http_framed(const http_front_t *http)
+{
+    return http->mode == HTTP_MODE_FORWARD;
+}
+
+/*
+ * Заголовки, которые нужны фронту из сообщения
+ */
+typedef struct proxy_headers
+{
+    http_headers_t  h;
+    char            auth[256];   // Proxy-Authorization как есть
+} proxy_headers_t;
+
+static int header_is(const char *name, size_t nlen, const char *want)
+{
+    return nlen == strlen(want) && strncasecmp(name, want, nlen) == 0;
+}
+
+/*
+ * Разбирает строку заголовка в ph. Возвращает 1, если её надо выкинуть при пересылке
+ * (hop-by-hop заголовки прокси)
+ */
+static int header_parse(proxy_headers_t *ph, const char *line, size_t len)
+{
+    const char *v;
+    size_t      vlen;
+    size_t      nlen = http_header_parse(&ph->h, line, len, &v, &vlen);
+    if (header_is(line, nlen, "Proxy-Connection"))
+    {
+        return 1;
+    }
+    if (header_is(line, nlen, "Proxy-Authorization"))
+    {
+        snprintf(ph->auth, sizeof(ph->auth), "%.*s", (int)vlen, v);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Проверяет "Basic base64(user:pass)" против SERVER.username/passwd
+ */
+static int auth_check(const char *auth)
+{
+    if (SERVER.username[0] == '\0' || SERVER.passwd[0] == '\0')
+    {
+        return 1;
+    }
+    if (strncasecmp(auth, "Basic ", 6) != 0)
+    {
+        return 0;
+    }
+
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char     plain[256];
+    size_t   n    = 0;
+    uint32_t acc  = 0;
+    int      bits = 0;
+    for (const char *p = auth + 6; *p != '\0' && *p != '='; ++p)
+    {
+        const char *pos = strchr(alphabet, *p);
+        if (pos == NULL || n + 1 >= sizeof(plain))
+        {
+            return 0;
+        }
+        acc   = (acc << 6) | (uint32_t)(pos - alphabet);
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            plain[n++] = (char)(acc >> bits);
+        }
+    }
+    plain[n] = '\0';
+
+    char expected[sizeof(SERVER.username) + sizeof(SERVER.passwd) + 1];
+    snprintf(expected, sizeof(expected), "%s:%s", SERVER.username, SERVER.passwd);
+    return strcmp(plain, expected) == 0;
+}
+
+/*
+ * Кладёт назначение в rp туннеля — так же, как его заполнил бы SOCKS5-запрос
+ */
+static int dest_set(request_protocol_t *rp, const char *host, size_t hlen, unsigned port)
+{
+    char name[256];
+    if (hlen == 0 || hlen >= sizeof(name) || port == 0 || port > 65535)
+    {
+        return -1;
+    }
+    memcpy(name, host, hlen);
+    name[hlen] = '\0';
+
+    memset(rp, 0, sizeof(*rp));
+    rp->ver  = 0x05;
+    rp->cmd  = 0x01;
+    rp->port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, name, rp->addr) == 1)
+    {
+        rp->atyp = 0x01;
+    }
+    else if (inet_pton(AF_INET6, name, rp->addr) == 1)
+    {
+        rp->atyp = 0x04;
+    }
+    else
+    {
+        rp->atyp      = 0x03;
+        rp->domainlen = (uint8_t)hlen;
+        memcpy(rp->addr, name, hlen + 1);
+    }
+    return 0;
+}
+
+/*
+ * "host[:port]" / "[v6][:port]" → назначение туннеля
+ */
+static int authority_parse(request_protocol_t *rp, const char *a, size_t len, unsigned defport)
+{
+    const char *host = a;
+    size_t      hlen = len;
+    unsigned    port = defport;
+
+    const char *colon = NULL;
+    if (len > 0 && a[0] == '[')
+    {
+        const char *close = memchr(a, ']', len);
+        if (close == NULL)
+        {
+            return -1;
+        }
+        host = a + 1;
+        hlen = close - a - 1;
+        if (close + 1 < a + len)
+        {
+            if (close[1] != ':')
+            {
+                return -1;
+            }
+            colon = close + 1;
+        }
+    }
+    else
+    {
+        colon = memchr(a, ':', len);
+        if (colon != NULL)
+        {
+            hlen = colon - a;
+        }
+    }
+    if (colon != NULL)
+    {
+        char digits[8];
+        size_t dlen = a + len - colon - 1;
+        if (dlen == 0 || dlen >= sizeof(digits))
+        {
+            return -1;
+        }
+        memcpy(digits, colon + 1, dlen);
+        digits[dlen] = '\0';
+        port = (unsigned)strtoul(digits, NULL, 10);
+    }
+    return dest_set(rp, host, hlen, port);
+}
+
+/*
+ * Ответ-ошибка клиенту и закрытие после отправки
+ */
+static int http_fail(tunnel_t *tunnel, const char *status, const char *extra)
+{
+    char reply[256];
+    int n = snprintf(reply, sizeof(reply), "HTTP/1.1 %s\r\n%sConnection: close\r\nContent-Length: 0\r\n\r\n",
+                     status, extra);
+    LOG_WARN("HTTP proxy: %s to client fd=%d", status, tunnel->client_sock->fd);
+    if (tunnel_write_client(tunnel, reply, n) < 0)
+    {
+        return -1;
+    }
+    buffer_clear(tunnel->client_sock->read_buffer);
+    // Дописываем ответ и закрываемся (см. tunnel_write_handle для полузакрытого сокета)
+    sock_shutdown(tunnel->client_sock);
+    return 0;
+}
+
+/*
+ * Дописывает в head[size] с позиции *hn. -1 — не влезло (*hn не меняется)
+ */
+static int head_printf(char *head, size_t size, size_t *hn, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(head + *hn, size - *hn, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= size - *hn)
+    {
+        return -1;
+    }
+    *hn += (size_t)n;
+    return 0;
+}
+
+int http_request_handle(tunnel_t *tunnel)
+{
+    http_front_t *http = tunnel->http;
+    buffer_t     *buff = tunnel->client_sock->read_buffer;
+    const char   *p    = buff->data + buff->read_index;
+    size_t        len  = buffer_readable(buff);
+
+    size_t end = scan_head_end((const uint8_t *)p, len, http->req_scanned);
+    if (end == 0)
+    {
+        http->req_scanned = len;
+        return len > HTTP_MAX_HEAD ? http_fail(tunnel, "431 Request Header Fields Too Large", "") : 0;
+    }
+    http->req_scanned = 0;
+    // Конец заголовка мог найтись и за пределом — переписывать такой некуда
+    if (end > HTTP_MAX_HEAD)
+    {
+        return http_fail(tunnel, "431 Request Header Fields Too Large", "");
+    }
+
+    // Request-line: METHOD SP target SP HTTP/1.x
+    const char *eol = memchr(p, '\n', end);
+    size_t      llen = eol - p;
+    if (llen > 0 && p[llen - 1] == '\r')
+    {
+        --llen;
+    }
+    const char *sp1 = memchr(p, ' ', llen);
+    const char *sp2 = sp1 ? memchr(sp1 + 1, ' ', p + llen - sp1 - 1) : NULL;
+    if (sp2 == NULL || p + llen - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0)
+    {
+        return http_fail(tunnel, "400 Bad Request", "");
+    }
+    const char *method  = p;
+    size_t      mlen    = sp1 - p;
+    const char *target  = sp1 + 1;
+    size_t      tlen    = sp2 - target;
+    const char *version = sp2 + 1;
+    int         http10  = version[7] == '0';
+
+    proxy_headers_t ph;
+    memset(&ph, 0, sizeof(ph));
+    for (const char *line = eol + 1; line < p + end - 2; )
+    {
+        const char *next = memchr(line, '\n', p + end - line);
+        size_t n = next - line;
+        header_parse(&ph, line, n > 0 && line[n - 1] == '\r' ? n - 1 : n);
+        line = next + 1;
+    }
+
+    if (!auth_check(ph.auth))
+    {
+        tunnel_close_reason(tunnel, close_auth);
+        return http_fail(tunnel, "407 Proxy Authentication Required",
+                         "Proxy-Authenticate: Basic realm=\"proxy\"\r\n");
+    }
+    if (SERVER.username[0] != '\0' && tunnel->ap.ulen == 0)
+    {
+        // Как после SOCKS5 USER/PASS: имя пользователя туннеля (для политики инспекции)
+        tunnel->ap.ulen = (uint8_t)strlen(SERVER.username);
+        memcpy(tunnel->ap.uname, SERVER.username, tunnel->ap.ulen);
+    }
+
+    ++http->requests;
+    if (mlen == 7 && memcmp(method, "CONNECT", 7) == 0)
+    {
+        if (http->requests > 1 || authority_parse(&tunnel->rp, target, tlen, 0) < 0)
+        {
+            return http_fail(tunnel, "400 Bad Request", "");
+        }
+        LOG_INFO("HTTP CONNECT %.*s from fd=%d", (int)tlen, target, tunnel->client_sock->fd);
+        http->mode = HTTP_MODE_TUNNEL;
+        buffer_skip(buff, end);
+    }
+    else
+    {
+        // Прокси получает absolute-form: http://authority[/path]
+        if (tlen < 7 || strncasecmp(target, "http://", 7) != 0)
+        {
+            return http_fail(tunnel, "400 Bad Request", "");
+        }
+        const char *auth  = target + 7;
+        const char *slash = memchr(auth, '/', target + tlen - auth);
+        size_t      alen  = (slash ? slash : target + tlen) - auth;
+        if (authority_parse(&tunnel->rp, auth, alen, 80) < 0)
+        {
+            return http_fail(tunnel, "400 Bad Request", "");
+        }
+
+        // Через мультиплексор ответ едет мимо нас — границ сообщений не видим,
+        // поэтому соединение с origin'ом одноразовое
+        int oneshot = mux_edge_enabled();
+
+        // Переписываем заголовок на месте: origin-form, без Proxy-* и с Host
+        char   head[HTTP_MAX_HEAD + 512];
+        size_t hn = 0;
+        if (head_printf(head, sizeof(head), &hn, "%.*s %.*s %.8s\r\n", (int)mlen, method,
+                        slash ? (int)(target + tlen - slash) : 1, slash ? slash : "/", version) < 0)
+        {
+            return http_fail(tunnel, "431 Request Header Fields Too Large", "");
+        }
+        for (const char *line = eol + 1; line < p + end - 2; )
+        {
+            const char *next = memchr(line, '\n', p + end - line);
+            size_t n = next - line + 1;
+            proxy_headers_t skip;
+            memset(&skip, 0, sizeof(skip));
+            size_t content = n >= 2 && line[n - 2] == '\r' ? n - 2 : n - 1;
+            int drop = header_parse(&skip, line, content)
+                    || (oneshot && (skip.h.conn_close || skip.h.conn_keepalive));
+            if (!drop && hn + n < sizeof(head))
+            {
+                memcpy(head + hn, line, n);
+                hn += n;
+            }
+            line = next + 1;
+        }
+        if ((!ph.h.has_host && head_printf(head, sizeof(head), &hn, "Host: %.*s\r\n", (int)alen, auth) < 0)
+            || (oneshot && head_printf(head, sizeof(head), &hn, "Connection: close\r\n") < 0)
+            || head_printf(head, sizeof(head), &hn, "\r\n") < 0)
+        {
+            return http_fail(tunnel, "431 Request Header Fields Too Large", "");
+        }
+
+        LOG_INFO("HTTP %.*s %.*s from fd=%d", (int)mlen, method, (int)tlen, target, tunnel->client_sock->fd);
+
+        // Хвост (тело и, может быть, следующие запросы) переезжает за новый заголовок
+        size_t rest = len - end;
+        char  *tail = NULL;
+        if (rest > 0)
+        {
+            tail = malloc(rest);
+            if (tail == NULL)
+            {
+                return -1;
+            }
+            memcpy(tail, p + end, rest);
+        }
+        buffer_clear(buff);
+        int rc = buffer_write(buff, head, hn);
+        if (rc == 0 && rest > 0)
+        {
+            rc = buffer_write(buff, tail, rest);
+        }
+        free(tail);
+        if (rc < 0)
+        {
+            return -1;
+        }
+
+        http->mode       = HTTP_MODE_FORWARD;
+        http->head_left  = hn;
+        http->is_head    = mlen == 4 && memcmp(method, "HEAD", 4) == 0;
+        http->keepalive  = !ph.h.conn_close && (!http10 || ph.h.conn_keepalive);
+        http->resp_head  = 0;
+        http->remote_reuse = 0;
+        memset(&http->req, 0, sizeof(http->req));
+        if (ph.h.chunked)
+        {
+            http->req.state = HTTP_BODY_CHUNK_SIZE;
+        }
+        else if (ph.h.has_length && ph.h.length > 0)
+        {
+            http->req.state = HTTP_BODY_LENGTH;
+            http->req.left  = ph.h.length;
+        }
+    }
+
+    if (tunnel_connect_to_remote(tunnel) < 0)
+    {
+        return http_fail(tunnel, "502 Bad Gateway", "");
+    }
+    return 0;
+}
+
+int http_connected(tunnel_t *tunnel)
+{
+    if (tunnel->http->mode != HTTP_MODE_TUNNEL)
+    {
+        return 0;
+    }
+    static const char reply[] = "HTTP/1.1 200 Connection established\r\n\r\n";
+    LOG_INFO("Sent HTTP CONNECT success to client fd=%d", tunnel->client_sock->fd);
+    return tunnel_write_client(tunnel, (void *)reply, sizeof(reply) - 1);
+}
+
+/*
+ * Разбирает заголовок ответа: выставляет фреймер тела и keep-alive origin'а.
+ * Возвращает 1 для промежуточного ответа (1xx — за ним будет ещё заголовок),
+ * 2 для 101 Switching Protocols (дальше уже не HTTP)
+ */
+static int response_head(http_front_t *http, const char *p, size_t end)
+{
+    const char *eol = memchr(p, '\n', end);
+    int http10 = end > 8 && p[7] == '0';
+    int status = end > 12 ? atoi(p + 9) : 0;
+
+    proxy_headers_t ph;
+    memset(&ph, 0, sizeof(ph));
+    for (const char *line = eol + 1; line < p + end - 2; )
+    {
+        const char *next = memchr(line, '\n', p + end - line);
+        size_t n = next - line;
+        header_parse(&ph, line, n > 0 && line[n - 1] == '\r' ? n - 1 : n);
+        line = next + 1;
+    }
+
+    if (status == 101)
+    {
+        return 2;
+    }
+    if (status >= 100 && status < 200)
+    {
+        return 1;
+    }
+
+    http->remote_reuse = !ph.h.conn_close && (!http10 || ph.h.conn_keepalive);
+    memset(&http->resp, 0, sizeof(http->resp));
+    if (http->is_head || status == 204 || status == 304)
+    {
+        http->resp.state = HTTP_BODY_DONE;
+    }
+    else if (ph.h.chunked)
+    {
+        http->resp.state = HTTP_BODY_CHUNK_SIZE;
+    }
+    else if (ph.h.has_length)
+    {
+        http->resp.state = ph.h.length > 0 ? HTTP_BODY_LENGTH : HTTP_BODY_DONE;
+        http->resp.left  = ph.h.length;
+    }
+    else
+    {
+        // Тело до закрытия — соединение с origin'ом не переиспользовать
+        http->resp.state   = HTTP_BODY_CLOSE;
+        http->remote_reuse = 0;
+    }
+    return 0;
+}
+
+/*
+ * Ответ на текущий запрос доехал: origin — в пул или закрыть, клиент — ждать
+ * следующий запрос или закрыть
+ */
+static int response_complete(tunnel_t *tunnel)
+{
+    http_front_t *http   = tunnel->http;
+    sock_t       *remote = tunnel->remote_sock;
+
+    // Origin уже прислал EOF — sock_shutdown сам его закроет, а клиента закроет вызывающий
+    if (remote->state != sock_connected)
+    {
+        return 0;
+    }
+
+    int reuse = http->remote_reuse && http->req.state == HTTP_BODY_DONE
+             && buffer_readable(remote->read_buffer) == 0
+             && buffer_readable(remote->write_buffer) == 0;
+
+    tunnel->remote_sock = NULL;
+    tunnel->state       = request_state;
+    if (reuse)
+    {
+        if (pool_count >= HTTP_POOL_MAX)
+        {
+            // Выкидываем самое старое (хвост списка)
+            http_idle_t **it = &pool;
+            while ((*it)->next != NULL)
+            {
+                it = &(*it)->next;
+            }
+            sock_release((*it)->sock);
+            free(*it);
+            *it = NULL;
+            --pool_count;
+        }
+
+        http_idle_t *idle = malloc(sizeof(*idle));
+        if (idle != NULL)
+        {
+            snprintf(idle->key, sizeof(idle->key), "%s:%s", tunnel->dst_host, tunnel->dst_port);
+            idle->sock     = remote;
+            idle->deadline = server_now_ms() + HTTP_POOL_IDLE_MS;
+            idle->next     = pool;
+            pool           = idle;
+            ++pool_count;
+
+            remote->tunnel       = NULL;
+            remote->context      = idle;
+            remote->read_handle  = http_idle_read_handle;
+            remote->write_handle = http_idle_write_handle;
+            epoll_modify(remote, 0, 1);
+            LOG_INFO("Parked keep-alive fd=%d to %s", remote->fd, idle->key);
+        }
+        else
+        {
+            remote->tunnel = NULL;
+            sock_release(remote);
+        }
+    }
+    else
+    {
+        // Сначала отвязываем, чтобы закрытие origin'а не потянуло за собой туннель
+        remote->tunnel = NULL;
+        sock_release(remote);
+    }
+
+    if (!http->keepalive)
+    {
+        sock_shutdown(tunnel->client_sock);
+        return 0;
+    }
+
+    // Следующий запрос уже мог прийти, пока ехал ответ
+    if (buffer_readable(tunnel->client_sock->read_buffer) > 0)
+    {
+        return http_request_handle(tunnel);
+    }
+    return 0;
+}
+
+int http_forward(tunnel_t *tunnel, int is_client)
+{
+    http_front_t *http   = tunnel->http;
+    sock_t       *client = tunnel->client_sock;
+    sock_t       *remote = tunnel->remote_sock;
+
+    if (client == NULL || remote == NULL)
+    {
+        // Второй стороны уже нет — данные никому не нужны (или ждут следующего запроса)
+        return 0;
+    }
+
+    if (is_client)
+    {
+        // Переписанный заголовок и тело текущего запроса; следующий запрос ждёт ответа
+        buffer_t *buff = client->read_buffer;
+        size_t    n    = 0;
+        size_t    len  = buffer_readable(buff);
+        if (http->head_left > 0)
+        {
+            n = len < http->head_left ? len : http->head_left;
+            http->head_left -= n;
+        }
+        if (http->head_left == 0 && n < len)
+        {
+            n += http_body_feed(&http->req, buff->data + buff->read_index + n, len - n);
+        }
+        if (n > 0)
+        {
+            if (buffer_write(remote->write_buffer, buff->data + buff->read_index, n) < 0)
+            {
+                return -1;
+            }
+            buffer_skip(buff, n);
+            epoll_modify(remote, 1, 1);
+        }
+        return 0;
+    }
+
+    buffer_t *buff = remote->read_buffer;
+    while (buffer_readable(buff) > 0)
+    {
+        const char *p   = buff->data + buff->read_index;
+        size_t      len = buffer_readable(buff);
+        size_t      n;
+        int         head = -1;
+
+        if (!http->resp_head)
+        {
+            size_t end = scan_head_end((const uint8_t *)p, len, http->resp_scanned);
+            if (end == 0)
+            {
+                http->resp_scanned = len;
+                if (len > HTTP_MAX_HEAD || memcmp(p, "HTTP/1.", len < 7 ? len : 7) != 0)
+                {
+                    return -1;
+                }
+                break;
+            }
+            if (end < 12 || memcmp(p, "HTTP/1.", 7) != 0)
+            {
+                return -1;
+            }
+            head               = response_head(http, p, end);
+            http->resp_head    = head == 0;
+            http->resp_scanned = 0;
+            n = end;
+        }
+        else
+        {
+            n = http_body_feed(&http->resp, p, len);
+        }
+
+        if (buffer_write(client->write_buffer, (void *)p, n) < 0)
+        {
+            return -1;
+        }
+        buffer_skip(buff, n);
+        epoll_modify(client, 1, 1);
+
+        if (head == 2)
+        {
+            // Upgrade (WebSocket и т.п.): как после CONNECT — сырой туннель в обе стороны,
+            // включая то, что уже лежит в буферах за заголовком
+            LOG_INFO("HTTP 101 Switching Protocols on fd=%d, raw tunnel from now on", client->fd);
+            http->mode = HTTP_MODE_TUNNEL;
+            if (tunnel_forward(tunnel, 0) < 0)
+            {
+                return -1;
+            }
+            return buffer_readable(client->read_buffer) > 0 ? tunnel_forward(tunnel, 1) : 0;
+        }
+
+        if (http->resp_head && http->resp.state == HTTP_BODY_DONE)
+        {
+            // Лишнее после конца ответа origin прислать не мог — не переиспользуем
+            if (buffer_readable(buff) > 0)
+            {
+                http->remote_reuse = 0;
+                buffer_clear(buff);
+            }
+            return response_complete(tunnel);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Выкидывает соединение из пула и закрывает его
+ */
+static void pool_drop(http_idle_t *idle)
+{
+    for (http_idle_t **it = &pool; *it != NULL; it = &(*it)->next)
+    {
+        if (*it == idle)
+        {
+            *it = idle->next;
+            break;
+        }
+    }
+    --pool_count;
+    sock_release(idle->sock);
+    free(idle);
+}
+
+/*
+ * EPOLLIN в простое: origin закрыл соединение (или прислал мусор) — выкидываем
+ */
+static void http_idle_read_handle(int fd, void *ud)
+{
+    sock_t *sock = (sock_t *)ud;
+    int n = buffer_readfd(sock->read_buffer, fd);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    pool_drop((http_idle_t *)sock->context);
+}
+
+static void http_idle_write_handle(int fd, void *ud)
+{
+    (void)fd;
+    epoll_modify((sock_t *)ud, 0, 1);
+}
+
+static void http_pool_tick(void *ud)
+{
+    (void)ud;
+    unsigned long long now = server_now_ms();
+    http_idle_t *idle = pool;
+    while (idle != NULL)
+    {
+        http_idle_t *next = idle->next;
+        if (now >= idle->deadline)
+        {
+            pool_drop(idle);
+        }
+        idle = next;
+    }
+}
+
+sock_t *http_pool_take(tunnel_t *tunnel)
+{
+    // Таймер чистки заводим при первом обращении — без HTTP-клиентов пул не нужен
+    if (!pool_timer)
+    {
+        pool_timer = 1;
+        server_timer_add(HTTP_POOL_TICK_MS, http_pool_tick, NULL);
+    }
+
+    char key[HTTP_KEY_LEN];
+    snprintf(key, sizeof(key), "%s:%s", tunnel->dst_host, tunnel->dst_port);
+    for (http_idle_t **it = &pool; *it != NULL; it = &(*it)->next)
+    {
+        http_idle_t *idle = *it;
+        if (strcmp(idle->key, key) == 0)
+        {
+            sock_t *sock = idle->sock;
+            *it = idle->next;
+            --pool_count;
+            free(idle);
+            LOG_INFO("Reusing keep-alive fd=%d to %s", sock->fd, key);
+            return sock;
+        }
+    }
+    return NULL;
+}
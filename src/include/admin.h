@@ -0,0 +1,32 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+/*
+ * Админ-сокет (-S): unix domain, для systemd, контейнеров и скриптов, где stdin
+ * терминала никто не читает. Команды — по одной на строку, текстом или JSON:
+ *
+ *   stats                    {"cmd":"stats"}
+ *   tunnels                  {"cmd":"tunnels"}
+ *   kill 12                  {"cmd":"kill","id":12}
+ *   freeze user=alice        {"cmd":"freeze","selector":"user=alice"}
+ *   unfreeze [selector]      {"cmd":"unfreeze"}
+ *   level [spec]             {"cmd":"level","spec":"warning,tunnel=debug"}
+ *   auth <user> <pass>|off   {"cmd":"auth","user":"bob","pass":"secret"}
+ *
+ * Текстовый ответ — строки "ключ значение" или по строке на туннель, последняя —
+ * "ok" или "error <что не так>". На JSON-запрос — один JSON-объект в строку,
+ * с "ok": true/false. freeze без селектора здесь замораживает всё, а не переключает.
+ *
+ * Клиентов обслуживает отдельный поток с пониженным приоритетом. Данных event
+ * loop'а он не трогает: статистика — лок-фри слепки stats.h, заморозка — очередь
+ * freeze.h, kill и auth — своя очередь с eventfd в epoll, которую разбирает сам
+ * event loop. Медленный или зависший клиент держит только свой буфер ответа.
+ */
+
+/*
+ * Слушает path (файл прав 0600, старый сокет на том же пути удаляется) и запускает
+ * поток. Вызывать после server_init. 0 — ок, <0 — ошибка
+ */
+int admin_init(const char *path);
+
+#endif // ADMIN_H
@@ -1,21 +1,45 @@
 #ifndef BUFF_H
 #define BUFF_H
 
+#include <stddef.h>
+
+/*
+ * Блок памяти буфера со счётчиком ссылок. На блок, кроме самого буфера,
+ * могут ссылаться снимки (buffer_view_t) — например, у потока анализа трафика.
+ * Пока снимки живы, буфер не сдвигает и не перезаписывает байты в блоке,
+ * а при нужде переезжает в новый блок (copy-on-write).
+ */
+typedef struct buffer_block buffer_block_t;
+
 /*
  * Структура буфера:
  * - data        : указатель на область памяти для хранения данных
  * - write_index : индекс, куда будет записываться следующий байт
  * - read_index  : индекс, откуда будет читаться следующий байт
  * - cap         : текущая ёмкость выделенного массива data
+ * - block       : блок, внутри которого лежит data
  */
 typedef struct buffer
 {
-    char   *data;        // Указатель на старт данных буфера
-    size_t  write_index; // Сколько байт записано (конец данных)
-    size_t  read_index;  // Сколько байт прочитано (начало данных)
-    size_t  cap;         // Общий размер буфера
+    char           *data;        // Указатель на старт данных буфера
+    size_t          write_index; // Сколько байт записано (конец данных)
+    size_t          read_index;  // Сколько байт прочитано (начало данных)
+    size_t          cap;         // Общий размер буфера
+    buffer_block_t *block;       // Владелец памяти data (data == block->data)
 } buffer_t;
 
+/*
+ * Снимок куска буфера без копирования: держит ссылку на блок,
+ * байты data[0..len) не изменятся, пока снимок не отпущен.
+ * Отпускать можно из любого потока
+ */
+typedef struct buffer_view
+{
+    buffer_block_t *block;
+    const char     *data;
+    size_t          len;
+} buffer_view_t;
+
 /*
  * Создаёт буфер с заданным размером. Вернёт NULL, если память не выделится.
  */
@@ -69,4 +93,14 @@ size_t buffer_readable(buffer_t *buffer);
  */
 void buffer_clear(buffer_t *buffer);
 
+/*
+ * Снимок len байт, начиная с offset от начала непрочитанного (read_index)
+ */
+void buffer_view(buffer_t *buffer, size_t offset, size_t len, buffer_view_t *view);
+
+/*
+ * Отпускает снимок; блок освобождается, когда на него больше никто не ссылается
+ */
+void buffer_view_release(buffer_view_t *view);
+
 #endif // BUFF_H
@@ -0,0 +1,67 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+#include "tunnel.h"
+
+/*
+ * Запись выбранных туннелей в pcapng (-W) — для разбора проблем клиентов
+ * в Wireshark.
+ *
+ * Туннель выбирается на первых данных (пользователь, хост назначения, порт,
+ * номер туннеля). Каждый прочитанный кусок обеих сторон event loop отдаёт
+ * снимком буфера (buffer_view_t, без копирования) в SPSC-кольцо потока записи
+ * и сразу форвардит дальше. Поток записи синтезирует из кусков TCP-поток между
+ * настоящими адресами клиента и назначения: SYN/SYN-ACK/ACK перед первыми
+ * данными, сегменты с честными seq/ack, FIN в обе стороны при закрытии.
+ *
+ * Пишет он прямо в отображённый в память сегмент файла, заранее выделенный
+ * на весь размер (size=); сегмент кончился — файл обрезается по записанному,
+ * открывается следующий (base-000001.pcapng, base-000002.pcapng...), старше
+ * files= последних удаляются.
+ *
+ * Запись никогда не тормозит форвардинг: кольцо полно — кусок выбрасывается
+ * и считается, а в захвате на его месте дыра в seq (Wireshark покажет
+ * "previous segment not captured").
+ */
+
+/*
+ * Счётчики захвата
+ */
+typedef struct capture_stats
+{
+    unsigned long long tunnels;   // Туннелей, попавших в захват
+    unsigned long long packets;   // Записано пакетов (с синтезированными SYN/FIN)
+    unsigned long long bytes;     // Записано байт полезной нагрузки
+    unsigned long long dropped;   // Кусков выброшено: поток записи не успевал
+    unsigned long long files;     // Открыто файлов
+} capture_stats_t;
+
+/*
+ * Включает захват. spec — строка -W: "file=PATH,size=N[K|M|G],files=K,
+ * user=U,host=H,port=P,tunnel=ID"; file обязателен, селекторы можно повторять
+ * (туннель пишется, если подошёл хоть один; без селекторов — все туннели),
+ * host=.example.com — домен вместе с поддоменами.
+ * NULL или "" — захват выключен. Вызывать до server_start. 0 — ок, <0 — ошибка
+ */
+int capture_init(const char *spec);
+
+/*
+ * Отдаёт в захват последние fresh байт read_buffer'а стороны is_client.
+ * Ничего не копирует и не блокирует. Туннель не выбран (или захват выключен) —
+ * выставляет tunnel->capture_off, дальше вызывать не надо
+ */
+void capture_publish(tunnel_t *tunnel, int is_client, size_t fresh);
+
+/*
+ * Туннель закрывается: в захват уходят FIN, состояние отпускается
+ */
+void capture_flow_release(capture_flow_t *flow);
+
+/*
+ * Снимок счётчиков
+ */
+void capture_get_stats(capture_stats_t *stats);
+
+#endif // CAPTURE_H
@@ -0,0 +1,64 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+/*
+ * Потоковое сжатие данных стрима между двумя инстансами (DATA-фреймы мультиплексора).
+ *
+ * На каждый стрим — свой deflate-поток (zlib, быстрый уровень, Z_SYNC_FLUSH на каждый
+ * фрейм: получатель распаковывает фрейм сразу, без ожидания следующих).
+ * Несжимаемое (TLS, архивы, видео) отсекается адаптивно: первые CODEC_SAMPLE байт
+ * сжимаются на пробу, и если выигрыш меньше ~10%, стрим дальше идёт как есть,
+ * с повторной пробой через растущий (x2) интервал.
+ */
+
+#define CODEC_MAX_INPUT 15872  // Сколько байт жать в один фрейм (сжатое влезает в MUX_MAX_FRAME)
+
+typedef struct codec codec_t;
+
+/*
+ * Суммарные счётчики по всем стримам процесса
+ */
+typedef struct codec_stats
+{
+    unsigned long long raw_in;      // Сколько отдали в deflate
+    unsigned long long packed_out;  // Сколько получилось на выходе
+    unsigned long long skipped;     // Сколько ушло как есть (несжимаемое)
+} codec_stats_t;
+
+/*
+ * Создаёт пустой кодек стрима (zlib-состояния заводятся лениво, при первом использовании).
+ * Возвращает NULL при нехватке памяти
+ */
+codec_t *codec_create(void);
+
+/*
+ * Освобождает кодек и его zlib-состояния
+ */
+void codec_release(codec_t *codec);
+
+/*
+ * Пробует сжать len (<= CODEC_MAX_INPUT) байт src в out (ёмкостью outcap).
+ * Возвращает:
+ *   >0 — размер сжатого фрейма в out (отправлять с флагом сжатия)
+ *    0 — слать как есть (сейчас не жмём: поток несжимаемый)
+ *   <0 — ошибка zlib
+ */
+int codec_encode(codec_t *codec, const uint8_t *src, size_t len, uint8_t *out, size_t outcap);
+
+/*
+ * Распаковывает сжатый фрейм и дописывает результат в dst.
+ * Возвращает число распакованных байт или <0 при битых данных
+ */
+int codec_decode(codec_t *codec, const uint8_t *src, size_t len, buffer_t *dst);
+
+/*
+ * Снимок суммарных счётчиков
+ */
+void codec_get_stats(codec_stats_t *stats);
+
+#endif // CODEC_H
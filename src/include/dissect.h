@@ -0,0 +1,114 @@
+#ifndef DISSECT_H
+#define DISSECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Реестр диссекторов протоколов для инспекции туннеля.
+ *
+ * Каждый протокол регистрирует дешёвую сигнатуру: с каких байтов может начинаться
+ * направление (из этого при регистрации строится таблица решений: первый байт →
+ * маска кандидатов) и проверку первых байтов с подсказкой по порту назначения.
+ * Туннель классифицируется один раз, по первым байтам того направления, что
+ * заговорило первым, и дальше навсегда остаётся со своим диссектором — или без
+ * него. На кусок классифицированного туннеля — один вызов feed, сколько бы
+ * протоколов ни было зарегистрировано.
+ *
+ * Всё, кроме регистрации, вызывается только с потока анализа туннеля.
+ */
+
+#define DISSECT_MAX    32   // Сколько диссекторов можно зарегистрировать (бит маски)
+#define DISSECT_PEEK   64   // Сколько первых байтов направления копим, пока сигнатуре мало
+#define DISSECT_PORTS  4    // Портов-подсказок у диссектора
+
+typedef enum dissect_match
+{
+    DISSECT_NO,     // Не этот протокол
+    DISSECT_MORE,   // Пока похоже, но байт мало для решения
+    DISSECT_YES     // Этот протокол
+} dissect_match_t;
+
+typedef struct dissector
+{
+    const char       *name;
+    uint16_t          ports[DISSECT_PORTS];  // Обычные порты протокола (0 — нет)
+    // Может ли направление is_client начинаться с байта b (строит таблицу решений)
+    bool            (*first)(uint8_t b, int is_client);
+    // Сигнатура по первым байтам направления. port_hint — порт назначения из ports.
+    // Получив DISSECT_PEEK байт, должна решить: YES или NO
+    dissect_match_t (*match)(const uint8_t *p, size_t len, int is_client, bool port_hint);
+    // Состояние разбора туннеля (NULL — нет памяти). Сам create == NULL — состояние не нужно
+    void           *(*create)(void);
+    // Очередной кусок направления. false — дальше разбирать нечего (например, пошёл TLS)
+    bool            (*feed)(void *ctx, const uint8_t *p, size_t len, int is_client);
+    // Сколько сообщений разобрано — для бюджета messages политики (NULL — не считает)
+    unsigned        (*messages)(const void *ctx);
+    void            (*destroy)(void *ctx);
+} dissector_t;
+
+/*
+ * Что делать с куском
+ */
+typedef enum dissect_result
+{
+    DISSECT_OK,     // Разобран (или ждёт классификации)
+    DISSECT_RAW,    // Протокол не опознан — показать кусок как есть (первый кусок направления)
+    DISSECT_DONE    // Дальше в туннеле смотреть нечего
+} dissect_result_t;
+
+typedef enum dissect_state
+{
+    DISSECT_CLASSIFY,   // Смотрим первые байты
+    DISSECT_BOUND,      // Диссектор выбран
+    DISSECT_NONE,       // Ничего не подошло
+    DISSECT_FINISHED    // Диссектор закончил или не смог завести состояние
+} dissect_state_t;
+
+/*
+ * Классификация и разбор одного туннеля
+ */
+typedef struct dissect_flow
+{
+    dissect_state_t     state;
+    const dissector_t  *dissector;
+    void               *ctx;
+    uint32_t            hinted;                    // Диссекторы, чей порт совпал с портом назначения
+    int                 shown[2];                  // NONE: первый кусок направления уже показан
+    size_t              peek_len[2];
+    uint8_t             peek[2][DISSECT_PEEK];     // Начало направления, если сигнатуре его было мало
+} dissect_flow_t;
+
+/*
+ * Регистрирует диссектор (d должен жить до конца программы).
+ * Вызывать до старта потоков анализа. Возвращает 0 или -1, если реестр полон
+ */
+int dissect_register(const dissector_t *d);
+
+/*
+ * Имя диссектора туннеля, "-" — не классифицирован или ничего не подошло
+ */
+const char *dissect_name(const dissect_flow_t *flow);
+
+/*
+ * Сброс перед первым байтом туннеля; port — порт назначения (для подсказок)
+ */
+void dissect_flow_init(dissect_flow_t *flow, uint16_t port);
+
+/*
+ * Кормит туннель очередным куском направления is_client
+ */
+dissect_result_t dissect_feed(dissect_flow_t *flow, const uint8_t *data, size_t len, int is_client);
+
+/*
+ * Сколько сообщений разобрал диссектор туннеля
+ */
+unsigned dissect_messages(const dissect_flow_t *flow);
+
+/*
+ * Освобождает состояние диссектора
+ */
+void dissect_flow_free(dissect_flow_t *flow);
+
+#endif // DISSECT_H
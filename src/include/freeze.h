@@ -0,0 +1,57 @@
+#ifndef FREEZE_H
+#define FREEZE_H
+
+#include <stdbool.h>
+
+#include "tunnel.h"
+
+/*
+ * Заморозка форвардинга (команда терминала freeze) — всего прокси или только
+ * части туннелей: tunnel=ID, user=U, host=H (.example.com — с поддоменами), port=P.
+ *
+ * Замороженный туннель не читает вовсе: на первом же событии чтения его сокет
+ * снимается с EPOLLIN (sock_pause), данные копятся в ядре, и TCP-окно само
+ * притормаживает отправителя — память прокси не растёт, сколько ни стой.
+ * Уже прочитанное дописывается. Разморозка снова включает EPOLLIN.
+ *
+ * Правила живут в event loop'е и меняются только им: другие потоки кладут
+ * команду в очередь и будят цикл через eventfd, так что горячий путь чтения
+ * проверяет их без локов.
+ */
+
+/*
+ * Что сделать с селектором
+ */
+typedef enum freeze_op
+{
+    FREEZE_ON,      // Заморозить
+    FREEZE_OFF,     // Разморозить (без селектора — всё)
+    FREEZE_TOGGLE   // Без селектора: весь прокси — переключить
+} freeze_op_t;
+
+/*
+ * Заводит eventfd очереди команд в epoll. Вызывать после server_init.
+ * 0 — ок, <0 — ошибка
+ */
+int freeze_init(void);
+
+/*
+ * Команда из любого потока: selector — "user=alice", "host=.example.com",
+ * "port=443", "tunnel=12" или NULL/"" (весь прокси). Применит её event loop
+ * и сам напишет в консоль, что теперь заморожено.
+ * 0 — принята, <0 — кривой селектор или очередь полна
+ */
+int freeze_request(freeze_op_t op, const char *selector);
+
+/*
+ * Event loop, перед чтением из сокета установленного туннеля: true — туннель
+ * заморожен, сокет поставлен на паузу, читать не надо
+ */
+bool freeze_check(tunnel_t *tunnel, sock_t *sock);
+
+/*
+ * Сокет закрывается — вычеркнуть его из списка замороженных
+ */
+void freeze_forget(sock_t *sock);
+
+#endif // FREEZE_H
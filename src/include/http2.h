@@ -0,0 +1,189 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dissect.h"
+
+/*
+ * Потоковый декодер HTTP/2 (RFC 9113) без TLS для инспекции туннеля: h2c.
+ *
+ * Включается, когда туннель начался с преамбулы клиента "PRI * HTTP/2.0..."
+ * (prior knowledge, см. h2_signature) или HTTP-парсер увидел 101 на Upgrade: h2c.
+ * Заголовок фрейма может прийти по байту — копится в hdr. Payload DATA
+ * не копируется и не просматривается — только отсчитывается по длине в счётчик
+ * потока. Блоки заголовков (HEADERS/PUSH_PROMISE + CONTINUATION) собираются
+ * в block и декодируются HPACK (RFC 7541): статическая таблица, Huffman,
+ * динамическая таблица — кольцо байтов фиксированного размера.
+ * Размер таблицы больше H2_TABLE_MAX не поддерживаем: на этом направлении заголовки
+ * дальше не декодируются, фреймы и размеры по-прежнему считаются.
+ * По ходу разбора ничего не выделяется.
+ */
+
+#define H2_TABLE_MAX     16384  // Предел динамической таблицы HPACK (в единицах RFC: имя + значение + 32)
+#define H2_TABLE_ENTRIES (H2_TABLE_MAX / 32)
+#define H2_BLOCK_MAX     16384  // Блок заголовков, который собираем (длиннее — HPACK направления теряем)
+#define H2_TEXT_MAX      4096   // Сколько декодированных заголовков блока показываем в логе
+#define H2_CONTROL_MAX   64     // Сколько начала SETTINGS/RST_STREAM/GOAWAY собираем
+#define H2_STREAMS_MAX   64     // Сколько одновременных потоков считаем
+#define H2_DATA_UNKNOWN  UINT64_MAX  // Поток не поместился в streams — размер неизвестен
+
+#define H2_DATA          0x0
+#define H2_HEADERS       0x1
+#define H2_PRIORITY      0x2
+#define H2_RST_STREAM    0x3
+#define H2_SETTINGS      0x4
+#define H2_PUSH_PROMISE  0x5
+#define H2_PING          0x6
+#define H2_GOAWAY        0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION  0x9
+
+#define H2_FLAG_END_STREAM  0x01
+#define H2_FLAG_ACK         0x01
+#define H2_FLAG_END_HEADERS 0x04
+#define H2_FLAG_PADDED      0x08
+#define H2_FLAG_PRIORITY    0x20
+
+typedef enum h2_state
+{
+    H2_PREFACE,   // Клиент: ждём "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+    H2_HEADER,    // Копим заголовок фрейма (9 байт)
+    H2_PREFIX,    // Pad Length, приоритет, promised stream id — перед полезной частью
+    H2_PAYLOAD,   // Идёт payload фрейма
+    H2_PADDING,   // Паддинг в конце фрейма
+    H2_BROKEN     // Нарушение протокола — дальше не разбираем
+} h2_state_t;
+
+/*
+ * Запись динамической таблицы: имя и значение подряд в кольце bytes
+ */
+typedef struct h2_entry
+{
+    uint32_t  off;
+    uint32_t  nlen;
+    uint32_t  vlen;
+} h2_entry_t;
+
+/*
+ * Динамическая таблица HPACK. Записи вытесняются с самой старой, а живые байты
+ * всегда меньше H2_TABLE_MAX, поэтому новая запись пишется в кольцо следом
+ * за предыдущей и никого не затирает
+ */
+typedef struct h2_table
+{
+    size_t      size;    // Текущий размер по RFC
+    size_t      max;     // Текущий предел (меняется size update'ом энкодера)
+    size_t      first;   // Самая старая запись в ent
+    size_t      count;
+    size_t      head;    // Куда писать следующую запись в bytes
+    h2_entry_t  ent[H2_TABLE_ENTRIES];
+    uint8_t     bytes[H2_TABLE_MAX];
+} h2_table_t;
+
+/*
+ * Одно направление соединения
+ */
+typedef struct h2_dir
+{
+    h2_state_t  state;
+    size_t      preface;       // Сколько байт преамбулы уже совпало
+    uint8_t     hdr[9];
+    size_t      hdr_len;
+    uint8_t     type;          // Текущего фрейма
+    uint8_t     flags;
+    uint32_t    stream;
+    uint32_t    length;        // Payload фрейма целиком
+    uint32_t    body;          // Полезная часть: без префикса и паддинга
+    uint32_t    left;          // Сколько полезной части осталось
+    uint32_t    pad;           // Сколько паддинга осталось
+    uint8_t     prefix[6];
+    size_t      prefix_len;
+    size_t      prefix_want;
+
+    int         in_block;      // Ждём CONTINUATION
+    uint8_t     block_type;    // HEADERS или PUSH_PROMISE
+    uint32_t    block_stream;
+    uint32_t    block_promised;
+    int         block_end;     // END_STREAM у HEADERS
+    size_t      block_len;
+    size_t      block_wire;    // Сколько байт блока прошло (может быть больше block)
+    int         hpack_off;     // Таблица рассинхронизирована — заголовки больше не декодируем
+
+    uint8_t     ctrl[H2_CONTROL_MAX];
+    size_t      ctrl_len;
+    unsigned    frames;
+    unsigned    messages;      // Сколько потоков это направление закончило (END_STREAM)
+
+    h2_table_t  table;
+    uint8_t     block[H2_BLOCK_MAX];
+} h2_dir_t;
+
+/*
+ * Поток HTTP/2 в обе стороны
+ */
+typedef struct h2_stream
+{
+    uint32_t  id;              // 0 — слот свободен
+    uint64_t  data[2];         // Байт DATA: [0] remote → client, [1] client → remote
+    int       ended[2];
+} h2_stream_t;
+
+/*
+ * Оба направления: [0] remote → client, [1] client → remote
+ */
+typedef struct h2_flow
+{
+    h2_dir_t     dir[2];
+    h2_stream_t  streams[H2_STREAMS_MAX];
+    char         text[H2_TEXT_MAX];     // Заголовки блока для лога: "name: value\n"
+    uint8_t      field[H2_TABLE_MAX];   // Имя и значение текущего поля (для вставки в таблицу)
+} h2_flow_t;
+
+/*
+ * Декодированный блок заголовков
+ */
+typedef struct h2_headers
+{
+    uint8_t      type;          // H2_HEADERS или H2_PUSH_PROMISE
+    uint32_t     stream;
+    uint32_t     promised;      // PUSH_PROMISE: обещанный поток
+    int          end_stream;
+    size_t       wire_len;      // Размер блока HPACK
+    int          decoded;       // 0 — HPACK направления потерян, text пуст
+    unsigned     count;         // Сколько полей
+    const char  *text;          // "name: value\n" по полю, обрезано до H2_TEXT_MAX
+    size_t       text_len;
+    int          truncated;
+} h2_headers_t;
+
+typedef struct h2_flow_cb
+{
+    void (*on_headers)(void *ud, int is_client, const h2_headers_t *h);
+    // Направление закончило поток (END_STREAM): data_len байт DATA
+    void (*on_stream_end)(void *ud, int is_client, uint32_t stream, uint64_t data_len);
+    // SETTINGS, RST_STREAM, GOAWAY: начало payload'а (не больше H2_CONTROL_MAX)
+    void (*on_control)(void *ud, int is_client, uint8_t type, uint8_t flags, uint32_t stream,
+                       const uint8_t *payload, size_t len, size_t full_len);
+    void (*on_error)(void *ud, int is_client, const char *what);
+} h2_flow_cb_t;
+
+/*
+ * Сброс состояния обоих направлений: клиент начнёт с преамбулы
+ */
+void h2_flow_init(h2_flow_t *h2);
+
+/*
+ * Сигнатура HTTP/2 с prior knowledge: преамбула клиента или SETTINGS,
+ * которым сервер начинает, не дожидаясь клиента
+ */
+dissect_match_t h2_signature(const uint8_t *p, size_t len, int is_client);
+
+/*
+ * Кормит направление is_client очередной порцией фреймов
+ */
+void h2_flow_feed(h2_flow_t *h2, const uint8_t *data, size_t len, int is_client,
+                  const h2_flow_cb_t *cb, void *ud);
+
+#endif // HTTP2_H
@@ -0,0 +1,135 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Потоковый разбор HTTP/1.x.
+ *
+ * Общие куски (фреймер тела, разбор заголовков) использует и HTTP-фронт прокси,
+ * и инспекция трафика. Для инспекции — возобновляемый парсер на направление туннеля:
+ * кормим его тем, что пришло из сокета, он сам помнит, где остановился (заголовок
+ * на стыке чтений, середина тела, строка размера чанка), и наружу отдаёт только
+ * блоки заголовков и границы сообщений. Тело пропускается по длине, без просмотра
+ * байтов. Память — только внутри http_flow_t, по ходу разбора ничего не выделяется.
+ */
+
+#define HTTP_FLOW_HEAD_MAX 4096  // Сколько заголовка на стыке чтений копим (длиннее — бросаем разбор)
+
+/*
+ * Где фреймер тела сообщения
+ */
+typedef enum http_body_state
+{
+    HTTP_BODY_DONE,        // Сообщение кончилось
+    HTTP_BODY_LENGTH,      // Content-Length: осталось left байт
+    HTTP_BODY_CHUNK_SIZE,  // Строка размера чанка (hex)
+    HTTP_BODY_CHUNK_EXT,   // Расширения чанка до конца строки
+    HTTP_BODY_CHUNK_DATA,  // Данные чанка: осталось left байт
+    HTTP_BODY_CHUNK_CRLF,  // CRLF после данных чанка
+    HTTP_BODY_TRAILER,     // Трейлеры после нулевого чанка до пустой строки
+    HTTP_BODY_CLOSE        // Тело до закрытия соединения
+} http_body_state_t;
+
+typedef struct http_body
+{
+    http_body_state_t  state;
+    uint64_t           left;
+    int                line_start;  // TRAILER: в начале строки
+} http_body_t;
+
+/*
+ * Заголовки, от которых зависят границы сообщений и судьба соединения
+ */
+typedef struct http_headers
+{
+    int       has_length;
+    uint64_t  length;
+    int       chunked;
+    int       conn_close;
+    int       conn_keepalive;
+    int       conn_upgrade;   // Connection: upgrade
+    int       upgrade_ws;     // Upgrade: websocket
+    int       upgrade_h2c;    // Upgrade: h2c
+    int       has_host;
+} http_headers_t;
+
+/*
+ * Состояние разбора одного направления
+ */
+typedef enum http_stream_state
+{
+    HTTP_STREAM_START,  // Ждём стартовую строку
+    HTTP_STREAM_HEAD,   // Копим заголовок до "\r\n\r\n"
+    HTTP_STREAM_BODY,   // Пропускаем тело
+    HTTP_STREAM_RAW     // Не HTTP или после Upgrade/CONNECT — дальше не разбираем
+} http_stream_state_t;
+
+typedef struct http_stream
+{
+    http_stream_state_t  state;
+    http_body_t          body;
+    uint64_t             body_len;    // Сколько тела у текущего сообщения прошло
+    unsigned             messages;    // Сколько сообщений разобрали
+    size_t               spill_len;   // Сколько начала заголовка лежит в spill
+    size_t               scanned;     // Сколько из spill уже просмотрели без "\r\n\r\n"
+    int                  raw_next;    // После текущего сообщения — RAW (был запрос CONNECT)
+    char                 spill[HTTP_FLOW_HEAD_MAX];
+} http_stream_t;
+
+/*
+ * Разбор обоих направлений туннеля. Ответу нужно знать, на какой запрос он
+ * (у ответа на HEAD нет тела, 2xx на CONNECT — дальше туннель), поэтому методы
+ * запросов, ждущих ответа, копятся здесь очередью битов
+ */
+typedef struct http_flow
+{
+    http_stream_t  dir[2];        // [0] remote → client (ответы), [1] client → remote (запросы)
+    uint64_t       pending_head;  // Бит i — i-й ждущий ответа запрос был HEAD
+    uint64_t       pending_conn;  // То же для CONNECT
+    unsigned       pending;       // Сколько запросов ждут ответа (не больше 64)
+    int            upgraded;      // Был 101 или CONNECT: оба направления — RAW
+    int            websocket;     // Был 101 на Upgrade: websocket — дальше фреймы WebSocket
+    int            h2c;           // Был 101 на Upgrade: h2c — дальше фреймы HTTP/2
+} http_flow_t;
+
+/*
+ * Что парсер отдаёт наружу
+ */
+typedef struct http_flow_cb
+{
+    // Целый блок заголовков сообщения (стартовая строка + заголовки + пустая строка)
+    void (*on_head)(void *ud, int is_client, const char *head, size_t len);
+    // Сообщение кончилось: body_len байт тела
+    void (*on_message)(void *ud, int is_client, uint64_t body_len);
+} http_flow_cb_t;
+
+/*
+ * Сколько байт из p принадлежит телу текущего сообщения; двигает фреймер
+ */
+size_t http_body_feed(http_body_t *b, const char *p, size_t len);
+
+/*
+ * Разбирает строку заголовка (без CRLF) в h, если она про границы/соединение.
+ * Возвращает длину имени (до ':'), 0 — если это не заголовок. Значение — в value и vlen
+ */
+size_t http_header_parse(http_headers_t *h, const char *line, size_t len,
+                         const char **value, size_t *vlen);
+
+/*
+ * Сброс состояния перед первым байтом туннеля
+ */
+void http_flow_init(http_flow_t *flow);
+
+/*
+ * Кормит направление is_client очередной порцией данных.
+ * Возвращает, сколько байт с начала — HTTP (всё интересное уже отдано через cb).
+ * Остаток (весь кусок, если это не HTTP, или хвост после Upgrade/CONNECT) надо
+ * смотреть кем-то ещё
+ */
+size_t http_flow_feed(http_flow_t *flow, const uint8_t *data, size_t len, int is_client,
+                    const http_flow_cb_t *cb, void *ud);
+
+#endif // HTTP_PARSER_H
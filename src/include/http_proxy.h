@@ -0,0 +1,74 @@
+#ifndef HTTP_PROXY_H
+#define HTTP_PROXY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tunnel.h"
+
+/*
+ * HTTP-прокси на том же порту, что и SOCKS5.
+ *
+ * tunnel_open_handle смотрит на первый байт: 0x05 — SOCKS5, заглавная ASCII-буква —
+ * метод HTTP. Дальше туннель ведёт HTTP-фронт:
+ *   CONNECT host:port  — после коннекта отвечаем "200 Connection established",
+ *                        и дальше это обычный сырой туннель;
+ *   GET http://host/.. — запрос переписывается в origin-form и уходит origin'у,
+ *                        ответ разбирается по границам сообщения (Content-Length,
+ *                        chunked, до закрытия), и по keep-alive соединение с origin'ом
+ *                        после ответа паркуется в пул — следующий запрос к тому же
+ *                        host:port (от любого клиента) заберёт его без коннекта.
+ * Коннект, форвардинг и буферы — общие с SOCKS5 (tunnel_connect_to_remote,
+ * tunnel_forward). Конвейер (pipelining) не поддерживаем: следующий запрос клиента
+ * ждёт в read_buffer, пока не доедет ответ на текущий.
+ */
+
+typedef struct http_front http_front_t;
+
+/*
+ * Похоже ли начало соединения на HTTP-запрос (заглавная буква метода)
+ */
+bool http_sniff(uint8_t first);
+
+/*
+ * Создаёт состояние HTTP-фронта туннеля. Возвращает NULL при нехватке памяти
+ */
+http_front_t *http_front_create(void);
+
+/*
+ * Освобождает состояние HTTP-фронта
+ */
+void http_front_release(http_front_t *http);
+
+/*
+ * request_state HTTP-туннеля: ждёт заголовок запроса целиком, проверяет
+ * Proxy-Authorization и запускает коннект.
+ * Возвращает 0 (ждём данных / коннект пошёл / ответили ошибкой и закрываемся) или <0
+ */
+int http_request_handle(tunnel_t *tunnel);
+
+/*
+ * Удалённая сторона готова: для CONNECT шлёт клиенту 200, для обычного запроса — ничего
+ * (переписанный заголовок уже лежит в read_buffer клиента и уедет форвардингом).
+ * Возвращает 0 или <0 при ошибке
+ */
+int http_connected(tunnel_t *tunnel);
+
+/*
+ * Разбирает ли фронт сообщения сам (обычные запросы) или туннель сырой (CONNECT)
+ */
+bool http_framed(const http_front_t *http);
+
+/*
+ * Форвардинг по границам HTTP-сообщений (вызывается из tunnel_forward).
+ * Возвращает 0 или <0 при ошибке
+ */
+int http_forward(tunnel_t *tunnel, int is_client);
+
+/*
+ * Простаивающее keep-alive соединение к tunnel->dst_host:dst_port (или NULL).
+ * Сокет уже в epoll, но без туннеля — как у preconnect_take
+ */
+sock_t *http_pool_take(tunnel_t *tunnel);
+
+#endif // HTTP_PROXY_H
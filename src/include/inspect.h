@@ -0,0 +1,90 @@
+#ifndef INSPECT_H
+#define INSPECT_H
+
+#include <stddef.h>
+
+#include "tunnel.h"
+
+/*
+ * Инспекция трафика вне горячего пути форвардинга.
+ *
+ * Event loop ничего не разбирает и не форматирует: на каждый прочитанный кусок
+ * установленного туннеля он кладёт снимок буфера (buffer_view_t — ссылка на блок,
+ * без копирования байтов) в SPSC-кольцо потока анализа и сразу форвардит дальше.
+ * Потоки анализа (-A) один раз классифицируют туннель по первым байтам (реестр
+ * диссекторов, dissect.h) и дальше отдают куски только его диссектору: HTTP
+ * (с WebSocket и h2c), HTTP/2, Redis, PostgreSQL, MQTT; незнакомое — hex-дамп
+ * первого куска. Туннель закреплён за одним потоком — состояние разбора потоку
+ * не делится.
+ *
+ * Кольцо полно (анализ не успевает) — кусок выбрасывается и считается, event loop
+ * никогда не ждёт. Направление с пропуском дальше не публикуется: потоковому
+ * парсеру без пропавших байтов не за что зацепиться.
+ *
+ * Политика (-I) ограничивает объём: первые N байт или M сообщений туннеля,
+ * один туннель из K, без инспекции для портов/хостов/пользователей. Решение
+ * принимается на первом куске, туннель вне политики или с исчерпанным бюджетом
+ * уходит в чистый форвардинг: на кусок остаётся одна проверка флага.
+ *
+ * Если клиент начинает с TLS, ClientHello (SNI, ALPN, версии) разбирается сразу
+ * на event loop (см. tls.h) и остаётся в tunnel->tls: для лога, счётчиков и
+ * правил skip-host, которые сверяются и с SNI.
+ *
+ * С -K каждый опубликованный кусок сначала проходит матчер ключевых слов
+ * (match.h) со своим состоянием на каждое направление; совпадение — событие
+ * "Match: rule=... target=... offset=..." в лог. Пока матчер включён, туннель
+ * публикуется и после того, как диссектору стало нечего делать (кроме TLS), —
+ * в пределах того же бюджета -I.
+ */
+
+/*
+ * Счётчики инспекции
+ */
+typedef struct inspect_stats
+{
+    unsigned long long published;  // Кусков отдано потокам анализа
+    unsigned long long dropped;    // Выброшено: кольцо полно
+    unsigned long long lost;       // Направлений, которые из-за этого больше не разбираются
+    unsigned long long skipped;    // Туннелей, которые политика не разбирает совсем
+    unsigned long long exhausted;  // Туннелей, исчерпавших бюджет байтов или сообщений
+    unsigned long long finished;   // Туннелей, где смотреть больше нечего (TLS, незнакомый протокол)
+    unsigned long long tls;        // Разобранных TLS ClientHello
+    unsigned long long tls_bad;    // Начинались как TLS, но ClientHello битый
+    unsigned long long matches;    // Срабатываний матчера ключевых слов (-K)
+} inspect_stats_t;
+
+/*
+ * Запускает threads потоков анализа (0 — инспекция выключена).
+ * policy — строка -I (или NULL): "bytes=N,messages=M,sample=K,skip-port=P,
+ * skip-host=H,skip-user=U"; skip-* можно повторять, skip-host=.example.com —
+ * домен вместе с поддоменами.
+ * patterns — файл шаблонов матчера -K (или NULL/"" — без него).
+ * Вызывать до server_start. Возвращает 0 при успехе, <0 при ошибке
+ */
+int inspect_init(int threads, const char *policy, const char *patterns);
+
+/*
+ * Отдаёт на анализ последние fresh байт read_buffer'а стороны is_client.
+ * Ничего не копирует и не блокирует; если анализ не успевает — кусок теряется.
+ * Когда туннель разбирать больше не нужно (политика, бюджет, потери в обе стороны),
+ * выставляет tunnel->inspect_off — дальше вызывать не надо
+ */
+void inspect_publish(tunnel_t *tunnel, int is_client, size_t fresh);
+
+/*
+ * Туннель закрывается: отпускает его состояние разбора (освободит тот,
+ * кто отпустит последним — event loop или поток анализа)
+ */
+void inspect_flow_release(inspect_flow_t *flow);
+
+/*
+ * Туннель закрылся, не дождавшись конца ClientHello: отпускает придержанные снимки
+ */
+void inspect_held_release(inspect_held_t *held);
+
+/*
+ * Снимок счётчиков
+ */
+void inspect_get_stats(inspect_stats_t *stats);
+
+#endif // INSPECT_H
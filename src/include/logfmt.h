@@ -0,0 +1,71 @@
+#ifndef LOGFMT_H
+#define LOGFMT_H
+
+#include <stdint.h>
+
+/*
+ * Разбор printf-формата для бинарного лога (-b): по строке формата call site'а
+ * заранее выясняем, какие аргументы и какого размера он передаёт. Логгер по этому
+ * списку копирует сырые аргументы в запись, cliproxy-logcat по нему же читает их
+ * обратно и форматирует офлайн — код разбора один на обоих.
+ *
+ * Файл — последовательность сессий (каждый запуск дописывает свою):
+ *   "CLPXLOG1", uint32 число call site'ов, на каждый: uint8 уровень, uint32 строка,
+ *   uint16 длина формата, uint16 длина имени файла, формат, имя файла (id — порядковый номер);
+ *   дальше записи: uint16 длина записи, uint16 id, uint64 тики, аргументы по формату:
+ *   целые (и errno для %m) — zigzag-varint, %p и double — 8 байт, %s — varint длина + байты.
+ * Тики — TSC (на не-x86 — CLOCK_MONOTONIC в нс); записи LOGFMT_ID_SYNC (uint64 реальное
+ * время в нс) привязывают их к часам, между ними время интерполируется.
+ * Всё в порядке байт машины, писавшей лог.
+ */
+
+#define LOGFMT_MAGIC     "CLPXLOG1"  // Начало сессии
+#define LOGFMT_HEAD      12          // Заголовок записи
+#define LOGFMT_REC_MAX   4096        // Запись целиком
+#define LOGFMT_STR_MAX   1024        // Байт одной строки-аргумента
+#define LOGFMT_ID_SYNC   0xFFFF      // Запись-синхронизация тиков с реальным временем
+#define LOGFMT_VARINT_MAX 10         // Байт в varint'е 64-битного числа
+
+#define LOGFMT_ARGS_MAX  24  // Аргументов у одного call site'а
+
+/*
+ * Что лежит в записи на месте аргумента
+ */
+typedef enum logfmt_type
+{
+    LOGFMT_NONE,    // "%%" — аргумента нет
+    LOGFMT_INT,     // int и всё, что до него продвигается (%d %u %x %c, '*')
+    LOGFMT_LONG,    // long, long long, size_t... (%ld %llu %zu)
+    LOGFMT_PTR,     // %p
+    LOGFMT_DOUBLE,  // %f %e %g %a
+    LOGFMT_STR,     // %s: байты без NUL
+    LOGFMT_ERRNO,   // %m: errno в момент вызова, из va_list ничего не берётся
+    LOGFMT_BAD      // %n, long double и прочее, что не поддерживаем
+} logfmt_type_t;
+
+#define LOGFMT_PREC_NONE  -1  // У %s нет точности
+#define LOGFMT_PREC_STAR  -2  // Точность %s — предыдущий аргумент ('.*')
+
+/*
+ * Один аргумент call site'а
+ */
+typedef struct logfmt_arg
+{
+    uint8_t  type;  // logfmt_type_t
+    int16_t  prec;  // Для %s: точность, LOGFMT_PREC_NONE или LOGFMT_PREC_STAR
+} logfmt_arg_t;
+
+/*
+ * Разбор одной конверсии: p указывает на '%'. Возвращает указатель за конверсией;
+ * в *stars — сколько '*' (ширина и точность из аргументов, они идут раньше значения),
+ * в arg — тип значения
+ */
+const char *logfmt_spec(const char *p, int *stars, logfmt_arg_t *arg);
+
+/*
+ * Разбирает весь формат в список аргументов по порядку ('*' — отдельные LOGFMT_INT).
+ * Возвращает их число или -1, если формат не поддерживается
+ */
+int logfmt_parse(const char *fmt, logfmt_arg_t *args, int max);
+
+#endif // LOGFMT_H
@@ -1,44 +1,161 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "logfmt.h"
 
 /*
  * Логи для прокачки детализации вывода
  */
 typedef enum log_level
 {
+    DEBUG,   // Подробности по каждому чтению/записи, по умолчанию выключены
     INFO,    // Инфа-сообщения
     WARNING, // Варнинги про возможные косяки
     ERROR    // Ошибки, на которые надо забить внимание
 } log_level_t;
 
 /*
- * Инициализация логгера: открытие файла (append) или stdout, установка минимального уровня
+ * Уровень, ниже которого LOG_* не компилируются вовсе (ни вызова, ни вычисления
+ * аргументов): -DCLIPROXY_LOG_LEVEL=WARNING в CMake. Числа — для #if
  */
-void log_init(const char *filename, log_level_t level);
+#define LOG_LEVEL_DEBUG    0
+#define LOG_LEVEL_INFO     1
+#define LOG_LEVEL_WARNING  2
+#define LOG_LEVEL_ERROR    3
+
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN      LOG_LEVEL_DEBUG
+#endif
+
+/*
+ * Call site лога: заводится статиком прямо в макросе LOG_*, указатель на него
+ * линкер собирает в секцию log_sites. При log_init каждому выдаётся id и по формату
+ * разбирается список аргументов — в бинарном режиме (-b) в лог идут только id,
+ * тики и сырые аргументы, а текст собирает cliproxy-logcat.
+ *
+ * on — пишет ли site сейчас: log_set_levels пересчитывает его по общему уровню
+ * и уровню модуля (файла). Макрос проверяет его до вычисления аргументов, так что
+ * выключенный site стоит одну загрузку байта. EXTRA_LOG_* на ходу не выключаются —
+ * это то, что оператор должен увидеть в консоли
+ */
+typedef struct log_site
+{
+    atomic_bool    on;
+    bool           console;  // EXTRA_LOG_*: ответы терминала и т.п., уровнями на ходу не глушатся
+    log_level_t    level;
+    const char    *fmt;
+    const char    *file;
+    int            line;
+    uint16_t       id;
+    int8_t         nargs;  // -1 — формат не разбирается, пишем готовым текстом
+    logfmt_arg_t   args[LOGFMT_ARGS_MAX];
+} log_site_t;
+
+/*
+ * Инициализация логгера: открытие файла (append) или stdout.
+ * binary — писать записи для cliproxy-logcat вместо текста,
+ * rotate — строка -R (см. logrotate.h), NULL или "" — без ротации.
+ * Возвращает 0 или -1, если ротацию включить не вышло (errno — почему; лог тогда в stdout)
+ */
+int log_init(const char *filename, bool binary, const char *rotate);
+
+/*
+ * Уровни логирования, можно менять на ходу (команда терминала "level"):
+ * "warning" — общий, "error,protocol=info,tunnel=warning" — плюс по модулям
+ * (модуль — имя .c-файла без расширения). Уровни: debug, info, warning, error, off;
+ * по умолчанию — info.
+ * Возвращает 0 или -1, если строка кривая (тогда ничего не меняется)
+ */
+int log_set_levels(const char *spec);
+
+#define LOG_SPEC_MAX 256  // Строка уровней с нулём
+
+/*
+ * Копия текущей строки уровней (то, что последним принял log_set_levels) в out
+ */
+void log_get_levels(char *out, size_t size);
 
 /*
- * Запуск логгера: открываем файл (append) или stdout, задаём минимальный уровень
+ * Запись в лог от имени call site'а (см. LOG_*)
  */
-void log_message(log_level_t level, const char *fmt, ...);
+void log_message(log_site_t *site, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 
 /*
  * Доп. логирование: кроме файла, дублирует WARNING/ERROR в stdout
  */
-void extra_log_message(log_level_t level, const char *fmt, ...);
+void extra_log_message(log_site_t *site, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/*
+ * Ничего не делает: нужна только чтобы у вырезанных LOG_* проверялся формат
+ * и переменные не считались неиспользуемыми. Не вызывается никогда
+ */
+void log_format_check(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * Заводит call site и пишет от его имени, если site включён. fmt — только строковый литерал
+ */
+#define LOG_SITE(func, lvl, con, format, ...)                                                      \
+    do                                                                                             \
+    {                                                                                              \
+        static log_site_t log_site_ = {.on = true, .console = con, .level = lvl, .fmt = format,    \
+                                       .file = __FILE__, .line = __LINE__};                        \
+        static log_site_t *const log_site_ptr_                                                     \
+            __attribute__((section("log_sites"), used)) = &log_site_;                              \
+        if (__builtin_expect(atomic_load_explicit(&log_site_.on, memory_order_relaxed), 1))        \
+        {                                                                                          \
+            func(&log_site_, format, ##__VA_ARGS__);                                               \
+        }                                                                                          \
+    } while (0)
+
+/*
+ * Вырезанный при сборке LOG_*: кода нет, аргументы не вычисляются
+ */
+#define LOG_NONE(fmt, ...)                                                                         \
+    do                                                                                             \
+    {                                                                                              \
+        if (0)                                                                                     \
+        {                                                                                          \
+            log_format_check(fmt, ##__VA_ARGS__);                                                  \
+        }                                                                                          \
+    } while (0)
 
 /*
  * Макросы для вызова с уровнем без прямого вызова log\_message
  */
-#define LOG_INFO(...)         log_message(INFO,    __VA_ARGS__)
+#if LOG_LEVEL_MIN <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...)        LOG_SITE(log_message, DEBUG,   false, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...)        LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
 
-#define LOG_WARN(...)         log_message(WARNING, __VA_ARGS__)
+#if LOG_LEVEL_MIN <= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...)         LOG_SITE(log_message, INFO,    false, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...)         LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
 
-#define LOG_ERROR(...)        log_message(ERROR,   __VA_ARGS__)
+#if LOG_LEVEL_MIN <= LOG_LEVEL_WARNING
+#define LOG_WARN(fmt, ...)         LOG_SITE(log_message, WARNING, false, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...)         LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
 
-#define EXTRA_LOG_WARN(...)   extra_log_message(WARNING, __VA_ARGS__)
+#if LOG_LEVEL_MIN <= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...)        LOG_SITE(log_message, ERROR,   false, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...)        LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
 
-#define EXTRA_LOG_ERROR(...)  extra_log_message(ERROR,   __VA_ARGS__)
+/*
+ * Ответы консоли (stats, top, команды терминала) — интерфейс, а не лог:
+ * LOG_LEVEL_MIN их не вырезает, как и уровни на ходу (site->console)
+ */
+#define EXTRA_LOG_WARN(fmt, ...)   LOG_SITE(extra_log_message, WARNING, true, fmt, ##__VA_ARGS__)
+#define EXTRA_LOG_ERROR(fmt, ...)  LOG_SITE(extra_log_message, ERROR,   true, fmt, ##__VA_ARGS__)
 
 #endif // LOGGER_H
@@ -0,0 +1,50 @@
+#ifndef LOGROTATE_H
+#define LOGROTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Ротация файла лога (-R) силами потока-писателя логгера — без внешнего
+ * logrotate с его copytruncate, который теряет строки.
+ *
+ * Лог пишется сегментами base.000001, base.000002... (нумерация продолжается
+ * после перезапуска), base — симлинк на текущий сегмент, для tail -F.
+ * Место под сегмент выделяется заранее fallocate'ом (FALLOC_FL_KEEP_SIZE —
+ * размер файла растёт по мере записи, хвоста из нулей нет), пишет писатель
+ * теми же большими writev'ами раз в 10 мс. Сегмент сменяется между пачками,
+ * так что строка или бинарная запись никогда не рвётся между файлами; размер
+ * поэтому может превысить size= на одну пачку. Смена — это open + dup2 на том же
+ * дескрипторе: продюсеры о ней не знают, event loop её не ждёт.
+ *
+ * Закрытые сегменты сжимает в .gz и удаляет старше files= последних отдельный
+ * поток с пониженным приоритетом.
+ */
+
+/*
+ * Включает ротацию файла path. spec — строка -R: "size=N[K|M|G],every=N[s|m|h|d],
+ * files=K,compress" (нужен size или every; every выравнивается по часам: every=1h
+ * меняет сегмент в начале каждого часа).
+ * Возвращает дескриптор первого сегмента или <0 (кривой spec, не открылся файл)
+ */
+int logrotate_init(const char *path, const char *spec);
+
+/*
+ * Писатель дописал пачку в fd: пора ли менять сегмент (по размеру или по времени).
+ * header — сколько байт в начале сегмента занимает заголовок (словарь бинарного лога):
+ * сегмент, где кроме него ничего нет, по времени не сменяется
+ */
+bool logrotate_due(int fd, size_t header);
+
+/*
+ * Меняет сегмент: текущий закрывается и уходит на сжатие, следующий встаёт на
+ * место fd (dup2). Зовёт только писатель. 0 — ок, <0 — остались в старом
+ */
+int logrotate_next(int fd);
+
+/*
+ * Выход: у текущего сегмента отпускается заранее выделенный, но не записанный хвост
+ */
+void logrotate_finish(int fd);
+
+#endif // LOGROTATE_H
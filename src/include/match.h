@@ -0,0 +1,79 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Поиск ключевых слов в потоке туннеля (-K): префиксы утёкших API-ключей,
+ * внутренние имена хостов и т.п.
+ *
+ * Все шаблоны из файла собираются в один автомат Ахо-Корасик, развёрнутый
+ * в DFA: на каждый байт — один переход по таблице, без возвратов по fail-ссылкам.
+ * Байты, которых нет ни в одном шаблоне, сливаются в класс 0, строка таблицы —
+ * классы, дополненные до степени двойки (индекс — сдвиг, без умножения), состояния
+ * пронумерованы в порядке BFS: горячие мелкие глубины лежат рядом. Старший бит
+ * перехода — "здесь что-то совпало", так что на обычном байте проверка одна.
+ *
+ * В корне автомат стоит, пока не встретятся первые два байта какого-нибудь
+ * шаблона — такие куски пропускает векторный scan_set_find (scan.h). Одного
+ * первого байта мало: буквы вроде 's' или 'e' в тексте на каждом шагу.
+ *
+ * Состояние потока (match_stream_t) — одно на направление туннеля: совпадение,
+ * разрезанное чтениями, всё равно находится.
+ *
+ * Файл шаблонов: строка — шаблон, байты как есть (регистр важен); "\xHH" и "\\"
+ * — экранирование. Если в строке есть TAB, до него — имя правила для лога.
+ * Строки с '#' в начале и пустые пропускаются.
+ */
+
+#define MATCH_PATTERNS_MAX  4096   // Шаблонов в файле
+#define MATCH_PATTERN_MAX   255    // Байт в шаблоне
+#define MATCH_NAME_MAX      64     // Имя правила
+#define MATCH_STATES_MAX    32767  // Состояний автомата: номер — 15 бит перехода
+
+/*
+ * Состояние потока: где автомат и сколько байт направления он уже видел
+ */
+typedef struct match_stream
+{
+    uint16_t  state;
+    uint64_t  offset;
+} match_stream_t;
+
+/*
+ * Одно совпадение
+ */
+typedef struct match_hit
+{
+    const char  *rule;     // Имя правила (или сам шаблон, если имени нет)
+    const char  *pattern;  // Шаблон для лога: непечатное — \xHH
+    size_t       len;      // Длина шаблона в байтах
+    uint64_t     offset;   // Смещение начала совпадения от начала направления
+} match_hit_t;
+
+typedef void (*match_cb_t)(void *ud, const match_hit_t *hit);
+
+/*
+ * Читает шаблоны из path и строит автомат. Вызывать до старта потоков анализа:
+ * дальше автомат только читается. Возвращает 0 при успехе, <0 при ошибке
+ */
+int match_load(const char *path);
+
+/*
+ * Загружен ли автомат
+ */
+bool match_enabled(void);
+
+/*
+ * Сброс перед первым байтом направления
+ */
+void match_stream_init(match_stream_t *ms);
+
+/*
+ * Прогоняет кусок направления через автомат; на каждое совпадение — cb
+ */
+void match_feed(match_stream_t *ms, const uint8_t *data, size_t len, match_cb_t cb, void *ud);
+
+#endif // MATCH_H
@@ -0,0 +1,116 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Метрики для Prometheus (-T): GET /metrics на loopback.
+ *
+ * Счётчики шардированы по потокам: у каждого потока свой шард, выровненный
+ * по кэш-линии, и пишет в него только он — обычные load + store (relaxed
+ * атомики компилируются в простые mov), без lock-префикса и без чужих кэш-линий.
+ * Складывает шарды только скрейпер, на каждый запрос. Шард заводится при первом
+ * metrics_add в потоке и живёт до конца процесса, так что счётчики ушедших
+ * потоков не теряются.
+ *
+ * Гейджи (туннели по состояниям, память буферов) берутся из слепков stats.h.
+ */
+
+/*
+ * Счётчики. Метки Prometheus — в metrics.c
+ */
+typedef enum metric
+{
+    METRIC_ACCEPTS,              // Принято клиентских соединений
+    METRIC_HANDSHAKE_OK,         // Туннель установлен
+    METRIC_HANDSHAKE_AUTH,       // Неверный логин/пароль
+    METRIC_HANDSHAKE_PROTOCOL,   // Кривой greeting/request
+    METRIC_HANDSHAKE_CONNECT,    // Не удалось подключиться к назначению
+    METRIC_HANDSHAKE_ABANDONED,  // Клиент ушёл или туннель прибили до установки
+    METRIC_BYTES_TO_REMOTE,      // Записано байт в сторону назначения
+    METRIC_BYTES_TO_CLIENT,      // Записано байт клиенту
+    METRIC_DNS_OK,               // getaddrinfo назначения успешен
+    METRIC_DNS_ERROR,
+    METRIC_DNS_CACHE_HIT,        // Адрес горячего назначения взят из кэша пула
+    METRIC_DNS_CACHE_MISS,
+    METRIC_EPOLL_WAKEUPS,        // Возвратов из epoll_wait
+    METRIC_EPOLL_EVENTS,         // Событий, которые они принесли
+    METRIC_SYS_READ,             // Системные вызовы
+    METRIC_SYS_WRITE,
+    METRIC_SYS_ACCEPT,
+    METRIC_SYS_CONNECT,
+    METRIC_SYS_EPOLL_CTL,
+    METRIC_SYS_EPOLL_WAIT,
+    METRIC_COUNT
+} metric_t;
+
+#define METRICS_BUCKETS  16  // Корзин гистограммы времени коннекта (без +Inf)
+
+/*
+ * Шард потока. Выравнивание по 64 — соседние шарды не делят кэш-линию
+ */
+typedef struct metrics_shard
+{
+    _Alignas(64) atomic_ullong  counter[METRIC_COUNT];
+    atomic_ullong               connect_bucket[METRICS_BUCKETS + 1];  // Последняя — +Inf
+    atomic_ullong               connect_sum_us;
+    struct metrics_shard       *next;
+} metrics_shard_t;
+
+/*
+ * Шард текущего потока (NULL — ещё не заводился)
+ */
+extern _Thread_local metrics_shard_t *metrics_local;
+
+/*
+ * Заводит шард текущего потока — зовёт metrics_shard при первом обращении
+ */
+metrics_shard_t *metrics_shard_new(void);
+
+static inline metrics_shard_t *metrics_shard(void)
+{
+    return metrics_local != NULL ? metrics_local : metrics_shard_new();
+}
+
+static inline void metrics_bump(atomic_ullong *counter, unsigned long long n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+/*
+ * counter += n в шарде текущего потока
+ */
+static inline void metrics_add(metric_t metric, unsigned long long n)
+{
+    metrics_bump(&metrics_shard()->counter[metric], n);
+}
+
+/*
+ * Сумма шардов на один момент
+ */
+typedef struct metrics_sum
+{
+    unsigned long long counter[METRIC_COUNT];
+    unsigned long long connect_bucket[METRICS_BUCKETS + 1];
+    unsigned long long connect_sum_us;
+} metrics_sum_t;
+
+/*
+ * Складывает шарды всех потоков — из любого потока, держит лок списка шардов
+ * только на время обхода
+ */
+void metrics_sum(metrics_sum_t *sum);
+
+/*
+ * Время от запроса клиента до установки туннеля — в гистограмму
+ */
+void metrics_connect_time(unsigned long long us);
+
+/*
+ * Запускает поток с HTTP-слушателем на 127.0.0.1:port. 0 — ок, <0 — ошибка
+ */
+int metrics_init(const char *port);
+
+#endif // METRICS_H
@@ -0,0 +1,93 @@
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dissect.h"
+
+/*
+ * Потоковый разбор MQTT (3.1, 3.1.1, 5.0) для инспекции туннеля.
+ *
+ * Пакет: тип и флаги (1 байт), оставшаяся длина varint (1-4 байта), тело. Тело
+ * собирается только первыми MQTT_BODY_MAX байтами — этого хватает на топик
+ * и поля CONNECT, — payload PUBLISH отсчитывается по длине. Версию протокола
+ * запоминаем из CONNECT: в 5.0 после заголовков пакетов идут properties.
+ */
+
+#define MQTT_BODY_MAX  512        // Сколько начала пакета собираем
+#define MQTT_TEXT_MAX  256        // Сколько описания пакета показываем в логе
+#define MQTT_LEN_MAX   268435455  // Предел оставшейся длины по спецификации
+
+#define MQTT_CONNECT     1
+#define MQTT_CONNACK     2
+#define MQTT_PUBLISH     3
+#define MQTT_SUBSCRIBE   8
+#define MQTT_UNSUBSCRIBE 10
+#define MQTT_DISCONNECT  14
+
+typedef enum mqtt_state
+{
+    MQTT_HEADER,  // Копим тип и длину
+    MQTT_BODY,    // Идёт тело
+    MQTT_BROKEN   // Нарушение протокола — дальше не разбираем
+} mqtt_state_t;
+
+typedef struct mqtt_stream
+{
+    mqtt_state_t  state;
+    uint8_t       hdr[5];
+    size_t        hdr_len;
+    uint32_t      len;        // Оставшаяся длина пакета
+    uint32_t      left;
+    uint8_t       body[MQTT_BODY_MAX];
+    size_t        body_len;
+} mqtt_stream_t;
+
+/*
+ * Оба направления: [0] remote → client, [1] client → remote
+ */
+typedef struct mqtt_flow
+{
+    mqtt_stream_t  dir[2];
+    uint8_t        level;     // Версия протокола из CONNECT (4 — 3.1.1, 5 — 5.0)
+    unsigned       messages;  // Сколько PUBLISH разобрали
+} mqtt_flow_t;
+
+/*
+ * Разобранный пакет
+ */
+typedef struct mqtt_packet
+{
+    uint8_t      type;
+    uint8_t      flags;
+    const char  *name;      // "CONNECT", "PUBLISH"...
+    uint32_t     len;
+    const char  *text;      // Описание: клиент, топик, подписки...
+    size_t       text_len;
+} mqtt_packet_t;
+
+typedef struct mqtt_flow_cb
+{
+    void (*on_packet)(void *ud, int is_client, const mqtt_packet_t *pkt);
+    void (*on_error)(void *ud, int is_client, const char *what);
+} mqtt_flow_cb_t;
+
+/*
+ * Сброс перед первым байтом туннеля
+ */
+void mqtt_flow_init(mqtt_flow_t *mqtt);
+
+/*
+ * Сигнатура: клиент начинает с CONNECT и имени протокола "MQTT" или "MQIsdp"
+ */
+dissect_match_t mqtt_signature(const uint8_t *p, size_t len, int is_client, bool port_hint);
+
+/*
+ * Кормит направление is_client. Подтверждения и пинги пропускаются молча
+ */
+void mqtt_flow_feed(mqtt_flow_t *mqtt, const uint8_t *data, size_t len, int is_client,
+                    const mqtt_flow_cb_t *cb, void *ud);
+
+#endif // MQTT_H
@@ -0,0 +1,131 @@
+#ifndef MUX_H
+#define MUX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tunnel.h"
+
+/*
+ * Мультиплексор между двумя инстансами прокси.
+ *
+ * Edge-инстанс держит несколько долгоживущих TCP-линков к core-инстансу и гонит
+ * по ним туннели клиентов как стримы. Core разбирает стримы и делает настоящие
+ * коннекты к назначениям. Так туннель не платит за TCP-хэндшейк и slow-start через WAN.
+ *
+ * Линк начинается с преамбулы MUX_PREFACE (первый байт не 0x05 — core отличает
+ * линк от SOCKS5-клиента на том же порту). Дальше — фреймы:
+ * +------+-------+--------+-----------+---------+
+ * | TYPE | FLAGS | LENGTH | STREAM ID | PAYLOAD |
+ * +------+-------+--------+-----------+---------+
+ * |  1   |   1   |   2    |     4     | LENGTH  |
+ * +------+-------+--------+-----------+---------+
+ * (LENGTH и STREAM ID — big-endian, LENGTH <= MUX_MAX_FRAME)
+ *
+ * OPEN    — edge → core, payload как хвост SOCKS5-запроса: ATYP, DST.ADDR, DST.PORT
+ * OPEN_OK — core → edge, payload как хвост SOCKS5-ответа: ATYP, BND.ADDR, BND.PORT
+ * DATA    — данные стрима
+ * WINDOW  — возврат окна: payload u32, сколько (несжатых) байт получатель отдал в сокет
+ * FIN     — стрим закрыт отправителем (до OPEN_OK — отказ в коннекте)
+ * AUTH    — edge → core, первый фрейм линка (STREAM ID 0): payload — секрет линка (-X).
+ *           Core с секретом без верного AUTH линк закрывает, core без секрета AUTH игнорирует
+ *
+ * FLAGS у DATA: MUX_FLAG_DEFLATE — payload сжат deflate-потоком стрима (см. codec.h).
+ * Каждая сторона сама решает, жать ли то, что шлёт; распаковывать умеют обе.
+ *
+ * У каждого стрима своё окно в каждую сторону: отправитель шлёт не больше окна,
+ * дальше ставит чтение своего сокета на паузу до WINDOW. Получатель, которому
+ * прислали больше окна, рвёт весь линк.
+ */
+
+#define MUX_PREFACE       "\xc5MUX/1\r\n"
+#define MUX_PREFACE_LEN   8
+#define MUX_PREFACE_FIRST 0xc5
+#define MUX_HEADER_LEN    8
+#define MUX_MAX_FRAME     16384         // Максимальный payload одного фрейма
+#define MUX_WINDOW        (256 * 1024)  // Стартовое окно стрима в каждую сторону
+#define MUX_FLAG_DEFLATE  0x01
+#define MUX_SECRET_MAX    255           // Длина секрета линка максимум
+
+/*
+ * Стрим мультиплексора — виртуальная сторона туннеля
+ */
+typedef struct mux_stream mux_stream_t;
+
+/*
+ * Edge-режим: открыть nlinks линков к peer ("host:port") и держать их живыми.
+ * Возвращает 0 при успехе, <0 при ошибке
+ */
+int mux_init_edge(const char *peer, int nlinks);
+
+/*
+ * Core-режим: принимать линки мультиплексора на основном порту
+ */
+void mux_init_core(void);
+
+/*
+ * Сжимать DATA, которые этот инстанс шлёт по линкам (на любой стороне).
+ * Возвращает 0 при успехе, <0 при ошибке
+ */
+int mux_init_compress(void);
+
+/*
+ * Секрет линков: edge шлёт его в AUTH, core без него линк не принимает.
+ * Возвращает 0 при успехе, <0 при ошибке
+ */
+int mux_init_secret(const char *secret);
+
+/*
+ * Включён ли edge-режим (новые туннели уходят в стримы)
+ */
+bool mux_edge_enabled(void);
+
+/*
+ * Включён ли core-режим (надо ли узнавать преамбулу линка)
+ */
+bool mux_core_enabled(void);
+
+/*
+ * Вызывается из tunnel_open_handle, когда первым байтом пришёл MUX_PREFACE_FIRST:
+ * забирает клиентский сокет туннеля под линк, а сам туннель освобождает.
+ * Возвращает 0 (после вызова tunnel трогать нельзя) или <0, если линк не принять
+ * (в том числе: SOCKS5 с аутентификацией, а секрета линков нет)
+ */
+int mux_accept(tunnel_t *tunnel);
+
+/*
+ * Edge: открывает стрим к назначению туннеля (tunnel->rp) вместо настоящего коннекта.
+ * Туннель уходит в connecting_state до OPEN_OK. Возвращает 0 или <0 при ошибке
+ */
+int mux_connect(tunnel_t *tunnel);
+
+/*
+ * 1 — стрим заменяет клиентскую сторону туннеля (core), 0 — удалённую (edge)
+ */
+int mux_stream_client_side(const mux_stream_t *stream);
+
+/*
+ * Шлёт в стрим всё, что лежит в read_buffer сокета rear, сколько позволяет окно;
+ * остаток ждёт WINDOW, а чтение rear на паузе. Полузакрытый rear с остатком не закрывается,
+ * пока окно не позволит его отправить.
+ * Возвращает 0 или <0 при ошибке
+ */
+int mux_stream_send(mux_stream_t *stream, sock_t *rear);
+
+/*
+ * Настоящий сокет туннеля дописал n байт — возвращаем окно отправителю
+ */
+void mux_stream_consumed(mux_stream_t *stream, size_t n);
+
+/*
+ * Core: коннект к назначению доехал, bnd — ATYP, BND.ADDR, BND.PORT для OPEN_OK
+ */
+int mux_stream_open_ok(mux_stream_t *stream, const uint8_t *bnd, size_t len);
+
+/*
+ * Туннель умирает: шлём FIN (если ещё не было) и освобождаем стрим
+ */
+void mux_stream_detach(mux_stream_t *stream);
+
+#endif // MUX_H
@@ -0,0 +1,88 @@
+#ifndef POSTGRES_H
+#define POSTGRES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dissect.h"
+
+/*
+ * Потоковый разбор протокола PostgreSQL (frontend/backend v3) для инспекции туннеля.
+ *
+ * Клиент начинает с сообщения без типа: StartupMessage, SSLRequest, GSSENCRequest
+ * или CancelRequest; дальше обе стороны шлют "тип(1) + длина(4) + тело". Тело
+ * собирается только первыми PG_BODY_MAX байтами, остальное пропускается по длине.
+ * Наружу отдаются параметры старта, запросы (Query, Parse), аутентификация,
+ * ошибки и CommandComplete сервера. Согласие сервера на SSL/GSS — дальше шифр,
+ * разбор на этом кончается.
+ */
+
+#define PG_BODY_MAX  1024  // Сколько начала сообщения собираем
+#define PG_TEXT_MAX  512   // Сколько описания сообщения показываем в логе
+#define PG_LEN_MAX   (1u << 30)
+
+typedef enum pg_state
+{
+    PG_HEADER,  // Копим тип и длину
+    PG_BODY,    // Идёт тело
+    PG_REPLY,   // Сервер отвечает одним байтом на SSLRequest/GSSENCRequest
+    PG_BROKEN   // Не наш протокол — дальше не разбираем
+} pg_state_t;
+
+typedef struct pg_stream
+{
+    pg_state_t  state;
+    uint8_t     hdr[8];
+    size_t      hdr_len;
+    uint8_t     type;       // 0 — сообщение без типа (первое сообщение клиента)
+    uint32_t    len;        // Длина тела
+    uint32_t    left;       // Сколько тела осталось
+    uint8_t     body[PG_BODY_MAX];
+    size_t      body_len;
+} pg_stream_t;
+
+/*
+ * Оба направления: [0] remote → client, [1] client → remote
+ */
+typedef struct pg_flow
+{
+    pg_stream_t  dir[2];
+    int          startup;   // Следующее сообщение клиента — без типа
+    unsigned     messages;  // Сколько запросов клиента разобрали
+} pg_flow_t;
+
+/*
+ * Интересное сообщение
+ */
+typedef struct pg_message
+{
+    char         type;      // Тип по протоколу, 0 — сообщение старта
+    uint32_t     len;       // Длина тела
+    const char  *text;      // Описание: параметры, запрос, ошибка...
+    size_t       text_len;
+} pg_message_t;
+
+typedef struct pg_flow_cb
+{
+    void (*on_message)(void *ud, int is_client, const pg_message_t *msg);
+    void (*on_error)(void *ud, int is_client, const char *what);
+} pg_flow_cb_t;
+
+/*
+ * Сброс перед первым байтом туннеля
+ */
+void pg_flow_init(pg_flow_t *pg);
+
+/*
+ * Сигнатура: первое сообщение клиента — StartupMessage v3 или запрос SSL/GSS/отмены
+ */
+dissect_match_t pg_signature(const uint8_t *p, size_t len, int is_client, bool port_hint);
+
+/*
+ * Кормит направление is_client. false — дальше TLS/GSS или отмена запроса, разбирать нечего
+ */
+bool pg_flow_feed(pg_flow_t *pg, const uint8_t *data, size_t len, int is_client,
+                  const pg_flow_cb_t *cb, void *ud);
+
+#endif // POSTGRES_H
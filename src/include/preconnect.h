@@ -0,0 +1,50 @@
+#ifndef PRECONNECT_H
+#define PRECONNECT_H
+
+#include <stddef.h>
+
+#include "tunnel.h"
+
+/*
+ * Предиктивный пул коннектов к горячим назначениям.
+ *
+ * Каждый CONNECT учитывается в sketch'е тяжёлых хиттеров (Space-Saving на
+ * фиксированное число счётчиков — память не растёт от числа адресов).
+ * По таймеру для топа назначений держатся простаивающие, уже подключённые сокеты:
+ * туннель забирает готовый сокет и сразу отвечает клиенту, без DNS и TCP-хэндшейка.
+ * Если готового нет — обычный коннект.
+ */
+
+/*
+ * Счётчики пула для статистики
+ */
+typedef struct preconnect_stats
+{
+    unsigned long long hits;     // CONNECT получил готовый сокет
+    unsigned long long misses;   // Готового не нашлось, пошли коннектиться сами
+    unsigned long long dialed;   // Сколько раз открывали сокет впрок
+    unsigned long long failed;   // Из них не доехали
+    unsigned long long expired;  // Простояли дольше idle_ms или закрыты сервером
+    size_t             idle;     // Сколько готовых сокетов лежит сейчас
+} preconnect_stats_t;
+
+/*
+ * Включает пул: slots — всего простаивающих сокетов, per_dest — максимум на одно
+ * назначение, idle_ms — сколько сокет может пролежать без дела.
+ * Возвращает 0 при успехе, <0 при ошибке
+ */
+int preconnect_init(int slots, int per_dest, int idle_ms);
+
+/*
+ * Учитывает CONNECT к tunnel->dst_host:dst_port и, если в пуле есть готовый
+ * сокет к этому назначению, отдаёт его (он уже в epoll, но без туннеля).
+ * Возвращает сокет или NULL (пул выключен или промах)
+ */
+sock_t *preconnect_take(tunnel_t *tunnel);
+
+/*
+ * Снимок счётчиков пула
+ */
+void preconnect_get_stats(preconnect_stats_t *stats);
+
+#endif // PRECONNECT_H
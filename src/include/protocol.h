@@ -4,6 +4,11 @@
 
 #include <stdint.h>
 
+/*
+ * Длиннее логин/пароль SOCKS5 не принимаем (длины RFC1929 — до 255)
+ */
+#define MAX_PASSWD_LEN 20
+#define MAX_UNAME_LEN  20
 
 /*
  * Подрубаем главную структуру туннеля — хранит состояние SOCKS-сессии и нужные сокеты
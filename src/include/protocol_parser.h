@@ -2,22 +2,21 @@
 #define PROTOCOL_PARSER_H
 
 
-#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
 /*
- * Проверяет буфер на HTTP-запрос или ответ.
- * Если находит HTTP, логирует заголовки и старт тела до "\r\n\r\n".
- * Возвращает true, если это HTTP, иначе false.
+ * Регистрирует диссекторы инспекции (см. dissect.h): HTTP/1.x (с WebSocket и h2c
+ * после Upgrade), HTTP/2 с prior knowledge, TLS, Redis, PostgreSQL, MQTT.
+ * Всё, что они разбирают, логируется по мере появления.
+ * Вызывать до старта потоков анализа. Возвращает 0 или -1
  */
-bool parse_and_log_http(const uint8_t *data, size_t len, int is_client);
+int parse_register_dissectors(void);
 
 /*
- * Проверяет буфер на текстовый WebSocket-фрейм (opcode=1), без маски.
- * Если всё ок — логирует payload.
- * Возвращает true, если фрейм есть и без маски, иначе false.
+ * Незнакомый протокол: hex-dump первых байтов куска
  */
-bool parse_and_log_websocket(const uint8_t *data, size_t len, int is_client);
+void parse_and_log_raw(const uint8_t *data, size_t len, int is_client);
 
 #endif // PROTOCOL_PARSER_H
@@ -0,0 +1,79 @@
+#ifndef REDIS_H
+#define REDIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dissect.h"
+
+/*
+ * Потоковый разбор команд Redis (RESP) для инспекции туннеля.
+ *
+ * Смотрим только клиента: команда — массив bulk-строк ("*3\r\n$3\r\nSET\r\n...")
+ * или inline-строка ("PING\r\n"). Ответы сервера не разбираем — их вложенность
+ * ничего не добавляет к тому, что видно по командам. Аргументы показываются
+ * первыми байтами, остальное пропускается по длине.
+ */
+
+#define REDIS_LINE_MAX  512  // Строка протокола ("*N", "$N" или inline-команда), дальше — обрезаем
+#define REDIS_TEXT_MAX  256  // Сколько команды показываем в логе
+#define REDIS_ARG_SHOW  64   // Сколько байт одного аргумента показываем
+
+typedef enum redis_state
+{
+    REDIS_LINE,    // Копим строку до "\n"
+    REDIS_BULK,    // Идёт bulk-строка аргумента (с CRLF за ней)
+    REDIS_BROKEN   // Не RESP — дальше не разбираем
+} redis_state_t;
+
+/*
+ * Разобранная команда
+ */
+typedef struct redis_command
+{
+    const char  *text;      // Команда и начало аргументов через пробел
+    size_t       text_len;
+    unsigned     args;      // Сколько аргументов вместе с именем команды
+    uint64_t     len;       // Сколько байт занимает
+    int          is_inline; // Inline, а не массив
+} redis_command_t;
+
+typedef struct redis_flow
+{
+    redis_state_t  state;
+    char           line[REDIS_LINE_MAX];
+    size_t         line_len;
+    long long      args_left;  // Сколько аргументов команды ещё впереди, 0 — ждём новую
+    unsigned       args;
+    uint64_t       bulk_left;  // Сколько bulk-строки осталось (с CRLF)
+    uint64_t       shown;      // Сколько её уже попало в text
+    uint64_t       len;
+    char           text[REDIS_TEXT_MAX];
+    size_t         text_len;
+    unsigned       messages;   // Сколько команд разобрали
+} redis_flow_t;
+
+typedef struct redis_flow_cb
+{
+    void (*on_command)(void *ud, const redis_command_t *cmd);
+    void (*on_error)(void *ud, const char *what);
+} redis_flow_cb_t;
+
+/*
+ * Сброс перед первым байтом туннеля
+ */
+void redis_flow_init(redis_flow_t *redis);
+
+/*
+ * Сигнатура: клиент начинает с "*N\r\n$". Inline-команду принимаем только на порту Redis
+ */
+dissect_match_t redis_signature(const uint8_t *p, size_t len, int is_client, bool port_hint);
+
+/*
+ * Кормит направление is_client (сервер пропускается)
+ */
+void redis_flow_feed(redis_flow_t *redis, const uint8_t *data, size_t len, int is_client,
+                     const redis_flow_cb_t *cb, void *ud);
+
+#endif // REDIS_H
@@ -0,0 +1,103 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Быстрые сканеры для разбора трафика: конец HTTP-заголовка, распознавание
+ * стартовой строки HTTP, снятие маски WebSocket, поиск не-ASCII (для проверки UTF-8)
+ * и поиск пары байтов из множества (префильтр матчера, match.h).
+ *
+ * Всё строго в пределах len — буферы туннелей не NUL-терминированы.
+ * Поиск "\r\n\r\n", снятие маски WebSocket, поиск не-ASCII и пары из множества
+ * векторные: AVX2, иначе SSE2, на не-x86 — скалярные. Реализация выбирается один
+ * раз в scan_init по CPU.
+ */
+
+/*
+ * Что лежит в начале буфера
+ */
+typedef enum scan_http
+{
+    SCAN_HTTP_NO,        // Не HTTP/1.x
+    SCAN_HTTP_MORE,      // Пока совпадает, но байт мало для решения
+    SCAN_HTTP_REQUEST,   // Request-line: известный метод + SP
+    SCAN_HTTP_RESPONSE   // Status-line: "HTTP/1.x " + три цифры
+} scan_http_t;
+
+/*
+ * Множество пар байтов для scan_set_find (начала шаблонов матчера). Таблицы
+ * shufti: байт (h, l) по полубайтам — кандидат, если lo[l] & hi[h] != 0 (корзина —
+ * h & 7); отдельно для первого и второго байта пары. Кандидаты (редкие ложные —
+ * соседи по корзине и "чужие" сочетания) сверяются с точной таблицей pairs.
+ * Если первых байтов не больше SCAN_SET_EQ, они же лежат в bytes: там проще сравнить
+ */
+#define SCAN_SET_EQ 3  // До стольких первых байтов — прямое сравнение
+
+typedef struct scan_set
+{
+    uint8_t   lo[2][16];
+    uint8_t   hi[2][16];
+    uint8_t   first[256];
+    uint8_t   pairs[256 * 256 / 8];  // Бит a << 8 | b
+    unsigned  nbytes;                // Разных первых байтов
+    uint8_t   bytes[SCAN_SET_EQ];
+} scan_set_t;
+
+/*
+ * Выбирает реализацию под текущий CPU. Вызывать до старта сервера (и потоков)
+ */
+void scan_init(void);
+
+/*
+ * Имя выбранной реализации ("avx2", "sse2", "scalar") — для лога
+ */
+const char *scan_impl_name(void);
+
+/*
+ * Ставит реализацию по имени ("avx2", "sse2", "scalar") вместо выбранной scan_init —
+ * для сравнения в bench/scan_bench.c. 0 или -1, если такой нет или CPU её не умеет
+ */
+int scan_select(const char *name);
+
+/*
+ * Конец заголовка: смещение сразу за первым "\r\n\r\n" в p[0..len) или 0, если его нет.
+ * from — сколько байт с начала уже просмотрено прошлым вызовом без успеха
+ * (разделитель на стыке учитывается): при дозаписи в буфер не сканируем всё заново
+ */
+size_t scan_head_end(const uint8_t *p, size_t len, size_t from);
+
+/*
+ * dst = src XOR ключ маски WebSocket; phase — смещение src от начала payload'а
+ * (ключ циклический по 4 байта). dst и src могут совпадать
+ */
+void scan_unmask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4], size_t phase);
+
+/*
+ * Длина ASCII-префикса p (индекс первого байта >= 0x80 или len)
+ */
+size_t scan_ascii(const uint8_t *p, size_t len);
+
+/*
+ * Пустое множество
+ */
+void scan_set_init(scan_set_t *set);
+
+/*
+ * Добавляет пару (a, b); b < 0 — a с любым следующим байтом
+ */
+void scan_set_add(scan_set_t *set, uint8_t a, int b);
+
+/*
+ * Индекс первой позиции p, с которой начинается пара из множества, или len.
+ * Последний байт p отдаётся, если он может начать пару: второй придёт следующим куском
+ */
+size_t scan_set_find(const scan_set_t *set, const uint8_t *p, size_t len);
+
+/*
+ * Распознаёт стартовую строку HTTP/1.x по первым байтам буфера
+ */
+scan_http_t scan_http_start(const uint8_t *p, size_t len);
+
+#endif // SCAN_H
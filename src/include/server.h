@@ -8,6 +8,11 @@
  */
 typedef void read_cb(int fd, void *ud);
 
+/*
+ * Тип callback для таймера: ud — контекст, переданный при регистрации
+ */
+typedef void timer_cb(void *ud);
+
 /*
  * Основная структура сервера-прокси
  */
@@ -46,4 +51,16 @@ int server_start(void);
  */
 int server_init(char *host, char *port, char *username, char *passwd);
 
+/*
+ * Регистрирует периодический таймер event-цикла: cb дёргается раз в interval_ms
+ * из того же потока, что и хэндлеры сокетов (никаких локов не нужно).
+ * Возвращает 0 при успехе, <0 если слоты таймеров кончились
+ */
+int server_timer_add(int interval_ms, timer_cb *cb, void *ud);
+
+/*
+ * Монотонное время в миллисекундах — для дедлайнов и таймеров
+ */
+unsigned long long server_now_ms(void);
+
 #endif // SERVER_H
@@ -0,0 +1,72 @@
+#ifndef SHMSTAT_H
+#define SHMSTAT_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Сегмент статистики в разделяемой памяти (-G): /dev/shm/cliproxy.<pid>.
+ *
+ * Отдельный поток сервера раз в период (от 1 мс) складывает шарды metrics.h и
+ * счётчики stats.h и переписывает значения в сегмент под seqlock'ом. Читатель
+ * (cliproxy-stat) просто мапит файл: ни сокетов, ни системных вызовов на чтение,
+ * ни потоков сервера, которые он мог бы задержать, — работает, даже когда
+ * админ-сокет или /metrics повисли.
+ *
+ * Раскладка общая для сервера и cliproxy-stat. Сегмент самоописываемый: имена и
+ * типы полей лежат в заголовке, так что новые поля не ломают старый cliproxy-stat.
+ * SHMSTAT_VERSION меняется, только если меняется сама раскладка.
+ */
+
+#define SHMSTAT_MAGIC       "CLIPSTAT"  // Пишется последним — до него сегмент не готов
+#define SHMSTAT_VERSION     1
+#define SHMSTAT_FIELDS_MAX  64          // Полей максимум
+#define SHMSTAT_NAME        32          // Длина имени поля с нулём
+#define SHMSTAT_PATH        "/dev/shm/cliproxy.%d"
+
+/*
+ * Тип поля: счётчик растёт с запуска, читатель считает по нему скорость;
+ * гейдж — текущее значение
+ */
+typedef enum shmstat_kind
+{
+    SHMSTAT_COUNTER = 1,
+    SHMSTAT_GAUGE   = 2
+} shmstat_kind_t;
+
+typedef struct shmstat_field
+{
+    char      name[SHMSTAT_NAME];
+    uint32_t  kind;
+    uint32_t  reserved;
+} shmstat_field_t;
+
+/*
+ * Заголовок до seq пишется один раз при создании. Дальше меняются только seq,
+ * now_us, publishes и value — под seqlock'ом: seq нечётный, пока сервер пишет
+ */
+typedef struct shmstat_segment
+{
+    char              magic[8];
+    uint32_t          version;
+    uint32_t          size;       // sizeof(shmstat_segment_t) у сервера
+    int64_t           pid;
+    uint64_t          start_us;   // CLOCK_REALTIME запуска
+    uint32_t          period_us;  // Как часто сервер публикует
+    uint32_t          nfields;
+    shmstat_field_t   field[SHMSTAT_FIELDS_MAX];
+
+    _Alignas(64) atomic_uint  seq;
+    uint32_t          reserved;
+    uint64_t          now_us;     // CLOCK_MONOTONIC публикации — по нему читатель считает скорости
+    uint64_t          publishes;  // Сколько раз опубликовано
+    uint64_t          value[SHMSTAT_FIELDS_MAX];
+} shmstat_segment_t;
+
+/*
+ * Создаёт сегмент и запускает поток публикации раз в period_ms.
+ * 0 — ок, <0 — ошибка. Файл удаляется при выходе
+ */
+int shmstat_init(int period_ms);
+
+#endif // SHMSTAT_H
@@ -28,6 +28,15 @@ typedef enum sock_state {
     sock_closed        // Сокет полностью закрыт
 } sock_state_t;
 
+/*
+ * Причины, по которым чтение из сокета поставлено на паузу (битовая маска).
+ * Пока хоть одна выставлена, epoll_modify не включает EPOLLIN
+ */
+typedef enum sock_pause_reason {
+    SOCK_PAUSE_WINDOW = 0x01,  // Кончилось окно стрима мультиплексора
+    SOCK_PAUSE_FREEZE = 0x02   // Туннель заморожен (см. freeze.h)
+} sock_pause_reason_t;
+
 /*
  * Основная структура для руля одного сокета
  */
@@ -40,6 +49,11 @@ struct sock {
     tunnel_t      *tunnel;         // Связь с родительским туннелем
     sock_state_t   state;          // Текущий стейт соединения
     int            is_client;      // Флаг: клиент (1) или удалённый (0) сокет
+    void          *context;        // Контекст владельца, если сокет пока не в туннеле (tunnel == NULL)
+    struct sock   *next_closed;    // Очередь на освобождение после текущей пачки epoll-событий
+    int            paused;         // Маска sock_pause_reason_t — почему не читаем
+    struct sock   *frozen_prev;    // Список сокетов, стоящих на паузе из-за заморозки
+    struct sock   *frozen_next;
 };
 
 /*
@@ -50,16 +64,29 @@ int epoll_add(sock_t *sock);
 
 /*
  * Апдейтит набор epoll-событий: writable=1 — врубаем EPOLLOUT, readable=1 — врубаем EPOLLIN
+ * (если чтение не на паузе, см. sock_pause)
  * Возвращает 0 при норме, <0 при ошибке
  */
 int epoll_modify(sock_t *sock, int writable, int readable);
 
+/*
+ * Ставит чтение сокета на паузу по причине reason: EPOLLIN снимается, данные копятся
+ * в ядре, и TCP-окно само притормаживает отправителя
+ */
+void sock_pause(sock_t *sock, int reason);
+
+/*
+ * Снимает паузу reason; если других причин нет — EPOLLIN снова включается
+ */
+void sock_resume(sock_t *sock, int reason);
+
 /*
  * Создаёт sock\_t с буферами для чтения/записи
  * fd — уже открытый дескриптор
  * state — стартовый стейт (напр. sock\_connecting)
  * isclient — клиентский (1) или удалённый (0) сокет
- * tunnel — указатель на родительский туннель
+ * tunnel — указатель на родительский туннель (NULL — сокет живёт сам по себе,
+ *          например в пуле, и хэндлеры ему назначает владелец)
  * Возвращает указатель на sock\_t при успехе, или NULL при ошибке
  */
 sock_t* sock_create(int fd, sock_state_t state, int is_client, tunnel_t *tunnel);
@@ -75,6 +102,25 @@ void sock_shutdown(sock_t *sock);
  */
 void sock_force_shutdown(sock_t *sock);
 
+/*
+ * EPOLLERR/EPOLLHUP на сокете, который не ждёт ни чтения, ни записи (стоит на паузе):
+ * соединение уже оборвано — закрываем, иначе epoll будет сообщать об этом вечно
+ */
+void sock_hangup(sock_t *sock);
+
+/*
+ * Тихо закрывает сокет и освобождает ресурсы (штатное закрытие, без ERROR в лог).
+ * Если это был последний сокет туннеля — освобождает и туннель
+ */
+void sock_release(sock_t *sock);
+
+/*
+ * Освобождает память сокетов, закрытых за текущую пачку epoll-событий.
+ * Зовётся event-циклом после пачки: до этого события на закрытые сокеты
+ * ещё могут лежать в массиве epoll_wait и их надо просто пропустить (state == sock_closed)
+ */
+void sock_reap(void);
+
 /*
  * Переводит файловый дескриптор в неблокирующий режим с помощью fcntl
  * Возвращает 0 при успехе или отрицательное число при ошибке
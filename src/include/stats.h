@@ -0,0 +1,110 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "tunnel.h"
+
+/*
+ * Живая статистика прокси для команд терминала stats и top.
+ *
+ * Пишет только event loop, читает кто угодно без локов:
+ *   • глобальные счётчики — атомики (открыто/закрыто туннелей, байты в обе стороны,
+ *     память буферов). Пишущий у каждого один, так что это обычный store, без lock-префикса;
+ *     исключение — память буферов: блок может отпустить и поток анализа
+ *   • реестр туннелей — слоты в кусках по STATS_CHUNK, куски не освобождаются
+ *     и не переезжают. Состояние и подписи (peer, user, target) слота читаются
+ *     под seqlock'ом, байты — отдельные атомики, которые event loop просто наращивает
+ *
+ * Читатель (stats_print, stats_top) ничего не ждёт от event loop'а: снимает
+ * слепок, спит секунду, снимает второй и считает скорости по разнице.
+ */
+
+/*
+ * Слот туннеля в реестре (см. stats.c)
+ */
+typedef struct stats_slot stats_slot_t;
+
+/*
+ * Копия слота реестра у читателя
+ */
+typedef struct stats_tunnel
+{
+    unsigned long long  id;
+    tunnel_state_t      state;
+    unsigned long long  start_us;    // Монотонное время создания
+    unsigned long long  age_ms;      // Сколько живёт на момент слепка
+    char                peer[64];
+    char                user[64];
+    char                target[272]; // host:port назначения или "-"
+    unsigned long long  rx[2];       // Прочитано со стороны, [1] — клиент, [0] — удалённый
+} stats_tunnel_t;
+
+/*
+ * Глобальные счётчики и туннели по состояниям на один момент
+ */
+typedef struct stats_summary
+{
+    unsigned long long  opened;      // Туннелей с запуска
+    unsigned long long  closed;
+    unsigned long long  rx[2];       // Байт прочитано со сторон с запуска
+    long long           buffer_mem;  // Байт в блоках буферов
+    unsigned            states[connected_state + 1];
+} stats_summary_t;
+
+/*
+ * Туннель создан: занимает ему слот в реестре (tunnel->slot)
+ */
+void stats_tunnel_open(tunnel_t *tunnel);
+
+/*
+ * Туннель сменил состояние или узнал адрес назначения — переписать слот
+ */
+void stats_tunnel_update(tunnel_t *tunnel);
+
+/*
+ * Из сокета стороны is_client прочитано n байт
+ */
+void stats_tunnel_read(tunnel_t *tunnel, int is_client, size_t n);
+
+/*
+ * Туннель освобождается — слот возвращается в реестр
+ */
+void stats_tunnel_close(tunnel_t *tunnel);
+
+/*
+ * Память блоков буферов изменилась на delta байт (из любого потока)
+ */
+void stats_buffer_mem(ssize_t delta);
+
+/*
+ * Event loop: живой туннель с номером id или NULL
+ */
+tunnel_t *stats_tunnel_find(unsigned long long id);
+
+/*
+ * Слепок счётчиков и состояний — из любого потока, без ожидания. Реестр не
+ * обходит: по состояниям event loop ведёт отдельные счётчики, так что это
+ * десяток load'ов — можно звать хоть каждые 10 мс
+ */
+void stats_summary(stats_summary_t *summary);
+
+/*
+ * Слепок живых туннелей — из любого потока. *tunnels освобождает вызывающий (free).
+ * Возвращает их число
+ */
+size_t stats_tunnels(stats_tunnel_t **tunnels);
+
+/*
+ * Команда stats: туннели по состояниям, открытия/закрытия и байты в секунду,
+ * память буферов. Блокирует вызывающий поток на секунду замера
+ */
+void stats_print(void);
+
+/*
+ * Команда top: n туннелей, прокачавших больше всего байт за секунду замера
+ */
+void stats_top(int n);
+
+#endif // STATS_H
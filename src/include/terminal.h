@@ -1,20 +1,16 @@
 #ifndef TERMINAL_H
 #define TERMINAL_H
 
-#include <stdbool.h>
-
 /*
  * Запускает фоновый поток, который читает команды из stdin.
  * Поддержка команд:
- * freeze — ставит паузу на форвардинг пакетов
- * stop   — корректно выключает программу (через SIGINT)
+ * freeze   — ставит паузу на форвардинг (всего прокси или tunnel=/user=/host=/port=, см. freeze.h)
+ * unfreeze — снимает её
+ * stop     — корректно выключает программу (через SIGINT)
+ * level    — показывает или меняет уровни логирования ("level error,protocol=info")
+ * stats    — туннели по состояниям, открытия/закрытия и байты в секунду, память буферов
+ * top [N]  — N туннелей, прокачавших больше всего за последнюю секунду (см. stats.h)
  */
 void terminal_start(void);
 
-/*
- * Проверяет, включён ли сейчас режим «freeze».
- * Если true — туннель читает и логирует данные, но не шлёт дальше.
- */
-bool terminal_is_frozen(void);
-
 #endif // TERMINAL_H
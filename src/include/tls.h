@@ -0,0 +1,74 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Потоковый разбор TLS ClientHello (первый полёт клиента): SNI, ALPN, версии.
+ *
+ * Записи TLS и сам ClientHello могут резаться чтениями как угодно — парсер идёт
+ * по байтам: длинные неинтересные поля (random, session id, шифры, чужие расширения)
+ * пропускаются счётчиком, в буфер acc собираются только маленькие поля и три
+ * нужных расширения. Все длины сверяются с объемлющими, ничего не выделяется,
+ * за пределы поданного куска не читается.
+ */
+
+#define TLS_FIELD_MAX     512   // Самое длинное расширение, которое собираем (SNI, ALPN, версии)
+#define TLS_SNI_MAX       256
+#define TLS_ALPN_MAX      128   // Протоколы ALPN через запятую
+#define TLS_VERSIONS_MAX  8
+
+typedef enum tls_result
+{
+    TLS_MORE,   // ClientHello ещё не весь
+    TLS_DONE,   // Разобран, результат в hello
+    TLS_NOT     // Не TLS или ClientHello битый — дальше не смотрим
+} tls_result_t;
+
+/*
+ * Что клиент сказал о себе
+ */
+typedef struct tls_hello
+{
+    char      sni[TLS_SNI_MAX];             // server_name (host_name), "" — нет
+    char      alpn[TLS_ALPN_MAX];           // "h2,http/1.1", "" — нет
+    uint16_t  legacy_version;               // Из заголовка ClientHello (для TLS 1.3 — 0x0303)
+    uint16_t  versions[TLS_VERSIONS_MAX];   // supported_versions без GREASE
+    unsigned  nversions;
+} tls_hello_t;
+
+typedef struct tls_parser
+{
+    int           state;
+    // Слой записей
+    uint8_t       rec_hdr[5];
+    size_t        rec_hdr_len;
+    size_t        rec_left;      // Сколько payload'а текущей записи осталось
+    // Слой ClientHello
+    size_t        hs_left;       // Сколько тела ClientHello осталось
+    size_t        ext_left;      // Сколько блока расширений осталось
+    uint16_t      ext_type;
+    size_t        skip;          // Сколько байт пропустить перед следующим полем
+    size_t        want;          // Сколько байт собрать в acc для следующего поля
+    size_t        acc_len;
+    uint8_t       acc[TLS_FIELD_MAX];
+    tls_hello_t   hello;
+} tls_parser_t;
+
+/*
+ * Сброс перед первым байтом клиента
+ */
+void tls_parser_init(tls_parser_t *p);
+
+/*
+ * Кормит парсер очередными байтами клиента. После TLS_DONE/TLS_NOT больше не кормить
+ */
+tls_result_t tls_parser_feed(tls_parser_t *p, const uint8_t *data, size_t len);
+
+/*
+ * Имя версии для лога: "TLS1.3", ..., "0x7f1c" для неизвестных
+ */
+const char *tls_version_name(uint16_t version, char *buf, size_t size);
+
+#endif // TLS_H
@@ -2,6 +2,8 @@
 #define TUNNEL_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
 #include "protocol.h"
 
 /*
@@ -10,6 +12,46 @@
  */
 typedef struct sock sock_t;
 
+/*
+ * Соединение с родительским SOCKS5-прокси (см. upstream.h)
+ */
+typedef struct upstream_conn upstream_conn_t;
+
+/*
+ * Стрим мультиплексора между инстансами (см. mux.h)
+ */
+typedef struct mux_stream mux_stream_t;
+
+/*
+ * HTTP-фронт туннеля (см. http_proxy.h)
+ */
+typedef struct http_front http_front_t;
+
+/*
+ * Состояние инспекции трафика туннеля на потоке анализа (см. inspect.h)
+ */
+typedef struct inspect_flow inspect_flow_t;
+
+/*
+ * Куски ClientHello, придержанные до решения политики инспекции (см. inspect.c)
+ */
+typedef struct inspect_held inspect_held_t;
+
+/*
+ * Разбор TLS ClientHello клиента (см. tls.h)
+ */
+typedef struct tls_parser tls_parser_t;
+
+/*
+ * Состояние записи туннеля в pcapng (см. capture.h)
+ */
+typedef struct capture_flow capture_flow_t;
+
+/*
+ * Слот туннеля в реестре живой статистики (см. stats.h)
+ */
+typedef struct stats_slot stats_slot_t;
+
 /*
  * Доступные состояния туннеля SOCKS5:
  * open_state       — ожидаем Client Greeting
@@ -27,6 +69,43 @@ typedef enum tunnel_state
     connected_state
 } tunnel_state_t;
 
+/*
+ * Почему закрылся туннель: фиксируется первая причина (tunnel_close_reason),
+ * остальное — её последствия
+ */
+typedef enum tunnel_close
+{
+    close_none,         // Явной причины не было
+    close_client_eof,   // Клиент закрыл соединение
+    close_remote_eof,   // Удалённый сервер закрыл соединение
+    close_read_error,   // Ошибка чтения
+    close_write_error,  // Ошибка записи
+    close_protocol,     // Кривой greeting/auth/request от клиента
+    close_auth,         // Неверный логин/пароль
+    close_connect,      // Не удалось подключиться к назначению
+    close_forward,      // Некуда пересылать — другой стороны уже нет
+    close_aborted,      // Прибит целиком (линк мультиплексора и т.п.)
+    close_killed        // Закрыт командой kill админ-сокета
+} tunnel_close_t;
+
+/*
+ * Счётчики сессии туннеля — из них при освобождении собирается одна
+ * access-запись в лог. Индекс сторон как у is_client: [1] — клиент, [0] — удалённый.
+ * Времена — монотонные микросекунды, 0 — этап не был достигнут
+ */
+typedef struct tunnel_stats
+{
+    unsigned long long rx[2];        // Прочитано байт со стороны
+    unsigned long long tx[2];        // Записано байт в сторону
+    unsigned           reads[2];     // Вызовов read с данными
+    unsigned           writes[2];    // Вызовов write с данными
+    unsigned long long start_us;     // Туннель создан
+    unsigned long long request_us;   // Хэндшейк клиента пройден, пошёл коннект
+    unsigned long long connected_us; // Клиенту ответили, что туннель установлен
+    unsigned long long first_us;     // Первый байт от удалённой стороны после установки
+    tunnel_close_t     close;
+} tunnel_stats_t;
+
 /*
  * Основная структура туннеля:
  * client_sock — сокет клиента, откуда читаем запросы
@@ -35,9 +114,14 @@ typedef enum tunnel_state
  * op, ap, rp  — данные для greeting, auth и request этапов
  * read_count  — сколько байт прочитано на этапе
  * closed      — флаг, что туннель закрыт (пока не используется)
+ * dst_host, dst_port — адрес назначения строкой (заполняется при коннекте)
+ * upstream    — незавершённый хэндшейк с родительским прокси (или NULL)
+ * stream      — стрим мультиплексора, заменяющий одну из сторон (или NULL)
+ * http        — клиент говорит HTTP-прокси, а не SOCKS5 (или NULL)
  */
 typedef struct tunnel
 {
+    unsigned long long id;        // Номер туннеля с запуска — для логов и селектора захвата
     sock_t          *client_sock;
     sock_t          *remote_sock;
     tunnel_state_t   state;
@@ -46,16 +130,38 @@ typedef struct tunnel
     request_protocol_t rp;
     size_t           read_count;
     int              closed;
+    char             dst_host[256];
+    char             dst_port[16];
+    upstream_conn_t *upstream;
+    mux_stream_t    *stream;
+    http_front_t    *http;
+    inspect_flow_t  *inspect;     // Заводится при первых данных установленного туннеля
+    int              inspect_off; // Инспекция туннеля кончилась — только форвардинг
+    tls_parser_t    *tls;         // Клиент начал с TLS: SNI/ALPN/версии из ClientHello
+    inspect_held_t  *inspect_held; // Снимки первого полёта клиента, пока ClientHello не весь
+    capture_flow_t  *capture;     // Туннель пишется в pcapng
+    int              capture_off; // В захват не попал (или захват выключен)
+    char             peer[64];    // Адрес клиента "ip:port" (пусто у виртуальных)
+    tunnel_stats_t   stats;
+    stats_slot_t    *slot;        // Слот в реестре stats/top (NULL — реестр полон)
 } tunnel_t;
 
 /*
  * Создаёт новый туннель для принятого клиентского соединения.
+ * peer — адрес клиента из accept (для access-записи, может быть NULL).
  * В случае ошибки освобождает ресурсы и закрывает fd.
  */
-tunnel_t* tunnel_create(int fd);
+tunnel_t* tunnel_create(int fd, const struct sockaddr *peer);
 
 /*
- * Освобождает память, выделенную под tunnel_t.
+ * Создаёт туннель без клиентского сокета: клиентскую сторону заменяет стрим
+ * мультиплексора. Стартует в request_state — вызывающий заполняет rp и коннектится.
+ */
+tunnel_t* tunnel_create_virtual(void);
+
+/*
+ * Освобождает память, выделенную под tunnel_t, перед этим пишет в лог
+ * access-запись сессии (см. tunnel_stats_t).
  */
 void tunnel_release(tunnel_t *tunnel);
 
@@ -90,4 +196,34 @@ int tunnel_write_client(tunnel_t *tunnel, void *src, size_t size);
  */
 int tunnel_connect_to_remote(tunnel_t *tunnel);
 
+/*
+ * Делает уже открытый сокет (из пула и т.п.) удалённым сокетом туннеля:
+ * назначает туннельные хэндлеры и прописывает его в tunnel->remote_sock.
+ * Регистрацию в epoll не трогает — сокет там уже должен быть.
+ */
+void tunnel_attach_remote(tunnel_t *tunnel, sock_t *sock);
+
+/*
+ * Переносит всё прочитанное сокетом стороны is_client на противоположную сторону:
+ * в write_buffer её сокета или в стрим мультиплексора.
+ * Возвращает 0 или <0, если противоположной стороны уже нет
+ */
+int tunnel_forward(tunnel_t *tunnel, int is_client);
+
+/*
+ * Edge-стрим открыт: bnd — ATYP, BND.ADDR, BND.PORT от core.
+ * Шлёт клиенту ответ и переводит туннель в connected_state
+ */
+int tunnel_stream_opened(tunnel_t *tunnel, const uint8_t *bnd, size_t len);
+
+/*
+ * Запоминает причину закрытия, если её ещё нет
+ */
+void tunnel_close_reason(tunnel_t *tunnel, tunnel_close_t reason);
+
+/*
+ * Жёстко закрывает всё, что осталось от туннеля, и освобождает его
+ */
+void tunnel_abort(tunnel_t *tunnel);
+
 #endif // TUNNEL_H
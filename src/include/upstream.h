@@ -0,0 +1,56 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdbool.h>
+
+#include "tunnel.h"
+
+/*
+ * Режим апстрима: вместо прямого коннекта к назначению туннель уходит через
+ * один из родительских SOCKS5-прокси. Мы сами играем роль SOCKS5-клиента:
+ * greeting → (USER/PASS) → CONNECT.
+ *
+ * Родитель выбирается консистентным хэшированием по назначению (host:port),
+ * чтобы один и тот же адрес стабильно ходил через одного родителя (кэш у него тёплый).
+ * Упавшие родители выкидываются из кольца (пассивно — по ошибкам коннекта/хэндшейка,
+ * активно — пробами по таймеру) и возвращаются, когда проба прошла.
+ * Для каждого родителя держится пул тёплых соединений, уже прошедших greeting/auth,
+ * так что новому туннелю остаётся отправить только CONNECT.
+ */
+
+/*
+ * Парсит список родителей вида "[user:pass@]host:port,[user:pass@]host:port,..."
+ * и стартует пулы и health-check'и (таймер event-цикла).
+ * Вызывать после server_init. Возвращает 0 при успехе, <0 при ошибке
+ */
+int upstream_init(const char *parents);
+
+/*
+ * Включён ли режим апстрима (задан хотя бы один родитель)
+ */
+bool upstream_enabled(void);
+
+/*
+ * Выбирает родителя для назначения из tunnel->dst_host/dst_port,
+ * берёт тёплое соединение из пула (или открывает новое) и вешает его на туннель
+ * как remote_sock. Туннель уходит в connecting_state.
+ * Возвращает 0 при успехе, <0 если живых родителей нет или коннект не удался
+ */
+int upstream_connect(tunnel_t *tunnel);
+
+/*
+ * Продвигает хэндшейк с родителем по данным в remote_sock туннеля.
+ * Возвращает:
+ *   >0 — родитель ответил успехом на CONNECT, туннель можно считать установленным
+ *    0 — ждём ещё данных/записи
+ *   <0 — ошибка (родитель отказал или отвалился)
+ */
+int upstream_connecting_handle(tunnel_t *tunnel);
+
+/*
+ * Освобождает состояние незавершённого хэндшейка (сокет при этом не трогает —
+ * он принадлежит туннелю)
+ */
+void upstream_conn_release(upstream_conn_t *conn);
+
+#endif // UPSTREAM_H
@@ -0,0 +1,104 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Потоковый декодер фреймов WebSocket (RFC 6455) для инспекции туннеля.
+ *
+ * Включается после того, как HTTP-парсер увидел 101 на Upgrade: websocket.
+ * Заголовок фрейма может прийти по байту — копится в hdr. Длины 7/16/64 бит,
+ * фрагментированные сообщения (continuation), управляющие фреймы посреди сообщения.
+ * Payload текстовых сообщений снимается с маски векторно (scan_unmask) блоками
+ * на стеке и проверяется на UTF-8 (ASCII-прогоны — scan_ascii); бинарные
+ * просто отсчитываются по длине. Сами данные туннеля не меняются.
+ */
+
+#define WS_PREVIEW_MAX  512  // Сколько начала текстового сообщения показываем в логе
+#define WS_CONTROL_MAX  125  // Payload управляющего фрейма по RFC
+
+#define WS_OP_CONT   0x0
+#define WS_OP_TEXT   0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE  0x8
+#define WS_OP_PING   0x9
+#define WS_OP_PONG   0xA
+
+typedef enum ws_state
+{
+    WS_HEADER,   // Копим заголовок фрейма
+    WS_PAYLOAD,  // Идёт payload фрейма
+    WS_BROKEN    // Нарушение протокола — дальше не разбираем
+} ws_state_t;
+
+typedef struct ws_stream
+{
+    ws_state_t  state;
+    uint8_t     hdr[14];
+    size_t      hdr_len;
+    uint8_t     opcode;         // Текущего фрейма
+    int         fin;
+    int         masked;
+    uint8_t     key[4];
+    uint64_t    left;           // Сколько payload'а фрейма осталось
+    uint64_t    offset;         // Сколько прошло (фаза маски)
+
+    uint8_t     msg_opcode;     // TEXT/BINARY незаконченного сообщения, 0 — нет
+    int         msg_deflate;    // RSV1: permessage-deflate, payload сжат
+    uint64_t    msg_len;
+    unsigned    msg_frames;
+
+    uint8_t     utf8_need;      // Сколько байт продолжения ждём
+    uint8_t     utf8_lo;        // Допустимый диапазон следующего байта
+    uint8_t     utf8_hi;
+    int         utf8_bad;
+
+    uint8_t     ctrl[WS_CONTROL_MAX];
+    size_t      ctrl_len;
+    char        preview[WS_PREVIEW_MAX];
+    size_t      preview_len;
+    unsigned    messages;       // Сколько сообщений собрали
+} ws_stream_t;
+
+/*
+ * Оба направления: [0] remote → client, [1] client → remote
+ */
+typedef struct ws_flow
+{
+    ws_stream_t  dir[2];
+} ws_flow_t;
+
+/*
+ * Собранное сообщение (все фреймы)
+ */
+typedef struct ws_message
+{
+    uint8_t      opcode;       // WS_OP_TEXT или WS_OP_BINARY
+    uint64_t     len;
+    unsigned     frames;
+    int          deflate;      // Сжато — текст не проверялся и не показывается
+    int          utf8_ok;
+    const char  *preview;      // Начало текста (снятое с маски)
+    size_t       preview_len;
+} ws_message_t;
+
+typedef struct ws_flow_cb
+{
+    void (*on_message)(void *ud, int is_client, const ws_message_t *msg);
+    void (*on_control)(void *ud, int is_client, uint8_t opcode, const uint8_t *payload, size_t len);
+    void (*on_error)(void *ud, int is_client, const char *what);
+} ws_flow_cb_t;
+
+/*
+ * Сброс состояния обоих направлений
+ */
+void ws_flow_init(ws_flow_t *ws);
+
+/*
+ * Кормит направление is_client очередной порцией фреймов
+ */
+void ws_flow_feed(ws_flow_t *ws, const uint8_t *data, size_t len, int is_client,
+                  const ws_flow_cb_t *cb, void *ud);
+
+#endif // WEBSOCKET_H
@@ -0,0 +1,773 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+
+#include "inspect.h"
+#include "buffer.h"
+#include "sock.h"
+#include "server.h"
+#include "logger.h"
+#include "protocol_parser.h"
+#include "dissect.h"
+#include "match.h"
+#include "tls.h"
+
+
+#define INSPECT_RING         4096               // Слотов в кольце одного потока (степень двойки)
+#define INSPECT_INFLIGHT     (32 * 1024 * 1024) // Сколько байт снимков может ждать в одном кольце
+#define INSPECT_THREADS_MAX  16
+#define INSPECT_SPIN         64                 // Сколько раз уступить CPU на пустом кольце перед сном
+#define INSPECT_IDLE_MS      100                // Сон пустого потока без сигнала (страховка)
+#define INSPECT_STATS_MS     60000              // Раз в столько пишем в лог, сколько выбросили
+#define INSPECT_RULES_MAX    16                 // Правил skip-* каждого вида
+#define INSPECT_TARGET_MAX   (256 + 16 + 1)     // "хост:порт" для событий матчера
+#define INSPECT_HELD_MAX     16                 // Кусков ClientHello, придержанных до решения политики
+
+#define INSPECT_ENOUGH_BUDGET 1                 // Почему дальше не смотрим: разобрали policy.messages
+#define INSPECT_ENOUGH_DONE   2                 // Диссектор закончил или протокол не опознан (и матчеру нечего искать)
+
+
+/*
+ * Политика инспекции (-I): что и сколько разбирать
+ */
+typedef struct inspect_policy
+{
+    unsigned long long bytes;                            // Первые столько байт туннеля, 0 — все
+    unsigned           messages;                         // Первые столько сообщений, 0 — все
+    unsigned           sample;                           // Один туннель из sample, 0/1 — каждый
+    unsigned           nports;
+    unsigned           ports[INSPECT_RULES_MAX];         // skip-port
+    unsigned           nhosts;
+    char               hosts[INSPECT_RULES_MAX][256];    // skip-host: имя или ".суффикс"
+    unsigned           nusers;
+    char               users[INSPECT_RULES_MAX][256];    // skip-user
+} inspect_policy_t;
+
+
+/*
+ * Состояние разбора туннеля. Ссылки: туннель + каждый кусок в кольце.
+ * lost и budget трогает только event loop, dissect — только поток анализа shard,
+ * enough — поток анализа пишет, event loop читает. target, user и opaque
+ * заполняются при создании и дальше не меняются: потоки анализа в tunnel_t не лезут
+ */
+struct inspect_flow
+{
+    atomic_uint         refs;
+    unsigned            shard;
+    int                 lost[2];   // Кусок направления выброшен — дальше его не публикуем
+    unsigned long long  budget;    // Сколько байт ещё можно опубликовать
+    atomic_int          enough;    // INSPECT_ENOUGH_*: дальше туннель не смотрим
+    dissect_flow_t      dissect;   // Протокол туннеля и его разбор
+    match_stream_t      match[2];  // Матчер ключевых слов по направлениям
+    int                 opaque;    // Туннель под TLS: после ClientHello матчеру нечего искать
+    char                target[INSPECT_TARGET_MAX];
+    char                user[256];
+};
+
+/*
+ * Снимки кусков первого полёта клиента: пока ClientHello не весь, решать по SNI
+ * рано, а форвардинг их уже унёс — держим ссылки на блоки и публикуем потом
+ */
+struct inspect_held
+{
+    unsigned       n;
+    buffer_view_t  view[INSPECT_HELD_MAX];
+};
+
+typedef struct inspect_event
+{
+    inspect_flow_t *flow;
+    buffer_view_t   view;
+    int             is_client;
+} inspect_event_t;
+
+/*
+ * SPSC-кольцо: пишет только event loop (head), читает только свой поток анализа (tail)
+ */
+typedef struct inspect_ring
+{
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_size_t    inflight;  // Байт в снимках, ждущих разбора
+    atomic_int       sleeping;  // Поток ждёт на wake — продюсеру надо разбудить
+    pthread_mutex_t  lock;
+    pthread_cond_t   wake;
+    pthread_t        thread;
+    inspect_event_t  slots[INSPECT_RING];
+} inspect_ring_t;
+
+
+static inspect_ring_t   *rings;
+static unsigned          nrings;
+static unsigned          next_shard;
+static inspect_policy_t  policy;
+static unsigned          sample_tick;
+
+// Счётчики ведёт только event loop
+static unsigned long long published;
+static unsigned long long dropped;
+static unsigned long long lost;
+static unsigned long long skipped;
+static unsigned long long exhausted;
+static unsigned long long finished;
+static unsigned long long tls_hellos;
+static unsigned long long tls_13;
+static unsigned long long tls_h2;
+static unsigned long long tls_bad;
+static unsigned long long dropped_logged;
+static unsigned long long policy_logged;
+static unsigned long long tls_logged;
+static unsigned long long matches_logged;
+
+// Совпадения матчера считают потоки анализа
+static atomic_ullong      matches;
+
+
+static void flow_put(inspect_flow_t *flow)
+{
+    if (atomic_fetch_sub_explicit(&flow->refs, 1, memory_order_acq_rel) == 1)
+    {
+        dissect_flow_free(&flow->dissect);
+        free(flow);
+    }
+}
+
+void inspect_flow_release(inspect_flow_t *flow)
+{
+    flow_put(flow);
+}
+
+void inspect_held_release(inspect_held_t *held)
+{
+    for (unsigned i = 0; i < held->n; ++i)
+    {
+        buffer_view_release(&held->view[i]);
+    }
+    free(held);
+}
+
+typedef struct inspect_hit_ctx
+{
+    const inspect_flow_t *flow;
+    int                   is_client;
+} inspect_hit_ctx_t;
+
+/*
+ * Событие матчера: одной строкой key=value, чтобы его было легко выгрепать
+ */
+static void on_match(void *ud, const match_hit_t *hit)
+{
+    const inspect_hit_ctx_t *ctx = ud;
+    atomic_fetch_add_explicit(&matches, 1, memory_order_relaxed);
+    LOG_WARN("Match: rule=\"%s\" pattern=\"%s\" target=%s user=%s dir=%s offset=%llu len=%zu",
+             hit->rule, hit->pattern, ctx->flow->target, ctx->flow->user[0] ? ctx->flow->user : "-",
+             ctx->is_client ? "client->remote" : "remote->client", (unsigned long long)hit->offset, hit->len);
+}
+
+/*
+ * Разбор одного куска на потоке анализа: сначала матчер ключевых слов (если есть
+ * -K), потом диссектор — туннель классифицируется по первым байтам и дальше идёт
+ * прямо в свой диссектор; незнакомый протокол — hex первого куска каждого направления
+ */
+static void inspect_chunk(inspect_flow_t *flow, const inspect_event_t *ev)
+{
+    const uint8_t *data = (const uint8_t *)ev->view.data;
+    size_t         len  = ev->view.len;
+
+    if (atomic_load_explicit(&flow->enough, memory_order_relaxed))
+    {
+        // Бюджет сообщений кончился (или смотреть нечего), а куски ещё были в кольце
+        return;
+    }
+
+    bool scan = match_enabled();
+    if (scan)
+    {
+        inspect_hit_ctx_t ctx = { flow, ev->is_client };
+        match_feed(&flow->match[ev->is_client ? 1 : 0], data, len, on_match, &ctx);
+    }
+
+    dissect_result_t r = dissect_feed(&flow->dissect, data, len, ev->is_client);
+    if (r == DISSECT_RAW)
+    {
+        parse_and_log_raw(data, len, ev->is_client);
+    }
+    else if (r == DISSECT_DONE)
+    {
+        // Диссектору больше нечего делать, но матчер смотрит весь открытый поток
+        if (!scan || flow->opaque)
+        {
+            atomic_store_explicit(&flow->enough, INSPECT_ENOUGH_DONE, memory_order_relaxed);
+        }
+        return;
+    }
+
+    if (policy.messages > 0 && dissect_messages(&flow->dissect) >= policy.messages)
+    {
+        atomic_store_explicit(&flow->enough, INSPECT_ENOUGH_BUDGET, memory_order_relaxed);
+    }
+}
+
+/*
+ * Пустое кольцо: спим, пока продюсер не разбудит. sleeping выставляется до
+ * повторной проверки head (seq_cst с обеих сторон), так что сигнал не теряется;
+ * таймаут — на всякий случай
+ */
+static void ring_wait(inspect_ring_t *ring, size_t tail)
+{
+    pthread_mutex_lock(&ring->lock);
+    atomic_store(&ring->sleeping, 1);
+    if (atomic_load(&ring->head) == tail)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += INSPECT_IDLE_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ring->wake, &ring->lock, &ts);
+    }
+    atomic_store(&ring->sleeping, 0);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void *inspect_thread(void *arg)
+{
+    inspect_ring_t *ring = arg;
+    size_t          tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned        idle = 0;
+
+    for (;;)
+    {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head == tail)
+        {
+            // На потоке данных куски идут чаще, чем стоит засыпание и futex-пробуждение:
+            // сначала немного ждём на месте, потом спим
+            if (++idle < INSPECT_SPIN)
+            {
+                sched_yield();
+                continue;
+            }
+            ring_wait(ring, tail);
+            continue;
+        }
+        idle = 0;
+        while (tail != head)
+        {
+            inspect_event_t ev = ring->slots[tail & (INSPECT_RING - 1)];
+            // Слот скопирован — отдаём его продюсеру сразу, снимок держим сами
+            atomic_store_explicit(&ring->tail, ++tail, memory_order_release);
+
+            inspect_chunk(ev.flow, &ev);
+            atomic_fetch_sub_explicit(&ring->inflight, ev.view.len, memory_order_relaxed);
+            buffer_view_release(&ev.view);
+            flow_put(ev.flow);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Правило skip-host: имя целиком или ".example.com" — сам домен и все поддомены
+ */
+static bool host_matches(const char *rule, const char *host)
+{
+    size_t rlen = strlen(rule);
+    size_t hlen = strlen(host);
+    if (hlen == 0)
+    {
+        return false;
+    }
+    if (rule[0] != '.')
+    {
+        return strcasecmp(rule, host) == 0;
+    }
+    return (hlen >= rlen && strcasecmp(host + hlen - rlen, rule) == 0) || strcasecmp(rule + 1, host) == 0;
+}
+
+/*
+ * Надо ли вообще разбирать туннель: выборка 1 из K и правила skip-*
+ */
+static bool policy_wants(const tunnel_t *tunnel)
+{
+    if (policy.sample > 1 && sample_tick++ % policy.sample != 0)
+    {
+        return false;
+    }
+    unsigned port = (unsigned)atoi(tunnel->dst_port);
+    for (unsigned i = 0; i < policy.nports; ++i)
+    {
+        if (policy.ports[i] == port)
+        {
+            return false;
+        }
+    }
+    // Хост — и адрес назначения, и SNI (за одним IP может быть что угодно)
+    const char *sni = tunnel->tls != NULL ? tunnel->tls->hello.sni : "";
+    for (unsigned i = 0; i < policy.nhosts; ++i)
+    {
+        if (host_matches(policy.hosts[i], tunnel->dst_host) || host_matches(policy.hosts[i], sni))
+        {
+            return false;
+        }
+    }
+    const auth_protocol_t *ap = &tunnel->ap;
+    for (unsigned i = 0; i < policy.nusers; ++i)
+    {
+        if (strlen(policy.users[i]) == ap->ulen && memcmp(policy.users[i], ap->uname, ap->ulen) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Первый полёт клиента, начавшийся как TLS: ClientHello разбирается прямо здесь,
+ * на event loop (доли микросекунды, без аллокаций по ходу) — SNI нужен политике
+ * до того, как туннель отдан потоку анализа. Результат остаётся в tunnel->tls
+ */
+static tls_result_t tls_sniff(tunnel_t *tunnel, const uint8_t *data, size_t len)
+{
+    if (tunnel->tls == NULL)
+    {
+        if (data[0] != 0x16)
+        {
+            return TLS_NOT;
+        }
+        tunnel->tls = malloc(sizeof(*tunnel->tls));
+        if (tunnel->tls == NULL)
+        {
+            return TLS_NOT;
+        }
+        tls_parser_init(tunnel->tls);
+    }
+
+    tls_result_t r = tls_parser_feed(tunnel->tls, data, len);
+    if (r == TLS_NOT)
+    {
+        ++tls_bad;
+        free(tunnel->tls);
+        tunnel->tls = NULL;
+    }
+    else if (r == TLS_DONE)
+    {
+        const tls_hello_t *h = &tunnel->tls->hello;
+        char versions[TLS_VERSIONS_MAX * 8 + 1] = "";
+        char name[8];
+        size_t at = 0;
+        for (unsigned i = 0; i < h->nversions; ++i)
+        {
+            at += snprintf(versions + at, sizeof(versions) - at, "%s%s", i ? "," : "",
+                           tls_version_name(h->versions[i], name, sizeof(name)));
+            tls_13 += h->versions[i] == 0x0304;
+        }
+        if (h->nversions == 0)
+        {
+            tls_version_name(h->legacy_version, versions, sizeof(versions));
+        }
+        ++tls_hellos;
+        tls_h2 += strncmp(h->alpn, "h2", 2) == 0 && (h->alpn[2] == ',' || h->alpn[2] == '\0');
+        LOG_INFO("TLS ClientHello to %s:%s: SNI=%s ALPN=%s versions=%s", tunnel->dst_host, tunnel->dst_port,
+                 h->sni[0] ? h->sni : "-", h->alpn[0] ? h->alpn : "-", versions);
+    }
+    return r;
+}
+
+/*
+ * Туннель уходит в чистый форвардинг: дальше tunnel_connected_handle сюда не зовёт
+ */
+static void inspect_stop(tunnel_t *tunnel)
+{
+    tunnel->inspect_off = 1;
+    if (tunnel->inspect_held != NULL)
+    {
+        inspect_held_release(tunnel->inspect_held);
+        tunnel->inspect_held = NULL;
+    }
+}
+
+/*
+ * Придерживает снимок куска, пока ClientHello не весь. <0 — держать больше некуда,
+ * решаем без SNI
+ */
+static int held_add(tunnel_t *tunnel, buffer_t *buffer, size_t offset, size_t len)
+{
+    inspect_held_t *held = tunnel->inspect_held;
+    if (held == NULL)
+    {
+        held = calloc(1, sizeof(*held));
+        if (held == NULL)
+        {
+            return -1;
+        }
+        tunnel->inspect_held = held;
+    }
+    if (held->n == INSPECT_HELD_MAX)
+    {
+        return -1;
+    }
+    buffer_view(buffer, offset, len, &held->view[held->n++]);
+    return 0;
+}
+
+/*
+ * Кладёт снимок в кольцо потока анализа (снимок переходит туда или отпускается).
+ * <0 — направление больше не публикуем: кольцо полно или кончился бюджет
+ */
+static int publish_view(tunnel_t *tunnel, inspect_flow_t *flow, int is_client, buffer_view_t *view)
+{
+    int d = is_client ? 1 : 0;
+    // Бюджет байтов: публикуем начало куска, остальное уже не смотрим
+    size_t len = view->len < flow->budget ? view->len : (size_t)flow->budget;
+    inspect_ring_t *ring = &rings[flow->shard];
+    size_t          head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t          tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == INSPECT_RING
+        || atomic_load_explicit(&ring->inflight, memory_order_relaxed) + len > INSPECT_INFLIGHT)
+    {
+        // Анализ не успевает — не ждём его. Потоковому парсеру без этих байтов
+        // дальше не за что зацепиться, так что направление больше не публикуем
+        buffer_view_release(view);
+        ++dropped;
+        ++lost;
+        flow->lost[d] = 1;
+        if (flow->lost[!d])
+        {
+            inspect_stop(tunnel);
+        }
+        return -1;
+    }
+
+    inspect_event_t *ev = &ring->slots[head & (INSPECT_RING - 1)];
+    atomic_fetch_add_explicit(&flow->refs, 1, memory_order_relaxed);
+    ev->flow      = flow;
+    ev->is_client = is_client;
+    ev->view      = *view;
+    ev->view.len  = len;
+    atomic_fetch_add_explicit(&ring->inflight, len, memory_order_relaxed);
+    atomic_store(&ring->head, head + 1);
+    ++published;
+
+    int rc = 0;
+    flow->budget -= len;
+    if (flow->budget == 0)
+    {
+        ++exhausted;
+        inspect_stop(tunnel);
+        rc = -1;
+    }
+
+    if (atomic_load(&ring->sleeping))
+    {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->wake);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    return rc;
+}
+
+void inspect_publish(tunnel_t *tunnel, int is_client, size_t fresh)
+{
+    if (nrings == 0)
+    {
+        inspect_stop(tunnel);
+        return;
+    }
+    sock_t   *sock   = is_client ? tunnel->client_sock : tunnel->remote_sock;
+    buffer_t *buffer = sock->read_buffer;
+    size_t    length = buffer_readable(buffer);
+    if (fresh > length)
+    {
+        fresh = length;
+    }
+    if (fresh == 0)
+    {
+        return;
+    }
+
+    // ClientHello режется чтениями — до конца первого полёта решение не принимаем,
+    // а куски придерживаем снимками; форвардинг при этом идёт как обычно
+    const uint8_t *data = (const uint8_t *)buffer->data + buffer->read_index + (length - fresh);
+    if (tunnel->inspect == NULL && is_client && tls_sniff(tunnel, data, fresh) == TLS_MORE
+        && held_add(tunnel, buffer, length - fresh, fresh) == 0)
+    {
+        return;
+    }
+
+    // Состояние разбора живёт весь туннель: заголовки и тела режутся чтениями как угодно
+    inspect_flow_t *flow = tunnel->inspect;
+    if (flow == NULL)
+    {
+        if (!policy_wants(tunnel))
+        {
+            ++skipped;
+            inspect_stop(tunnel);
+            return;
+        }
+        flow = calloc(1, sizeof(*flow));
+        if (flow == NULL)
+        {
+            ++dropped;
+            return;
+        }
+        atomic_init(&flow->refs, 1);
+        atomic_init(&flow->enough, 0);
+        flow->shard  = next_shard++ % nrings;
+        flow->budget = policy.bytes > 0 ? policy.bytes : ~0ULL;
+        dissect_flow_init(&flow->dissect, (uint16_t)atoi(tunnel->dst_port));
+        match_stream_init(&flow->match[0]);
+        match_stream_init(&flow->match[1]);
+        flow->opaque = tunnel->tls != NULL;
+        snprintf(flow->target, sizeof(flow->target), "%s:%s", tunnel->dst_host, tunnel->dst_port);
+        snprintf(flow->user, sizeof(flow->user), "%.*s", (int)tunnel->ap.ulen, tunnel->ap.uname);
+        tunnel->inspect = flow;
+    }
+
+    int enough = atomic_load_explicit(&flow->enough, memory_order_relaxed);
+    if (enough)
+    {
+        if (enough == INSPECT_ENOUGH_DONE)
+        {
+            ++finished;
+        }
+        else
+        {
+            ++exhausted;
+        }
+        inspect_stop(tunnel);
+        return;
+    }
+    if (flow->lost[is_client ? 1 : 0])
+    {
+        return;
+    }
+
+    // Решение принято: сначала придержанное начало первого полёта, потом свежий кусок
+    inspect_held_t *held = tunnel->inspect_held;
+    if (held != NULL)
+    {
+        tunnel->inspect_held = NULL;
+        unsigned i = 0;
+        while (i < held->n && publish_view(tunnel, flow, 1, &held->view[i++]) == 0)
+        {
+        }
+        while (i < held->n)
+        {
+            buffer_view_release(&held->view[i++]);
+        }
+        free(held);
+        if (tunnel->inspect_off || flow->lost[is_client ? 1 : 0])
+        {
+            return;
+        }
+    }
+
+    buffer_view_t view;
+    buffer_view(buffer, length - fresh, fresh, &view);
+    publish_view(tunnel, flow, is_client, &view);
+}
+
+void inspect_get_stats(inspect_stats_t *stats)
+{
+    stats->published = published;
+    stats->dropped   = dropped;
+    stats->lost      = lost;
+    stats->skipped   = skipped;
+    stats->exhausted = exhausted;
+    stats->finished  = finished;
+    stats->tls       = tls_hellos;
+    stats->tls_bad   = tls_bad;
+    stats->matches   = atomic_load_explicit(&matches, memory_order_relaxed);
+}
+
+/*
+ * Таймер: сколько направлений бросили, пока анализ не успевал, и что сэкономила политика
+ */
+static void inspect_stats_tick(void *ud)
+{
+    (void)ud;
+    if (dropped != dropped_logged)
+    {
+        dropped_logged = dropped;
+        LOG_WARN("Inspection behind: %llu chunks dropped, %llu tunnel directions no longer inspected",
+                 dropped, lost);
+    }
+    if (skipped + exhausted + finished != policy_logged)
+    {
+        policy_logged = skipped + exhausted + finished;
+        LOG_INFO("Inspection policy: %llu tunnels skipped, %llu stopped on budget, %llu with nothing more to inspect, "
+                 "%llu chunks inspected", skipped, exhausted, finished, published);
+    }
+    if (tls_hellos + tls_bad != tls_logged)
+    {
+        tls_logged = tls_hellos + tls_bad;
+        LOG_INFO("TLS: %llu ClientHello parsed (%llu offer TLS1.3, %llu prefer h2), %llu malformed",
+                 tls_hellos, tls_13, tls_h2, tls_bad);
+    }
+    unsigned long long hits = atomic_load_explicit(&matches, memory_order_relaxed);
+    if (hits != matches_logged)
+    {
+        matches_logged = hits;
+        LOG_INFO("Content matcher: %llu matches", hits);
+    }
+}
+
+/*
+ * Число политики: только десятичные цифры и не больше max, иначе <0
+ */
+static int policy_number(const char *key, const char *value, unsigned long long max, unsigned long long *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(value, &end, 10);
+    // strtoull пропускает пробелы и глотает минус — такое не число
+    if (value[0] < '0' || value[0] > '9' || *end != '\0' || errno == ERANGE || n > max)
+    {
+        LOG_ERROR("Inspection policy: bad %s \"%s\", expected 0..%llu", key, value, max);
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+/*
+ * Разбор -I: "bytes=N,messages=M,sample=K,skip-port=P,skip-host=H,skip-user=U",
+ * skip-* можно повторять
+ */
+static int policy_parse(const char *spec)
+{
+    char  copy[4096];
+    char *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        if (value == NULL || value[1] == '\0')
+        {
+            LOG_ERROR("Inspection policy: \"%s\" is not key=value", item);
+            return -1;
+        }
+        *value++ = '\0';
+        unsigned long long n;
+        if (strcmp(item, "bytes") == 0)
+        {
+            if (policy_number(item, value, ULLONG_MAX, &policy.bytes) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(item, "messages") == 0)
+        {
+            if (policy_number(item, value, UINT_MAX, &n) < 0)
+            {
+                return -1;
+            }
+            policy.messages = (unsigned)n;
+        }
+        else if (strcmp(item, "sample") == 0)
+        {
+            if (policy_number(item, value, UINT_MAX, &n) < 0)
+            {
+                return -1;
+            }
+            policy.sample = (unsigned)n;
+        }
+        else if (strcmp(item, "skip-port") == 0 && policy.nports < INSPECT_RULES_MAX)
+        {
+            if (policy_number(item, value, 65535, &n) < 0)
+            {
+                return -1;
+            }
+            policy.ports[policy.nports++] = (unsigned)n;
+        }
+        else if (strcmp(item, "skip-host") == 0 && policy.nhosts < INSPECT_RULES_MAX)
+        {
+            snprintf(policy.hosts[policy.nhosts++], sizeof(policy.hosts[0]), "%s", value);
+        }
+        else if (strcmp(item, "skip-user") == 0 && policy.nusers < INSPECT_RULES_MAX)
+        {
+            snprintf(policy.users[policy.nusers++], sizeof(policy.users[0]), "%s", value);
+        }
+        else
+        {
+            LOG_ERROR("Inspection policy: unknown key \"%s\" (or more than %d rules)", item, INSPECT_RULES_MAX);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int inspect_init(int threads, const char *spec, const char *patterns)
+{
+    if (threads <= 0)
+    {
+        LOG_INFO("Traffic inspection disabled");
+        if (patterns != NULL && patterns[0] != '\0')
+        {
+            LOG_WARN("Content matcher: -K needs inspection threads (-A), patterns ignored");
+        }
+        return 0;
+    }
+    if (spec != NULL && spec[0] != '\0')
+    {
+        if (policy_parse(spec) < 0)
+        {
+            return -1;
+        }
+        LOG_INFO("Inspection policy: first %llu bytes, %u messages, 1 of %u tunnels, %u/%u/%u skip rules (port/host/user)",
+                 policy.bytes, policy.messages, policy.sample > 1 ? policy.sample : 1,
+                 policy.nports, policy.nhosts, policy.nusers);
+    }
+    if (threads > INSPECT_THREADS_MAX)
+    {
+        threads = INSPECT_THREADS_MAX;
+    }
+    // Реестр диссекторов и автомат матчера заполняются до того, как их увидят потоки анализа
+    if (parse_register_dissectors() < 0)
+    {
+        return -1;
+    }
+    if (patterns != NULL && patterns[0] != '\0' && match_load(patterns) < 0)
+    {
+        return -1;
+    }
+    rings = calloc(threads, sizeof(*rings));
+    if (rings == NULL)
+    {
+        LOG_ERROR("Failed to allocate inspection rings");
+        return -1;
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        inspect_ring_t *ring = &rings[i];
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->inflight, 0);
+        atomic_init(&ring->sleeping, 0);
+        pthread_mutex_init(&ring->lock, NULL);
+        pthread_cond_init(&ring->wake, NULL);
+        if (pthread_create(&ring->thread, NULL, inspect_thread, ring) != 0)
+        {
+            LOG_ERROR("Failed to launch inspection thread");
+            return -1;
+        }
+        pthread_detach(ring->thread);
+        // Поток уже читает кольцо — считаем его, только когда он запущен
+        nrings = i + 1;
+    }
+    LOG_INFO("Traffic inspection: %u analysis threads, %d chunks per ring", nrings, INSPECT_RING);
+    return server_timer_add(INSPECT_STATS_MS, inspect_stats_tick, NULL);
+}
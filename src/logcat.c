@@ -0,0 +1,608 @@
+/*
+ * cliproxy-logcat: превращает бинарный лог (CLIProxyServer -b) обратно в текст —
+ * те же строки "[время] [уровень] сообщение", что пишет текстовый режим.
+ *
+ *   cliproxy-logcat [-u] [-l] [файл...]   (без файла или "-" — stdin)
+ *     -u  время с микросекундами
+ *     -l  после уровня — call site (файл:строка)
+ *
+ * Записи разных потоков лежат в файле пачками по кольцам, поэтому внутри сессии
+ * они сортируются по тикам; тики переводятся в реальное время по записям
+ * синхронизации (см. logfmt.h).
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logfmt.h"
+
+
+static const char *labels[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+/*
+ * Call site из словаря сессии
+ */
+typedef struct site
+{
+    unsigned      level;
+    unsigned      line;
+    char         *fmt;
+    char         *file;
+    int           nargs;
+    logfmt_arg_t  args[LOGFMT_ARGS_MAX];
+} site_t;
+
+typedef struct sync_point
+{
+    uint64_t  ticks;
+    uint64_t  real;
+} sync_point_t;
+
+typedef struct record
+{
+    uint64_t       ticks;
+    size_t         order;
+    const uint8_t *data;
+    uint16_t       len;
+    uint16_t       id;
+} record_t;
+
+/*
+ * Что накопили по сессии
+ */
+typedef struct session
+{
+    site_t        *sites;
+    uint32_t       nsites;
+    sync_point_t  *syncs;
+    size_t         nsyncs;
+    record_t      *records;
+    size_t         nrecords;
+} session_t;
+
+static int with_usec;
+static int with_site;
+
+
+static uint16_t get16(const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return v;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+/*
+ * zigzag-varint; -1, если запись кончилась посреди числа
+ */
+static int get_varint(const uint8_t **p, const uint8_t *end, int64_t *value)
+{
+    uint64_t v     = 0;
+    unsigned shift = 0;
+    while (*p < end && shift < 64)
+    {
+        uint8_t b = *(*p)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static void *grow(void *array, size_t count, size_t *cap, size_t size)
+{
+    if (count < *cap)
+    {
+        return array;
+    }
+    *cap = *cap != 0 ? *cap * 2 : 1024;
+    array = realloc(array, *cap * size);
+    if (array == NULL)
+    {
+        fprintf(stderr, "cliproxy-logcat: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+/*
+ * Читает весь вход: сортировка и интерполяция времени всё равно требуют всего файла
+ */
+static uint8_t *slurp(FILE *in, size_t *len)
+{
+    size_t   cap  = 0;
+    uint8_t *data = NULL;
+    *len = 0;
+    for (;;)
+    {
+        data = grow(data, *len + 65536, &cap, 1);
+        size_t got = fread(data + *len, 1, cap - *len, in);
+        if (got == 0)
+        {
+            break;
+        }
+        *len += got;
+    }
+    return data;
+}
+
+/*
+ * Тики записи — в реальное время (нс): линейно между соседними синхронизациями,
+ * за краями — по крайнему отрезку. Одна синхронизация — считаем тики наносекундами
+ */
+static uint64_t ticks_to_real(const session_t *s, uint64_t ticks)
+{
+    if (s->nsyncs == 0)
+    {
+        return 0;
+    }
+    if (s->nsyncs == 1)
+    {
+        return s->syncs[0].real + (ticks - s->syncs[0].ticks);
+    }
+
+    size_t lo = 0;
+    size_t hi = s->nsyncs - 1;
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (s->syncs[mid].ticks <= ticks)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    const sync_point_t *a = &s->syncs[lo];
+    const sync_point_t *b = &s->syncs[hi];
+    if (b->ticks == a->ticks)
+    {
+        return a->real;
+    }
+    long double rate = (long double)(int64_t)(b->real - a->real) / (long double)(b->ticks - a->ticks);
+    return a->real + (uint64_t)(int64_t)((long double)(int64_t)(ticks - a->ticks) * rate);
+}
+
+static int by_ticks(const void *pa, const void *pb)
+{
+    const record_t *a = pa;
+    const record_t *b = pb;
+    if (a->ticks != b->ticks)
+    {
+        return a->ticks < b->ticks ? -1 : 1;
+    }
+    return a->order < b->order ? -1 : a->order > b->order;
+}
+
+static int by_sync(const void *pa, const void *pb)
+{
+    const sync_point_t *a = pa;
+    const sync_point_t *b = pb;
+    return a->ticks < b->ticks ? -1 : a->ticks > b->ticks;
+}
+
+/*
+ * Дописывает в out одну конверсию spec (с '%'), беря аргументы из записи.
+ * Возвращает 0 или -1, если запись кончилась раньше аргументов
+ */
+static int render_spec(char *out, size_t cap, size_t *len, const char *spec, size_t spec_len,
+                       const logfmt_arg_t *arg, int stars, const uint8_t **p, const uint8_t *end)
+{
+    char fmt[64];
+    if (spec_len >= sizeof(fmt))
+    {
+        return -1;
+    }
+    memcpy(fmt, spec, spec_len);
+    fmt[spec_len] = '\0';
+
+    int star[2] = {0, 0};
+    for (int i = 0; i < stars; ++i)
+    {
+        int64_t v;
+        if (get_varint(p, end, &v) < 0)
+        {
+            return -1;
+        }
+        star[i] = (int)v;
+    }
+
+    char       *dst  = out + *len;
+    size_t      room = cap - *len;
+    int         n    = 0;
+    long long   lv   = 0;
+    double      dv   = 0;
+    const char *sv   = NULL;
+    char        str[LOGFMT_STR_MAX + 1];
+
+    switch (arg->type)
+    {
+        case LOGFMT_INT:
+        case LOGFMT_LONG:
+        case LOGFMT_ERRNO:
+        {
+            int64_t v;
+            if (get_varint(p, end, &v) < 0)
+            {
+                return -1;
+            }
+            lv = v;
+            break;
+        }
+        case LOGFMT_PTR:
+        case LOGFMT_DOUBLE:
+        {
+            if (end - *p < 8)
+            {
+                return -1;
+            }
+            lv = (long long)get64(*p);
+            memcpy(&dv, *p, 8);
+            *p += 8;
+            break;
+        }
+        case LOGFMT_STR:
+        {
+            int64_t slen;
+            if (get_varint(p, end, &slen) < 0 || slen < 0 || slen > end - *p)
+            {
+                return -1;
+            }
+            size_t sl = (size_t)slen < LOGFMT_STR_MAX ? (size_t)slen : LOGFMT_STR_MAX;
+            memcpy(str, *p, sl);
+            str[sl] = '\0';
+            *p += slen;
+            sv = str;
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    if (arg->type == LOGFMT_ERRNO)
+    {
+        // %m — текст errno, как его напечатал бы glibc
+        fmt[spec_len - 1] = 's';
+        sv = strerror((int)lv);
+    }
+
+#define EMIT(value)                                                   \
+    do                                                                \
+    {                                                                 \
+        if (stars == 0)                                               \
+            n = snprintf(dst, room, fmt, value);                      \
+        else if (stars == 1)                                          \
+            n = snprintf(dst, room, fmt, star[0], value);             \
+        else                                                          \
+            n = snprintf(dst, room, fmt, star[0], star[1], value);    \
+    } while (0)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    switch (arg->type)
+    {
+        case LOGFMT_NONE:
+        {
+            n = snprintf(dst, room, "%%");
+            break;
+        }
+        case LOGFMT_INT:
+        {
+            EMIT((int)lv);
+            break;
+        }
+        case LOGFMT_LONG:
+        {
+            EMIT(lv);
+            break;
+        }
+        case LOGFMT_PTR:
+        {
+            EMIT((void *)(uintptr_t)lv);
+            break;
+        }
+        case LOGFMT_DOUBLE:
+        {
+            EMIT(dv);
+            break;
+        }
+        case LOGFMT_STR:
+        case LOGFMT_ERRNO:
+        {
+            EMIT(sv);
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+#pragma GCC diagnostic pop
+#undef EMIT
+
+    if (n > 0)
+    {
+        *len += (size_t)n < room ? (size_t)n : room - 1;
+    }
+    return 0;
+}
+
+/*
+ * Собирает текст записи по формату call site'а
+ */
+static void render(const site_t *site, const uint8_t *p, const uint8_t *end, char *out, size_t cap)
+{
+    size_t len = 0;
+    out[0] = '\0';
+    for (const char *f = site->fmt; *f != '\0' && len + 1 < cap;)
+    {
+        if (*f != '%')
+        {
+            out[len++] = *f++;
+            out[len]   = '\0';
+            continue;
+        }
+
+        int          stars;
+        logfmt_arg_t arg;
+        const char  *next = logfmt_spec(f, &stars, &arg);
+        if (arg.type == LOGFMT_BAD ||
+            render_spec(out, cap, &len, f, (size_t)(next - f), &arg, stars, &p, end) < 0)
+        {
+            len += (size_t)snprintf(out + len, cap - len, "<bad record>");
+            break;
+        }
+        f = next;
+    }
+    out[len < cap ? len : cap - 1] = '\0';
+}
+
+static void print_record(const session_t *s, const record_t *rec)
+{
+    const site_t *site = &s->sites[rec->id];
+    char          text[65536];
+    render(site, rec->data + LOGFMT_HEAD, rec->data + rec->len, text, sizeof(text));
+
+    // Заголовок — как у текстового лога
+    uint64_t  real = ticks_to_real(s, rec->ticks);
+    time_t    sec  = (time_t)(real / 1000000000u);
+    struct tm tm_info;
+    char      header[256];
+    char      stamp[32];
+    localtime_r(&sec, &tm_info);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+    size_t hlen = (size_t)snprintf(header, sizeof(header), "[%s", stamp);
+    if (with_usec)
+    {
+        hlen += (size_t)snprintf(header + hlen, sizeof(header) - hlen, ".%06u", (unsigned)(real % 1000000000u / 1000u));
+    }
+    hlen += (size_t)snprintf(header + hlen, sizeof(header) - hlen, "] [%s] ", labels[site->level < 4 ? site->level : 3]);
+    if (with_site)
+    {
+        snprintf(header + hlen, sizeof(header) - hlen, "%s:%u: ", site->file, site->line);
+    }
+
+    // Многострочное сообщение — каждая строка со своим заголовком
+    char *start = text;
+    while (*start)
+    {
+        char *pos = strchr(start, '\n');
+        if (pos != NULL)
+        {
+            *pos = '\0';
+        }
+        printf("%s%s\n", header, start);
+        if (pos == NULL)
+        {
+            break;
+        }
+        start = pos + 1;
+    }
+}
+
+static void session_free(session_t *s)
+{
+    for (uint32_t i = 0; i < s->nsites; ++i)
+    {
+        free(s->sites[i].fmt);
+        free(s->sites[i].file);
+    }
+    free(s->sites);
+    free(s->syncs);
+    free(s->records);
+    memset(s, 0, sizeof(*s));
+}
+
+static void session_flush(session_t *s)
+{
+    qsort(s->syncs, s->nsyncs, sizeof(*s->syncs), by_sync);
+    qsort(s->records, s->nrecords, sizeof(*s->records), by_ticks);
+    for (size_t i = 0; i < s->nrecords; ++i)
+    {
+        print_record(s, &s->records[i]);
+    }
+    session_free(s);
+}
+
+/*
+ * Словарь call site'ов в начале сессии. Возвращает смещение за ним или 0
+ */
+static size_t read_dict(const uint8_t *data, size_t len, size_t at, session_t *s)
+{
+    if (len - at < 12)
+    {
+        return 0;
+    }
+    s->nsites = get32(data + at + 8);
+    s->sites  = calloc(s->nsites != 0 ? s->nsites : 1, sizeof(*s->sites));
+    at += 12;
+    for (uint32_t i = 0; i < s->nsites; ++i)
+    {
+        if (len - at < 9)
+        {
+            return 0;
+        }
+        site_t *site = &s->sites[i];
+        size_t  flen = get16(data + at + 5);
+        size_t  nlen = get16(data + at + 7);
+        if (len - at - 9 < flen + nlen)
+        {
+            return 0;
+        }
+        site->level = data[at];
+        site->line  = get32(data + at + 1);
+        site->fmt   = strndup((const char *)data + at + 9, flen);
+        site->file  = strndup((const char *)data + at + 9 + flen, nlen);
+        site->nargs = logfmt_parse(site->fmt, site->args, LOGFMT_ARGS_MAX);
+        at += 9 + flen + nlen;
+    }
+    return at;
+}
+
+static int decode(const uint8_t *data, size_t len, const char *name)
+{
+    session_t s     = {0};
+    size_t    scap  = 0;
+    size_t    rcap  = 0;
+    size_t    at    = 0;
+    size_t    order = 0;
+    int       open  = 0;
+
+    while (at < len)
+    {
+        if (len - at >= 8 && memcmp(data + at, LOGFMT_MAGIC, 8) == 0)
+        {
+            // Новая сессия: предыдущую выводим целиком
+            if (open)
+            {
+                session_flush(&s);
+            }
+            at   = read_dict(data, len, at, &s);
+            open = 1;
+            if (at == 0)
+            {
+                fprintf(stderr, "cliproxy-logcat: %s: truncated session header\n", name);
+                session_free(&s);
+                return -1;
+            }
+            continue;
+        }
+        if (!open)
+        {
+            fprintf(stderr, "cliproxy-logcat: %s: not a binary log (run the proxy with -b)\n", name);
+            return -1;
+        }
+        if (len - at < LOGFMT_HEAD)
+        {
+            break;
+        }
+
+        uint16_t rlen = get16(data + at);
+        uint16_t id   = get16(data + at + 2);
+        if (rlen > len - at)
+        {
+            // Процесс упал посреди записи — хвост обрезан
+            fprintf(stderr, "cliproxy-logcat: %s: truncated record at offset %zu\n", name, at);
+            break;
+        }
+        if (rlen < LOGFMT_HEAD || (id != LOGFMT_ID_SYNC && id >= s.nsites))
+        {
+            fprintf(stderr, "cliproxy-logcat: %s: corrupt record at offset %zu\n", name, at);
+            break;
+        }
+        if (id == LOGFMT_ID_SYNC && rlen >= LOGFMT_HEAD + 8)
+        {
+            s.syncs = grow(s.syncs, s.nsyncs, &scap, sizeof(*s.syncs));
+            s.syncs[s.nsyncs++] = (sync_point_t){get64(data + at + 4), get64(data + at + LOGFMT_HEAD)};
+        }
+        else if (id != LOGFMT_ID_SYNC)
+        {
+            s.records = grow(s.records, s.nrecords, &rcap, sizeof(*s.records));
+            s.records[s.nrecords++] = (record_t){get64(data + at + 4), order++, data + at, rlen, id};
+        }
+        at += rlen;
+    }
+
+    if (open)
+    {
+        session_flush(&s);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int option;
+    while ((option = getopt(argc, argv, "ul")) > 0)
+    {
+        switch (option)
+        {
+            case 'u':
+            {
+                with_usec = 1;
+                break;
+            }
+            case 'l':
+            {
+                with_site = 1;
+                break;
+            }
+            default:
+            {
+                fprintf(stderr, "usage: cliproxy-logcat [-u] [-l] [file...]\n");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    int status = EXIT_SUCCESS;
+    int files  = argc - optind;
+    for (int i = files > 0 ? optind : argc - 1; i < argc; ++i)
+    {
+        const char *name = files > 0 ? argv[i] : "-";
+        FILE       *in   = strcmp(name, "-") == 0 ? stdin : fopen(name, "rb");
+        if (in == NULL)
+        {
+            fprintf(stderr, "cliproxy-logcat: %s: %s\n", name, strerror(errno));
+            status = EXIT_FAILURE;
+            continue;
+        }
+        size_t   len;
+        uint8_t *data = slurp(in, &len);
+        if (in != stdin)
+        {
+            fclose(in);
+        }
+        if (decode(data, len, name) < 0)
+        {
+            status = EXIT_FAILURE;
+        }
+        free(data);
+    }
+    return status;
+}
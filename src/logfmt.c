@@ -0,0 +1,139 @@
+#include "logfmt.h"
+
+#include <string.h>
+
+
+const char *logfmt_spec(const char *p, int *stars, logfmt_arg_t *arg)
+{
+    *stars    = 0;
+    arg->type = LOGFMT_BAD;
+    arg->prec = LOGFMT_PREC_NONE;
+
+    ++p;
+    if (*p == '%')
+    {
+        arg->type = LOGFMT_NONE;
+        return p + 1;
+    }
+
+    // Флаги и ширина
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+    {
+        ++p;
+    }
+    if (*p == '*')
+    {
+        ++*stars;
+        ++p;
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+        ++p;
+    }
+
+    // Точность: для %s она ограничивает, сколько байт строки читать
+    int prec = LOGFMT_PREC_NONE;
+    if (*p == '.')
+    {
+        ++p;
+        if (*p == '*')
+        {
+            ++*stars;
+            prec = LOGFMT_PREC_STAR;
+            ++p;
+        }
+        else
+        {
+            prec = 0;
+            while (*p >= '0' && *p <= '9')
+            {
+                prec = prec < 10000 ? prec * 10 + (*p - '0') : prec;
+                ++p;
+            }
+        }
+    }
+
+    // Модификаторы длины: всё, что шире int, на LP64 — 8 байт
+    int wide = 0;
+    while (*p != '\0' && strchr("hlLqjzt", *p) != NULL)
+    {
+        if (*p == 'L')
+        {
+            return p + 1;   // long double не поддерживаем
+        }
+        if (*p != 'h')
+        {
+            wide = 1;
+        }
+        ++p;
+    }
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        {
+            arg->type = wide ? LOGFMT_LONG : LOGFMT_INT;
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        {
+            arg->type = LOGFMT_DOUBLE;
+            break;
+        }
+        case 's':
+        {
+            arg->type = wide ? LOGFMT_BAD : LOGFMT_STR;  // %ls — нет
+            arg->prec = (int16_t)prec;
+            break;
+        }
+        case 'p':
+        {
+            arg->type = LOGFMT_PTR;
+            break;
+        }
+        case 'm':
+        {
+            arg->type = LOGFMT_ERRNO;
+            break;
+        }
+        case '\0':
+        {
+            return p;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    return p + 1;
+}
+
+int logfmt_parse(const char *fmt, logfmt_arg_t *args, int max)
+{
+    int n = 0;
+    for (const char *p = fmt; *p != '\0';)
+    {
+        if (*p != '%')
+        {
+            ++p;
+            continue;
+        }
+
+        int          stars;
+        logfmt_arg_t arg;
+        p = logfmt_spec(p, &stars, &arg);
+        if (arg.type == LOGFMT_BAD || n + stars + 1 > max)
+        {
+            return -1;
+        }
+        for (int i = 0; i < stars; ++i)
+        {
+            args[n++] = (logfmt_arg_t){LOGFMT_INT, LOGFMT_PREC_NONE};
+        }
+        if (arg.type != LOGFMT_NONE)
+        {
+            args[n++] = arg;
+        }
+    }
+    return n;
+}
@@ -1,139 +1,883 @@
 #include "logger.h"
+#include "logrotate.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 
-static FILE         *log_file      = NULL;       // Целевой файл для записи логов
-static log_level_t   current_level = INFO;       // Минимальный выводимый уровень
+#define LOG_RING        (1u << 20)  // Кольцо потока, байт (степень двойки)
+#define LOG_MSG_MAX     1024        // Сообщение после форматирования
+#define LOG_OUT_MAX     8192        // Сообщение с заголовками строк
+#define LOG_FLUSH_MS    10          // Пауза писателя между пачками: копим запись побольше
+#define LOG_IDLE_ROUNDS 100         // Столько пустых пауз подряд — засыпаем до пробуждения
+#define LOG_DROP_MS     1000        // Не чаще раза в секунду пишем про выброшенные сообщения
+#define LOG_SYNC_MS     1000        // Бинарный лог: так часто привязываем тики к реальному времени
+#define LOG_SYNC_FIRST  10          // ...а вторая привязка — сразу, чтобы было по чему считать частоту
+#define LOG_MODULES_MAX 32          // Модулей со своим уровнем
 
+/*
+ * Кольцо одного потока-продюсера: пишет только он (head), читает только
+ * писатель (tail). В кольце — готовые строки лога, как они лягут в файл
+ */
+typedef struct log_ring
+{
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_ullong      dropped;  // Сообщений не влезло
+    struct log_ring   *next;     // Список колец, только растёт
+    char               data[LOG_RING];
+} log_ring_t;
 
 /*
- * Инициализация: если filename есть — пытаемся открыть файл на дозапись,
- * иначе — stdout. Если файл не открывается — падаем на stdout.
+ * Заголовок строки, пересобирается раз в секунду: время у потока своё, без локов
  */
-void log_init(const char *filename, log_level_t level)
+typedef struct log_clock
 {
-    current_level = level;
-    if (filename != NULL && strcmp(filename, "") != 0)
+    time_t  sec;
+    size_t  len;
+    char    text[32];
+} log_clock_t;
+
+
+static int           log_fd        = STDOUT_FILENO; // Куда пишем логи
+static bool          binary_mode   = false;         // Записи для cliproxy-logcat вместо текста
+static bool          rotating      = false;         // log_fd — сегмент logrotate (-R)
+static char         *dict;                          // Словарь сессии: с него начинается каждый сегмент
+static size_t        dict_len;
+
+static log_ring_t *_Atomic  rings;              // Все кольца, новые — в голову
+static atomic_int           running;            // Писатель работает — пишем через кольца
+static atomic_int           stopping;           // Выход: писатель дописывает всё и завершается
+static atomic_int           sleeping;           // 1 — пауза между пачками, 2 — спит до пробуждения
+static pthread_mutex_t      wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       wake      = PTHREAD_COND_INITIALIZER;
+static pthread_t            writer;
+
+static _Thread_local log_ring_t  *own_ring;  // Кольцо текущего потока
+static _Thread_local log_clock_t  own_clock;
+static _Thread_local volatile sig_atomic_t in_log;  // Поток посреди записи в кольцо
+
+static const char *labels[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+/*
+ * Свой уровень модуля (имя .c-файла без расширения)
+ */
+typedef struct log_module
+{
+    char  name[32];
+    int   level;
+} log_module_t;
+
+// Уровни меняет только log_set_levels (main при старте, потом потоки терминала и админки)
+static pthread_mutex_t  levels_lock = PTHREAD_MUTEX_INITIALIZER;
+static char             levels_spec[LOG_SPEC_MAX] = "info";
+
+// Указатели на все call site'ы LOG_* — линкер собирает их в одну секцию
+extern log_site_t *const __start_log_sites[];
+extern log_site_t *const __stop_log_sites[];
+
+
+/*
+ * Метка времени записи: TSC — дешевле часов; на реальное время пересчитывает logcat
+ */
+static inline uint64_t log_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+/*
+ * Пишет всё, повторяя на EINTR и частичной записи. Ошибка — остаток выбрасываем:
+ * крутиться на сломанном выводе смысла нет
+ */
+static void write_all(int fd, struct iovec *iov, int n)
+{
+    while (n > 0)
     {
-        log_file = fopen(filename, "a");
-        if (!log_file)
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0)
         {
-            // Невозможно открыть файл — переключаемся на стандартный вывод
-            log_file = stdout;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len)
+        {
+            w -= (ssize_t)iov->iov_len;
+            ++iov;
+            --n;
+        }
+        if (n > 0)
+        {
+            iov->iov_base  = (char *)iov->iov_base + w;
+            iov->iov_len  -= (size_t)w;
         }
-    }
-    else
-    {
-        // По умолчанию выводим в консоль
-        log_file = stdout;
     }
 }
 
+static void write_text(int fd, const char *text, size_t len)
+{
+    struct iovec iov = {(void *)text, len};
+    write_all(fd, &iov, 1);
+}
+
 /*
- * Базовое логирование: чекаем уровень, формируем хедер и шлём сообщение
+ * Получаем локальное время и формируем [YYYY-MM-DD HH:MM:SS] — раз в секунду
  */
-void log_message(log_level_t level, const char *fmt, ...)
+static void clock_refresh(void)
 {
-    if (level < current_level)
+    time_t t = time(NULL);
+    if (t != own_clock.sec || own_clock.len == 0)
     {
-        return; // Уровень ниже текущего — пропускаем
+        struct tm tm_info;
+        localtime_r(&t, &tm_info);
+        own_clock.sec = t;
+        own_clock.len = strftime(own_clock.text, sizeof(own_clock.text), "[%Y-%m-%d %H:%M:%S] ", &tm_info);
     }
+}
 
-    // Получаем текущее локальное время
-    time_t t = time(NULL);
-    struct tm tm_info;
-    localtime_r(&t, &tm_info);
-
-    // Формируем строку времени [YYYY-MM-DD HH:MM:SS]
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+/*
+ * Форматирует сообщение в готовые строки "[время] [уровень] текст\n":
+ * многострочное сообщение — каждая строка со своим заголовком
+ */
+static size_t log_format(log_level_t level, const char *fmt, va_list args, char *out)
+{
+    clock_refresh();
 
-    // Метки уровней
-    static const char *labels[] = {"INFO", "WARNING", "ERROR"};
-    char header[64];
-    snprintf(header, sizeof(header), "[%s] [%s] ", timestamp, labels[level]);
+    char   header[64];
+    size_t hlen = own_clock.len;
+    memcpy(header, own_clock.text, hlen);
+    hlen += (size_t)snprintf(header + hlen, sizeof(header) - hlen, "[%s] ", labels[level]);
 
-    // Формируем само сообщение, разбивая по символам '\n'
-    char    msgbuf[1024];
-    va_list args;
-    va_start(args, fmt);
+    char msgbuf[LOG_MSG_MAX];
     vsnprintf(msgbuf, sizeof(msgbuf), fmt, args);
-    va_end(args);
 
     // Печать построчно: для многострочных сообщений сохраняем структуру
-    char *start = msgbuf;
-    char *pos;
-    while ((pos = strchr(start, '\n')) != NULL)
+    size_t      len   = 0;
+    const char *start = msgbuf;
+    while (*start)
     {
-        *pos = '\0';
-        fprintf(log_file, "%s%s\n", header, start);
+        const char *pos  = strchr(start, '\n');
+        size_t      line = pos != NULL ? (size_t)(pos - start) : strlen(start);
+        if (len + hlen + line + 1 > LOG_OUT_MAX)
+        {
+            break;
+        }
+        memcpy(out + len, header, hlen);
+        memcpy(out + len + hlen, start, line);
+        len += hlen + line;
+        out[len++] = '\n';
+        if (pos == NULL)
+        {
+            break;
+        }
         start = pos + 1;
     }
-    if (*start)
+    return len;
+}
+
+/*
+ * Число — zigzag-varint: мелкие (а их большинство — длины, fd, счётчики) в байт-два
+ */
+static inline size_t put_varint(char *p, int64_t value)
+{
+    uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    size_t   n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+
+/*
+ * Бинарная запись: заголовок и сырые аргументы по заранее разобранному формату,
+ * строки копируются (указатель после вызова уже ничего не значит)
+ */
+static size_t log_record(const log_site_t *site, int err, va_list args, char *rec)
+{
+    size_t len  = LOGFMT_HEAD;
+    int    prec = -1;
+
+    for (int i = 0; i < site->nargs; ++i)
     {
-        fprintf(log_file, "%s%s\n", header, start);
+        switch (site->args[i].type)
+        {
+            case LOGFMT_INT:
+            {
+                int v = va_arg(args, int);
+                len += put_varint(rec + len, (int64_t)v);
+                prec = v;
+                break;
+            }
+            case LOGFMT_LONG:
+            {
+                len += put_varint(rec + len, (int64_t)va_arg(args, long long));
+                break;
+            }
+            case LOGFMT_PTR:
+            {
+                uint64_t v = (uintptr_t)va_arg(args, void *);
+                memcpy(rec + len, &v, 8);
+                len += 8;
+                break;
+            }
+            case LOGFMT_DOUBLE:
+            {
+                double v = va_arg(args, double);
+                memcpy(rec + len, &v, 8);
+                len += 8;
+                break;
+            }
+            case LOGFMT_ERRNO:
+            {
+                len += put_varint(rec + len, err);
+                break;
+            }
+            case LOGFMT_STR:
+            {
+                const char *str   = va_arg(args, const char *);
+                int         limit = site->args[i].prec == LOGFMT_PREC_STAR ? prec : site->args[i].prec;
+                if (str == NULL)
+                {
+                    str = "(null)";
+                }
+                // Места хватает на все оставшиеся числа, строки режем
+                size_t room = LOGFMT_REC_MAX - len - 2 - LOGFMT_VARINT_MAX * (size_t)(site->nargs - i - 1);
+                size_t max  = room < LOGFMT_STR_MAX ? room : LOGFMT_STR_MAX;
+                if (limit >= 0 && (size_t)limit < max)
+                {
+                    max = (size_t)limit;
+                }
+                // memchr, а не strnlen: в связке с memcpy он заметно дешевле на glibc с AVX-512
+                const char *nul = memchr(str, 0, max);
+                uint16_t    n   = (uint16_t)(nul != NULL ? (size_t)(nul - str) : max);
+                len += put_varint(rec + len, n);
+                memcpy(rec + len, str, n);
+                len += n;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
     }
 
-    fflush(log_file);
+    uint16_t size = (uint16_t)len;
+    uint64_t now  = log_ticks();
+    memcpy(rec, &size, 2);
+    memcpy(rec + 2, &site->id, 2);
+    memcpy(rec + 4, &now, 8);
+    return len;
 }
 
 /*
- * Доп. лог: кроме файла, дублим WARNING/ERROR в stdout
+ * Call site, чей формат не разбирается, пишется готовым текстом: одна строка-аргумент
+ */
+static size_t log_record_text(const log_site_t *site, const char *fmt, va_list args, char *rec)
+{
+    char text[LOG_MSG_MAX];
+    vsnprintf(text, sizeof(text), fmt, args);
+
+    size_t   n    = strlen(text);
+    size_t   len  = LOGFMT_HEAD + put_varint(rec + LOGFMT_HEAD, (int64_t)n);
+    memcpy(rec + len, text, n);
+    len += n;
+
+    uint16_t size = (uint16_t)len;
+    uint64_t now  = log_ticks();
+    memcpy(rec, &size, 2);
+    memcpy(rec + 2, &site->id, 2);
+    memcpy(rec + 4, &now, 8);
+    return len;
+}
+
+/*
+ * Запись-синхронизация: текущие тики и реальное время
+ */
+static void log_sync(void)
+{
+    char            rec[LOGFMT_HEAD + 8];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint16_t size = sizeof(rec);
+    uint16_t id   = LOGFMT_ID_SYNC;
+    uint64_t now  = log_ticks();
+    uint64_t real = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    memcpy(rec, &size, 2);
+    memcpy(rec + 2, &id, 2);
+    memcpy(rec + 4, &now, 8);
+    memcpy(rec + LOGFMT_HEAD, &real, 8);
+    write_text(log_fd, rec, sizeof(rec));
+}
+
+/*
+ * Раздаёт call site'ам id, разбирает их форматы и пишет в начало сессии словарь
  */
-void extra_log_message(log_level_t level, const char *fmt, ...)
+static void log_sites_init(void)
 {
-    // Только WARNING или выше, и не ниже текущего уровня
-    if (level < current_level || level < WARNING)
+    size_t nsites = (size_t)(__stop_log_sites - __start_log_sites);
+    size_t size   = 8 + 4;
+    for (size_t i = 0; i < nsites; ++i)
+    {
+        log_site_t *site = __start_log_sites[i];
+        site->id    = (uint16_t)i;
+        site->nargs = (int8_t)logfmt_parse(site->fmt, site->args, LOGFMT_ARGS_MAX);
+        size += 9 + strlen(site->nargs < 0 ? "%s" : site->fmt) + strlen(site->file);
+        // Для logcat хватит имени файла без пути сборки
+        const char *base = strrchr(site->file, '/');
+        if (base != NULL)
+        {
+            site->file = base + 1;
+        }
+    }
+    if (!binary_mode)
     {
         return;
     }
 
-    // Пустая строка перед важными сообщениями для наглядности
-    fprintf(stdout, "\n");
+    dict = malloc(size);
+    if (dict == NULL)
+    {
+        binary_mode = false;
+        return;
+    }
+    char    *p = dict;
+    uint32_t n = (uint32_t)nsites;
+    memcpy(p, LOGFMT_MAGIC, 8);
+    memcpy(p + 8, &n, 4);
+    p += 12;
+    for (size_t i = 0; i < nsites; ++i)
+    {
+        const log_site_t *site = __start_log_sites[i];
+        // Формат, который не разбирается, logcat получит как "%s" с готовым текстом
+        const char *fmt   = site->nargs < 0 ? "%s" : site->fmt;
+        uint8_t     level = (uint8_t)site->level;
+        uint32_t    line  = (uint32_t)site->line;
+        uint16_t    flen  = (uint16_t)strlen(fmt);
+        uint16_t    nlen  = (uint16_t)strlen(site->file);
+        *p = (char)level;
+        memcpy(p + 1, &line, 4);
+        memcpy(p + 5, &flen, 2);
+        memcpy(p + 7, &nlen, 2);
+        memcpy(p + 9, fmt, flen);
+        memcpy(p + 9 + flen, site->file, nlen);
+        p += 9 + flen + nlen;
+    }
+    dict_len = (size_t)(p - dict);
+    write_text(log_fd, dict, dict_len);
+    log_sync();
+}
 
-    // Логика очень похожа на log_message
-    time_t t = time(NULL);
-    struct tm tm_info;
-    localtime_r(&t, &tm_info);
+/*
+ * Кольцо потока: заводится на первом сообщении и вешается в общий список без локов
+ */
+static log_ring_t *ring_get(void)
+{
+    if (own_ring == NULL)
+    {
+        log_ring_t *ring = calloc(1, sizeof(*ring));
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        ring->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+        {
+        }
+        own_ring = ring;
+    }
+    return own_ring;
+}
+
+/*
+ * Кладёт готовые строки в кольцо потока. Места нет — сообщение выбрасывается
+ * и считается: тормозить event loop ради лога нельзя
+ */
+static void log_emit(const char *text, size_t len)
+{
+    // Писателя нет (до log_init, после выхода) или сигнал перебил этот поток
+    // посреди записи в кольцо (SIGINT пишет в лог) — пишем сами
+    if (in_log || !atomic_load_explicit(&running, memory_order_acquire))
+    {
+        write_text(log_fd, text, len);
+        return;
+    }
+    in_log = 1;
+    log_ring_t *ring = ring_get();
+    if (ring == NULL)
+    {
+        write_text(log_fd, text, len);
+        in_log = 0;
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (len > LOG_RING - (head - tail))
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        in_log = 0;
+        return;
+    }
+
+    size_t at    = head & (LOG_RING - 1);
+    size_t first = LOG_RING - at < len ? LOG_RING - at : len;
+    memcpy(ring->data + at, text, first);
+    memcpy(ring->data, text + first, len - first);
+    atomic_store(&ring->head, head + len);
+
+    // Писатель будим, только если он спит всерьёз или кольцо заполнено больше чем наполовину:
+    // в остальное время он сам заберёт пачку через LOG_FLUSH_MS
+    int sleep = atomic_load(&sleeping);
+    if (sleep == 2 || (sleep == 1 && head + len - tail > LOG_RING / 2))
+    {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&wake_lock);
+    }
+    in_log = 0;
+}
+
+/*
+ * Один проход писателя: всё, что лежит во всех кольцах, — одним writev
+ */
+static size_t log_drain(void)
+{
+    struct iovec  iov[128];
+    log_ring_t   *owner[128];
+    size_t        upto[128];
+    int           n     = 0;
+    int           nring = 0;
+    size_t        total = 0;
+
+    for (log_ring_t *ring = atomic_load(&rings); ring != NULL && n + 2 <= 128; ring = ring->next)
+    {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        if (head == tail)
+        {
+            continue;
+        }
+        size_t at    = tail & (LOG_RING - 1);
+        size_t len   = head - tail;
+        size_t first = LOG_RING - at < len ? LOG_RING - at : len;
+        iov[n++] = (struct iovec){ring->data + at, first};
+        if (len > first)
+        {
+            iov[n++] = (struct iovec){ring->data, len - first};
+        }
+        owner[nring]  = ring;
+        upto[nring++] = head;
+        total += len;
+    }
+
+    if (total > 0)
+    {
+        write_all(log_fd, iov, n);
+        for (int i = 0; i < nring; ++i)
+        {
+            atomic_store_explicit(&owner[i]->tail, upto[i], memory_order_release);
+        }
+    }
+    return total;
+}
+
+/*
+ * Сколько сообщений выброшено — в лог от имени писателя
+ */
+static void log_report_drops(unsigned long long *reported)
+{
+    unsigned long long dropped = 0;
+    for (log_ring_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    if (dropped == *reported)
+    {
+        return;
+    }
+
+    LOG_WARN("Logger: %llu messages dropped, log writer fell behind", dropped - *reported);
+    *reported = dropped;
+}
+
+/*
+ * Пауза писателя. sleeping выставляется до повторной проверки колец (seq_cst
+ * с обеих сторон), так что пробуждение не теряется
+ */
+static void writer_wait(int mode, long ms)
+{
+    pthread_mutex_lock(&wake_lock);
+    atomic_store(&sleeping, mode);
+    int empty = 1;
+    for (log_ring_t *ring = atomic_load(&rings); ring != NULL && empty; ring = ring->next)
+    {
+        empty = atomic_load(&ring->head) == atomic_load(&ring->tail);
+    }
+    if ((mode == 1 || empty) && !atomic_load(&stopping))
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += ms / 1000;
+        ts.tv_nsec += (ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wake, &wake_lock, &ts);
+    }
+    atomic_store(&sleeping, 0);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+static void *writer_thread(void *arg)
+{
+    unsigned long long reported = 0;
+    unsigned           idle     = 0;
+    unsigned           syncs    = 1;
+    struct timespec    last     = {0, 0};
+    struct timespec    synced;
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &synced);
+
+    for (;;)
+    {
+        size_t written = log_drain();
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000 >= LOG_DROP_MS)
+        {
+            log_report_drops(&reported);
+            last = now;
+        }
+        if (binary_mode && (now.tv_sec - synced.tv_sec) * 1000 + (now.tv_nsec - synced.tv_nsec) / 1000000 >=
+                               (syncs < 2 ? LOG_SYNC_FIRST : LOG_SYNC_MS))
+        {
+            log_sync();
+            synced = now;
+            ++syncs;
+        }
+        // Смена сегмента — между пачками, запись не рвётся; новый сегмент бинарного
+        // лога начинается со словаря, чтобы читаться сам по себе
+        if (rotating && logrotate_due(log_fd, binary_mode ? dict_len + LOGFMT_HEAD + 8 : 0)
+            && logrotate_next(log_fd) == 0 && binary_mode)
+        {
+            write_text(log_fd, dict, dict_len);
+            log_sync();
+        }
+
+        if (written > 0)
+        {
+            idle = 0;
+        }
+        else if (atomic_load(&stopping))
+        {
+            log_report_drops(&reported);
+            log_drain();
+            if (binary_mode)
+            {
+                log_sync();
+            }
+            break;
+        }
+        else
+        {
+            ++idle;
+        }
+        // Данные идут — пауза короткая, за неё набирается следующая пачка;
+        // давно пусто — спим, пока продюсер не разбудит
+        if (idle < LOG_IDLE_ROUNDS)
+        {
+            writer_wait(1, LOG_FLUSH_MS);
+        }
+        else
+        {
+            writer_wait(2, LOG_DROP_MS);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Выход (stop, SIGINT): писатель дописывает кольца и завершается, дальше пишем сами
+ */
+static void log_atexit(void)
+{
+    atomic_store(&stopping, 1);
+    if (!in_log)
+    {
+        // Если сигнал перебил этот поток внутри log_emit, wake_lock может быть наш:
+        // тогда не будим, писатель сам проснётся по таймауту
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&wake_lock);
+    }
+    pthread_join(writer, NULL);
+    atomic_store_explicit(&running, 0, memory_order_release);
+    log_drain();
+    if (rotating)
+    {
+        logrotate_finish(log_fd);
+    }
+}
+
+/*
+ * "debug" / "info" / "warning" / "warn" / "error" / "off" -> уровень (off — выше любого); -1 — не уровень
+ */
+static int level_parse(const char *name, size_t len)
+{
+    static const struct
+    {
+        const char *name;
+        int         level;
+    } names[] = {{"debug", DEBUG}, {"info", INFO}, {"warning", WARNING}, {"warn", WARNING}, {"error", ERROR}, {"off", ERROR + 1}};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        if (strlen(names[i].name) == len && strncasecmp(name, names[i].name, len) == 0)
+        {
+            return names[i].level;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Модуль call site'а: имя файла без пути и расширения
+ */
+static size_t site_module(const log_site_t *site, const char **name)
+{
+    const char *base = strrchr(site->file, '/');
+    base  = base != NULL ? base + 1 : site->file;
+    *name = base;
+    const char *dot = strrchr(base, '.');
+    return dot != NULL ? (size_t)(dot - base) : strlen(base);
+}
+
+int log_set_levels(const char *spec)
+{
+    log_module_t modules[LOG_MODULES_MAX];
+    int          nmodules = 0;
+    int          level    = INFO;
 
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+    if (strlen(spec) >= LOG_SPEC_MAX)
+    {
+        return -1;
+    }
+    // Разбираем всё целиком, и только потом применяем: кривая строка ничего не меняет
+    for (const char *p = spec; *p != '\0';)
+    {
+        const char *end = strchr(p, ',');
+        size_t      len = end != NULL ? (size_t)(end - p) : strlen(p);
+        const char *eq  = memchr(p, '=', len);
+        if (eq == NULL)
+        {
+            level = level_parse(p, len);
+            if (level < 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            size_t name = (size_t)(eq - p);
+            // "protocol.c=info" — тоже можно
+            if (name > 2 && strncmp(eq - 2, ".c", 2) == 0)
+            {
+                name -= 2;
+            }
+            int module_level = level_parse(eq + 1, len - (size_t)(eq - p) - 1);
+            if (name == 0 || name >= sizeof(modules[0].name) || module_level < 0 || nmodules == LOG_MODULES_MAX)
+            {
+                return -1;
+            }
+            memcpy(modules[nmodules].name, p, name);
+            modules[nmodules].name[name] = '\0';
+            modules[nmodules].level      = module_level;
+            ++nmodules;
+        }
+        p += len + (end != NULL);
+    }
 
-    static const char *labels[] = {"INFO", "WARNING", "ERROR"};
-    char header[64];
-    snprintf(header, sizeof(header), "[%s] [%s] ", timestamp, labels[level]);
+    // Пересчитываем все call site'ы: на горячем пути дальше только их флаг
+    pthread_mutex_lock(&levels_lock);
+    for (log_site_t *const *it = __start_log_sites; it < __stop_log_sites; ++it)
+    {
+        log_site_t *site      = *it;
+        int         threshold = level;
+        const char *name;
+        size_t      len = site_module(site, &name);
+        for (int i = 0; i < nmodules; ++i)
+        {
+            if (strlen(modules[i].name) == len && strncmp(modules[i].name, name, len) == 0)
+            {
+                threshold = modules[i].level;
+            }
+        }
+        atomic_store_explicit(&site->on, site->console || (int)site->level >= threshold, memory_order_relaxed);
+    }
+    memmove(levels_spec, spec, strlen(spec) + 1);  // log_init зовёт с самой levels_spec
+    pthread_mutex_unlock(&levels_lock);
+    return 0;
+}
 
-    char    msgbuf[1024];
+void log_get_levels(char *out, size_t size)
+{
+    // Строку переписывает log_set_levels из другого потока — копируем под тем же локом
+    pthread_mutex_lock(&levels_lock);
+    snprintf(out, size, "%s", levels_spec);
+    pthread_mutex_unlock(&levels_lock);
+}
+
+void log_format_check(const char *fmt, ...)
+{
+}
+
+/*
+ * Инициализация: если filename есть — пытаемся открыть файл на дозапись
+ * (с rotate — первый сегмент ротации), иначе — stdout. Если файл не открывается —
+ * падаем на stdout; для ротации это ошибка, её видно по возврату.
+ * Раздаём id call site'ам (в бинарном режиме — пишем словарь сессии) и включаем
+ * их по уровню по умолчанию (DEBUG выключен).
+ * Запускаем поток-писатель; не запустился — пишем синхронно, как раньше
+ */
+int log_init(const char *filename, bool binary, const char *rotate)
+{
+    int  status = 0;
+    bool rotate_on = rotate != NULL && rotate[0] != '\0';
+
+    binary_mode = binary;
+    if (filename != NULL && strcmp(filename, "") != 0)
+    {
+        int fd = rotate_on ? logrotate_init(filename, rotate)
+                           : open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+        if (fd >= 0)
+        {
+            log_fd   = fd;
+            rotating = rotate_on;
+        }
+        // Невозможно открыть файл — остаёмся на стандартном выводе
+        status = fd < 0 && rotate_on ? -1 : 0;
+    }
+    else if (rotate_on)
+    {
+        // Ротировать stdout нечего
+        errno  = EINVAL;
+        status = -1;
+    }
+    int err = errno;
+    log_sites_init();
+    log_set_levels(levels_spec);
+
+    if (pthread_create(&writer, NULL, writer_thread, NULL) == 0)
+    {
+        atomic_store_explicit(&running, 1, memory_order_release);
+        atexit(log_atexit);
+    }
+    errno = err;
+    return status;
+}
+
+/*
+ * Базовое логирование: форматируем строки (или собираем бинарную запись)
+ * и кладём в кольцо потока
+ */
+void log_message(log_site_t *site, const char *fmt, ...)
+{
+    // Уровень уже проверил макрос (site->on)
+    int     err = errno;
+    char    out[LOG_OUT_MAX];
+    size_t  len;
     va_list args;
     va_start(args, fmt);
-    vsnprintf(msgbuf, sizeof(msgbuf), fmt, args);
+    if (!binary_mode)
+    {
+        len = log_format(site->level, fmt, args, out);
+    }
+    else if (site->nargs >= 0)
+    {
+        len = log_record(site, err, args, out);
+    }
+    else
+    {
+        len = log_record_text(site, fmt, args, out);
+    }
     va_end(args);
 
-    char *start = msgbuf;
-    char *pos;
-    while ((pos = strchr(start, '\n')) != NULL)
+    log_emit(out, len);
+}
+
+/*
+ * Доп. лог: кроме файла, дублим WARNING/ERROR в stdout
+ */
+void extra_log_message(log_site_t *site, const char *fmt, ...)
+{
+    // Только WARNING или выше
+    if (site->level < WARNING)
     {
-        *pos = '\0';
-        // Запись и в файл
-        fprintf(log_file, "%s%s\n", header, start);
-        // Дублируем в stdout, если файл не stdout
-        if (log_file != stdout)
-        {
-            fprintf(stdout, "%s%s\n", header, start);
-        }
-        start = pos + 1;
+        return;
     }
-    if (*start)
+
+    // Пустая строка перед важными сообщениями для наглядности
+    int     err = errno;
+    char    out[LOG_OUT_MAX + 1];
+    va_list args;
+    va_list copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    out[0] = '\n';
+    size_t len = log_format(site->level, fmt, args, out + 1);
+    va_end(args);
+
+    if (binary_mode)
     {
-        fprintf(log_file, "%s%s\n", header, start);
-        if (log_file != stdout)
+        // В файл — запись, в консоль — текст (если лог не в тот же stdout)
+        char   rec[LOGFMT_REC_MAX];
+        size_t size = site->nargs >= 0 ? log_record(site, err, copy, rec) : log_record_text(site, fmt, copy, rec);
+        va_end(copy);
+        log_emit(rec, size);
+        if (log_fd != STDOUT_FILENO)
         {
-            fprintf(stdout, "%s%s\n", header, start);
+            write_text(STDOUT_FILENO, out, len + 1);
         }
+        return;
     }
+    va_end(copy);
 
-    fflush(log_file);
+    if (log_fd == STDOUT_FILENO)
+    {
+        log_emit(out, len + 1);
+        return;
+    }
+    // В файл — через кольцо, в консоль — сразу: такие сообщения редкие
+    log_emit(out + 1, len);
+    write_text(STDOUT_FILENO, out, len + 1);
 }
@@ -0,0 +1,556 @@
+#define _GNU_SOURCE  // fallocate
+
+#include "logrotate.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "logger.h"
+
+
+#define LOGROTATE_CHUNK     (16ULL << 20)  // Без size=: столько выделяем за раз
+#define LOGROTATE_SIZE_MIN  (1ULL << 20)   // Меньше сегмент не бывает
+#define LOGROTATE_QUEUE     64             // Закрытых сегментов в очереди на сжатие
+#define LOGROTATE_BUF       (256u << 10)   // Кусок чтения при сжатии
+#define LOGROTATE_RETRY     1              // Не открылся следующий сегмент — ждём, сек
+#define LOGROTATE_NICE      10             // Приоритет потока сжатия
+
+/*
+ * Разобранный -R
+ */
+typedef struct logrotate_policy
+{
+    char                base[256];
+    unsigned long long  size;      // Байт в сегменте, 0 — без ограничения
+    unsigned            every;     // Секунд на сегмент, 0 — без ограничения
+    unsigned            files;     // Сколько последних сегментов хранить, 0 — все
+    bool                compress;  // Закрытые — в .gz
+} logrotate_policy_t;
+
+/*
+ * Текущий сегмент — его трогает только писатель
+ */
+typedef struct logrotate_segment
+{
+    unsigned  number;
+    off_t     allocated;  // Сколько выделено fallocate'ом
+    time_t    deadline;   // Когда сменить по времени
+    time_t    retry;      // Не открылся следующий — до этого времени не пробуем
+} logrotate_segment_t;
+
+/*
+ * Очередь закрытых сегментов для потока сжатия
+ */
+typedef struct logrotate_queue
+{
+    pthread_mutex_t  lock;
+    pthread_cond_t   wake;
+    unsigned         numbers[LOGROTATE_QUEUE];
+    unsigned         head;
+    unsigned         tail;
+    unsigned         oldest;  // Самый старый сегмент, который ещё может лежать на диске
+    bool             running;
+} logrotate_queue_t;
+
+
+static logrotate_policy_t   policy;
+static logrotate_segment_t  seg;
+static logrotate_queue_t    queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+
+static void segment_path(char *path, size_t size, unsigned number, const char *suffix)
+{
+    snprintf(path, size, "%s.%06u%s", policy.base, number, suffix);
+}
+
+/*
+ * Число с необязательным суффиксом: только десятичные цифры, n * unit не больше max.
+ * Суффиксы — строка букв, units — их множители. 0 или -1 на мусоре
+ */
+static int parse_number(const char *s, const char *suffixes, const unsigned long long *units,
+                        unsigned long long max, unsigned long long *out)
+{
+    char              *end;
+    unsigned long long unit = 1;
+    if (s[0] < '0' || s[0] > '9')
+    {
+        return -1;
+    }
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    const char *suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (suffix != NULL)
+    {
+        unit = units[suffix - suffixes];
+        ++end;
+    }
+    if (*end != '\0' || errno == ERANGE || n > max / unit)
+    {
+        return -1;
+    }
+    *out = n * unit;
+    return 0;
+}
+
+/*
+ * Размер с суффиксом K/M/G
+ */
+static int parse_size(const char *s, unsigned long long *out)
+{
+    static const unsigned long long units[] = { 1ULL << 10, 1ULL << 10, 1ULL << 20, 1ULL << 20,
+                                                1ULL << 30, 1ULL << 30 };
+    return parse_number(s, "kKmMgG", units, ULLONG_MAX, out);
+}
+
+/*
+ * Интервал с суффиксом s/m/h/d (без суффикса — секунды)
+ */
+static int parse_interval(const char *s, unsigned *out)
+{
+    static const unsigned long long units[] = { 1, 60, 3600, 86400 };
+    unsigned long long n;
+    if (parse_number(s, "smhd", units, UINT_MAX, &n) < 0)
+    {
+        return -1;
+    }
+    *out = (unsigned)n;
+    return 0;
+}
+
+/*
+ * Разбор -R: "size=N,every=N,files=K,compress"
+ */
+static int policy_parse(const char *spec)
+{
+    char  copy[256];
+    char *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        if (strcmp(item, "compress") == 0)
+        {
+            policy.compress = true;
+            continue;
+        }
+        if (value == NULL || value[1] == '\0')
+        {
+            return -1;
+        }
+        *value++ = '\0';
+        // Мусор в числе — ошибка, а не тихий ноль: иначе ротация выключится незаметно
+        if (strcmp(item, "size") == 0)
+        {
+            if (parse_size(value, &policy.size) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(item, "every") == 0)
+        {
+            if (parse_interval(value, &policy.every) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(item, "files") == 0)
+        {
+            unsigned long long n;
+            if (parse_number(value, "", NULL, UINT_MAX, &n) < 0)
+            {
+                return -1;
+            }
+            policy.files = (unsigned)n;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    if (policy.size == 0 && policy.every == 0)
+    {
+        return -1;
+    }
+    if (policy.size > 0 && policy.size < LOGROTATE_SIZE_MIN)
+    {
+        policy.size = LOGROTATE_SIZE_MIN;
+    }
+    return 0;
+}
+
+/*
+ * Следующая граница интервала по часам: every=1h — начало следующего часа (UTC)
+ */
+static time_t next_deadline(time_t now)
+{
+    return policy.every > 0 ? now - now % policy.every + policy.every : 0;
+}
+
+/*
+ * base — симлинк на текущий сегмент. Обычный файл с тем же именем (лог до -R) не трогаем
+ */
+static void link_current(unsigned number)
+{
+    struct stat st;
+    if (lstat(policy.base, &st) == 0 && !S_ISLNK(st.st_mode))
+    {
+        return;
+    }
+    char        target[300];
+    char        tmp[300];
+    const char *name = strrchr(policy.base, '/');
+    name = name != NULL ? name + 1 : policy.base;
+    snprintf(target, sizeof(target), "%s.%06u", name, number);
+    snprintf(tmp, sizeof(tmp), "%s.link", policy.base);
+    unlink(tmp);
+    if (symlink(target, tmp) == 0 && rename(tmp, policy.base) < 0)
+    {
+        unlink(tmp);
+    }
+}
+
+/*
+ * Открывает сегмент number и выделяет под него место (сколько вышло — в *allocated).
+ * Возвращает fd или -1
+ */
+static int segment_open(unsigned number, off_t *allocated)
+{
+    char path[300];
+    segment_path(path, sizeof(path), number, "");
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // Не умеет файловая система — просто пишем без предвыделения
+    off_t chunk = (off_t)(policy.size > 0 ? policy.size : LOGROTATE_CHUNK);
+    *allocated  = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, chunk) == 0 ? chunk : 0;
+    link_current(number);
+    return fd;
+}
+
+/*
+ * Отпускает выделенное сверх записанного: иначе блоки за концом файла так и висят.
+ * ftruncate по текущему размеру их освобождает (PUNCH_HOLE за концом файла — нет)
+ */
+static void segment_trim(int fd)
+{
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    if (end >= 0 && seg.allocated > end && ftruncate(fd, end) < 0)
+    {
+        LOG_WARN("Logger: failed to trim log segment %u: %m", seg.number);
+    }
+    seg.allocated = 0;
+}
+
+/*
+ * Сжимает сегмент в .gz (через .gz.tmp — недожатый файл под настоящим именем
+ * не появится) и удаляет исходный
+ */
+static void segment_compress(unsigned number)
+{
+    char path[300];
+    char gz[310];
+    char tmp[320];
+    segment_path(path, sizeof(path), number, "");
+    segment_path(gz, sizeof(gz), number, ".gz");
+    segment_path(tmp, sizeof(tmp), number, ".gz.tmp");
+
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        return;  // Уже удалили (files=) или сжали
+    }
+    char  *buf = malloc(LOGROTATE_BUF);
+    gzFile out = gzopen(tmp, "wb6");
+    ssize_t r  = -1;
+    if (buf != NULL && out != NULL)
+    {
+        while ((r = read(in, buf, LOGROTATE_BUF)) > 0)
+        {
+            if (gzwrite(out, buf, (unsigned)r) != (int)r)
+            {
+                r = -1;
+                break;
+            }
+        }
+    }
+    close(in);
+    free(buf);
+    if (out != NULL && gzclose(out) == Z_OK && r == 0 && rename(tmp, gz) == 0)
+    {
+        unlink(path);
+        return;
+    }
+    LOG_WARN("Logger: failed to compress %s", path);
+    unlink(tmp);
+}
+
+/*
+ * Удаляет сегменты старше files= последних; current — номер открытого
+ */
+static void segments_prune(unsigned current)
+{
+    if (policy.files == 0)
+    {
+        return;
+    }
+    while (queue.oldest + policy.files <= current)
+    {
+        char path[310];
+        segment_path(path, sizeof(path), queue.oldest, "");
+        unlink(path);
+        segment_path(path, sizeof(path), queue.oldest, ".gz");
+        unlink(path);
+        ++queue.oldest;
+    }
+}
+
+/*
+ * Поток сжатия и чистки: закрытые сегменты по одному, с пониженным приоритетом —
+ * делит CPU с event loop'ом, но уступает ему
+ */
+static void *janitor_thread(void *arg)
+{
+    unsigned current = (unsigned)(uintptr_t)arg;
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), LOGROTATE_NICE);
+
+    segments_prune(current);
+    pthread_mutex_lock(&queue.lock);
+    for (;;)
+    {
+        while (queue.head == queue.tail)
+        {
+            pthread_cond_wait(&queue.wake, &queue.lock);
+        }
+        unsigned number = queue.numbers[queue.tail % LOGROTATE_QUEUE];
+        ++queue.tail;
+        pthread_mutex_unlock(&queue.lock);
+
+        if (policy.compress)
+        {
+            segment_compress(number);
+        }
+        // Номера только растут: открыт следующий за последним закрытым
+        if (number + 1 > current)
+        {
+            current = number + 1;
+        }
+        segments_prune(current);
+
+        pthread_mutex_lock(&queue.lock);
+    }
+    return NULL;
+}
+
+/*
+ * Закрытый сегмент — потоку сжатия. Очередь полна — сожмётся при следующем старте
+ */
+static void janitor_push(unsigned number)
+{
+    if (!queue.running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&queue.lock);
+    if (queue.head - queue.tail < LOGROTATE_QUEUE)
+    {
+        queue.numbers[queue.head % LOGROTATE_QUEUE] = number;
+        ++queue.head;
+        pthread_cond_signal(&queue.wake);
+    }
+    pthread_mutex_unlock(&queue.lock);
+}
+
+/*
+ * Что уже лежит на диске от прошлых запусков: последний номер, самый старый,
+ * несжатые сегменты (дожмём) и брошенные .gz.tmp (удалим)
+ */
+static unsigned segments_scan(unsigned *pending, unsigned *npending)
+{
+    char        dir[256];
+    const char *name  = strrchr(policy.base, '/');
+    unsigned    last  = 0;
+    size_t      nlen;
+
+    if (name != NULL)
+    {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(name - policy.base), policy.base);
+        ++name;
+    }
+    else
+    {
+        snprintf(dir, sizeof(dir), ".");
+        name = policy.base;
+    }
+    nlen         = strlen(name);
+    queue.oldest = 0;
+    *npending    = 0;
+
+    DIR *d = opendir(dir[0] != '\0' ? dir : "/");
+    if (d == NULL)
+    {
+        return 0;
+    }
+    for (struct dirent *e = readdir(d); e != NULL; e = readdir(d))
+    {
+        if (strncmp(e->d_name, name, nlen) != 0 || e->d_name[nlen] != '.')
+        {
+            continue;
+        }
+        char          *end;
+        unsigned long  number = strtoul(e->d_name + nlen + 1, &end, 10);
+        if (end != e->d_name + nlen + 7 || number == 0)
+        {
+            continue;
+        }
+        if (strcmp(end, ".gz.tmp") == 0)
+        {
+            char path[600];
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+            continue;
+        }
+        if (strcmp(end, "") != 0 && strcmp(end, ".gz") != 0)
+        {
+            continue;
+        }
+        if (number > last)
+        {
+            last = (unsigned)number;
+        }
+        if (queue.oldest == 0 || number < queue.oldest)
+        {
+            queue.oldest = (unsigned)number;
+        }
+        if (end[0] == '\0' && *npending < LOGROTATE_QUEUE)
+        {
+            pending[(*npending)++] = (unsigned)number;
+        }
+    }
+    closedir(d);
+    return last;
+}
+
+int logrotate_init(const char *path, const char *spec)
+{
+    unsigned pending[LOGROTATE_QUEUE];
+    unsigned npending;
+
+    snprintf(policy.base, sizeof(policy.base), "%s", path);
+    if (policy_parse(spec) < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned last = segments_scan(pending, &npending);
+    int      fd   = segment_open(last + 1, &seg.allocated);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    seg.number   = last + 1;
+    seg.deadline = next_deadline(time(NULL));
+    if (queue.oldest == 0)
+    {
+        queue.oldest = seg.number;
+    }
+
+    // Нечего сжимать и нечего удалять — поток не нужен
+    if (!policy.compress && policy.files == 0)
+    {
+        return fd;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, janitor_thread, (void *)(uintptr_t)seg.number) == 0)
+    {
+        pthread_detach(thread);
+        queue.running = true;
+        for (unsigned i = 0; i < npending && policy.compress; ++i)
+        {
+            janitor_push(pending[i]);
+        }
+    }
+    return fd;
+}
+
+bool logrotate_due(int fd, size_t header)
+{
+    off_t  end = lseek(fd, 0, SEEK_CUR);
+    time_t now = time(NULL);
+    if (end < 0 || now < seg.retry)
+    {
+        return false;
+    }
+    if (policy.size > 0 && (unsigned long long)end >= policy.size)
+    {
+        return true;
+    }
+    if (policy.every > 0 && now >= seg.deadline)
+    {
+        if (end > (off_t)header)
+        {
+            return true;
+        }
+        // В сегменте ничего, кроме заголовка, — не плодим пустые файлы, ждём следующей границы
+        seg.deadline = next_deadline(now);
+    }
+    // Без size= сегмент растёт, пока не кончится интервал: выделяем ещё кусок заранее
+    if (policy.size == 0 && seg.allocated > 0 && end + (off_t)LOGROTATE_CHUNK / 2 > seg.allocated
+        && fallocate(fd, FALLOC_FL_KEEP_SIZE, seg.allocated, (off_t)LOGROTATE_CHUNK) == 0)
+    {
+        seg.allocated += (off_t)LOGROTATE_CHUNK;
+    }
+    return false;
+}
+
+int logrotate_next(int fd)
+{
+    off_t allocated;
+    int   next = segment_open(seg.number + 1, &allocated);
+    if (next < 0)
+    {
+        LOG_WARN("Logger: cannot open the next log segment: %m");
+        seg.retry = time(NULL) + LOGROTATE_RETRY;
+        return -1;
+    }
+    // Хвост закрытого отпускаем, пока fd ещё смотрит на него
+    segment_trim(fd);
+    if (dup2(next, fd) < 0)
+    {
+        close(next);
+        return -1;
+    }
+    close(next);
+    janitor_push(seg.number);
+    seg.number    = seg.number + 1;
+    seg.allocated = allocated;
+    seg.deadline  = next_deadline(time(NULL));
+
+    char path[300];
+    segment_path(path, sizeof(path), seg.number, "");
+    LOG_INFO("Logger: writing %s", path);
+    return 0;
+}
+
+void logrotate_finish(int fd)
+{
+    segment_trim(fd);
+}
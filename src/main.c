@@ -9,6 +9,16 @@
 #include "logger.h"
 #include "server.h"
 #include "terminal.h"
+#include "upstream.h"
+#include "preconnect.h"
+#include "mux.h"
+#include "scan.h"
+#include "inspect.h"
+#include "capture.h"
+#include "freeze.h"
+#include "admin.h"
+#include "metrics.h"
+#include "shmstat.h"
 
 /*
  * Задаём размеры буферов для адреса, порта и других строк.
@@ -18,9 +28,44 @@ typedef enum size_var
 {
     SIZE_ADDR = 64,  // Макс длина IP или хоста
     SIZE_PORT = 16,  // Макс длина порта
-    SIZE_OTH  = 255  // Размер для остального — логин, пароль, имя лога
+    SIZE_OTH  = 255, // Размер для остального — логин, пароль, имя лога
+    SIZE_LIST = 4096 // Списки через запятую (родители апстрима и т.п.)
 } size_var_t;
 
+#define POOL_MAX 65535  // -C: больше готовых сокетов всё равно не даст лимит дескрипторов
+
+/*
+ * Всё, что пришло из командной строки
+ */
+typedef struct options
+{
+    char addr[SIZE_ADDR];     // -a
+    char port[SIZE_PORT];     // -p
+    char username[SIZE_OTH];  // -u
+    char passwd[SIZE_OTH];    // -k
+    char outfile[SIZE_OTH];   // -o
+    int  log_binary;          // -b — бинарный лог для cliproxy-logcat
+    char log_levels[SIZE_OTH];  // -L — уровни логирования, общий и по модулям
+    char log_rotate[SIZE_OTH];  // -R — ротация файла лога по размеру/времени
+    char parents[SIZE_LIST];  // -P
+    char pool_spec[SIZE_OTH]; // -C <slots>[:<per_dest>]
+    int  pool_slots;
+    int  pool_per_dest;
+    int  pool_idle_sec;       // -E
+    char mux_peer[SIZE_OTH];  // -M <host:port> — edge: туннели стримами к core-инстансу
+    int  mux_links;           // -N
+    int  mux_core;            // -m — core: принимать линки мультиплексора
+    int  mux_compress;        // -z — сжимать то, что шлём по линкам
+    char mux_secret[SIZE_OTH];  // -X — секрет линков мультиплексора
+    int  inspect_threads;     // -A — потоков анализа трафика, 0 — без инспекции
+    char inspect_policy[SIZE_LIST]; // -I — что и сколько разбирать
+    char match_file[SIZE_OTH];      // -K — файл ключевых слов для матчера
+    char capture[SIZE_LIST];        // -W — какие туннели писать в pcapng и куда
+    char admin_socket[SIZE_OTH];    // -S — unix-сокет для команд управления
+    char metrics_port[SIZE_PORT];   // -T — порт /metrics на 127.0.0.1
+    int  shm_period_ms;             // -G — период публикации в /dev/shm, мс; 0 — без сегмента
+} options_t;
+
 /*
  * Триггерится, когда аргументы командной строки невалидные или неполные.
  * В лог кладёт предупреждения с описанием всех доступных опций.
@@ -29,54 +74,213 @@ static void usage()
 {
     LOG_WARN("WOWOWOWOW Usage:");
     LOG_WARN("  -o <optional> : file name for log (if not specified, log is output to stdout)");
+    LOG_WARN("  -b <optional> : binary log, formatted offline by cliproxy-logcat");
+    LOG_WARN("  -L <optional> : log levels \"<level>,<module>=<level>,...\" (debug, info, warning, error, off; default info)");
+    LOG_WARN("  -R <optional> : log rotation \"size=N[K|M|G],every=N[s|m|h|d],files=K,compress\" (needs -o)");
     LOG_WARN("  -a <required> : IP address or host name for server bind address");
     LOG_WARN("  -p <required> : port for server bind address");
     LOG_WARN("  -u <optional> : login for SOCKS5 authentication (can be omitted if not required)");
     LOG_WARN("  -k <optional> : password for SOCKS5 authentication (can be omitted if not required)");
+    LOG_WARN("  -P <optional> : upstream parent SOCKS5 proxies, \"[user:pass@]host:port,...\"");
+    LOG_WARN("  -C <optional> : pre-connect pool for hot destinations, \"<slots>[:<per destination>]\"");
+    LOG_WARN("  -E <optional> : idle expiry of pre-connected sockets, seconds (default 15)");
+    LOG_WARN("  -M <optional> : mux edge mode, carry tunnels as streams to a core instance \"host:port\"");
+    LOG_WARN("  -N <optional> : number of persistent mux links in edge mode (default 2)");
+    LOG_WARN("  -m <optional> : mux core mode, accept mux links on the main port");
+    LOG_WARN("  -z <optional> : compress data sent over mux links (incompressible flows are skipped)");
+    LOG_WARN("  -X <optional> : shared secret of mux links, same on edge and core (required for -m with -u/-k)");
+    LOG_WARN("  -A <optional> : traffic analysis threads, 0 disables inspection (default 1)");
+    LOG_WARN("  -I <optional> : inspection policy \"bytes=N,messages=M,sample=K,skip-port=P,skip-host=H,skip-user=U\"");
+    LOG_WARN("  -K <optional> : file of keywords to alert on in inspected traffic, one per line");
+    LOG_WARN("  -W <optional> : pcapng capture \"file=PATH,size=N,files=K,user=U,host=H,port=P,tunnel=ID\"");
+    LOG_WARN("  -S <optional> : admin control socket (unix domain path), text or JSON commands");
+    LOG_WARN("  -T <optional> : Prometheus metrics on http://127.0.0.1:<port>/metrics");
+    LOG_WARN("  -G <optional> : publish counters to /dev/shm/cliproxy.<pid> every <ms> for cliproxy-stat");
+}
+
+/*
+ * Число из -C: только цифры, 0..max. 0 или -1
+ */
+static int pool_number(const char *s, char **end, int max, int *out)
+{
+    if (*s < '0' || *s > '9')
+    {
+        return -1;
+    }
+    errno = 0;
+    unsigned long n = strtoul(s, end, 10);
+    if (errno != 0 || n > (unsigned long)max)
+    {
+        return -1;
+    }
+    *out = (int)n;
+    return 0;
+}
+
+/*
+ * -C "<slots>[:<per_dest>]": slots 0..POOL_MAX (0 — пул выключен), per_dest 1..POOL_MAX,
+ * по умолчанию 2. 0 или -1 на мусоре
+ */
+static int parse_pool(const char *spec, int *slots, int *per_dest)
+{
+    char *end;
+    *per_dest = 2;
+    if (pool_number(spec, &end, POOL_MAX, slots) < 0)
+    {
+        return -1;
+    }
+    if (*end == ':' && (pool_number(end + 1, &end, POOL_MAX, per_dest) < 0 || *per_dest == 0))
+    {
+        return -1;
+    }
+    return *end == '\0' ? 0 : -1;
 }
 
 /*
  * Функция parse_args: парсит аргументы командной строки через getopt.
  */
-static void parse_args(int n, char **args,
-                       char addr[SIZE_ADDR], char port[SIZE_PORT],
-                       char username[SIZE_OTH], char passwd[SIZE_OTH],
-                       char outfile[SIZE_OTH])
+static void parse_args(int n, char **args, options_t *opts)
 {
     char option;
     // getopt выдаёт следующий символ опции или -1, когда все опции обработаны.
-    while ((option = getopt(n, args, "a:p:u:k:o:")) > 0)
+    while ((option = getopt(n, args, "a:p:u:k:o:bL:R:P:C:E:M:N:mzX:A:I:K:W:S:T:G:")) > 0)
     {
         switch (option)
         {
             case 'a':
             {
                 // Копируем строку адреса в буфер addr
-                strncpy(addr, optarg, SIZE_ADDR);
+                strncpy(opts->addr, optarg, SIZE_ADDR - 1);
                 break;
             }
             case 'p':
             {
                 // Аналогично копируем порт
-                strncpy(port, optarg, SIZE_PORT);
+                strncpy(opts->port, optarg, SIZE_PORT - 1);
                 break;
             }
             case 'u':
             {
                 // Логин для SOCKS5-аутентификации
-                strncpy(username, optarg, SIZE_OTH);
+                strncpy(opts->username, optarg, SIZE_OTH - 1);
                 break;
             }
             case 'k':
             {
                 // Пароль для SOCKS5-аутентификации
-                strncpy(passwd, optarg, SIZE_OTH);
+                strncpy(opts->passwd, optarg, SIZE_OTH - 1);
                 break;
             }
             case 'o':
             {
                 // Имя файла для логирования
-                strncpy(outfile, optarg, SIZE_OTH);
+                strncpy(opts->outfile, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'b':
+            {
+                // Лог — бинарные записи, текст из них собирает cliproxy-logcat
+                opts->log_binary = 1;
+                break;
+            }
+            case 'L':
+            {
+                // Уровни логирования: "warning" или "error,protocol=info"
+                strncpy(opts->log_levels, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'R':
+            {
+                // Ротация лога: "size=64M,files=10,compress"
+                strncpy(opts->log_rotate, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'P':
+            {
+                // Родительские SOCKS5-прокси для режима апстрима
+                strncpy(opts->parents, optarg, SIZE_LIST - 1);
+                break;
+            }
+            case 'C':
+            {
+                // Размер пула предварительных коннектов и лимит на одно назначение (разбор в main)
+                strncpy(opts->pool_spec, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'E':
+            {
+                // Сколько готовый сокет может простаивать в пуле
+                opts->pool_idle_sec = atoi(optarg);
+                break;
+            }
+            case 'M':
+            {
+                // Адрес core-инстанса для мультиплексора
+                strncpy(opts->mux_peer, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'N':
+            {
+                // Сколько долгоживущих линков держать к core
+                opts->mux_links = atoi(optarg);
+                break;
+            }
+            case 'm':
+            {
+                opts->mux_core = 1;
+                break;
+            }
+            case 'z':
+            {
+                opts->mux_compress = 1;
+                break;
+            }
+            case 'X':
+            {
+                // Секрет, которым edge открывает линк к core
+                strncpy(opts->mux_secret, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'A':
+            {
+                // Сколько потоков разбирают трафик вне event loop
+                opts->inspect_threads = atoi(optarg);
+                break;
+            }
+            case 'I':
+            {
+                // Политика инспекции: бюджет, выборка, исключения
+                strncpy(opts->inspect_policy, optarg, SIZE_LIST - 1);
+                break;
+            }
+            case 'K':
+            {
+                // Ключевые слова, о которых кричать, если они пролетят через прокси
+                strncpy(opts->match_file, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'W':
+            {
+                // Захват выбранных туннелей в pcapng
+                strncpy(opts->capture, optarg, SIZE_LIST - 1);
+                break;
+            }
+            case 'S':
+            {
+                // Админ-сокет: stats, tunnels, kill, freeze, level, auth
+                strncpy(opts->admin_socket, optarg, SIZE_OTH - 1);
+                break;
+            }
+            case 'T':
+            {
+                // Prometheus: слушаем только loopback
+                strncpy(opts->metrics_port, optarg, SIZE_PORT - 1);
+                break;
+            }
+            case 'G':
+            {
+                // Сегмент статистики для cliproxy-stat
+                opts->shm_period_ms = atoi(optarg);
                 break;
             }
         }
@@ -88,30 +292,57 @@ static void parse_args(int n, char **args,
  */
 int main(int n, char **args)
 {
-    // Буферы для хранения параметров. Инициализируем пустыми строками.
-    char addr[SIZE_ADDR]       = "";
-    char port[SIZE_PORT]       = "";
-    char username[SIZE_OTH]    = "";
-    char passwd[SIZE_OTH]      = "";
-    char outfile[SIZE_OTH]     = "";
+    // Буферы для хранения параметров. static — значит все строки изначально пустые.
+    static options_t opts;
 
     // Разбираем аргументы командной строки и заполняем буферы
-    parse_args(n, args,
-               addr, port,
-               username, passwd,
-               outfile);
+    opts.inspect_threads = 1;
+    parse_args(n, args, &opts);
 
     // Инициализируем логгер: если outfile пуст, лог при старте будет записываться в stdout
-    log_init(outfile, INFO);
+    if (log_init(opts.outfile, opts.log_binary, opts.log_rotate) < 0)
+    {
+        // EINVAL — сам -R кривой (или ротировать нечего: нет -o), остальное — от файла
+        if (errno != EINVAL)
+        {
+            LOG_ERROR("Cannot rotate log \"%s\" with \"%s\": %m", opts.outfile, opts.log_rotate);
+        }
+        else if (opts.outfile[0] == '\0')
+        {
+            LOG_ERROR("Log rotation \"%s\" needs a log file (-o)", opts.log_rotate);
+        }
+        else
+        {
+            LOG_ERROR("Bad log rotation \"%s\", expected size=N[K|M|G],every=N[s|m|h|d],files=K,compress "
+                      "with size or every", opts.log_rotate);
+        }
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // Уровни логирования: по умолчанию всё от INFO, терминал может поменять на ходу
+    if (opts.log_levels[0] != '\0' && log_set_levels(opts.log_levels) < 0)
+    {
+        LOG_ERROR("Bad log levels \"%s\"", opts.log_levels);
+        usage();
+        return EXIT_FAILURE;
+    }
 
     // Проверяем, что обязательные параметры заданы: и addr, и port должно быть хоть че т
-    if (strcmp(port, "") == 0 || strcmp(addr, "") == 0)
+    if (strcmp(opts.port, "") == 0 || strcmp(opts.addr, "") == 0)
     {
         // Если хотя бы один из них пуст, выводим гайд для дауна
         usage();
         return EXIT_FAILURE;
     }
 
+    if (opts.pool_spec[0] != '\0' && parse_pool(opts.pool_spec, &opts.pool_slots, &opts.pool_per_dest) < 0)
+    {
+        LOG_ERROR("Bad pre-connect pool \"%s\", expected <slots>[:<per_dest>] up to %d", opts.pool_spec, POOL_MAX);
+        usage();
+        return EXIT_FAILURE;
+    }
+
     // Настраиваем обработку сигналов: игнорить SIGPIPE и ловить SIGINT
     sigign();
 
@@ -119,16 +350,99 @@ int main(int n, char **args)
     terminal_start();
 
     // Логируем информацию о конфигурации сервера
-    LOG_INFO("Configured server at %s:%s (user=%s)", addr, port, username[0] ? username : "<none>");
+    LOG_INFO("Configured server at %s:%s (user=%s)", opts.addr, opts.port,
+             opts.username[0] ? opts.username : "<none>");
 
     // Инициализируем сервер
-    if (server_init(addr, port, username, passwd) < 0)
+    if (server_init(opts.addr, opts.port, opts.username, opts.passwd) < 0)
     {
         // server_init уже записал ошибку в лог внутри себя (наверное? ну должен наверно, хз), просто завершаемся
         return EXIT_FAILURE;
     }
 
-    LOG_INFO("Server initialization OK on %s:%s", addr, port);
+    LOG_INFO("Server initialization OK on %s:%s", opts.addr, opts.port);
+
+    // Команды заморозки из терминала доходят до event loop'а через eventfd
+    if (freeze_init() < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Админ-сокет — свой поток, в event loop попадает только через очереди
+    if (opts.admin_socket[0] != '\0' && admin_init(opts.admin_socket) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // /metrics — тоже свой поток, читает только шарды счётчиков и слепки stats
+    if (opts.metrics_port[0] != '\0' && metrics_init(opts.metrics_port) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Сегмент в /dev/shm: читатели мапят его и ни о чём сервер не просят
+    if (opts.shm_period_ms != 0 && shmstat_init(opts.shm_period_ms) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Сканеры разбора трафика: выбираем SIMD-реализацию под CPU
+    scan_init();
+    LOG_INFO("Traffic scanner: %s", scan_impl_name());
+
+    // Разбор трафика — в отдельных потоках, event loop только публикует снимки
+    if (inspect_init(opts.inspect_threads, opts.inspect_policy, opts.match_file) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Захват туннелей в pcapng — свой поток записи, форвардинг его не ждёт
+    if (capture_init(opts.capture) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Режим апстрима: туннели идут через родительские SOCKS5-прокси
+    if (opts.parents[0] != '\0' && upstream_init(opts.parents) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Пул предварительных коннектов к горячим назначениям (только для прямого режима)
+    if (opts.pool_slots > 0)
+    {
+        int idle_sec = opts.pool_idle_sec > 0 ? opts.pool_idle_sec : 15;
+        if (preconnect_init(opts.pool_slots, opts.pool_per_dest, idle_sec * 1000) < 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Мультиплексор между инстансами: core принимает линки, edge гонит по ним туннели.
+    // Стримы линка не проходят SOCKS5 USER/PASS — без секрета core с -u/-k был бы открытым прокси
+    if (opts.mux_core && opts.username[0] != '\0' && opts.passwd[0] != '\0' && opts.mux_secret[0] == '\0')
+    {
+        LOG_ERROR("Mux core with SOCKS5 authentication needs a link secret (-X)");
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (opts.mux_secret[0] != '\0' && mux_init_secret(opts.mux_secret) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    if (opts.mux_core)
+    {
+        mux_init_core();
+    }
+    if (opts.mux_compress && mux_init_compress() < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    if (opts.mux_peer[0] != '\0'
+        && mux_init_edge(opts.mux_peer, opts.mux_links > 0 ? opts.mux_links : 2) < 0)
+    {
+        return EXIT_FAILURE;
+    }
 
     // Запускаем основной цикл обработки событий через epoll (крутая штука неблокирующая поток)
     if (server_start() < 0)
@@ -0,0 +1,415 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+#include "scan.h"
+#include "logger.h"
+
+
+#define MATCH_ACCEPT  0x8000u  // Бит перехода: в новом состоянии что-то совпало
+#define MATCH_LINE    4096     // Строка файла шаблонов
+#define MATCH_SHOWN   (MATCH_PATTERN_MAX * 4 + 1)
+
+/*
+ * Правило: шаблон и как его показывать
+ */
+typedef struct match_rule
+{
+    char     name[MATCH_NAME_MAX];
+    uint8_t  bytes[MATCH_PATTERN_MAX];
+    size_t   len;
+    char     shown[MATCH_SHOWN];
+} match_rule_t;
+
+/*
+ * Автомат. Строится один раз в match_load, потом только читается потоками анализа
+ */
+typedef struct match_dfa
+{
+    uint16_t      *next;        // [состояние << shift | класс] → состояние | MATCH_ACCEPT
+    uint8_t        cls[256];    // Байт → класс, 0 — байт не встречается в шаблонах
+    unsigned       shift;
+    unsigned       nstates;
+    int32_t       *own;         // Шаблон, который кончается в состоянии, или -1
+    uint16_t      *link;        // Ближайшее по fail-цепочке состояние со своим шаблоном, 0 — нет
+    scan_set_t     first;       // Первые пары байтов шаблонов — выход из корня
+    match_rule_t  *rules;
+    unsigned       nrules;
+} match_dfa_t;
+
+
+static match_dfa_t dfa;
+
+
+/*
+ * Строка файла → байты шаблона. 0 — ок, <0 — плохое экранирование или длина
+ */
+static int unescape(const char *s, match_rule_t *rule)
+{
+    rule->len = 0;
+    while (*s != '\0')
+    {
+        int c = (unsigned char)*s++;
+        if (c == '\\')
+        {
+            if (*s == '\\')
+            {
+                ++s;
+            }
+            else if (*s == 'x' && s[1] != '\0' && s[2] != '\0')
+            {
+                char  hex[3] = { s[1], s[2], '\0' };
+                char *end;
+                c = (int)strtol(hex, &end, 16);
+                if (*end != '\0')
+                {
+                    return -1;
+                }
+                s += 3;
+            }
+            else
+            {
+                return -1;
+            }
+        }
+        if (rule->len == MATCH_PATTERN_MAX)
+        {
+            return -1;
+        }
+        rule->bytes[rule->len++] = (uint8_t)c;
+    }
+    return rule->len > 0 ? 0 : -1;
+}
+
+/*
+ * Шаблон для лога: печатное как есть, остальное (и '"', '\') — \xHH
+ */
+static void show(match_rule_t *rule)
+{
+    size_t at = 0;
+    for (size_t i = 0; i < rule->len; ++i)
+    {
+        uint8_t c = rule->bytes[i];
+        if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\')
+        {
+            at += (size_t)snprintf(rule->shown + at, MATCH_SHOWN - at, "\\x%02x", c);
+        }
+        else
+        {
+            rule->shown[at++] = (char)c;
+        }
+    }
+    rule->shown[at] = '\0';
+}
+
+/*
+ * Читает файл в dfa.rules
+ */
+static int read_rules(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        LOG_ERROR("Content matcher: cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char     line[MATCH_LINE];
+    unsigned lineno = 0;
+    unsigned cap    = 0;
+    int      rc     = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        ++lineno;
+        size_t n = strlen(line);
+        if (n == sizeof(line) - 1 && line[n - 1] != '\n')
+        {
+            LOG_ERROR("Content matcher: %s:%u: line too long", path, lineno);
+            rc = -1;
+            break;
+        }
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+        {
+            line[--n] = '\0';
+        }
+        if (n == 0 || line[0] == '#')
+        {
+            continue;
+        }
+        if (dfa.nrules == MATCH_PATTERNS_MAX)
+        {
+            LOG_ERROR("Content matcher: %s: more than %d patterns", path, MATCH_PATTERNS_MAX);
+            rc = -1;
+            break;
+        }
+        if (dfa.nrules == cap)
+        {
+            cap = cap > 0 ? cap * 2 : 64;
+            match_rule_t *grown = realloc(dfa.rules, cap * sizeof(*grown));
+            if (grown == NULL)
+            {
+                LOG_ERROR("Content matcher: out of memory");
+                rc = -1;
+                break;
+            }
+            dfa.rules = grown;
+        }
+
+        match_rule_t *rule    = &dfa.rules[dfa.nrules];
+        char         *pattern = line;
+        char         *tab     = strchr(line, '\t');
+        rule->name[0] = '\0';
+        if (tab != NULL)
+        {
+            *tab    = '\0';
+            pattern = tab + 1;
+            snprintf(rule->name, sizeof(rule->name), "%.*s", MATCH_NAME_MAX - 1, line);
+        }
+        if (unescape(pattern, rule) < 0)
+        {
+            LOG_ERROR("Content matcher: %s:%u: empty pattern, bad escape or longer than %d bytes",
+                      path, lineno, MATCH_PATTERN_MAX);
+            rc = -1;
+            break;
+        }
+        show(rule);
+        if (rule->name[0] == '\0')
+        {
+            snprintf(rule->name, sizeof(rule->name), "%.*s", MATCH_NAME_MAX - 1, rule->shown);
+        }
+        dfa.nrules++;
+    }
+    fclose(f);
+    return rc;
+}
+
+/*
+ * Сборка автомата: бор по классам байтов, потом обход в ширину — он же
+ * перенумеровывает состояния, достраивает недостающие переходы по fail-ссылкам
+ * и считает link для отчёта о вложенных совпадениях
+ */
+static int compile(void)
+{
+    // Классы байтов
+    unsigned nclasses = 1;
+    uint8_t  used[256] = { 0 };
+    size_t   total     = 0;
+    for (unsigned r = 0; r < dfa.nrules; ++r)
+    {
+        for (size_t i = 0; i < dfa.rules[r].len; ++i)
+        {
+            used[dfa.rules[r].bytes[i]] = 1;
+        }
+        total += dfa.rules[r].len;
+    }
+    for (int b = 0; b < 256; ++b)
+    {
+        nclasses += used[b];
+    }
+    for (int b = 0, c = 1; b < 256; ++b)
+    {
+        // Шаблоны задействуют все 256 байтов — класс 0 не нужен, класс и есть байт
+        dfa.cls[b] = nclasses > 256 ? (uint8_t)b : used[b] ? (uint8_t)c++ : 0;
+    }
+    if (nclasses > 256)
+    {
+        nclasses = 256;
+    }
+    while ((1u << dfa.shift) < nclasses)
+    {
+        dfa.shift++;
+    }
+    unsigned width = 1u << dfa.shift;
+
+    // Бор: 0 — перехода нет (в корень бор не ведёт)
+    size_t    limit = total + 1 < MATCH_STATES_MAX ? total + 1 : MATCH_STATES_MAX;
+    uint16_t *trie  = calloc(limit * width, sizeof(*trie));
+    int32_t  *own   = malloc(limit * sizeof(*own));
+    uint16_t *order = malloc(limit * sizeof(*order));
+    uint16_t *fail  = calloc(limit, sizeof(*fail));
+    dfa.next = calloc(limit * width, sizeof(*dfa.next));
+    dfa.own  = malloc(limit * sizeof(*dfa.own));
+    dfa.link = calloc(limit, sizeof(*dfa.link));
+    int rc = -1;
+    if (trie == NULL || own == NULL || order == NULL || fail == NULL
+        || dfa.next == NULL || dfa.own == NULL || dfa.link == NULL)
+    {
+        LOG_ERROR("Content matcher: out of memory");
+        goto out;
+    }
+
+    unsigned ntrie = 1;
+    own[0] = -1;
+    for (unsigned r = 0; r < dfa.nrules; ++r)
+    {
+        const match_rule_t *rule = &dfa.rules[r];
+        unsigned            s    = 0;
+        for (size_t i = 0; i < rule->len; ++i)
+        {
+            uint16_t *edge = &trie[s << dfa.shift | dfa.cls[rule->bytes[i]]];
+            if (*edge == 0)
+            {
+                if (ntrie == limit)
+                {
+                    LOG_ERROR("Content matcher: patterns need more than %d automaton states", MATCH_STATES_MAX);
+                    goto out;
+                }
+                own[ntrie] = -1;
+                *edge      = (uint16_t)ntrie++;
+            }
+            s = *edge;
+        }
+        if (own[s] >= 0)
+        {
+            LOG_WARN("Content matcher: pattern \"%s\" repeats, rule %s ignored", rule->shown, rule->name);
+            continue;
+        }
+        own[s] = (int32_t)r;
+    }
+
+    // BFS: номер в order — новый номер состояния
+    unsigned head = 0;
+    unsigned tail = 1;
+    order[0] = 0;
+    while (head < tail)
+    {
+        unsigned  k    = head;
+        unsigned  old  = order[head++];
+        uint16_t *row  = &dfa.next[k << dfa.shift];
+        uint16_t *frow = &dfa.next[fail[k] << dfa.shift];
+        dfa.own[k] = own[old];
+        for (unsigned c = 0; c < nclasses; ++c)
+        {
+            uint16_t t = trie[old << dfa.shift | c];
+            if (t == 0)
+            {
+                row[c] = k == 0 ? 0 : frow[c];
+                continue;
+            }
+            // Ребёнок: fail — переход из fail родителя (та строка уже готова, она мельче)
+            fail[tail]  = k == 0 ? 0 : frow[c];
+            order[tail] = t;
+            row[c]      = (uint16_t)tail++;
+        }
+    }
+    dfa.nstates = tail;
+
+    // link и бит совпадения: fail-состояния мельче, их link уже посчитан
+    for (unsigned k = 1; k < dfa.nstates; ++k)
+    {
+        unsigned f = fail[k];
+        dfa.link[k] = dfa.own[f] >= 0 ? (uint16_t)f : dfa.link[f];
+    }
+    for (size_t e = 0; e < (size_t)dfa.nstates * width; ++e)
+    {
+        unsigned t = dfa.next[e];
+        if (t != 0 && (dfa.own[t] >= 0 || dfa.link[t] != 0))
+        {
+            dfa.next[e] = (uint16_t)(t | MATCH_ACCEPT);
+        }
+    }
+
+    // Префильтр: с каких пар байтов начинаются шаблоны (однобайтовый — с любым вторым)
+    scan_set_init(&dfa.first);
+    for (unsigned r = 0; r < dfa.nrules; ++r)
+    {
+        const match_rule_t *rule = &dfa.rules[r];
+        scan_set_add(&dfa.first, rule->bytes[0], rule->len > 1 ? rule->bytes[1] : -1);
+    }
+    rc = 0;
+
+out:
+    free(trie);
+    free(own);
+    free(order);
+    free(fail);
+    if (rc < 0)
+    {
+        free(dfa.next);
+        free(dfa.own);
+        free(dfa.link);
+        dfa.next = NULL;
+    }
+    else
+    {
+        LOG_INFO("Content matcher: %u patterns, %u states, %u byte classes, table %zu KiB, %u first bytes",
+                 dfa.nrules, dfa.nstates, nclasses, ((size_t)dfa.nstates * width * sizeof(uint16_t) + 1023) / 1024,
+                 dfa.first.nbytes);
+    }
+    return rc;
+}
+
+int match_load(const char *path)
+{
+    if (read_rules(path) < 0)
+    {
+        return -1;
+    }
+    if (dfa.nrules == 0)
+    {
+        LOG_ERROR("Content matcher: no patterns in %s", path);
+        return -1;
+    }
+    return compile();
+}
+
+bool match_enabled(void)
+{
+    return dfa.next != NULL;
+}
+
+void match_stream_init(match_stream_t *ms)
+{
+    ms->state  = 0;
+    ms->offset = 0;
+}
+
+/*
+ * Совпадения, кончающиеся в состоянии s: своё и по link-цепочке.
+ * end — смещение сразу за последним байтом
+ */
+static void report(unsigned s, uint64_t end, match_cb_t cb, void *ud)
+{
+    for (unsigned t = s; t != 0; t = dfa.link[t])
+    {
+        if (dfa.own[t] < 0)
+        {
+            continue;
+        }
+        const match_rule_t *rule = &dfa.rules[dfa.own[t]];
+        match_hit_t         hit  = { rule->name, rule->shown, rule->len, end - rule->len };
+        cb(ud, &hit);
+    }
+}
+
+void match_feed(match_stream_t *ms, const uint8_t *data, size_t len, match_cb_t cb, void *ud)
+{
+    const uint16_t *next  = dfa.next;
+    const uint8_t  *cls   = dfa.cls;
+    unsigned        shift = dfa.shift;
+    unsigned        s     = ms->state;
+    size_t          i     = 0;
+
+    while (i < len)
+    {
+        if (s == 0)
+        {
+            // В корне: до начала какого-нибудь шаблона автомату делать нечего
+            i += scan_set_find(&dfa.first, data + i, len - i);
+            if (i == len)
+            {
+                break;
+            }
+        }
+        s = next[s << shift | cls[data[i++]]];
+        if (s & MATCH_ACCEPT)
+        {
+            s &= ~MATCH_ACCEPT;
+            report(s, ms->offset + i, cb, ud);
+        }
+    }
+    ms->state   = (uint16_t)s;
+    ms->offset += len;
+}
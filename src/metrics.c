@@ -0,0 +1,319 @@
+#define _GNU_SOURCE  // open_memstream
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "stats.h"
+#include "logger.h"
+
+
+#define METRICS_REQUEST_MAX  4096  // Заголовки запроса скрейпера
+#define METRICS_TIMEOUT_SEC  2     // Таймаут чтения запроса и записи ответа
+#define METRICS_NICE         10    // Приоритет потока скрейпера
+
+/*
+ * Семейство счётчиков для вывода: подряд идущие metric_t с одной меткой
+ */
+typedef struct metrics_family
+{
+    const char *name;
+    const char *help;
+    metric_t    first;
+    const char *label;      // NULL — без меток, один счётчик
+    const char *values[6];  // Значения метки по порядку metric_t
+} metrics_family_t;
+
+static const metrics_family_t families[] = {
+    {"cliproxy_connections_accepted_total", "Client connections accepted.", METRIC_ACCEPTS, NULL, {NULL}},
+    {"cliproxy_handshakes_total", "Tunnel handshakes by outcome.", METRIC_HANDSHAKE_OK, "outcome",
+     {"ok", "auth_failed", "protocol_error", "connect_failed", "abandoned", NULL}},
+    {"cliproxy_forwarded_bytes_total", "Bytes written to sockets by direction.", METRIC_BYTES_TO_REMOTE,
+     "direction", {"to_remote", "to_client", NULL}},
+    {"cliproxy_dns_lookups_total", "Blocking getaddrinfo calls for destinations.", METRIC_DNS_OK, "result",
+     {"ok", "error", NULL}},
+    {"cliproxy_dns_cache_lookups_total", "Pre-connect pool DNS cache lookups.", METRIC_DNS_CACHE_HIT, "result",
+     {"hit", "miss", NULL}},
+    {"cliproxy_epoll_wakeups_total", "Returns from epoll_wait.", METRIC_EPOLL_WAKEUPS, NULL, {NULL}},
+    {"cliproxy_epoll_events_total", "Events delivered by epoll_wait.", METRIC_EPOLL_EVENTS, NULL, {NULL}},
+    {"cliproxy_syscalls_total", "System calls on the forwarding path.", METRIC_SYS_READ, "call",
+     {"read", "write", "accept", "connect", "epoll_ctl", "epoll_wait"}},
+};
+
+// Границы корзин времени коннекта, мкс
+static const unsigned long long bucket_us[METRICS_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static const char *state_names[] = {"open", "auth", "request", "connecting", "connected"};
+
+_Thread_local metrics_shard_t *metrics_local;
+
+// Все шарды: список меняется только при заведении шарда, скрейпер обходит его под тем же локом
+static pthread_mutex_t  shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_shard_t *shards;
+static metrics_shard_t  spare;  // Если память под шард не выделилась — общий на всех таких
+
+static int listen_fd = -1;
+
+
+metrics_shard_t *metrics_shard_new(void)
+{
+    metrics_shard_t *shard = aligned_alloc(_Alignof(metrics_shard_t), sizeof(metrics_shard_t));
+    if (shard == NULL)
+    {
+        metrics_local = &spare;
+        return &spare;
+    }
+    memset(shard, 0, sizeof(*shard));
+    pthread_mutex_lock(&shards_lock);
+    shard->next = shards;
+    shards      = shard;
+    pthread_mutex_unlock(&shards_lock);
+    metrics_local = shard;
+    return shard;
+}
+
+void metrics_connect_time(unsigned long long us)
+{
+    metrics_shard_t *shard  = metrics_shard();
+    int              bucket = 0;
+    while (bucket < METRICS_BUCKETS && us > bucket_us[bucket])
+    {
+        ++bucket;
+    }
+    metrics_bump(&shard->connect_bucket[bucket], 1);
+    metrics_bump(&shard->connect_sum_us, us);
+}
+
+static void shard_add(metrics_sum_t *sum, metrics_shard_t *shard)
+{
+    for (int i = 0; i < METRIC_COUNT; ++i)
+    {
+        sum->counter[i] += atomic_load_explicit(&shard->counter[i], memory_order_relaxed);
+    }
+    for (int i = 0; i <= METRICS_BUCKETS; ++i)
+    {
+        sum->connect_bucket[i] += atomic_load_explicit(&shard->connect_bucket[i], memory_order_relaxed);
+    }
+    sum->connect_sum_us += atomic_load_explicit(&shard->connect_sum_us, memory_order_relaxed);
+}
+
+/*
+ * Сумма по всем шардам — только здесь шарды и читаются чужим потоком
+ */
+void metrics_sum(metrics_sum_t *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    pthread_mutex_lock(&shards_lock);
+    for (metrics_shard_t *shard = shards; shard != NULL; shard = shard->next)
+    {
+        shard_add(sum, shard);
+    }
+    pthread_mutex_unlock(&shards_lock);
+    shard_add(sum, &spare);
+}
+
+/*
+ * Тело ответа в формате Prometheus text 0.0.4
+ */
+static void metrics_render(FILE *out)
+{
+    metrics_sum_t   sum;
+    stats_summary_t summary;
+
+    metrics_sum(&sum);
+    stats_summary(&summary);
+
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); ++f)
+    {
+        const metrics_family_t *family = &families[f];
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", family->name, family->help, family->name);
+        if (family->label == NULL)
+        {
+            fprintf(out, "%s %llu\n", family->name, sum.counter[family->first]);
+            continue;
+        }
+        for (int i = 0; i < 6 && family->values[i] != NULL; ++i)
+        {
+            fprintf(out, "%s{%s=\"%s\"} %llu\n", family->name, family->label, family->values[i],
+                    sum.counter[family->first + i]);
+        }
+    }
+
+    fprintf(out, "# HELP cliproxy_connect_duration_seconds From client request to tunnel established.\n"
+                 "# TYPE cliproxy_connect_duration_seconds histogram\n");
+    unsigned long long cumulative = 0;
+    for (int i = 0; i <= METRICS_BUCKETS; ++i)
+    {
+        cumulative += sum.connect_bucket[i];
+        if (i < METRICS_BUCKETS)
+        {
+            fprintf(out, "cliproxy_connect_duration_seconds_bucket{le=\"%g\"} %llu\n", (double)bucket_us[i] / 1e6,
+                    cumulative);
+        }
+        else
+        {
+            fprintf(out, "cliproxy_connect_duration_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+        }
+    }
+    fprintf(out, "cliproxy_connect_duration_seconds_sum %.6f\ncliproxy_connect_duration_seconds_count %llu\n",
+            (double)sum.connect_sum_us / 1e6, cumulative);
+
+    fprintf(out, "# HELP cliproxy_tunnels Open tunnels by state.\n# TYPE cliproxy_tunnels gauge\n");
+    for (int state = open_state; state <= connected_state; ++state)
+    {
+        fprintf(out, "cliproxy_tunnels{state=\"%s\"} %u\n", state_names[state], summary.states[state]);
+    }
+    fprintf(out, "# HELP cliproxy_tunnels_opened_total Tunnels created.\n# TYPE cliproxy_tunnels_opened_total counter\n"
+                 "cliproxy_tunnels_opened_total %llu\n", summary.opened);
+    fprintf(out, "# HELP cliproxy_tunnels_closed_total Tunnels released.\n# TYPE cliproxy_tunnels_closed_total counter\n"
+                 "cliproxy_tunnels_closed_total %llu\n", summary.closed);
+    fprintf(out, "# HELP cliproxy_buffer_memory_bytes Memory held by socket buffer blocks.\n"
+                 "# TYPE cliproxy_buffer_memory_bytes gauge\ncliproxy_buffer_memory_bytes %lld\n", summary.buffer_mem);
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        len  -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Один запрос скрейпера: GET /metrics — метрики, остальное — 404
+ */
+static void metrics_serve(int fd)
+{
+    char    request[METRICS_REQUEST_MAX];
+    size_t  len = 0;
+    char   *body = NULL;
+    size_t  body_len = 0;
+    char    header[256];
+
+    // Дочитываем заголовки: тело у GET не бывает
+    while (len + 1 < sizeof(request))
+    {
+        ssize_t n = read(fd, request + len, sizeof(request) - 1 - len);
+        if (n <= 0)
+        {
+            return;
+        }
+        len += (size_t)n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+        {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    int found = strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL)
+    {
+        return;
+    }
+    if (found)
+    {
+        metrics_render(out);
+    }
+    else
+    {
+        fprintf(out, "Not found, try /metrics\n");
+    }
+    fclose(out);
+
+    int head = snprintf(header, sizeof(header),
+                        "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                        "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                        found ? "200 OK" : "404 Not Found", body_len);
+    if (write_all(fd, header, (size_t)head) == 0)
+    {
+        write_all(fd, body, body_len);
+    }
+    free(body);
+}
+
+/*
+ * Поток скрейпера: соединения по одному, Prometheus больше и не шлёт
+ */
+static void *metrics_thread(void *arg)
+{
+    struct timeval timeout = {.tv_sec = METRICS_TIMEOUT_SEC};
+    (void)arg;
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), METRICS_NICE);
+
+    for (;;)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        // Зависший клиент не должен держать поток дольше таймаута
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        metrics_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_init(const char *port)
+{
+    struct addrinfo  hint = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICHOST};
+    struct addrinfo *ai   = NULL;
+    int              one  = 1;
+
+    // Только loopback: метрики не для чужих глаз, наружу их отдаёт уже сам Prometheus
+    if (getaddrinfo("127.0.0.1", port, &hint, &ai) != 0)
+    {
+        LOG_ERROR("Metrics: bad port %s", port);
+        return -1;
+    }
+    listen_fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0
+        || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+        || bind(listen_fd, ai->ai_addr, ai->ai_addrlen) < 0
+        || listen(listen_fd, 16) < 0)
+    {
+        LOG_ERROR("Metrics: cannot listen on 127.0.0.1:%s: %m", port);
+        freeaddrinfo(ai);
+        return -1;
+    }
+    freeaddrinfo(ai);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, metrics_thread, NULL) != 0)
+    {
+        LOG_ERROR("Metrics: failed to launch thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    LOG_INFO("Metrics on http://127.0.0.1:%s/metrics", port);
+    return 0;
+}
@@ -0,0 +1,340 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mqtt.h"
+
+
+static const char *names[16] =
+{
+    "reserved", "CONNECT", "CONNACK", "PUBLISH", "PUBACK", "PUBREC", "PUBREL", "PUBCOMP",
+    "SUBSCRIBE", "SUBACK", "UNSUBSCRIBE", "UNSUBACK", "PINGREQ", "PINGRESP", "DISCONNECT", "AUTH"
+};
+
+/*
+ * Чтение тела пакета: выход за собранное — ok = 0, дальше всё читается пустым
+ */
+typedef struct reader
+{
+    const uint8_t *p;
+    size_t         n;
+    size_t         at;
+    int            ok;
+} reader_t;
+
+
+void mqtt_flow_init(mqtt_flow_t *mqtt)
+{
+    // body значим только до body_len
+    for (int d = 0; d < 2; ++d)
+    {
+        memset(&mqtt->dir[d], 0, offsetof(mqtt_stream_t, body));
+    }
+    mqtt->level    = 4;
+    mqtt->messages = 0;
+}
+
+dissect_match_t mqtt_signature(const uint8_t *p, size_t len, int is_client, bool port_hint)
+{
+    (void)port_hint;
+    if (!is_client || p[0] != 0x10)
+    {
+        return DISSECT_NO;
+    }
+    // Оставшаяся длина varint, потом имя протокола строкой с длиной
+    size_t at = 1;
+    while (at < len && at < 5 && (p[at] & 0x80))
+    {
+        ++at;
+    }
+    if (at == len)
+    {
+        return DISSECT_MORE;
+    }
+    if (at == 5)
+    {
+        return DISSECT_NO;
+    }
+    ++at;
+    static const uint8_t v4[] = { 0, 4, 'M', 'Q', 'T', 'T' };
+    static const uint8_t v3[] = { 0, 6, 'M', 'Q', 'I', 's', 'd', 'p' };
+    size_t n = len - at;
+    if (memcmp(p + at, v4, n < sizeof(v4) ? n : sizeof(v4)) == 0)
+    {
+        return n >= sizeof(v4) ? DISSECT_YES : DISSECT_MORE;
+    }
+    if (memcmp(p + at, v3, n < sizeof(v3) ? n : sizeof(v3)) == 0)
+    {
+        return n >= sizeof(v3) ? DISSECT_YES : DISSECT_MORE;
+    }
+    return DISSECT_NO;
+}
+
+static unsigned u8(reader_t *r)
+{
+    if (r->at + 1 > r->n)
+    {
+        r->ok = 0;
+        return 0;
+    }
+    return r->p[r->at++];
+}
+
+static unsigned u16(reader_t *r)
+{
+    unsigned hi = u8(r);
+    return hi << 8 | u8(r);
+}
+
+/*
+ * Properties MQTT 5.0: длина varint и сами свойства — пропускаем
+ */
+static void skip_properties(reader_t *r, uint8_t level)
+{
+    if (level < 5)
+    {
+        return;
+    }
+    uint32_t len = 0;
+    for (int shift = 0; shift < 28; shift += 7)
+    {
+        unsigned b = u8(r);
+        len |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            break;
+        }
+    }
+    if (r->at + len > r->n)
+    {
+        r->ok = 0;
+        return;
+    }
+    r->at += len;
+}
+
+/*
+ * Строка с длиной (2 байта) — в text, непечатное — '?'
+ */
+static void put_string(reader_t *r, char *text, size_t *at)
+{
+    size_t len = u16(r);
+    if (!r->ok || r->at + len > r->n)
+    {
+        r->ok = 0;
+        return;
+    }
+    for (size_t i = 0; i < len && *at < MQTT_TEXT_MAX; ++i)
+    {
+        uint8_t c = r->p[r->at + i];
+        text[(*at)++] = c < 0x20 || c == 0x7f ? '?' : (char)c;
+    }
+    r->at += len;
+}
+
+static void put(char *text, size_t *at, const char *fmt, ...)
+{
+    if (*at < MQTT_TEXT_MAX)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(text + *at, MQTT_TEXT_MAX - *at, fmt, ap);
+        va_end(ap);
+        *at += n > 0 ? (size_t)n : 0;
+        *at  = *at < MQTT_TEXT_MAX ? *at : MQTT_TEXT_MAX - 1;
+    }
+}
+
+/*
+ * Описание пакета в text; 0 — не показываем
+ */
+static size_t describe(mqtt_flow_t *mqtt, uint8_t type, uint8_t flags, const mqtt_stream_t *s, char *text)
+{
+    reader_t r  = { s->body, s->body_len, 0, 1 };
+    size_t   at = 0;
+
+    switch (type)
+    {
+        case MQTT_CONNECT:
+        {
+            put_string(&r, text, &at);
+            unsigned level     = u8(&r);
+            unsigned cflags    = u8(&r);
+            unsigned keepalive = u16(&r);
+            if (r.ok)
+            {
+                mqtt->level = (uint8_t)level;
+            }
+            put(text, &at, " level %u, client ", level);
+            skip_properties(&r, mqtt->level);
+            put_string(&r, text, &at);
+            put(text, &at, ", keepalive %u", keepalive);
+            if (cflags & 0x02)
+            {
+                put(text, &at, ", clean");
+            }
+            return at;
+        }
+        case MQTT_CONNACK:
+        {
+            unsigned ackflags = u8(&r);
+            unsigned code     = u8(&r);
+            put(text, &at, "code %u", code);
+            if (ackflags & 0x01)
+            {
+                put(text, &at, ", session present");
+            }
+            return at;
+        }
+        case MQTT_PUBLISH:
+        {
+            unsigned qos = (flags >> 1) & 3;
+            put_string(&r, text, &at);
+            if (qos > 0)
+            {
+                u16(&r);
+            }
+            skip_properties(&r, mqtt->level);
+            put(text, &at, ", qos %u", qos);
+            if (flags & 0x01)
+            {
+                put(text, &at, ", retain");
+            }
+            if (r.ok)
+            {
+                put(text, &at, ", payload %u байт", s->len - (uint32_t)r.at);
+            }
+            mqtt->messages++;
+            return at;
+        }
+        case MQTT_SUBSCRIBE:
+        case MQTT_UNSUBSCRIBE:
+        {
+            u16(&r);
+            skip_properties(&r, mqtt->level);
+            while (r.ok && r.at < r.n)
+            {
+                if (at > 0)
+                {
+                    put(text, &at, ", ");
+                }
+                put_string(&r, text, &at);
+                if (type == MQTT_SUBSCRIBE)
+                {
+                    put(text, &at, " (qos %u)", u8(&r) & 3);
+                }
+            }
+            return at;
+        }
+        case MQTT_DISCONNECT:
+        {
+            if (s->len > 0)
+            {
+                put(text, &at, "reason %u", u8(&r));
+            }
+            else
+            {
+                put(text, &at, "normal");
+            }
+            return at;
+        }
+    }
+    return 0;
+}
+
+static void broken(mqtt_stream_t *s, int is_client, const char *what, const mqtt_flow_cb_t *cb, void *ud)
+{
+    s->state = MQTT_BROKEN;
+    cb->on_error(ud, is_client, what);
+}
+
+static void packet_done(mqtt_flow_t *mqtt, mqtt_stream_t *s, int is_client, const mqtt_flow_cb_t *cb, void *ud)
+{
+    char          text[MQTT_TEXT_MAX];
+    mqtt_packet_t pkt;
+
+    s->state     = MQTT_HEADER;
+    pkt.type     = s->hdr[0] >> 4;
+    pkt.flags    = s->hdr[0] & 0x0f;
+    pkt.name     = names[pkt.type];
+    pkt.len      = s->len;
+    pkt.text     = text;
+    pkt.text_len = describe(mqtt, pkt.type, pkt.flags, s, text);
+    s->hdr_len   = 0;
+    if (pkt.text_len > 0)
+    {
+        cb->on_packet(ud, is_client, &pkt);
+    }
+}
+
+void mqtt_flow_feed(mqtt_flow_t *mqtt, const uint8_t *data, size_t len, int is_client,
+                    const mqtt_flow_cb_t *cb, void *ud)
+{
+    mqtt_stream_t *s = &mqtt->dir[is_client ? 1 : 0];
+
+    while (len > 0)
+    {
+        switch (s->state)
+        {
+            case MQTT_BROKEN:
+            {
+                return;
+            }
+            case MQTT_HEADER:
+            {
+                // Первый байт и varint до байта без старшего бита
+                while (len > 0 && (s->hdr_len < 2 || (s->hdr[s->hdr_len - 1] & 0x80)))
+                {
+                    if (s->hdr_len == sizeof(s->hdr))
+                    {
+                        broken(s, is_client, "remaining length longer than 4 bytes", cb, ud);
+                        return;
+                    }
+                    s->hdr[s->hdr_len++] = *data++;
+                    --len;
+                }
+                if (s->hdr_len < 2 || (s->hdr[s->hdr_len - 1] & 0x80))
+                {
+                    return;
+                }
+                if ((s->hdr[0] >> 4) == 0)
+                {
+                    broken(s, is_client, "reserved packet type", cb, ud);
+                    return;
+                }
+                s->len = 0;
+                for (size_t i = 1; i < s->hdr_len; ++i)
+                {
+                    s->len |= (uint32_t)(s->hdr[i] & 0x7f) << (7 * (i - 1));
+                }
+                s->left     = s->len;
+                s->body_len = 0;
+                s->state    = MQTT_BODY;
+                if (s->left == 0)
+                {
+                    packet_done(mqtt, s, is_client, cb, ud);
+                }
+                break;
+            }
+            case MQTT_BODY:
+            {
+                size_t n = len < s->left ? len : s->left;
+                if (s->body_len < sizeof(s->body))
+                {
+                    size_t c = sizeof(s->body) - s->body_len;
+                    c = c < n ? c : n;
+                    memcpy(s->body + s->body_len, data, c);
+                    s->body_len += c;
+                }
+                s->left -= (uint32_t)n;
+                data    += n;
+                len     -= n;
+                if (s->left == 0)
+                {
+                    packet_done(mqtt, s, is_client, cb, ud);
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,921 @@
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "mux.h"
+#include "buffer.h"
+#include "logger.h"
+#include "server.h"
+#include "sock.h"
+#include "codec.h"
+
+
+#define MUX_MAX_LINKS     16    // Линков у edge-инстанса максимум
+#define MUX_BUCKETS       256   // Корзин в хэше стримов линка
+#define MUX_REDIAL_MS     1000  // Период таймера, который переподнимает упавшие линки
+#define MUX_STATS_MS      60000 // Раз в столько пишем в лог степень сжатия
+
+
+/*
+ * Типы фреймов
+ */
+typedef enum mux_frame_type
+{
+    MUX_FRAME_OPEN    = 0x01,
+    MUX_FRAME_OPEN_OK = 0x02,
+    MUX_FRAME_DATA    = 0x03,
+    MUX_FRAME_WINDOW  = 0x04,
+    MUX_FRAME_FIN     = 0x05,
+    MUX_FRAME_AUTH    = 0x06
+} mux_frame_type_t;
+
+typedef struct mux_link mux_link_t;
+
+/*
+ * Стрим: одна сторона одного туннеля, едущая по линку
+ */
+struct mux_stream
+{
+    uint32_t             id;
+    mux_link_t          *link;          // NULL — линк умер, стрим ждёт освобождения туннеля
+    tunnel_t            *tunnel;
+    int                  client_side;   // 1 — стрим вместо клиентского сокета (core)
+    int                  opened;        // OPEN_OK отправлен/получен
+    int                  fin_sent;
+    int                  fin_recv;
+    size_t               send_window;   // Сколько ещё можно отправить без WINDOW
+    size_t               recv_unacked;  // Получено DATA, окно за которые ещё не вернули
+    size_t               recv_consumed; // Из них уже ушло в сокет, копим до половины окна
+    unsigned long long   open_ms;       // Когда отправили OPEN (для латентности)
+    codec_t             *codec;         // Сжатие DATA (NULL — пока не понадобилось)
+    struct mux_stream   *next;          // Цепочка корзины
+};
+
+/*
+ * Линк: долгоживущее TCP-соединение между инстансами
+ */
+struct mux_link
+{
+    sock_t        *sock;                    // NULL — линк лежит (edge переподнимет)
+    int            is_edge;
+    int            ready;                   // Преамбула отправлена (edge) / проверена (core)
+    int            authed;                  // Core: секрет проверен (или не нужен)
+    size_t         nstreams;
+    uint32_t       next_id;
+    mux_stream_t  *buckets[MUX_BUCKETS];
+};
+
+
+static mux_link_t  edge_links[MUX_MAX_LINKS];
+static int         edge_nlinks  = 0;
+static char        edge_host[256];
+static char        edge_port[16];
+static bool        core_enabled = false;
+static bool        compress     = false;
+static uint8_t     secret[MUX_SECRET_MAX];
+static size_t      secret_len   = 0;
+
+
+static void mux_link_read_handle(int fd, void *ud);
+
+static void mux_link_write_handle(int fd, void *ud);
+
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Сравнение секрета за время, не зависящее от того, где первое расхождение
+ */
+static bool secret_matches(const uint8_t *p, size_t len)
+{
+    unsigned diff = len != secret_len;
+    for (size_t i = 0; i < secret_len; ++i)
+    {
+        diff |= secret[i] ^ (i < len ? p[i] : 0);
+    }
+    return diff == 0;
+}
+
+/*
+ * Кладёт фрейм в write_buffer линка. EPOLLOUT включаем только на переходе
+ * из пустого буфера — дальше его держит write-хэндлер
+ */
+static int frame_write(mux_link_t *link, uint8_t type, uint8_t flags, uint32_t id,
+                       const void *payload, size_t len)
+{
+    buffer_t *buff  = link->sock->write_buffer;
+    int       empty = buffer_readable(buff) == 0;
+
+    uint8_t header[MUX_HEADER_LEN];
+    header[0] = type;
+    header[1] = flags;
+    put_u16(header + 2, (uint16_t)len);
+    put_u32(header + 4, id);
+
+    if (buffer_write(buff, header, sizeof(header)) < 0
+        || (len > 0 && buffer_write(buff, (void *)payload, len) < 0))
+    {
+        return -1;
+    }
+    if (empty && link->sock->state != sock_connecting)
+    {
+        epoll_modify(link->sock, 1, 1);
+    }
+    return 0;
+}
+
+static mux_stream_t *stream_find(mux_link_t *link, uint32_t id)
+{
+    for (mux_stream_t *s = link->buckets[id % MUX_BUCKETS]; s != NULL; s = s->next)
+    {
+        if (s->id == id)
+        {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static mux_stream_t *stream_create(mux_link_t *link, uint32_t id, tunnel_t *tunnel, int client_side)
+{
+    mux_stream_t *stream = malloc(sizeof(*stream));
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    memset(stream, 0, sizeof(*stream));
+    stream->id          = id;
+    stream->link        = link;
+    stream->tunnel      = tunnel;
+    stream->client_side = client_side;
+    stream->send_window = MUX_WINDOW;
+
+    mux_stream_t **bucket = &link->buckets[id % MUX_BUCKETS];
+    stream->next = *bucket;
+    *bucket      = stream;
+    ++link->nstreams;
+
+    tunnel->stream = stream;
+    return stream;
+}
+
+static void stream_unlink(mux_stream_t *stream)
+{
+    mux_link_t *link = stream->link;
+    for (mux_stream_t **it = &link->buckets[stream->id % MUX_BUCKETS]; *it != NULL; it = &(*it)->next)
+    {
+        if (*it == stream)
+        {
+            *it = stream->next;
+            break;
+        }
+    }
+    --link->nstreams;
+    stream->link = NULL;
+}
+
+/*
+ * Настоящий сокет туннеля на нашей стороне стрима
+ */
+static sock_t *stream_sock(const mux_stream_t *stream)
+{
+    return stream->client_side ? stream->tunnel->remote_sock : stream->tunnel->client_sock;
+}
+
+/*
+ * Линк умер: все его туннели рвём, сам сокет закрываем
+ */
+static void link_close(mux_link_t *link, const char *reason)
+{
+    LOG_WARN("Mux link fd=%d closed (%s), dropping %zu streams", link->sock->fd, reason, link->nstreams);
+
+    for (int i = 0; i < MUX_BUCKETS; ++i)
+    {
+        while (link->buckets[i] != NULL)
+        {
+            mux_stream_t *stream = link->buckets[i];
+            stream_unlink(stream);
+            stream->fin_sent = 1;
+            stream->fin_recv = 1;
+            // Освобождение туннеля освободит и стрим (mux_stream_detach)
+            tunnel_abort(stream->tunnel);
+        }
+    }
+
+    sock_release(link->sock);
+    link->sock  = NULL;
+    link->ready = 0;
+    if (!link->is_edge)
+    {
+        free(link);
+    }
+}
+
+/*
+ * Разбирает тело OPEN в request_protocol_t туннеля (формат как хвост SOCKS5-запроса)
+ */
+static int open_parse(request_protocol_t *rp, const uint8_t *p, size_t len)
+{
+    if (len < 1)
+    {
+        return -1;
+    }
+    rp->ver  = 0x05;
+    rp->cmd  = 0x01;
+    rp->atyp = p[0];
+    size_t alen;
+    switch (rp->atyp)
+    {
+        case 0x01: alen = 4;  break;
+        case 0x04: alen = 16; break;
+        case 0x03:
+        {
+            if (len < 2 || p[1] == 0)
+            {
+                return -1;
+            }
+            rp->domainlen = p[1];
+            ++p;
+            --len;
+            alen = rp->domainlen;
+            break;
+        }
+        default: return -1;
+    }
+    if (len != 1 + alen + 2 || alen >= sizeof(rp->addr))
+    {
+        return -1;
+    }
+    memcpy(rp->addr, p + 1, alen);
+    rp->addr[alen] = '\0';
+    memcpy(&rp->port, p + 1 + alen, 2);
+    return 0;
+}
+
+/*
+ * Core: новый стрим — заводим виртуальный туннель и коннектимся к назначению
+ */
+static int on_open(mux_link_t *link, uint32_t id, const uint8_t *payload, size_t len)
+{
+    if (link->is_edge || stream_find(link, id) != NULL)
+    {
+        return -1;
+    }
+
+    tunnel_t *tunnel = tunnel_create_virtual();
+    if (tunnel == NULL)
+    {
+        return frame_write(link, MUX_FRAME_FIN, 0, id, NULL, 0);
+    }
+    if (open_parse(&tunnel->rp, payload, len) < 0)
+    {
+        tunnel_release(tunnel);
+        return -1;
+    }
+    if (stream_create(link, id, tunnel, 1) == NULL)
+    {
+        tunnel_release(tunnel);
+        return frame_write(link, MUX_FRAME_FIN, 0, id, NULL, 0);
+    }
+
+    // Ошибка коннекта: abort освободит туннель, а detach отправит FIN — edge ответит клиенту отказом
+    if (tunnel_connect_to_remote(tunnel) < 0)
+    {
+        tunnel_abort(tunnel);
+    }
+    return 0;
+}
+
+static int on_frame(mux_link_t *link, uint8_t type, uint8_t flags, uint32_t id,
+                    const uint8_t *payload, size_t len)
+{
+    if (type == MUX_FRAME_OPEN)
+    {
+        return on_open(link, id, payload, len);
+    }
+
+    // Стрим мог уже закрыться на нашей стороне — хвосты по нему просто выкидываем
+    mux_stream_t *stream = stream_find(link, id);
+    if (stream == NULL)
+    {
+        return 0;
+    }
+    tunnel_t *tunnel = stream->tunnel;
+
+    switch (type)
+    {
+        case MUX_FRAME_OPEN_OK:
+        {
+            if (!link->is_edge || stream->opened)
+            {
+                return -1;
+            }
+            stream->opened = 1;
+            LOG_INFO("Mux stream %u to %s:%s opened in %llums", id, tunnel->dst_host, tunnel->dst_port,
+                     server_now_ms() - stream->open_ms);
+            if (tunnel_stream_opened(tunnel, payload, len) < 0)
+            {
+                tunnel_abort(tunnel);
+            }
+            return 0;
+        }
+        case MUX_FRAME_DATA:
+        {
+            sock_t *sock = stream_sock(stream);
+            if (sock == NULL || !stream->opened)
+            {
+                return 0;
+            }
+            if (flags & MUX_FLAG_DEFLATE)
+            {
+                if (stream->codec == NULL && (stream->codec = codec_create()) == NULL)
+                {
+                    tunnel_abort(tunnel);
+                    return 0;
+                }
+                int n = codec_decode(stream->codec, payload, len, sock->write_buffer);
+                if (n < 0)
+                {
+                    // Сжатый поток разошёлся — дальше по стриму верить нечему
+                    tunnel_abort(tunnel);
+                    return 0;
+                }
+                stream->recv_unacked += n;
+            }
+            else
+            {
+                stream->recv_unacked += len;
+            }
+            // Отправитель вышел за окно — он сломан или враждебен, линку верить нельзя
+            // (сжатый фрейм распаковывается не больше чем в CODEC_MAX_INPUT)
+            if (stream->recv_unacked > MUX_WINDOW)
+            {
+                return -1;
+            }
+            if (!(flags & MUX_FLAG_DEFLATE) && buffer_write(sock->write_buffer, (void *)payload, len) < 0)
+            {
+                tunnel_abort(tunnel);
+                return 0;
+            }
+            epoll_modify(sock, 1, sock->state != sock_halfclosed);
+            return 0;
+        }
+        case MUX_FRAME_WINDOW:
+        {
+            if (len != 4)
+            {
+                return -1;
+            }
+            stream->send_window += get_u32(payload);
+            sock_t *sock = stream_sock(stream);
+            if (sock != NULL && (sock->paused & SOCK_PAUSE_WINDOW))
+            {
+                if (mux_stream_send(stream, sock) < 0)
+                {
+                    return -1;
+                }
+                // Полузакрытый сокет ждал только окна: хвост ушёл — закрываем
+                if (sock->state == sock_halfclosed && !(sock->paused & SOCK_PAUSE_WINDOW)
+                    && buffer_readable(sock->write_buffer) == 0)
+                {
+                    sock_force_shutdown(sock);
+                }
+            }
+            return 0;
+        }
+        case MUX_FRAME_FIN:
+        {
+            stream->fin_recv = 1;
+            sock_t *sock = stream_sock(stream);
+            if (!stream->opened || sock == NULL)
+            {
+                // До OPEN_OK FIN означает, что core не смог подключиться
+                tunnel_abort(tunnel);
+            }
+            else
+            {
+                // Дописываем в сокет то, что уже пришло, и закрываем его
+                sock_shutdown(sock);
+            }
+            return 0;
+        }
+        default:
+        {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Разбирает все целые фреймы в read_buffer линка.
+ * Возвращает <0, если линк закрыт и трогать его больше нельзя
+ */
+static int link_process(mux_link_t *link)
+{
+    buffer_t *buff = link->sock->read_buffer;
+
+    if (!link->ready)
+    {
+        if (buffer_readable(buff) < MUX_PREFACE_LEN)
+        {
+            return 0;
+        }
+        if (memcmp(buff->data + buff->read_index, MUX_PREFACE, MUX_PREFACE_LEN) != 0)
+        {
+            link_close(link, "bad preface");
+            return -1;
+        }
+        buffer_skip(buff, MUX_PREFACE_LEN);
+        link->ready = 1;
+        LOG_INFO("Mux link fd=%d accepted", link->sock->fd);
+    }
+
+    while (buffer_readable(buff) >= MUX_HEADER_LEN)
+    {
+        const uint8_t *header = (const uint8_t *)buff->data + buff->read_index;
+        size_t   len = ((size_t)header[2] << 8) | header[3];
+        uint8_t  type = header[0];
+        uint8_t  flags = header[1];
+        uint32_t id   = get_u32(header + 4);
+
+        if (len > MUX_MAX_FRAME)
+        {
+            link_close(link, "oversized frame");
+            return -1;
+        }
+        if (buffer_readable(buff) < MUX_HEADER_LEN + len)
+        {
+            break;
+        }
+
+        // Core с секретом: до верного AUTH линк ничего не может
+        if (!link->authed)
+        {
+            if (type != MUX_FRAME_AUTH || !secret_matches(header + MUX_HEADER_LEN, len))
+            {
+                link_close(link, "bad link secret");
+                return -1;
+            }
+            link->authed = 1;
+            LOG_INFO("Mux link fd=%d authenticated", link->sock->fd);
+            buffer_skip(buff, MUX_HEADER_LEN + len);
+            continue;
+        }
+
+        if (on_frame(link, type, flags, id, header + MUX_HEADER_LEN, len) < 0)
+        {
+            link_close(link, "protocol error");
+            return -1;
+        }
+        buffer_skip(buff, MUX_HEADER_LEN + len);
+    }
+    return 0;
+}
+
+static void mux_link_read_handle(int fd, void *ud)
+{
+    sock_t     *sock = (sock_t *)ud;
+    mux_link_t *link = (mux_link_t *)sock->context;
+
+    int n = buffer_readfd(sock->read_buffer, fd);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        link_close(link, n == 0 ? "EOF" : strerror(errno));
+        return;
+    }
+    link_process(link);
+}
+
+static void mux_link_write_handle(int fd, void *ud)
+{
+    sock_t     *sock = (sock_t *)ud;
+    mux_link_t *link = (mux_link_t *)sock->context;
+
+    if (sock->state == sock_connecting)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error)
+        {
+            link_close(link, strerror(error ? error : errno));
+            return;
+        }
+        sock->state = sock_connected;
+        LOG_INFO("Mux link fd=%d up to %s:%s", fd, edge_host, edge_port);
+    }
+
+    if (buffer_readable(sock->write_buffer) > 0)
+    {
+        int n = buffer_writefd(sock->write_buffer, fd);
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            link_close(link, strerror(errno));
+            return;
+        }
+    }
+    epoll_modify(sock, buffer_readable(sock->write_buffer) > 0, 1);
+}
+
+/*
+ * Edge: поднимает линк в слоте link
+ */
+static int link_dial(mux_link_t *link)
+{
+    struct addrinfo hint;
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family   = AF_UNSPEC;
+    hint.ai_socktype = SOCK_STREAM;
+    hint.ai_protocol = IPPROTO_TCP;
+
+    struct addrinfo *ai = NULL;
+    if (getaddrinfo(edge_host, edge_port, &hint, &ai) != 0)
+    {
+        return -1;
+    }
+    int fd = socket(ai->ai_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+    {
+        freeaddrinfo(ai);
+        return -1;
+    }
+    sock_nonblocking(fd);
+    sock_keepalive(fd);
+    // Фреймы мелкие и латентность важнее — Nagle на линке только мешает
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    int status = connect(fd, ai->ai_addr, ai->ai_addrlen);
+    freeaddrinfo(ai);
+    if (status != 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+
+    sock_t *sock = sock_create(fd, sock_connecting, 0, NULL);
+    if (sock == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    sock->context      = link;
+    sock->read_handle  = mux_link_read_handle;
+    sock->write_handle = mux_link_write_handle;
+    link->sock    = sock;
+    link->ready   = 1;
+    link->authed  = 1;
+    link->next_id = 1;
+
+    // Преамбула (и AUTH, если есть секрет) уедет, как только доедет connect
+    buffer_write(sock->write_buffer, MUX_PREFACE, MUX_PREFACE_LEN);
+    if (secret_len > 0)
+    {
+        frame_write(link, MUX_FRAME_AUTH, 0, 0, secret, secret_len);
+    }
+    epoll_add(sock);
+    epoll_modify(sock, 1, 1);
+    return 0;
+}
+
+/*
+ * Таймер edge: переподнимаем упавшие линки
+ */
+static void mux_redial_tick(void *ud)
+{
+    (void)ud;
+    for (int i = 0; i < edge_nlinks; ++i)
+    {
+        if (edge_links[i].sock == NULL && link_dial(&edge_links[i]) < 0)
+        {
+            LOG_WARN("Mux link #%d to %s:%s: dial failed", i, edge_host, edge_port);
+        }
+    }
+}
+
+int mux_init_edge(const char *peer, int nlinks)
+{
+    const char *colon = strrchr(peer, ':');
+    if (colon == NULL || colon == peer || nlinks <= 0 || nlinks > MUX_MAX_LINKS)
+    {
+        LOG_ERROR("Failed mux_init_edge, peer=%s links=%d", peer, nlinks);
+        return -1;
+    }
+    snprintf(edge_host, sizeof(edge_host), "%.*s", (int)(colon - peer), peer);
+    snprintf(edge_port, sizeof(edge_port), "%s", colon + 1);
+
+    edge_nlinks = nlinks;
+    for (int i = 0; i < nlinks; ++i)
+    {
+        edge_links[i].is_edge = 1;
+    }
+
+    LOG_INFO("Mux edge: %d links to %s:%s", nlinks, edge_host, edge_port);
+    mux_redial_tick(NULL);
+    return server_timer_add(MUX_REDIAL_MS, mux_redial_tick, NULL);
+}
+
+/*
+ * Таймер: сколько сжали и сколько пропустили как несжимаемое
+ */
+static void mux_stats_tick(void *ud)
+{
+    (void)ud;
+    codec_stats_t st;
+    codec_get_stats(&st);
+    if (st.raw_in + st.skipped == 0)
+    {
+        return;
+    }
+    LOG_INFO("Mux compression: %llu → %llu bytes (ratio %.2f), %llu bytes sent as is",
+             st.raw_in, st.packed_out, st.packed_out ? (double)st.raw_in / st.packed_out : 0.0, st.skipped);
+}
+
+int mux_init_compress(void)
+{
+    compress = true;
+    LOG_INFO("Mux compression of outgoing DATA enabled");
+    return server_timer_add(MUX_STATS_MS, mux_stats_tick, NULL);
+}
+
+int mux_init_secret(const char *value)
+{
+    size_t len = strlen(value);
+    if (len == 0 || len > MUX_SECRET_MAX)
+    {
+        LOG_ERROR("Mux link secret must be 1..%d bytes", MUX_SECRET_MAX);
+        return -1;
+    }
+    memcpy(secret, value, len);
+    secret_len = len;
+    return 0;
+}
+
+void mux_init_core(void)
+{
+    core_enabled = true;
+    LOG_INFO("Mux core: accepting links on the main port");
+}
+
+bool mux_edge_enabled(void)
+{
+    return edge_nlinks > 0;
+}
+
+bool mux_core_enabled(void)
+{
+    return core_enabled;
+}
+
+int mux_accept(tunnel_t *tunnel)
+{
+    // Без секрета линк ничем не проверить, а стримы по нему не проходят SOCKS5 USER/PASS.
+    // Аутентификацию могли включить и на ходу (admin auth) — поэтому проверяем здесь
+    if (secret_len == 0 && SERVER.username[0] != '\0' && SERVER.passwd[0] != '\0')
+    {
+        LOG_WARN("Mux link refused: SOCKS5 authentication is on, but no link secret (-X) is set");
+        return -1;
+    }
+
+    mux_link_t *link = malloc(sizeof(*link));
+    if (link == NULL)
+    {
+        return -1;
+    }
+    memset(link, 0, sizeof(*link));
+
+    // Клиентский сокет уходит линку, туннель больше не нужен
+    sock_t *sock = tunnel->client_sock;
+    tunnel->client_sock = NULL;
+    tunnel_release(tunnel);
+
+    sock->tunnel       = NULL;
+    sock->context      = link;
+    sock->read_handle  = mux_link_read_handle;
+    sock->write_handle = mux_link_write_handle;
+    link->sock   = sock;
+    link->authed = secret_len == 0;
+
+    int enable = 1;
+    setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    link_process(link);
+    return 0;
+}
+
+int mux_connect(tunnel_t *tunnel)
+{
+    if (tunnel->stream != NULL)
+    {
+        return -1;
+    }
+
+    // Новый стрим — на наименее загруженный живой линк
+    mux_link_t *link = NULL;
+    for (int i = 0; i < edge_nlinks; ++i)
+    {
+        mux_link_t *it = &edge_links[i];
+        if (it->sock != NULL && it->sock->state == sock_connected
+            && (link == NULL || it->nstreams < link->nstreams))
+        {
+            link = it;
+        }
+    }
+    if (link == NULL)
+    {
+        LOG_WARN("Mux: no link up for %s:%s", tunnel->dst_host, tunnel->dst_port);
+        return -1;
+    }
+
+    // OPEN — хвост SOCKS5-запроса клиента как есть
+    request_protocol_t *rp = &tunnel->rp;
+    uint8_t payload[1 + 1 + 255 + 2];
+    size_t  len = 0;
+    payload[len++] = rp->atyp;
+    switch (rp->atyp)
+    {
+        case 0x01: memcpy(payload + len, rp->addr, 4);  len += 4;  break;
+        case 0x04: memcpy(payload + len, rp->addr, 16); len += 16; break;
+        default:
+        {
+            payload[len++] = rp->domainlen;
+            memcpy(payload + len, rp->addr, rp->domainlen);
+            len += rp->domainlen;
+            break;
+        }
+    }
+    memcpy(payload + len, &rp->port, 2);
+    len += 2;
+
+    mux_stream_t *stream = stream_create(link, link->next_id++, tunnel, 0);
+    if (stream == NULL)
+    {
+        return -1;
+    }
+    stream->open_ms = server_now_ms();
+    tunnel->state   = connecting_state;
+
+    LOG_INFO("Mux stream %u → %s:%s over link fd=%d (%zu streams)", stream->id,
+             tunnel->dst_host, tunnel->dst_port, link->sock->fd, link->nstreams);
+    return frame_write(link, MUX_FRAME_OPEN, 0, stream->id, payload, len);
+}
+
+int mux_stream_client_side(const mux_stream_t *stream)
+{
+    return stream->client_side;
+}
+
+/*
+ * Один DATA-фрейм: сжатый (MUX_FLAG_DEFLATE), если включено сжатие и кодек не решил,
+ * что поток несжимаемый. Окно считается в несжатых байтах
+ */
+static int stream_send_data(mux_stream_t *stream, const uint8_t *src, size_t len)
+{
+    static uint8_t packed[MUX_MAX_FRAME];
+
+    if (compress)
+    {
+        if (stream->codec == NULL && (stream->codec = codec_create()) == NULL)
+        {
+            return -1;
+        }
+        int n = codec_encode(stream->codec, src, len, packed, sizeof(packed));
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n > 0)
+        {
+            return frame_write(stream->link, MUX_FRAME_DATA, MUX_FLAG_DEFLATE, stream->id, packed, n);
+        }
+    }
+    return frame_write(stream->link, MUX_FRAME_DATA, 0, stream->id, src, len);
+}
+
+int mux_stream_send(mux_stream_t *stream, sock_t *rear)
+{
+    buffer_t *buff = rear->read_buffer;
+
+    // Соседу уже некуда писать — выкидываем (и ждать окна больше нечего)
+    if (stream->link == NULL || stream->fin_recv)
+    {
+        buffer_clear(buff);
+        if (rear->paused & SOCK_PAUSE_WINDOW)
+        {
+            sock_resume(rear, SOCK_PAUSE_WINDOW);
+        }
+        return 0;
+    }
+
+    // Окно не превышаем и для полузакрытого rear: он дождётся WINDOW (см. sock_shutdown)
+    while (buffer_readable(buff) > 0 && stream->send_window > 0)
+    {
+        size_t n = buffer_readable(buff);
+        size_t max = compress ? CODEC_MAX_INPUT : MUX_MAX_FRAME;
+        if (n > max)
+        {
+            n = max;
+        }
+        if (n > stream->send_window)
+        {
+            n = stream->send_window;
+        }
+        if (stream_send_data(stream, (const uint8_t *)buff->data + buff->read_index, n) < 0)
+        {
+            return -1;
+        }
+        buffer_skip(buff, n);
+        stream->send_window -= n;
+    }
+
+    if (buffer_readable(buff) > 0)
+    {
+        if (!(rear->paused & SOCK_PAUSE_WINDOW))
+        {
+            sock_pause(rear, SOCK_PAUSE_WINDOW);
+        }
+    }
+    else if (rear->paused & SOCK_PAUSE_WINDOW)
+    {
+        sock_resume(rear, SOCK_PAUSE_WINDOW);
+    }
+    return 0;
+}
+
+void mux_stream_consumed(mux_stream_t *stream, size_t n)
+{
+    if (stream->link == NULL || stream->fin_recv)
+    {
+        return;
+    }
+    // В сокет пишется не только DATA (ответ SOCKS5 на edge) — больше полученного не возвращаем
+    stream->recv_consumed += n;
+    if (stream->recv_consumed > stream->recv_unacked)
+    {
+        stream->recv_consumed = stream->recv_unacked;
+    }
+    if (stream->recv_consumed < MUX_WINDOW / 2)
+    {
+        return;
+    }
+
+    uint8_t payload[4];
+    put_u32(payload, (uint32_t)stream->recv_consumed);
+    stream->recv_unacked -= stream->recv_consumed;
+    stream->recv_consumed = 0;
+    frame_write(stream->link, MUX_FRAME_WINDOW, 0, stream->id, payload, sizeof(payload));
+}
+
+int mux_stream_open_ok(mux_stream_t *stream, const uint8_t *bnd, size_t len)
+{
+    if (stream->link == NULL)
+    {
+        return -1;
+    }
+    stream->opened = 1;
+    return frame_write(stream->link, MUX_FRAME_OPEN_OK, 0, stream->id, bnd, len);
+}
+
+void mux_stream_detach(mux_stream_t *stream)
+{
+    if (stream->link != NULL)
+    {
+        if (!stream->fin_sent && !stream->fin_recv)
+        {
+            frame_write(stream->link, MUX_FRAME_FIN, 0, stream->id, NULL, 0);
+        }
+        stream_unlink(stream);
+    }
+    if (stream->codec != NULL)
+    {
+        codec_release(stream->codec);
+    }
+    free(stream);
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "postgres.h"
+
+
+#define PG_STARTUP_V3  196608u    // Версия протокола 3.0 в StartupMessage
+#define PG_SSL         80877103u  // Коды "запросов" вместо версии
+#define PG_GSSENC      80877104u
+#define PG_CANCEL      80877102u
+#define PG_STARTUP_MAX 10000u     // Сообщение старта длиннее не бывает (так же режет сервер)
+
+
+void pg_flow_init(pg_flow_t *pg)
+{
+    // body значим только до body_len
+    for (int d = 0; d < 2; ++d)
+    {
+        memset(&pg->dir[d], 0, offsetof(pg_stream_t, body));
+    }
+    pg->startup  = 1;
+    pg->messages = 0;
+}
+
+static uint32_t be32(const uint8_t *b)
+{
+    return (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+}
+
+dissect_match_t pg_signature(const uint8_t *p, size_t len, int is_client, bool port_hint)
+{
+    (void)port_hint;
+    if (!is_client)
+    {
+        return DISSECT_NO;
+    }
+    // Длина (до PG_STARTUP_MAX — два старших байта нулевые) + код
+    static const uint8_t zero[2] = { 0, 0 };
+    if (len < 8)
+    {
+        return memcmp(p, zero, len < 2 ? len : 2) == 0 ? DISSECT_MORE : DISSECT_NO;
+    }
+    uint32_t length = be32(p);
+    uint32_t code   = be32(p + 4);
+    if (code == PG_STARTUP_V3)
+    {
+        return length > 8 && length <= PG_STARTUP_MAX ? DISSECT_YES : DISSECT_NO;
+    }
+    if (code == PG_SSL || code == PG_GSSENC)
+    {
+        return length == 8 ? DISSECT_YES : DISSECT_NO;
+    }
+    return code == PG_CANCEL && length == 16 ? DISSECT_YES : DISSECT_NO;
+}
+
+/*
+ * Дописывает в text строку из тела (до NUL или конца): управляющие символы — '?',
+ * переводы строк — пробелом. Возвращает, сколько байт тела прошло вместе с NUL
+ */
+static size_t text_put(char *text, size_t *at, const uint8_t *p, size_t n)
+{
+    size_t i = 0;
+    for (; i < n && p[i] != 0; ++i)
+    {
+        if (*at < PG_TEXT_MAX)
+        {
+            uint8_t c = p[i];
+            text[(*at)++] = c == '\n' || c == '\r' || c == '\t' ? ' ' : c < 0x20 || c == 0x7f ? '?' : (char)c;
+        }
+    }
+    return i < n ? i + 1 : i;
+}
+
+static void text_add(char *text, size_t *at, const char *s)
+{
+    text_put(text, at, (const uint8_t *)s, strlen(s));
+}
+
+/*
+ * Описание сообщения в text; 0 — его не показываем
+ */
+static size_t describe(pg_flow_t *pg, const pg_stream_t *s, int is_client, char *text)
+{
+    const uint8_t *p  = s->body;
+    size_t         n  = s->body_len;
+    size_t         at = 0;
+    char           num[32];
+
+    if (is_client)
+    {
+        switch (s->type)
+        {
+            case 0:
+            {
+                // Параметры старта: имя\0значение\0...\0
+                for (size_t i = 4; i < n && p[i] != 0; )
+                {
+                    text_add(text, &at, at > 0 ? " " : "");
+                    i += text_put(text, &at, p + i, n - i);
+                    text_add(text, &at, "=");
+                    i += text_put(text, &at, p + i, n - i);
+                }
+                return at;
+            }
+            case 'P':
+            {
+                // Имя подготовленного оператора, потом сам запрос
+                size_t skip = text_put(text, &at, p, n);
+                at = 0;
+                text_put(text, &at, p + skip, n - skip);
+                pg->messages++;
+                return at;
+            }
+            case 'Q':
+            {
+                text_put(text, &at, p, n);
+                pg->messages++;
+                return at;
+            }
+            case 'X':
+            {
+                text_add(text, &at, "terminate");
+                return at;
+            }
+        }
+        return 0;
+    }
+
+    switch (s->type)
+    {
+        case 'R':
+        {
+            static const char *names[] =
+            {
+                "ok", "?", "kerberos", "cleartext password", "?", "md5 password",
+                "?", "GSS", "GSS continue", "SSPI", "SASL", "SASL continue", "SASL final"
+            };
+            uint32_t code = n >= 4 ? be32(p) : ~0u;
+            if (code == 8 || code == 11)
+            {
+                // Промежуточные шаги обмена — не интересны
+                return 0;
+            }
+            if (code < sizeof(names) / sizeof(names[0]) && names[code][0] != '?')
+            {
+                text_add(text, &at, names[code]);
+            }
+            else
+            {
+                snprintf(num, sizeof(num), "code %u", code);
+                text_add(text, &at, num);
+            }
+            // SASL: список механизмов
+            for (size_t i = 4; code == 10 && i < n && p[i] != 0; )
+            {
+                text_add(text, &at, " ");
+                i += text_put(text, &at, p + i, n - i);
+            }
+            return at;
+        }
+        case 'E':
+        case 'N':
+        {
+            // Поля: тип(1) + строка; показываем серьёзность, код и текст
+            for (size_t i = 0; i < n && p[i] != 0; )
+            {
+                char field = (char)p[i++];
+                if (field != 'S' && field != 'C' && field != 'M')
+                {
+                    const uint8_t *end = memchr(p + i, 0, n - i);
+                    i = end != NULL ? (size_t)(end - p) + 1 : n;
+                    continue;
+                }
+                text_add(text, &at, at == 0 ? "" : field == 'M' ? ": " : " ");
+                i += text_put(text, &at, p + i, n - i);
+            }
+            return at;
+        }
+        case 'C':
+        {
+            text_put(text, &at, p, n);
+            return at;
+        }
+    }
+    return 0;
+}
+
+static void broken(pg_stream_t *s, int is_client, const char *what, const pg_flow_cb_t *cb, void *ud)
+{
+    s->state = PG_BROKEN;
+    cb->on_error(ud, is_client, what);
+}
+
+/*
+ * Сообщение собрано. false — дальше шифр или отмена
+ */
+static bool message_done(pg_flow_t *pg, pg_stream_t *s, int is_client, const pg_flow_cb_t *cb, void *ud)
+{
+    char          text[PG_TEXT_MAX];
+    pg_message_t  msg;
+
+    s->state = PG_HEADER;
+    msg.type = (char)s->type;
+    msg.len  = s->len;
+    msg.text = text;
+
+    if (is_client && s->type == 0)
+    {
+        uint32_t code = s->body_len >= 4 ? be32(s->body) : 0;
+        if (code == PG_SSL || code == PG_GSSENC)
+        {
+            // Сервер ответит одним байтом, клиент потом опять начнёт со старта
+            msg.text_len = (size_t)snprintf(text, sizeof(text), "%s",
+                                            code == PG_SSL ? "SSLRequest" : "GSSENCRequest");
+            pg->dir[0].state = PG_REPLY;
+            cb->on_message(ud, is_client, &msg);
+            return true;
+        }
+        if (code == PG_CANCEL)
+        {
+            msg.text_len = (size_t)snprintf(text, sizeof(text), "CancelRequest pid %u",
+                                            s->body_len >= 8 ? be32(s->body + 4) : 0);
+            cb->on_message(ud, is_client, &msg);
+            return false;
+        }
+        if (code != PG_STARTUP_V3)
+        {
+            broken(s, is_client, "unsupported startup message", cb, ud);
+            return true;
+        }
+        pg->startup = 0;
+    }
+
+    msg.text_len = describe(pg, s, is_client, text);
+    if (msg.text_len > 0)
+    {
+        cb->on_message(ud, is_client, &msg);
+    }
+    return true;
+}
+
+bool pg_flow_feed(pg_flow_t *pg, const uint8_t *data, size_t len, int is_client,
+                  const pg_flow_cb_t *cb, void *ud)
+{
+    pg_stream_t *s = &pg->dir[is_client ? 1 : 0];
+
+    while (len > 0)
+    {
+        switch (s->state)
+        {
+            case PG_BROKEN:
+            {
+                return true;
+            }
+            case PG_REPLY:
+            {
+                if (data[0] == 'S' || data[0] == 'G')
+                {
+                    // Дальше TLS или GSS-шифрование
+                    return false;
+                }
+                // 'N' — работаем открытым текстом; что-то другое (старые серверы
+                // шлют ErrorResponse) разбираем как обычное сообщение
+                s->state = PG_HEADER;
+                if (data[0] == 'N')
+                {
+                    ++data;
+                    --len;
+                }
+                break;
+            }
+            case PG_HEADER:
+            {
+                int    untyped = is_client && pg->startup;
+                size_t need    = untyped ? 4 : 5;
+                while (len > 0 && s->hdr_len < need)
+                {
+                    s->hdr[s->hdr_len++] = *data++;
+                    --len;
+                }
+                if (s->hdr_len < need)
+                {
+                    return true;
+                }
+                uint32_t length = be32(s->hdr + need - 4);
+                s->hdr_len = 0;
+                s->type    = untyped ? 0 : s->hdr[0];
+                if (length < (untyped ? 8u : 4u) || length > (untyped ? PG_STARTUP_MAX : PG_LEN_MAX))
+                {
+                    broken(s, is_client, "bad message length", cb, ud);
+                    return true;
+                }
+                s->len      = length - 4;
+                s->left     = s->len;
+                s->body_len = 0;
+                s->state    = PG_BODY;
+                if (s->left == 0 && !message_done(pg, s, is_client, cb, ud))
+                {
+                    return false;
+                }
+                break;
+            }
+            case PG_BODY:
+            {
+                size_t n = len < s->left ? len : s->left;
+                if (s->body_len < sizeof(s->body))
+                {
+                    size_t c = sizeof(s->body) - s->body_len;
+                    c = c < n ? c : n;
+                    memcpy(s->body + s->body_len, data, c);
+                    s->body_len += c;
+                }
+                s->left -= (uint32_t)n;
+                data    += n;
+                len     -= n;
+                if (s->left == 0 && !message_done(pg, s, is_client, cb, ud))
+                {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
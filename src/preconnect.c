@@ -0,0 +1,419 @@
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "preconnect.h"
+#include "buffer.h"
+#include "logger.h"
+#include "server.h"
+#include "sock.h"
+#include "metrics.h"
+
+
+#define SKETCH_SIZE          64     // Счётчиков в sketch'е тяжёлых хиттеров
+#define PRECONNECT_MIN_HITS  3      // Меньше — назначение не считаем горячим
+#define PRECONNECT_TICK_MS   250    // Период таймера пула
+#define PRECONNECT_DECAY_MS  10000  // Раз в столько счётчики делятся пополам (забываем старое)
+#define PRECONNECT_DNS_MS    60000  // Сколько живёт закэшированный адрес назначения
+#define PRECONNECT_STATS_MS  60000  // Раз в столько пишем hit-rate в лог
+#define PRECONNECT_KEY_LEN   280
+
+
+typedef struct preconnect_dest preconnect_dest_t;
+
+/*
+ * Сокет в пуле: прогревается (connect в процессе) или уже готов
+ */
+typedef struct pooled_sock
+{
+    sock_t              *sock;
+    preconnect_dest_t   *dest;
+    int                  ready;     // 1 — connect доехал, можно отдавать
+    unsigned long long   deadline;  // Когда выкинуть, если так и не забрали
+    struct pooled_sock  *next;
+} pooled_sock_t;
+
+/*
+ * Счётчик Space-Saving + всё, что пулу нужно знать о назначении
+ */
+struct preconnect_dest
+{
+    char                     key[PRECONNECT_KEY_LEN];  // "host:port", пустая — слот свободен
+    char                     host[256];
+    char                     port[16];
+    uint64_t                 hash;        // Чтобы не сравнивать строки на каждом слоте
+    unsigned long long       count;       // Оценка популярности (сверху)
+    unsigned long long       error;       // Насколько оценка может врать
+    struct sockaddr_storage  addr;        // Закэшированный адрес
+    socklen_t                addrlen;     // 0 — не резолвили
+    unsigned long long       resolved_at;
+    pooled_sock_t           *pool;        // Прогревающиеся и готовые сокеты
+    int                      npool;
+    int                      want;        // Сколько сокетов держать по последнему расчёту
+};
+
+
+static preconnect_dest_t  sketch[SKETCH_SIZE];
+static int                pool_slots    = 0;
+static int                pool_per_dest = 0;
+static int                pool_idle_ms  = 0;
+static preconnect_stats_t stats;
+static unsigned long long next_decay    = 0;
+static unsigned long long next_stats    = 0;
+
+
+static void preconnect_read_handle(int fd, void *ud);
+
+static void preconnect_write_handle(int fd, void *ud);
+
+
+static uint64_t key_hash(const char *str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *str; ++str)
+    {
+        h ^= (uint8_t)*str;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * Выкидывает сокет из пула назначения и закрывает его
+ */
+static void pool_drop(pooled_sock_t *ps)
+{
+    preconnect_dest_t *dest = ps->dest;
+    for (pooled_sock_t **it = &dest->pool; *it != NULL; it = &(*it)->next)
+    {
+        if (*it == ps)
+        {
+            *it = ps->next;
+            break;
+        }
+    }
+    --dest->npool;
+    if (ps->ready)
+    {
+        --stats.idle;
+    }
+    sock_release(ps->sock);
+    free(ps);
+}
+
+/*
+ * Space-Saving: нашли ключ — +1; нет — вытесняем минимальный счётчик,
+ * новый ключ наследует его значение как погрешность
+ */
+static preconnect_dest_t *sketch_observe(const char *host, const char *port)
+{
+    char key[PRECONNECT_KEY_LEN];
+    snprintf(key, sizeof(key), "%s:%s", host, port);
+    uint64_t h = key_hash(key);
+
+    preconnect_dest_t *min = &sketch[0];
+    for (int i = 0; i < SKETCH_SIZE; ++i)
+    {
+        preconnect_dest_t *d = &sketch[i];
+        if (d->key[0] != '\0' && d->hash == h && strcmp(d->key, key) == 0)
+        {
+            ++d->count;
+            return d;
+        }
+        if (d->count < min->count)
+        {
+            min = d;
+        }
+    }
+
+    // Вытесняем: пул старого назначения больше не нужен
+    while (min->pool != NULL)
+    {
+        pool_drop(min->pool);
+    }
+    unsigned long long inherited = min->key[0] != '\0' ? min->count : 0;
+    memset(min, 0, sizeof(*min));
+    snprintf(min->key,  sizeof(min->key),  "%s", key);
+    snprintf(min->host, sizeof(min->host), "%s", host);
+    snprintf(min->port, sizeof(min->port), "%s", port);
+    min->hash  = h;
+    min->count = inherited + 1;
+    min->error = inherited;
+    return min;
+}
+
+/*
+ * Резолвит назначение, если кэш пустой или протух. Блокирующий getaddrinfo,
+ * как и в tunnel_connect_to_remote, но только для горячих адресов и раз в PRECONNECT_DNS_MS
+ */
+static int dest_resolve(preconnect_dest_t *dest, unsigned long long now)
+{
+    if (dest->addrlen != 0 && now - dest->resolved_at < PRECONNECT_DNS_MS)
+    {
+        metrics_add(METRIC_DNS_CACHE_HIT, 1);
+        return 0;
+    }
+    metrics_add(METRIC_DNS_CACHE_MISS, 1);
+
+    struct addrinfo hint;
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family   = AF_UNSPEC;
+    hint.ai_socktype = SOCK_STREAM;
+    hint.ai_protocol = IPPROTO_TCP;
+
+    struct addrinfo *ai = NULL;
+    if (getaddrinfo(dest->host, dest->port, &hint, &ai) != 0)
+    {
+        metrics_add(METRIC_DNS_ERROR, 1);
+        dest->addrlen = 0;
+        return -1;
+    }
+    metrics_add(METRIC_DNS_OK, 1);
+    memcpy(&dest->addr, ai->ai_addr, ai->ai_addrlen);
+    dest->addrlen     = ai->ai_addrlen;
+    dest->resolved_at = now;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+/*
+ * Открывает впрок неблокирующий коннект к назначению
+ */
+static int dest_dial(preconnect_dest_t *dest, unsigned long long now)
+{
+    if (dest_resolve(dest, now) < 0)
+    {
+        return -1;
+    }
+
+    int fd = socket(dest->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    sock_nonblocking(fd);
+    sock_keepalive(fd);
+
+    ++stats.dialed;
+    metrics_add(METRIC_SYS_CONNECT, 1);
+    if (connect(fd, (struct sockaddr *)&dest->addr, dest->addrlen) != 0 && errno != EINPROGRESS)
+    {
+        ++stats.failed;
+        close(fd);
+        return -1;
+    }
+
+    pooled_sock_t *ps = malloc(sizeof(*ps));
+    if (ps == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    sock_t *sock = sock_create(fd, sock_connecting, 0, NULL);
+    if (sock == NULL)
+    {
+        free(ps);
+        close(fd);
+        return -1;
+    }
+    sock->context      = ps;
+    sock->read_handle  = preconnect_read_handle;
+    sock->write_handle = preconnect_write_handle;
+
+    ps->sock     = sock;
+    ps->dest     = dest;
+    ps->ready    = 0;
+    ps->deadline = now + pool_idle_ms;
+    ps->next     = dest->pool;
+    dest->pool   = ps;
+    ++dest->npool;
+
+    epoll_add(sock);
+    epoll_modify(sock, 1, 1);
+    return 0;
+}
+
+/*
+ * EPOLLOUT: connect доехал (или нет)
+ */
+static void preconnect_write_handle(int fd, void *ud)
+{
+    sock_t        *sock = (sock_t *)ud;
+    pooled_sock_t *ps   = (pooled_sock_t *)sock->context;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error)
+    {
+        ++stats.failed;
+        LOG_WARN("Pre-connect to %s failed: %s", ps->dest->key, strerror(error ? error : errno));
+        pool_drop(ps);
+        return;
+    }
+
+    sock->state = sock_connected;
+    ps->ready   = 1;
+    ++stats.idle;
+    // Дальше следим только за закрытием со стороны сервера
+    epoll_modify(sock, 0, 1);
+}
+
+/*
+ * EPOLLIN на простаивающем сокете: либо сервер закрыл его, либо прислал баннер
+ */
+static void preconnect_read_handle(int fd, void *ud)
+{
+    sock_t        *sock = (sock_t *)ud;
+    pooled_sock_t *ps   = (pooled_sock_t *)sock->context;
+
+    int n = buffer_readfd(sock->read_buffer, fd);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        ++stats.expired;
+        pool_drop(ps);
+        return;
+    }
+    // Баннер (SMTP, SSH и т.п.) бережём — туннель отдаст его клиенту сразу после ответа.
+    // Читать дальше не будем, пока сокет не заберут
+    epoll_modify(sock, 0, 0);
+}
+
+static int dest_cmp(const void *a, const void *b)
+{
+    const preconnect_dest_t *da = *(const preconnect_dest_t * const *)a;
+    const preconnect_dest_t *db = *(const preconnect_dest_t * const *)b;
+    return da->count < db->count ? 1 : da->count > db->count ? -1 : 0;
+}
+
+/*
+ * Таймер: выкидываем просроченное, пересчитываем топ и доливаем пул
+ */
+static void preconnect_tick(void *ud)
+{
+    (void)ud;
+    unsigned long long now = server_now_ms();
+
+    if (now >= next_decay)
+    {
+        next_decay = now + PRECONNECT_DECAY_MS;
+        for (int i = 0; i < SKETCH_SIZE; ++i)
+        {
+            sketch[i].count /= 2;
+            sketch[i].error /= 2;
+        }
+    }
+
+    if (now >= next_stats)
+    {
+        next_stats = now + PRECONNECT_STATS_MS;
+        unsigned long long total = stats.hits + stats.misses;
+        LOG_INFO("Pre-connect pool: hits=%llu misses=%llu hit-rate=%.1f%% idle=%zu dialed=%llu failed=%llu expired=%llu",
+                 stats.hits, stats.misses, total ? 100.0 * stats.hits / total : 0.0,
+                 stats.idle, stats.dialed, stats.failed, stats.expired);
+    }
+
+    // Топ по счётчикам: самым горячим — до per_dest сокетов, пока хватает слотов
+    preconnect_dest_t *order[SKETCH_SIZE];
+    for (int i = 0; i < SKETCH_SIZE; ++i)
+    {
+        order[i] = &sketch[i];
+    }
+    qsort(order, SKETCH_SIZE, sizeof(order[0]), dest_cmp);
+
+    int left = pool_slots;
+    for (int i = 0; i < SKETCH_SIZE; ++i)
+    {
+        preconnect_dest_t *d = order[i];
+        int hot = d->key[0] != '\0' && d->count >= PRECONNECT_MIN_HITS;
+        d->want = hot ? (left < pool_per_dest ? left : pool_per_dest) : 0;
+        left   -= d->want;
+
+        // Протухшие по простою и лишние (назначение остыло) — закрываем
+        pooled_sock_t *ps = d->pool;
+        while (ps != NULL)
+        {
+            pooled_sock_t *next = ps->next;
+            if (now >= ps->deadline || d->npool > d->want)
+            {
+                ++stats.expired;
+                pool_drop(ps);
+            }
+            ps = next;
+        }
+
+        while (d->npool < d->want)
+        {
+            if (dest_dial(d, now) < 0)
+            {
+                break;
+            }
+        }
+    }
+}
+
+int preconnect_init(int slots, int per_dest, int idle_ms)
+{
+    if (slots <= 0 || per_dest <= 0 || idle_ms <= 0)
+    {
+        LOG_ERROR("Failed preconnect_init, slots=%d per_dest=%d idle_ms=%d", slots, per_dest, idle_ms);
+        return -1;
+    }
+    pool_slots    = slots;
+    pool_per_dest = per_dest;
+    pool_idle_ms  = idle_ms;
+    next_decay    = server_now_ms() + PRECONNECT_DECAY_MS;
+    next_stats    = server_now_ms() + PRECONNECT_STATS_MS;
+
+    LOG_INFO("Pre-connect pool: slots=%d per_dest=%d idle=%dms", slots, per_dest, idle_ms);
+    return server_timer_add(PRECONNECT_TICK_MS, preconnect_tick, NULL);
+}
+
+sock_t *preconnect_take(tunnel_t *tunnel)
+{
+    if (pool_slots == 0)
+    {
+        return NULL;
+    }
+
+    preconnect_dest_t *dest = sketch_observe(tunnel->dst_host, tunnel->dst_port);
+    for (pooled_sock_t *ps = dest->pool; ps != NULL; ps = ps->next)
+    {
+        if (!ps->ready)
+        {
+            continue;
+        }
+
+        // Отвязываем от пула, но сокет не закрываем — он переходит туннелю
+        sock_t *sock = ps->sock;
+        for (pooled_sock_t **it = &dest->pool; *it != NULL; it = &(*it)->next)
+        {
+            if (*it == ps)
+            {
+                *it = ps->next;
+                break;
+            }
+        }
+        --dest->npool;
+        --stats.idle;
+        ++stats.hits;
+        free(ps);
+        return sock;
+    }
+
+    ++stats.misses;
+    return NULL;
+}
+
+void preconnect_get_stats(preconnect_stats_t *out)
+{
+    *out = stats;
+}
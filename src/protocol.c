@@ -10,11 +10,11 @@
 #include "server.h"
 #include "tunnel.h"
 #include "sock.h"
+#include "mux.h"
+#include "http_proxy.h"
+#include "stats.h"
 
 
-#define MAX_PASSWD_LEN 20
-#define MAX_UNAME_LEN  20
-
 #define NIPV4 4
 #define NIPV6 16
 
@@ -58,6 +58,27 @@ int tunnel_open_handle(tunnel_t *tunnel)
     }
 
 header:
+    // Core-режим: вместо SOCKS5-greeting на тот же порт может прийти линк мультиплексора
+    if (mux_core_enabled() && buffer_readable(buff) > 0
+        && (uint8_t)buff->data[buff->read_index] == MUX_PREFACE_FIRST)
+    {
+        return mux_accept(tunnel);
+    }
+
+    // HTTP-прокси на том же порту: первым байтом пришла буква метода, а не 0x05
+    if (*nreaded == 0 && buffer_readable(buff) > 0
+        && http_sniff((uint8_t)buff->data[buff->read_index]))
+    {
+        tunnel->http = http_front_create();
+        if (tunnel->http == NULL)
+        {
+            return -1;
+        }
+        tunnel->state = request_state;
+        stats_tunnel_update(tunnel);
+        return http_request_handle(tunnel);
+    }
+
     // Если в буфере достаточно байт, считываем ver и nmethods
     if (buffer_readable(buff) >= nheader)
     {
@@ -89,6 +110,7 @@ methods:
         reply[1] = auth ? SOCKS5_USER_PASS : SOCKS5_NO_AUTH;
         // Переход в следующее состояние
         tunnel->state = auth ? auth_state : request_state;
+        stats_tunnel_update(tunnel);
         *nreaded = 0;  // Сбрасываем счётчик прочитанных байт
 
         LOG_INFO("SOCKS5 greeting: ver=0x%02x, nmethods=%u → reply method=0x%02x",
@@ -153,7 +175,7 @@ header:
         }
         *nreaded += nheader;
     }
-    return 0;
+    else return 0;  // Ждём новых данных, иначе проваливаемся в следующий этап
 
 uname:
     if (buffer_readable(buff) >= ap->ulen)
@@ -161,7 +183,7 @@ uname:
         buffer_read(buff, ap->uname, ap->ulen);
         *nreaded += ap->ulen;
     }
-    return 0;
+    else return 0;
 
 plen:
     if (buffer_readable(buff) >= nplen)
@@ -171,7 +193,7 @@ plen:
             return -1;
         *nreaded += nplen;
     }
-    return 0;
+    else return 0;
 
 passwd:
     if (buffer_readable(buff) >= ap->plen)
@@ -181,6 +203,7 @@ passwd:
         if (strcmp(ap->uname, SERVER.username) != 0
          || strcmp(ap->passwd, SERVER.passwd) != 0)
         {
+            tunnel_close_reason(tunnel, close_auth);
             return -1;  // Аутентификация не пройдена
         }
 
@@ -192,6 +215,7 @@ passwd:
         }
 
         tunnel->state = request_state;  // Переходим к запросу CONNECT
+        stats_tunnel_update(tunnel);
         *nreaded = 0;
     }
     return 0;
@@ -213,6 +237,12 @@ int tunnel_request_handle(tunnel_t *tunnel)
     size_t ndomainlen  = sizeof(rp->domainlen);
     size_t nport       = sizeof(rp->port);
 
+    // Запрос HTTP-прокси разбирает его фронт
+    if (tunnel->http != NULL)
+    {
+        return http_request_handle(tunnel);
+    }
+
     // Предварительный лог: мы ещё не считали все поля, но выводим текущее состояние
     LOG_INFO("Request: cmd=0x%02x, addr_type=0x%02x, dst=\"%.*s\":%u",
              rp->cmd, rp->atyp, rp->domainlen, rp->addr, ntohs(rp->port));
@@ -1,88 +1,602 @@
-#include <ctype.h>
-#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "protocol_parser.h"
+#include "dissect.h"
+#include "http_parser.h"
+#include "http2.h"
+#include "websocket.h"
+#include "redis.h"
+#include "postgres.h"
+#include "mqtt.h"
+#include "scan.h"
 #include "logger.h"
 
 /*
- *  Чекает, начинается ли буфер с HTTP-метода (четыре буквы) или префикса "HTTP".
- *  Если данных достаточно, находит границу заголовков "\r\n\r\n" и логирует
- *  весь блок от начала до нее.
+ *  Логирование того, что отдал потоковый парсер: блок заголовков целиком
+ *  и границы сообщений (тело не логируем и не дампим)
+ */
+static void log_http_head(void *ud, int is_client, const char *head, size_t len)
+{
+    // Определяем метку направления передачи
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+
+    // Вывод в лог блока заголовков HTTP-сообщения
+    LOG_INFO("HTTP %s, %zu байт:\n%.*s", label, len, (int)len, head);
+}
+
+static void log_http_message(void *ud, int is_client, uint64_t body_len)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+    LOG_INFO("HTTP %s message end, body %llu байт", label, (unsigned long long)body_len);
+}
+
+static const http_flow_cb_t http_log_cb =
+{
+    .on_head    = log_http_head,
+    .on_message = log_http_message
+};
+
+/*
+ *  Кормит потоковый парсер направления. Заголовки, склеенные через стыки чтений,
+ *  и границы сообщений логируются по мере появления; байты тела просто пропускаются.
+ */
+static size_t parse_and_log_http(http_flow_t *flow, const uint8_t *data, size_t len, int is_client)
+{
+    return http_flow_feed(flow, data, len, is_client, &http_log_cb, NULL);
+}
+
+/*
+ * Логирование того, что отдал декодер WebSocket: собранные сообщения
+ * (текст — с превью, бинарные — размером), управляющие фреймы и сбои разбора
+ */
+static void log_ws_message(void *ud, int is_client, const ws_message_t *msg)
+{
+    // Направление передачи для логирования
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+
+    if (msg->opcode != WS_OP_TEXT || msg->deflate)
+    {
+        LOG_INFO("WebSocket %s, %s, %llu байт, фреймов %u", label,
+                 msg->deflate ? "compressed" : "binary", (unsigned long long)msg->len, msg->frames);
+        return;
+    }
+    // Логируем начало текста; битый UTF-8 помечаем
+    LOG_INFO("WebSocket %s, text%s, %llu байт, фреймов %u:\n%.*s%s", label,
+             msg->utf8_ok ? "" : " (invalid UTF-8)", (unsigned long long)msg->len, msg->frames,
+             (int)msg->preview_len, msg->preview, msg->len > msg->preview_len ? "..." : "");
+}
+
+static void log_ws_control(void *ud, int is_client, uint8_t opcode, const uint8_t *payload, size_t len)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+
+    if (opcode == WS_OP_CLOSE)
+    {
+        unsigned code = len >= 2 ? (unsigned)payload[0] << 8 | payload[1] : 0;
+        LOG_INFO("WebSocket %s, close %u %.*s", label, code,
+                 len > 2 ? (int)(len - 2) : 0, len > 2 ? (const char *)payload + 2 : "");
+        return;
+    }
+    LOG_INFO("WebSocket %s, %s, %zu байт", label, opcode == WS_OP_PING ? "ping" : "pong", len);
+}
+
+static void log_ws_error(void *ud, int is_client, const char *what)
+{
+    LOG_WARN("WebSocket %s: %s, дальше не разбираем",
+             is_client ? "client → remote" : "remote → client", what);
+}
+
+static const ws_flow_cb_t ws_log_cb =
+{
+    .on_message = log_ws_message,
+    .on_control = log_ws_control,
+    .on_error   = log_ws_error
+};
+
+/*
+ * Кормит декодер WebSocket направления; сообщения логируются по мере сборки
+ */
+static void parse_and_log_websocket(ws_flow_t *ws, const uint8_t *data, size_t len, int is_client)
+{
+    ws_flow_feed(ws, data, len, is_client, &ws_log_cb, NULL);
+}
+
+/*
+ * Логирование того, что отдал декодер HTTP/2: блоки заголовков потоков,
+ * концы потоков с размером DATA, управляющие фреймы и сбои разбора
+ */
+static void log_h2_headers(void *ud, int is_client, const h2_headers_t *h)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+
+    char what[48];
+    if (h->type == H2_PUSH_PROMISE)
+    {
+        snprintf(what, sizeof(what), "push promise %u", h->promised);
+    }
+    else
+    {
+        snprintf(what, sizeof(what), "headers%s", h->end_stream ? " (end stream)" : "");
+    }
+    if (!h->decoded)
+    {
+        LOG_INFO("HTTP/2 %s stream %u, %s, %zu байт (HPACK не разбираем)", label, h->stream, what, h->wire_len);
+        return;
+    }
+    LOG_INFO("HTTP/2 %s stream %u, %s, %zu байт, полей %u:\n%.*s%s", label, h->stream, what,
+             h->wire_len, h->count, (int)h->text_len, h->text, h->truncated ? "..." : "");
+}
+
+static void log_h2_stream_end(void *ud, int is_client, uint32_t stream, uint64_t data_len)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+    if (data_len == H2_DATA_UNKNOWN)
+    {
+        LOG_INFO("HTTP/2 %s stream %u end", label, stream);
+        return;
+    }
+    LOG_INFO("HTTP/2 %s stream %u end, data %llu байт", label, stream, (unsigned long long)data_len);
+}
+
+static void log_h2_control(void *ud, int is_client, uint8_t type, uint8_t flags, uint32_t stream,
+                           const uint8_t *payload, size_t len, size_t full_len)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+
+    if (type == H2_SETTINGS)
+    {
+        if (flags & H2_FLAG_ACK)
+        {
+            return;
+        }
+        // Параметры по 6 байт: id(2) + value(4)
+        static const char *names[] =
+        {
+            "?", "header_table_size", "enable_push", "max_concurrent_streams",
+            "initial_window_size", "max_frame_size", "max_header_list_size", "?",
+            "enable_connect_protocol"
+        };
+        char  text[256] = "";
+        char *p = text;
+        for (size_t i = 0; i + 6 <= len && p < text + sizeof(text) - 48; i += 6)
+        {
+            unsigned id    = (unsigned)payload[i] << 8 | payload[i + 1];
+            uint32_t value = (uint32_t)payload[i + 2] << 24 | (uint32_t)payload[i + 3] << 16
+                             | (uint32_t)payload[i + 4] << 8 | payload[i + 5];
+            if (id < sizeof(names) / sizeof(names[0]) && names[id][0] != '?')
+            {
+                p += sprintf(p, " %s=%u", names[id], value);
+            }
+            else
+            {
+                p += sprintf(p, " 0x%x=%u", id, value);
+            }
+        }
+        LOG_INFO("HTTP/2 %s settings:%s%s", label, text, full_len > len ? " ..." : "");
+        return;
+    }
+    if (type == H2_RST_STREAM)
+    {
+        uint32_t code = len >= 4 ? (uint32_t)payload[0] << 24 | (uint32_t)payload[1] << 16
+                                   | (uint32_t)payload[2] << 8 | payload[3] : 0;
+        LOG_INFO("HTTP/2 %s stream %u reset, error %u", label, stream, code);
+        return;
+    }
+    // GOAWAY: last stream id(4) + error(4) + отладочный текст
+    uint32_t last = len >= 4 ? ((uint32_t)payload[0] << 24 | (uint32_t)payload[1] << 16
+                                | (uint32_t)payload[2] << 8 | payload[3]) & 0x7fffffff : 0;
+    uint32_t code = len >= 8 ? (uint32_t)payload[4] << 24 | (uint32_t)payload[5] << 16
+                               | (uint32_t)payload[6] << 8 | payload[7] : 0;
+    LOG_INFO("HTTP/2 %s goaway, last stream %u, error %u %.*s", label, last, code,
+             len > 8 ? (int)(len - 8) : 0, len > 8 ? (const char *)payload + 8 : "");
+}
+
+static void log_h2_error(void *ud, int is_client, const char *what)
+{
+    LOG_WARN("HTTP/2 %s: %s", is_client ? "client → remote" : "remote → client", what);
+}
+
+static const h2_flow_cb_t h2_log_cb =
+{
+    .on_headers    = log_h2_headers,
+    .on_stream_end = log_h2_stream_end,
+    .on_control    = log_h2_control,
+    .on_error      = log_h2_error
+};
+
+/*
+ * Кормит декодер HTTP/2 направления; заголовки и концы потоков логируются по мере разбора
+ */
+static void parse_and_log_http2(h2_flow_t *h2, const uint8_t *data, size_t len, int is_client)
+{
+    h2_flow_feed(h2, data, len, is_client, &h2_log_cb, NULL);
+}
+
+/*
+ * Вспомогательный вывод данных в шестнадцатеричном виде.
+ * Ограничиваем логирование первыми 128 байтами для читаемости.
+ */
+void parse_and_log_raw(const uint8_t *data, size_t len, int is_client)
+{
+    const char *label = is_client
+                        ? "Forwarded client → remote"
+                        : "Forwarded remote → client";
+
+    size_t max = len < 128 ? len : 128;
+    char hexstr[3 * 128 + 1] = {0};
+    char *p = hexstr;
+    for (size_t i = 0; i < max; i++)
+    {
+        // Формируем текст вида "ab cd ef ..."
+        p += sprintf(p, "%02x ", data[i]);
+    }
+    LOG_INFO("%s hex (%zu bytes): %s%s", label, len, hexstr,
+             (len > max ? "...(truncated)" : ""));
+}
+
+/*
+ * Логирование того, что отдали разборщики Redis, PostgreSQL и MQTT
+ */
+static void log_redis_command(void *ud, const redis_command_t *cmd)
+{
+    LOG_INFO("Redis client → remote, %s, %llu байт, аргументов %u:\n%.*s%s",
+             cmd->is_inline ? "inline" : "command", (unsigned long long)cmd->len, cmd->args,
+             (int)cmd->text_len, cmd->text, cmd->text_len == REDIS_TEXT_MAX ? "..." : "");
+}
+
+static void log_redis_error(void *ud, const char *what)
+{
+    LOG_WARN("Redis client → remote: %s, дальше не разбираем", what);
+}
+
+static const redis_flow_cb_t redis_log_cb =
+{
+    .on_command = log_redis_command,
+    .on_error   = log_redis_error
+};
+
+static void log_pg_message(void *ud, int is_client, const pg_message_t *msg)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+
+    const char *what;
+    switch (msg->type)
+    {
+        case 0:   what = "startup";   break;
+        case 'Q': what = "query";     break;
+        case 'P': what = "parse";     break;
+        case 'X': what = "terminate"; break;
+        case 'R': what = "auth";      break;
+        case 'E': what = "error";     break;
+        case 'N': what = "notice";    break;
+        case 'C': what = "complete";  break;
+        default:  what = "message";   break;
+    }
+    LOG_INFO("PostgreSQL %s, %s, %u байт:\n%.*s%s", label, what, msg->len,
+             (int)msg->text_len, msg->text, msg->text_len == PG_TEXT_MAX ? "..." : "");
+}
+
+static void log_pg_error(void *ud, int is_client, const char *what)
+{
+    LOG_WARN("PostgreSQL %s: %s, дальше не разбираем",
+             is_client ? "client → remote" : "remote → client", what);
+}
+
+static const pg_flow_cb_t pg_log_cb =
+{
+    .on_message = log_pg_message,
+    .on_error   = log_pg_error
+};
+
+static void log_mqtt_packet(void *ud, int is_client, const mqtt_packet_t *pkt)
+{
+    const char *label = is_client
+                        ? "client → remote"
+                        : "remote → client";
+    LOG_INFO("MQTT %s, %s, %u байт: %.*s", label, pkt->name, pkt->len, (int)pkt->text_len, pkt->text);
+}
+
+static void log_mqtt_error(void *ud, int is_client, const char *what)
+{
+    LOG_WARN("MQTT %s: %s, дальше не разбираем",
+             is_client ? "client → remote" : "remote → client", what);
+}
+
+static const mqtt_flow_cb_t mqtt_log_cb =
+{
+    .on_packet = log_mqtt_packet,
+    .on_error  = log_mqtt_error
+};
+
+/*
+ * Диссекторы. Сигнатуры — по первым байтам направления, кто заговорил первым:
+ * первый байт отсекает всех, кому он не подходит, ещё до вызова match
  */
-bool parse_and_log_http(const uint8_t *data, size_t len, int is_client)
-{
-    // На любое корректное HTTP-сообщение уходит минимум 4 байта
-    if (len < 4)
-    {
-        return false;
-    }
-
-    // Проверяем первые 4 байта на буквы или на строку "HTTP"
-    bool starts_with_letters = (isalpha(data[0]) && isalpha(data[1]) &&
-                                isalpha(data[2]) && isalpha(data[3]));
-    bool starts_with_http    = (memcmp(data, "HTTP", 4) == 0);
-    if (starts_with_letters || starts_with_http) {
-
-        // Приводим указатель к строковому виду для поиска разделителя
-        const char *text   = (const char *)data;
-        const char *split  = strstr(text, "\r\n\r\n");
-        // Если разделитель найден, логируем до его конца (split+4),
-        // иначе логируем весь буфер целиком.
-        size_t      to_log  = split ? (split + 4 - text) : len;
-        // Определяем метку направления передачи
-        const char *label   = is_client
-                             ? "client → remote"
-                             : "remote → client";
-
-        // Вывод в лог первого блока HTTP-сообщения
-        LOG_INFO("HTTP %s, %zu байт:\n%.*s",
-                 label, to_log, (int)to_log, text);
+
+/*
+ * HTTP/1.x; после Upgrade: websocket и Upgrade: h2c туннель разбирает тот же диссектор
+ */
+typedef struct http_ctx
+{
+    http_flow_t  http;
+    ws_flow_t   *ws;   // Заводится после Upgrade: websocket
+    h2_flow_t   *h2;   // Заводится после Upgrade: h2c
+} http_ctx_t;
+
+static bool http_first(uint8_t b, int is_client)
+{
+    return is_client ? scan_http_start(&b, 1) != SCAN_HTTP_NO : b == 'H';
+}
+
+static dissect_match_t http_match(const uint8_t *p, size_t len, int is_client, bool port_hint)
+{
+    scan_http_t kind = scan_http_start(p, len);
+    if (kind == SCAN_HTTP_MORE)
+    {
+        return DISSECT_MORE;
+    }
+    return kind == (is_client ? SCAN_HTTP_REQUEST : SCAN_HTTP_RESPONSE) ? DISSECT_YES : DISSECT_NO;
+}
+
+static void *http_create(void)
+{
+    http_ctx_t *c = malloc(sizeof(*c));
+    if (c != NULL)
+    {
+        http_flow_init(&c->http);
+        c->ws = NULL;
+        c->h2 = NULL;
+    }
+    return c;
+}
+
+static bool http_feed(void *ctx, const uint8_t *data, size_t len, int is_client)
+{
+    http_ctx_t *c    = ctx;
+    size_t      used = parse_and_log_http(&c->http, data, len, is_client);
+    if (used == len)
+    {
+        return true;
+    }
+    if (c->http.websocket)
+    {
+        if (c->ws == NULL)
+        {
+            c->ws = malloc(sizeof(*c->ws));
+            if (c->ws == NULL)
+            {
+                return false;
+            }
+            ws_flow_init(c->ws);
+        }
+        parse_and_log_websocket(c->ws, data + used, len - used, is_client);
+        return true;
+    }
+    if (c->http.h2c)
+    {
+        if (c->h2 == NULL)
+        {
+            c->h2 = malloc(sizeof(*c->h2));
+            if (c->h2 == NULL)
+            {
+                return false;
+            }
+            h2_flow_init(c->h2);
+        }
+        parse_and_log_http2(c->h2, data + used, len - used, is_client);
         return true;
     }
+    // Не HTTP посреди разбора: показываем кусок; после CONNECT и чужого
+    // Upgrade весь туннель дальше не наш — на этом всё
+    parse_and_log_raw(data + used, len - used, is_client);
+    return !c->http.upgraded;
+}
 
-    // Если ни условие не сработало — это не HTTP
-    return false;
+static unsigned http_messages(const void *ctx)
+{
+    const http_ctx_t *c = ctx;
+    unsigned n = c->http.dir[0].messages + c->http.dir[1].messages;
+    if (c->ws != NULL)
+    {
+        n += c->ws->dir[0].messages + c->ws->dir[1].messages;
+    }
+    if (c->h2 != NULL)
+    {
+        n += c->h2->dir[0].messages + c->h2->dir[1].messages;
+    }
+    return n;
+}
+
+static void http_destroy(void *ctx)
+{
+    http_ctx_t *c = ctx;
+    free(c->ws);
+    free(c->h2);
+    free(c);
+}
+
+/*
+ * HTTP/2 с prior knowledge (h2c)
+ */
+static bool h2_first(uint8_t b, int is_client)
+{
+    return is_client ? b == 'P' : b == 0x00;
+}
+
+static dissect_match_t h2_match(const uint8_t *p, size_t len, int is_client, bool port_hint)
+{
+    return h2_signature(p, len, is_client);
+}
+
+static void *h2_create(void)
+{
+    h2_flow_t *h2 = malloc(sizeof(*h2));
+    if (h2 != NULL)
+    {
+        h2_flow_init(h2);
+    }
+    return h2;
+}
+
+static bool h2_feed(void *ctx, const uint8_t *data, size_t len, int is_client)
+{
+    parse_and_log_http2(ctx, data, len, is_client);
+    return true;
+}
+
+static unsigned h2_messages(const void *ctx)
+{
+    const h2_flow_t *h2 = ctx;
+    return h2->dir[0].messages + h2->dir[1].messages;
 }
 
 /*
- * parse_and_log_websocket
- * Распознаёт текстовый WebSocket-фрейм без маски (opcode = 1).
- * Не робит фрагментацию и маскирование. При успешном разборе
- * логирует содержимое payload.
+ * TLS: ClientHello уже разобран на event loop (см. inspect.c), дальше шифр —
+ * смотреть нечего
  */
-bool parse_and_log_websocket(const uint8_t *data, size_t len, int is_client)
+static bool tls_first(uint8_t b, int is_client)
+{
+    return is_client && b == 0x16;
+}
+
+static dissect_match_t tls_match(const uint8_t *p, size_t len, int is_client, bool port_hint)
 {
-    // Минимальный размер заголовка WebSocket — 2 байта
-    if (len < 2) {
-        return false;
+    // Handshake, версия записи 3.x
+    if (len < 2)
+    {
+        return DISSECT_MORE;
     }
+    return p[1] == 0x03 ? DISSECT_YES : DISSECT_NO;
+}
+
+static bool tls_feed(void *ctx, const uint8_t *data, size_t len, int is_client)
+{
+    return false;
+}
 
-    // Первый байт: FIN (старший бит) и opcode (младшие 4 бита)
-    uint8_t fin_and_opcode = data[0];
-    uint8_t opcode         = fin_and_opcode & 0x0F;
-    // Поддерживаем только текстовые фреймы (opcode = 1)
-    if (opcode != 0x1) {
-        return false;
+/*
+ * Redis: команды клиента
+ */
+static bool redis_first(uint8_t b, int is_client)
+{
+    // Буквы — inline-команды, их match примет только на порту Redis
+    return is_client && (b == '*' || ((b | 0x20) >= 'a' && (b | 0x20) <= 'z'));
+}
+
+static void *redis_create(void)
+{
+    redis_flow_t *r = malloc(sizeof(*r));
+    if (r != NULL)
+    {
+        redis_flow_init(r);
     }
+    return r;
+}
+
+static bool redis_feed(void *ctx, const uint8_t *data, size_t len, int is_client)
+{
+    redis_flow_feed(ctx, data, len, is_client, &redis_log_cb, NULL);
+    return true;
+}
+
+static unsigned redis_messages(const void *ctx)
+{
+    return ((const redis_flow_t *)ctx)->messages;
+}
 
-    // Второй байт: старший бит — флаг маски, младшие 7 бит — длина payload (если <= 125)
-    bool    has_mask      = (data[1] & 0x80) != 0;
-    uint8_t raw_length    = data[1] & 0x7F;
-    size_t  header_length = 2 + (has_mask ? 4 : 0);
+/*
+ * PostgreSQL: первое сообщение клиента короткое — старший байт длины нулевой
+ */
+static bool pg_first(uint8_t b, int is_client)
+{
+    return is_client && b == 0x00;
+}
 
-    // Проверяем, что в буфере есть полный фрейм (заголовок + payload)
-    if (len < header_length + raw_length) {
-        return false;
+static void *pg_create(void)
+{
+    pg_flow_t *pg = malloc(sizeof(*pg));
+    if (pg != NULL)
+    {
+        pg_flow_init(pg);
     }
+    return pg;
+}
 
-    // Сдвигаем указатель на начало payload
-    const uint8_t *payload = data + header_length;
-    // Направление передачи для логирования
-    const char   *label    = is_client
-                             ? "client → remote"
-                             : "remote → client";
+static bool pg_feed(void *ctx, const uint8_t *data, size_t len, int is_client)
+{
+    return pg_flow_feed(ctx, data, len, is_client, &pg_log_cb, NULL);
+}
+
+static unsigned pg_messages(const void *ctx)
+{
+    return ((const pg_flow_t *)ctx)->messages;
+}
+
+/*
+ * MQTT: клиент начинает с CONNECT
+ */
+static bool mqtt_first(uint8_t b, int is_client)
+{
+    return is_client && b == 0x10;
+}
+
+static void *mqtt_create(void)
+{
+    mqtt_flow_t *m = malloc(sizeof(*m));
+    if (m != NULL)
+    {
+        mqtt_flow_init(m);
+    }
+    return m;
+}
 
-    // Логируем полезную нагрузку как текстовую строку
-    LOG_INFO("WebSocket %s, %u байт:\n%.*s",
-             label, raw_length, raw_length, (const char *)payload);
+static bool mqtt_feed(void *ctx, const uint8_t *data, size_t len, int is_client)
+{
+    mqtt_flow_feed(ctx, data, len, is_client, &mqtt_log_cb, NULL);
     return true;
 }
+
+static unsigned mqtt_messages(const void *ctx)
+{
+    return ((const mqtt_flow_t *)ctx)->messages;
+}
+
+static const dissector_t dissectors[] =
+{
+    { "http",     { 80, 8080 }, http_first,  http_match,      http_create,  http_feed,  http_messages,  http_destroy },
+    { "http2",    { 0 },        h2_first,    h2_match,        h2_create,    h2_feed,    h2_messages,    free },
+    { "tls",      { 443 },      tls_first,   tls_match,       NULL,         tls_feed,   NULL,           NULL },
+    { "redis",    { 6379 },     redis_first, redis_signature, redis_create, redis_feed, redis_messages, free },
+    { "postgres", { 5432 },     pg_first,    pg_signature,    pg_create,    pg_feed,    pg_messages,    free },
+    { "mqtt",     { 1883 },     mqtt_first,  mqtt_signature,  mqtt_create,  mqtt_feed,  mqtt_messages,  free },
+};
+
+int parse_register_dissectors(void)
+{
+    for (size_t i = 0; i < sizeof(dissectors) / sizeof(dissectors[0]); ++i)
+    {
+        if (dissect_register(&dissectors[i]) < 0)
+        {
+            LOG_ERROR("Too many protocol dissectors (max %d)", DISSECT_MAX);
+            return -1;
+        }
+    }
+    return 0;
+}
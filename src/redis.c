@@ -0,0 +1,239 @@
+#include <string.h>
+
+#include "redis.h"
+
+
+#define REDIS_ARGS_MAX (1LL << 20)  // Больше аргументов в команде не бывает — значит, не RESP
+
+
+void redis_flow_init(redis_flow_t *redis)
+{
+    memset(redis, 0, sizeof(*redis));
+}
+
+/*
+ * Неотрицательное число из цифр p[0..len), -1 — не число
+ */
+static long long number(const char *p, size_t len)
+{
+    long long n = 0;
+    if (len == 0 || len > 18)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (p[i] < '0' || p[i] > '9')
+        {
+            return -1;
+        }
+        n = n * 10 + (p[i] - '0');
+    }
+    return n;
+}
+
+dissect_match_t redis_signature(const uint8_t *p, size_t len, int is_client, bool port_hint)
+{
+    if (!is_client)
+    {
+        return DISSECT_NO;
+    }
+    if (p[0] == '*')
+    {
+        // "*N\r\n$"
+        size_t i = 1;
+        while (i < len && i < 9 && p[i] >= '0' && p[i] <= '9')
+        {
+            ++i;
+        }
+        if (i == len)
+        {
+            return DISSECT_MORE;
+        }
+        if (i == 1 || p[i] != '\r')
+        {
+            return DISSECT_NO;
+        }
+        if (i + 2 >= len)
+        {
+            return i + 1 == len || p[i + 1] == '\n' ? DISSECT_MORE : DISSECT_NO;
+        }
+        return p[i + 1] == '\n' && p[i + 2] == '$' ? DISSECT_YES : DISSECT_NO;
+    }
+    if (!port_hint)
+    {
+        return DISSECT_NO;
+    }
+    // Inline: имя команды из букв, за ним пробел или конец строки
+    size_t i = 0;
+    while (i < len && i < 20 && ((p[i] | 0x20) >= 'a' && (p[i] | 0x20) <= 'z'))
+    {
+        ++i;
+    }
+    if (i == len)
+    {
+        return len < DISSECT_PEEK ? DISSECT_MORE : DISSECT_NO;
+    }
+    return i > 0 && (p[i] == ' ' || p[i] == '\r' || p[i] == '\n') ? DISSECT_YES : DISSECT_NO;
+}
+
+/*
+ * Дописывает в text кусок аргумента: непечатное — точками
+ */
+static void text_put(redis_flow_t *r, const char *p, size_t n)
+{
+    size_t room = sizeof(r->text) - r->text_len;
+    n = n < room ? n : room;
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char c = (unsigned char)p[i];
+        r->text[r->text_len++] = c >= 0x20 && c < 0x7f ? (char)c : '.';
+    }
+}
+
+static void command_done(redis_flow_t *r, int is_inline, const redis_flow_cb_t *cb, void *ud)
+{
+    redis_command_t cmd;
+    cmd.text      = r->text;
+    cmd.text_len  = r->text_len;
+    cmd.args      = r->args;
+    cmd.len       = r->len;
+    cmd.is_inline = is_inline;
+    r->messages++;
+    cb->on_command(ud, &cmd);
+    r->text_len = 0;
+    r->len      = 0;
+}
+
+static void broken(redis_flow_t *r, const char *what, const redis_flow_cb_t *cb, void *ud)
+{
+    r->state = REDIS_BROKEN;
+    cb->on_error(ud, what);
+}
+
+/*
+ * Строка протокола собрана (без CRLF)
+ */
+static void line_done(redis_flow_t *r, const redis_flow_cb_t *cb, void *ud)
+{
+    const char *p = r->line;
+    size_t      n = r->line_len;
+    if (n > 0 && p[n - 1] == '\r')
+    {
+        --n;
+    }
+
+    if (r->args_left > 0)
+    {
+        long long size = n > 0 && p[0] == '$' ? number(p + 1, n - 1) : -1;
+        if (size < 0)
+        {
+            broken(r, "expected a bulk string", cb, ud);
+            return;
+        }
+        r->bulk_left = (uint64_t)size + 2;
+        r->shown     = 0;
+        r->state     = REDIS_BULK;
+        if (r->text_len > 0)
+        {
+            text_put(r, " ", 1);
+        }
+        return;
+    }
+
+    if (n > 0 && p[0] == '*')
+    {
+        long long args = number(p + 1, n - 1);
+        if (args < 0 || args > REDIS_ARGS_MAX)
+        {
+            broken(r, "bad array length", cb, ud);
+            return;
+        }
+        r->args_left = args;
+        r->args      = (unsigned)args;
+        r->text_len  = 0;
+        return;
+    }
+    if (n == 0)
+    {
+        return;
+    }
+    // Inline-команда: слова через пробел
+    r->args = 1;
+    for (size_t i = 0; i < n; ++i)
+    {
+        r->args += p[i] == ' ' && i + 1 < n && p[i + 1] != ' ';
+    }
+    text_put(r, p, n);
+    command_done(r, 1, cb, ud);
+}
+
+void redis_flow_feed(redis_flow_t *redis, const uint8_t *data, size_t len, int is_client,
+                     const redis_flow_cb_t *cb, void *ud)
+{
+    if (!is_client)
+    {
+        return;
+    }
+
+    while (len > 0)
+    {
+        switch (redis->state)
+        {
+            case REDIS_BROKEN:
+            {
+                return;
+            }
+            case REDIS_LINE:
+            {
+                const uint8_t *nl   = memchr(data, '\n', len);
+                size_t         n    = nl != NULL ? (size_t)(nl - data) : len;
+                size_t         room = sizeof(redis->line) - redis->line_len;
+                // Длинную inline-команду обрезаем; длинный "*N"/"$N" отсеет number
+                memcpy(redis->line + redis->line_len, data, n < room ? n : room);
+                redis->line_len += n < room ? n : room;
+                size_t used = nl != NULL ? n + 1 : n;
+                redis->len += used;
+                data       += used;
+                len        -= used;
+                if (nl == NULL)
+                {
+                    return;
+                }
+                line_done(redis, cb, ud);
+                redis->line_len = 0;
+                break;
+            }
+            case REDIS_BULK:
+            {
+                size_t n = len < redis->bulk_left ? len : (size_t)redis->bulk_left;
+                // Аргумент без CRLF и не больше REDIS_ARG_SHOW
+                uint64_t body = redis->bulk_left > 2 ? redis->bulk_left - 2 : 0;
+                if (redis->shown < REDIS_ARG_SHOW && body > 0)
+                {
+                    size_t c = n < body ? n : (size_t)body;
+                    c = c < REDIS_ARG_SHOW - redis->shown ? c : (size_t)(REDIS_ARG_SHOW - redis->shown);
+                    text_put(redis, (const char *)data, c);
+                    redis->shown += c;
+                    if (redis->shown == REDIS_ARG_SHOW && body > c)
+                    {
+                        text_put(redis, "...", 3);
+                    }
+                }
+                redis->bulk_left -= n;
+                redis->len       += n;
+                data             += n;
+                len              -= n;
+                if (redis->bulk_left == 0)
+                {
+                    redis->state = REDIS_LINE;
+                    if (--redis->args_left == 0)
+                    {
+                        command_done(redis, 0, cb, ud);
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,589 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "scan.h"
+
+
+typedef size_t (*scan_fn_t)(const uint8_t *p, size_t len, size_t i);
+
+typedef void (*unmask_fn_t)(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key);
+
+typedef size_t (*ascii_fn_t)(const uint8_t *p, size_t len);
+
+typedef size_t (*set_fn_t)(const scan_set_t *set, const uint8_t *p, size_t len);
+
+/*
+ * Метод HTTP вместе с пробелом за ним
+ */
+typedef struct scan_method
+{
+    const char  *name;
+    size_t       len;
+} scan_method_t;
+
+
+#define M(s) { s, sizeof(s) - 1 }
+static const scan_method_t methods[] =
+{
+    M("GET "), M("PUT "), M("POST "), M("HEAD "), M("PATCH "), M("TRACE "),
+    M("DELETE "), M("CONNECT "), M("OPTIONS ")
+};
+#undef M
+
+static scan_fn_t    scan_fn   = NULL;
+static unmask_fn_t  unmask_fn = NULL;
+static ascii_fn_t   ascii_fn  = NULL;
+static set_fn_t     set_fn    = NULL;
+static const char  *scan_name = "scalar";
+
+
+/*
+ * Скалярный хвост (и реализация без SIMD): ищем с позиции i
+ */
+static size_t head_end_scalar(const uint8_t *p, size_t len, size_t i)
+{
+    // Ищем '\n' на месте последнего байта разделителя — memchr сам по себе векторный
+    while (i + 4 <= len)
+    {
+        const uint8_t *lf = memchr(p + i + 3, '\n', len - i - 3);
+        if (lf == NULL)
+        {
+            return 0;
+        }
+        size_t at = lf - p;
+        if (lf[-1] == '\r' && lf[-2] == '\n' && lf[-3] == '\r')
+        {
+            return at + 1;
+        }
+        i = at - 2;
+    }
+    return 0;
+}
+
+/*
+ * XOR с 4-байтным ключом; key — байты ключа в порядке памяти, уже с нужной фазой
+ */
+static void unmask_scalar(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, src + i, 4);
+        w ^= key;
+        memcpy(dst + i, &w, 4);
+    }
+    uint8_t k[4];
+    memcpy(k, &key, 4);
+    for (size_t j = 0; i < len; ++i, ++j)
+    {
+        dst[i] = src[i] ^ k[j];
+    }
+}
+
+static size_t ascii_scalar(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if (w & 0x8080808080808080ULL)
+        {
+            break;
+        }
+    }
+    while (i < len && p[i] < 0x80)
+    {
+        ++i;
+    }
+    return i;
+}
+
+static int pair_in(const scan_set_t *set, uint8_t a, uint8_t b)
+{
+    unsigned k = (unsigned)a << 8 | b;
+    return set->pairs[k >> 3] >> (k & 7) & 1;
+}
+
+static size_t set_scalar(const scan_set_t *set, const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 1 < len; ++i)
+    {
+        if (set->first[p[i]] && pair_in(set, p[i], p[i + 1]))
+        {
+            return i;
+        }
+    }
+    return i < len && set->first[p[i]] ? i : len;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Кандидаты из маски: бит k — позиция i + k, где первый (и, может, второй) байт
+ * похож на начало пары; точную проверку делает pairs
+ */
+static size_t set_check(const scan_set_t *set, const uint8_t *p, size_t i, uint32_t mask)
+{
+    while (mask != 0)
+    {
+        size_t at = i + (size_t)__builtin_ctz(mask);
+        if (pair_in(set, p[at], p[at + 1]))
+        {
+            return at;
+        }
+        mask &= mask - 1;
+    }
+    return (size_t)-1;
+}
+
+/*
+ * Кандидаты из маски: бит k — позиция i + k, где уже совпали '\r' и '\n' через три байта.
+ * Середину "\n\r" досматриваем скалярно — в заголовках такие кандидаты почти всегда настоящие
+ */
+static size_t head_end_check(const uint8_t *p, size_t i, uint64_t mask)
+{
+    while (mask != 0)
+    {
+        size_t at = i + (size_t)__builtin_ctzll(mask);
+        if (p[at + 1] == '\n' && p[at + 2] == '\r')
+        {
+            return at + 4;
+        }
+        mask &= mask - 1;
+    }
+    return 0;
+}
+
+/*
+ * SSE2: 16 позиций за шаг. Сравниваем только крайние байты разделителя
+ * (p[i] == '\r' и p[i + 3] == '\n') — две загрузки вместо четырёх
+ */
+static size_t head_end_sse2(const uint8_t *p, size_t len, size_t i)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for (; i + 16 + 3 <= len; i += 16)
+    {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), cr);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 3)), lf);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(a, d));
+        size_t   end  = mask != 0 ? head_end_check(p, i, mask) : 0;
+        if (end != 0)
+        {
+            return end;
+        }
+    }
+    return head_end_scalar(p, len, i);
+}
+
+/*
+ * AVX2: то же по 64 позиции за шаг (две пары загрузок, одна ветка на шаг)
+ */
+__attribute__((target("avx2")))
+static size_t head_end_avx2(const uint8_t *p, size_t len, size_t i)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for (; i + 64 + 3 <= len; i += 64)
+    {
+        __m256i a0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), cr);
+        __m256i d0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 3)), lf);
+        __m256i a1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 32)), cr);
+        __m256i d1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 35)), lf);
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(a0, d0))
+                      | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_and_si256(a1, d1)) << 32;
+        size_t   end  = mask != 0 ? head_end_check(p, i, mask) : 0;
+        if (end != 0)
+        {
+            return end;
+        }
+    }
+    return head_end_sse2(p, len, i);
+}
+
+static void unmask_sse2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    const __m128i k = _mm_set1_epi32((int)key);
+    size_t        i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+    }
+    // Шаг кратен 4 — фаза ключа для хвоста та же
+    unmask_scalar(dst + i, src + i, len - i, key);
+}
+
+__attribute__((target("avx2")))
+static void unmask_avx2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    const __m256i k = _mm256_set1_epi32((int)key);
+    size_t        i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, k));
+    }
+    unmask_sse2(dst + i, src + i, len - i, key);
+}
+
+static size_t ascii_sse2(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + ascii_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_avx2(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        if (_mm256_movemask_epi8(_mm256_or_si256(a, b)) != 0)
+        {
+            break;
+        }
+    }
+    return i + ascii_sse2(p + i, len - i);
+}
+
+/*
+ * SSE2: без pshufb shufti не сделать — векторно только прямое сравнение
+ * первого байта с маленьким множеством (bytes дополнен повтором первого)
+ */
+static size_t set_sse2(const scan_set_t *set, const uint8_t *p, size_t len)
+{
+    if (set->nbytes > SCAN_SET_EQ)
+    {
+        return set_scalar(set, p, len);
+    }
+    const __m128i b0 = _mm_set1_epi8((char)set->bytes[0]);
+    const __m128i b1 = _mm_set1_epi8((char)set->bytes[1]);
+    const __m128i b2 = _mm_set1_epi8((char)set->bytes[2]);
+    size_t        i  = 0;
+    for (; i + 16 + 1 <= len; i += 16)
+    {
+        __m128i  v    = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i  eq   = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, b0), _mm_cmpeq_epi8(v, b1)),
+                                     _mm_cmpeq_epi8(v, b2));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        size_t   at   = mask != 0 ? set_check(set, p, i, mask) : (size_t)-1;
+        if (at != (size_t)-1)
+        {
+            return at;
+        }
+    }
+    return i + set_scalar(set, p + i, len - i);
+}
+
+/*
+ * Корзины shufti для 32 байтов: ненулевой байт результата — кандидат
+ */
+__attribute__((target("avx2")))
+static inline __m256i shufti_avx2(__m256i v, __m256i lo, __m256i hi)
+{
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    return _mm256_and_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nib)),
+                            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+}
+
+/*
+ * AVX2: второй байт пары — shufti по сдвинутой на байт загрузке; первый —
+ * прямое сравнение, если первых байтов мало, иначе тоже shufti
+ */
+__attribute__((target("avx2")))
+static size_t set_avx2(const scan_set_t *set, const uint8_t *p, size_t len)
+{
+    const __m256i lo0  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo[0]));
+    const __m256i hi0  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->hi[0]));
+    const __m256i lo1  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo[1]));
+    const __m256i hi1  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->hi[1]));
+    const __m256i b0   = _mm256_set1_epi8((char)set->bytes[0]);
+    const __m256i b1   = _mm256_set1_epi8((char)set->bytes[1]);
+    const __m256i b2   = _mm256_set1_epi8((char)set->bytes[2]);
+    const __m256i zero = _mm256_setzero_si256();
+    const int     eq   = set->nbytes <= SCAN_SET_EQ;
+    size_t        i    = 0;
+
+    for (; i + 32 + 1 <= len; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 1));
+        __m256i second = _mm256_cmpeq_epi8(shufti_avx2(b, lo1, hi1), zero);
+        __m256i first;
+        if (eq)
+        {
+            first = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(a, b0), _mm256_cmpeq_epi8(a, b1)),
+                                    _mm256_cmpeq_epi8(a, b2));
+        }
+        else
+        {
+            first = _mm256_xor_si256(_mm256_cmpeq_epi8(shufti_avx2(a, lo0, hi0), zero), _mm256_set1_epi8(-1));
+        }
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(second, first));
+        size_t   at   = mask != 0 ? set_check(set, p, i, mask) : (size_t)-1;
+        if (at != (size_t)-1)
+        {
+            return at;
+        }
+    }
+    return i + set_scalar(set, p + i, len - i);
+}
+
+#endif
+
+/*
+ * Реализации от лучшей к худшей: scan_init берёт первую, которую умеет CPU
+ */
+typedef struct scan_impl
+{
+    const char   *name;
+    scan_fn_t     head_end;
+    unmask_fn_t   unmask;
+    ascii_fn_t    ascii;
+    set_fn_t      set;
+} scan_impl_t;
+
+static const scan_impl_t impls[] =
+{
+#ifdef SCAN_X86
+    { "avx2",   head_end_avx2,   unmask_avx2,   ascii_avx2,   set_avx2   },
+    { "sse2",   head_end_sse2,   unmask_sse2,   ascii_sse2,   set_sse2   },
+#endif
+    { "scalar", head_end_scalar, unmask_scalar, ascii_scalar, set_scalar }
+};
+
+static int impl_supported(const scan_impl_t *impl)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(impl->name, "avx2") == 0)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    // SSE2 есть на любом x86_64
+    if (strcmp(impl->name, "sse2") == 0)
+    {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return 1;
+}
+
+static void impl_use(const scan_impl_t *impl)
+{
+    scan_fn   = impl->head_end;
+    unmask_fn = impl->unmask;
+    ascii_fn  = impl->ascii;
+    set_fn    = impl->set;
+    scan_name = impl->name;
+}
+
+void scan_init(void)
+{
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i)
+    {
+        if (impl_supported(&impls[i]))
+        {
+            impl_use(&impls[i]);
+            return;
+        }
+    }
+}
+
+int scan_select(const char *name)
+{
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i)
+    {
+        if (strcmp(impls[i].name, name) == 0)
+        {
+            if (!impl_supported(&impls[i]))
+            {
+                return -1;
+            }
+            impl_use(&impls[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *scan_impl_name(void)
+{
+    return scan_name;
+}
+
+size_t scan_head_end(const uint8_t *p, size_t len, size_t from)
+{
+    // Разделитель мог начаться в последних трёх уже просмотренных байтах
+    size_t i = from > 3 ? from - 3 : 0;
+    if (len < 4 || i + 4 > len)
+    {
+        return 0;
+    }
+    return (scan_fn != NULL ? scan_fn : head_end_scalar)(p, len, i);
+}
+
+void scan_unmask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4], size_t phase)
+{
+    // Поворачиваем ключ так, чтобы dst[0] шёл с key[phase % 4]
+    uint8_t  k[4] = { key[phase & 3], key[(phase + 1) & 3], key[(phase + 2) & 3], key[(phase + 3) & 3] };
+    uint32_t w;
+    memcpy(&w, k, 4);
+    (unmask_fn != NULL ? unmask_fn : unmask_scalar)(dst, src, len, w);
+}
+
+size_t scan_ascii(const uint8_t *p, size_t len)
+{
+    return (ascii_fn != NULL ? ascii_fn : ascii_scalar)(p, len);
+}
+
+void scan_set_init(scan_set_t *set)
+{
+    memset(set, 0, sizeof(*set));
+    // Корзина байта — старший полубайт & 7: hi от множества не зависит, решает lo
+    for (int h = 0; h < 16; ++h)
+    {
+        set->hi[0][h] = set->hi[1][h] = (uint8_t)(1u << (h & 7));
+    }
+}
+
+/*
+ * Байт b в таблицы shufti k
+ */
+static void shufti_add(scan_set_t *set, int k, uint8_t b)
+{
+    set->lo[k][b & 0x0f] |= (uint8_t)(1u << ((b >> 4) & 7));
+}
+
+void scan_set_add(scan_set_t *set, uint8_t a, int b)
+{
+    if (!set->first[a])
+    {
+        set->first[a] = 1;
+        shufti_add(set, 0, a);
+        if (set->nbytes < SCAN_SET_EQ)
+        {
+            // Пустые места сравнения — повтор последнего байта, лишних совпадений они не дают
+            for (unsigned k = set->nbytes; k < SCAN_SET_EQ; ++k)
+            {
+                set->bytes[k] = a;
+            }
+        }
+        set->nbytes++;
+    }
+    for (int c = b < 0 ? 0 : b; c <= (b < 0 ? 255 : b); ++c)
+    {
+        unsigned k = (unsigned)a << 8 | (unsigned)c;
+        set->pairs[k >> 3] |= (uint8_t)(1u << (k & 7));
+        shufti_add(set, 1, (uint8_t)c);
+    }
+}
+
+size_t scan_set_find(const scan_set_t *set, const uint8_t *p, size_t len)
+{
+    if (set->nbytes == 0)
+    {
+        return len;
+    }
+    return (set_fn != NULL ? set_fn : set_scalar)(set, p, len);
+}
+
+/*
+ * Совпадает ли начало p с s на доступной длине: 1 — целиком, 0 — префикс (мало байт), -1 — нет
+ */
+static int prefix_match(const uint8_t *p, size_t len, const char *s, size_t slen)
+{
+    size_t n = len < slen ? len : slen;
+    if (memcmp(p, s, n) != 0)
+    {
+        return -1;
+    }
+    return n == slen;
+}
+
+static int is_digit(uint8_t c)
+{
+    return c >= '0' && c <= '9';
+}
+
+scan_http_t scan_http_start(const uint8_t *p, size_t len)
+{
+    if (len == 0)
+    {
+        return SCAN_HTTP_MORE;
+    }
+    // Методы и "HTTP" начинаются с заглавной буквы — остальное отсекаем сразу
+    if (p[0] < 'C' || p[0] > 'T')
+    {
+        return SCAN_HTTP_NO;
+    }
+
+    if (p[0] == 'H' && len > 1 && p[1] == 'T')
+    {
+        // Status-line: HTTP/1.x SP 3DIGIT
+        int m = prefix_match(p, len, "HTTP/1.", 7);
+        if (m < 0)
+        {
+            return SCAN_HTTP_NO;
+        }
+        for (size_t i = 7; i < 12; ++i)
+        {
+            if (i >= len)
+            {
+                return SCAN_HTTP_MORE;
+            }
+            // Минорная версия, пробел, три цифры кода
+            int ok = i == 8 ? p[i] == ' ' : is_digit(p[i]);
+            if (!ok)
+            {
+                return SCAN_HTTP_NO;
+            }
+        }
+        return SCAN_HTTP_RESPONSE;
+    }
+
+    int more = 0;
+    for (size_t k = 0; k < sizeof(methods) / sizeof(methods[0]); ++k)
+    {
+        if (methods[k].name[0] != (char)p[0])
+        {
+            continue;
+        }
+        int m = prefix_match(p, len, methods[k].name, methods[k].len);
+        if (m == 0)
+        {
+            more = 1;
+        }
+        else if (m > 0)
+        {
+            // За методом — request-target: '/', '*' или authority/absolute-URI, не пробел и не управляющий
+            if (len == methods[k].len)
+            {
+                return SCAN_HTTP_MORE;
+            }
+            uint8_t t = p[methods[k].len];
+            return t > ' ' && t < 0x7f ? SCAN_HTTP_REQUEST : SCAN_HTTP_NO;
+        }
+    }
+    return more ? SCAN_HTTP_MORE : SCAN_HTTP_NO;
+}
@@ -8,14 +8,17 @@
 #include <netinet/in.h>    // sockaddr_in и родственные типы
 #include <sys/epoll.h>     // epoll_create, epoll_ctl, epoll_wait
 #include <stdlib.h>        // exit, freeaddrinfo
+#include <time.h>          // clock_gettime для таймеров
 
 #include "sock.h"          // обёртки для неблокирующих сокетов
 #include "logger.h"        // логгирование
 #include "server.h"        // заголовок модуля сервера
 #include "tunnel.h"        // создание и управление туннелем SOCKS5
+#include "metrics.h"       // счётчики для /metrics
 
 #define MAX_EPOLL_EVENTS 64
 #define BLACKLOG         1024
+#define MAX_TIMERS       16
 
 // Глобальная структура сервера
 server_t SERVER;
@@ -24,14 +27,97 @@ server_t SERVER;
 typedef struct epoll_event epoll_event_t;
 typedef struct addrinfo      addrinfo_t;
 
+/*
+ * Периодический таймер event-цикла
+ */
+typedef struct server_timer
+{
+    timer_cb           *cb;        // Что дёргаем
+    void               *ud;        // Контекст для cb
+    unsigned long long  interval;  // Период, мс
+    unsigned long long  deadline;  // Когда сработать в следующий раз
+} server_timer_t;
+
+static server_timer_t timers[MAX_TIMERS];
+static int            ntimers = 0;
+
+
+/*
+ * Монотонные миллисекунды, на системное время не завязаны
+ */
+unsigned long long server_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000ULL;
+}
+
+/*
+ * Регистрация периодического таймера
+ */
+int server_timer_add(int interval_ms, timer_cb *cb, void *ud)
+{
+    if (ntimers >= MAX_TIMERS || interval_ms <= 0)
+    {
+        LOG_ERROR("Failed server_timer_add, ntimers=%d interval=%d", ntimers, interval_ms);
+        return -1;
+    }
+    timers[ntimers].cb       = cb;
+    timers[ntimers].ud       = ud;
+    timers[ntimers].interval = interval_ms;
+    timers[ntimers].deadline = server_now_ms() + interval_ms;
+    ++ntimers;
+    return 0;
+}
+
+/*
+ * Сколько можно спать в epoll_wait до ближайшего таймера (-1 — таймеров нет)
+ */
+static int timers_timeout(void)
+{
+    if (ntimers == 0)
+    {
+        return -1;
+    }
+    unsigned long long now     = server_now_ms();
+    unsigned long long nearest = timers[0].deadline;
+    for (int i = 1; i < ntimers; ++i)
+    {
+        if (timers[i].deadline < nearest)
+        {
+            nearest = timers[i].deadline;
+        }
+    }
+    return nearest <= now ? 0 : (int)(nearest - now);
+}
+
+/*
+ * Дёргаем все таймеры, у которых подошёл дедлайн
+ */
+static void timers_run(void)
+{
+    unsigned long long now = server_now_ms();
+    for (int i = 0; i < ntimers; ++i)
+    {
+        if (timers[i].deadline <= now)
+        {
+            timers[i].deadline = now + timers[i].interval;
+            timers[i].cb(timers[i].ud);
+        }
+    }
+}
+
 
 /*
  * Вспомогательная функция: обработка нового входящего соединения
  */
 static void accept_handle(void)
 {
-    // Принимаем новое соединение без получения адреса клиента
-    int newfd = accept(SERVER.listenfd, NULL, NULL);
+    // Принимаем новое соединение; адрес клиента пойдёт в access-запись туннеля
+    struct sockaddr_storage peer;
+    socklen_t               peer_len = sizeof(peer);
+    int newfd = accept(SERVER.listenfd, (struct sockaddr *)&peer, &peer_len);
+    metrics_add(METRIC_SYS_ACCEPT, 1);
     if (newfd < 0)
     {
         // В случае ошибки логируем и выходим из функции, но всё ещё продолжаем работу сервера
@@ -40,10 +126,11 @@ static void accept_handle(void)
         return;
     }
 
+    metrics_add(METRIC_ACCEPTS, 1);
     // Логируем успешное принятие нового клиента
     LOG_INFO("New client connection accepted: fd=%d", newfd);
     // Создаём новый объект туннеля, который будет обрабатывать SOCKS5 для этого клиента
-    tunnel_create(newfd);
+    tunnel_create(newfd, (struct sockaddr *)&peer);
 }
 
 /*
@@ -85,8 +172,14 @@ int server_start(void)
     // Бесконечный цикл ожидания событий
     while (true)
     {
-        // Ожидаем события (блокирующий вызов)
-        int n = epoll_wait(SERVER.epollfd, events, MAX_EPOLL_EVENTS, -1);
+        // Ожидаем события (блокирующий вызов, но не дольше ближайшего таймера)
+        int n = epoll_wait(SERVER.epollfd, events, MAX_EPOLL_EVENTS, timers_timeout());
+        metrics_add(METRIC_SYS_EPOLL_WAIT, 1);
+        if (n >= 0)
+        {
+            metrics_add(METRIC_EPOLL_WAKEUPS, 1);
+            metrics_add(METRIC_EPOLL_EVENTS, (unsigned long long)n);
+        }
         // Если произошла ошибка, отличная от прерывания, завершаем с ошибкой
         if (n < 0 && errno != EINTR)
         {
@@ -102,6 +195,12 @@ int server_start(void)
             int   current_fd = *(int *)ud;
             int   ev         = events[i].events;
 
+            // Сокет могли закрыть обработчики раньше в этой же пачке — событие протухло
+            if (ud != &SERVER.listenfd && ((sock_t *)ud)->state == sock_closed)
+            {
+                continue;
+            }
+
             // Обработка готовности на чтение
             if (ev & EPOLLIN)
             {
@@ -112,15 +211,21 @@ int server_start(void)
                 }
                 else
                 {
-                    // Иначе передаём управление туннелю клиента
-                    tunnel_read_handle(current_fd, ud);
+                    // Иначе передаём управление хэндлеру сокета (обычно туннель клиента)
+                    ((sock_t *)ud)->read_handle(current_fd, ud);
                 }
             }
             // Обработка готовности на запись
             else if (ev & EPOLLOUT)
             {
-                // Передаём событие записи туннелю
-                tunnel_write_handle(current_fd, ud);
+                // Передаём событие записи хэндлеру сокета
+                ((sock_t *)ud)->write_handle(current_fd, ud);
+            }
+            // Ошибка или обрыв без EPOLLIN/EPOLLOUT: сокет на паузе (заморозка, окно
+            // мультиплексора) чтения не слушает, а epoll сообщает об обрыве снова и снова
+            else if ((ev & (EPOLLERR | EPOLLHUP)) && ud != &SERVER.listenfd)
+            {
+                sock_hangup((sock_t *)ud);
             }
             else
             {
@@ -128,6 +233,12 @@ int server_start(void)
                 LOG_ERROR("Unexpected epoll events: 0x%x on fd=%d", ev, current_fd);
             }
         }
+
+        // Крутим периодические таймеры (пулы, health-check'и и т.д.)
+        timers_run();
+
+        // Теперь ссылок на закрытые сокеты в массиве событий не осталось
+        sock_reap();
     }
 
     // Код не достижим, но возвращаем 0 для полноты
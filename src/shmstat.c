@@ -0,0 +1,224 @@
+#include "shmstat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+#include "stats.h"
+#include "logger.h"
+
+
+#define SHMSTAT_PERIOD_MAX_MS  1000  // Реже публиковать смысла нет — есть /metrics
+
+/*
+ * Поля сегмента по порядку: сначала metric_t как есть, потом своё
+ */
+enum
+{
+    FIELD_CONNECT_SUM_US = METRIC_COUNT,
+    FIELD_CONNECT_COUNT,
+    FIELD_OPENED,
+    FIELD_CLOSED,
+    FIELD_RX_CLIENT,
+    FIELD_RX_REMOTE,
+    FIELD_STATE_FIRST,  // Гейджи туннелей по состояниям, open_state..connected_state
+    FIELD_BUFFER_MEM = FIELD_STATE_FIRST + connected_state + 1,
+    FIELD_COUNT
+};
+
+_Static_assert(FIELD_COUNT <= SHMSTAT_FIELDS_MAX, "shmstat: too many fields");
+
+static const char *metric_names[METRIC_COUNT] = {
+    [METRIC_ACCEPTS]             = "accepts",
+    [METRIC_HANDSHAKE_OK]        = "handshake_ok",
+    [METRIC_HANDSHAKE_AUTH]      = "handshake_auth_failed",
+    [METRIC_HANDSHAKE_PROTOCOL]  = "handshake_protocol_error",
+    [METRIC_HANDSHAKE_CONNECT]   = "handshake_connect_failed",
+    [METRIC_HANDSHAKE_ABANDONED] = "handshake_abandoned",
+    [METRIC_BYTES_TO_REMOTE]     = "bytes_to_remote",
+    [METRIC_BYTES_TO_CLIENT]     = "bytes_to_client",
+    [METRIC_DNS_OK]              = "dns_ok",
+    [METRIC_DNS_ERROR]           = "dns_error",
+    [METRIC_DNS_CACHE_HIT]       = "dns_cache_hit",
+    [METRIC_DNS_CACHE_MISS]      = "dns_cache_miss",
+    [METRIC_EPOLL_WAKEUPS]       = "epoll_wakeups",
+    [METRIC_EPOLL_EVENTS]        = "epoll_events",
+    [METRIC_SYS_READ]            = "sys_read",
+    [METRIC_SYS_WRITE]           = "sys_write",
+    [METRIC_SYS_ACCEPT]          = "sys_accept",
+    [METRIC_SYS_CONNECT]         = "sys_connect",
+    [METRIC_SYS_EPOLL_CTL]       = "sys_epoll_ctl",
+    [METRIC_SYS_EPOLL_WAIT]      = "sys_epoll_wait",
+};
+
+static const char *state_names[] = {"tunnels_open", "tunnels_auth", "tunnels_request", "tunnels_connecting",
+                                    "tunnels_connected"};
+
+static shmstat_segment_t *segment;
+static char               segment_path[64];
+static long               period_ns;
+
+
+static unsigned long long shmstat_now_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+static void field_set(int i, const char *name, shmstat_kind_t kind)
+{
+    snprintf(segment->field[i].name, SHMSTAT_NAME, "%s", name);
+    segment->field[i].kind = kind;
+}
+
+/*
+ * Снимает счётчики и переписывает значения сегмента. Писатель один — этот поток
+ */
+static void shmstat_publish(void)
+{
+    metrics_sum_t      sum;
+    stats_summary_t    summary;
+    unsigned long long value[FIELD_COUNT];
+
+    metrics_sum(&sum);
+    stats_summary(&summary);
+
+    memcpy(value, sum.counter, sizeof(sum.counter));
+    value[FIELD_CONNECT_SUM_US] = sum.connect_sum_us;
+    value[FIELD_CONNECT_COUNT]  = 0;
+    for (int i = 0; i <= METRICS_BUCKETS; ++i)
+    {
+        value[FIELD_CONNECT_COUNT] += sum.connect_bucket[i];
+    }
+    value[FIELD_OPENED]    = summary.opened;
+    value[FIELD_CLOSED]    = summary.closed;
+    value[FIELD_RX_CLIENT] = summary.rx[1];
+    value[FIELD_RX_REMOTE] = summary.rx[0];
+    for (int state = open_state; state <= connected_state; ++state)
+    {
+        value[FIELD_STATE_FIRST + state] = summary.states[state];
+    }
+    value[FIELD_BUFFER_MEM] = summary.buffer_mem > 0 ? (unsigned long long)summary.buffer_mem : 0;
+
+    // seqlock: нечётный seq — читатель повторит попытку
+    unsigned seq = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+    atomic_store_explicit(&segment->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < FIELD_COUNT; ++i)
+    {
+        segment->value[i] = value[i];
+    }
+    segment->now_us = shmstat_now_us(CLOCK_MONOTONIC);
+    ++segment->publishes;
+    atomic_store_explicit(&segment->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * Поток публикации: сон до следующей границы периода, без дрейфа.
+ * Приоритет обычный — работы на микросекунды, а с nice он отставал бы
+ * как раз тогда, когда прокси занят и на него смотрят
+ */
+static void *shmstat_thread(void *arg)
+{
+    struct timespec next;
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (;;)
+    {
+        shmstat_publish();
+        next.tv_nsec += period_ns;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            ++next.tv_sec;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+        {
+        }
+    }
+    return NULL;
+}
+
+static void shmstat_atexit(void)
+{
+    unlink(segment_path);
+}
+
+int shmstat_init(int period_ms)
+{
+    if (period_ms < 1 || period_ms > SHMSTAT_PERIOD_MAX_MS)
+    {
+        LOG_ERROR("Shared stats: period must be 1..%d ms", SHMSTAT_PERIOD_MAX_MS);
+        return -1;
+    }
+    period_ns = (long)period_ms * 1000000L;
+    snprintf(segment_path, sizeof(segment_path), SHMSTAT_PATH, (int)getpid());
+
+    // Файл с нашим pid мог остаться от давно упавшего процесса — он уже ничей
+    unlink(segment_path);
+    int fd = open(segment_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+    if (fd < 0 || ftruncate(fd, sizeof(shmstat_segment_t)) < 0)
+    {
+        LOG_ERROR("Shared stats: cannot create %s: %s", segment_path, strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(segment_path);
+        }
+        return -1;
+    }
+    segment = mmap(NULL, sizeof(shmstat_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        LOG_ERROR("Shared stats: mmap %s: %s", segment_path, strerror(errno));
+        unlink(segment_path);
+        return -1;
+    }
+    atexit(shmstat_atexit);
+
+    // Файл после ftruncate уже нулевой: заполняем заголовок, magic — последним
+    segment->version   = SHMSTAT_VERSION;
+    segment->size      = sizeof(shmstat_segment_t);
+    segment->pid       = getpid();
+    segment->start_us  = shmstat_now_us(CLOCK_REALTIME);
+    segment->period_us = (uint32_t)period_ms * 1000u;
+    segment->nfields   = FIELD_COUNT;
+    for (int i = 0; i < METRIC_COUNT; ++i)
+    {
+        field_set(i, metric_names[i], SHMSTAT_COUNTER);
+    }
+    field_set(FIELD_CONNECT_SUM_US, "connect_us_sum", SHMSTAT_COUNTER);
+    field_set(FIELD_CONNECT_COUNT, "connect_count", SHMSTAT_COUNTER);
+    field_set(FIELD_OPENED, "tunnels_opened", SHMSTAT_COUNTER);
+    field_set(FIELD_CLOSED, "tunnels_closed", SHMSTAT_COUNTER);
+    field_set(FIELD_RX_CLIENT, "rx_client", SHMSTAT_COUNTER);
+    field_set(FIELD_RX_REMOTE, "rx_remote", SHMSTAT_COUNTER);
+    for (int state = open_state; state <= connected_state; ++state)
+    {
+        field_set(FIELD_STATE_FIRST + state, state_names[state], SHMSTAT_GAUGE);
+    }
+    field_set(FIELD_BUFFER_MEM, "buffer_mem", SHMSTAT_GAUGE);
+    shmstat_publish();
+    atomic_thread_fence(memory_order_release);
+    memcpy(segment->magic, SHMSTAT_MAGIC, sizeof(segment->magic));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, shmstat_thread, NULL) != 0)
+    {
+        LOG_ERROR("Shared stats: failed to launch thread");
+        return -1;
+    }
+    pthread_detach(thread);
+    LOG_INFO("Shared stats in %s every %d ms", segment_path, period_ms);
+    return 0;
+}
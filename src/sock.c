@@ -11,12 +11,17 @@
 #include "sock.h"
 #include "logger.h"
 #include "server.h"
+#include "freeze.h"
+#include "metrics.h"
 
 #define INIT_BUFF_CAP 1024  // Стартовый размер буферов для чтения/записи
 
 
 typedef struct epoll_event epoll_event_t;
 
+// Закрытые, но ещё не освобождённые сокеты (см. sock_reap)
+static sock_t *closed_socks = NULL;
+
 
 /*
  * Добавляет сокет в epoll-инстанс сервера для отслеживания события чтения
@@ -26,6 +31,7 @@ int epoll_add(sock_t *sock)
     epoll_event_t event;
     event.events   = EPOLLIN;     // Событие «готовность к чтению»
     event.data.ptr = sock;        // В user data сохраняем указатель на сокет
+    metrics_add(METRIC_SYS_EPOLL_CTL, 1);
     return epoll_ctl(SERVER.epollfd, EPOLL_CTL_ADD, sock->fd, &event);
 }
 
@@ -35,6 +41,7 @@ int epoll_add(sock_t *sock)
 static int epoll_del(const sock_t *sock)
 {
     epoll_event_t event;
+    metrics_add(METRIC_SYS_EPOLL_CTL, 1);
     return epoll_ctl(SERVER.epollfd, EPOLL_CTL_DEL, sock->fd, &event);
 }
 
@@ -45,10 +52,37 @@ int epoll_modify(sock_t *sock, int writable, int readable)
 {
     epoll_event_t event;
     event.data.ptr = sock;
-    event.events   = (writable ? EPOLLOUT : 0) | (readable ? EPOLLIN : 0);
+    event.events   = (writable ? EPOLLOUT : 0) | (readable && !sock->paused ? EPOLLIN : 0);
+    metrics_add(METRIC_SYS_EPOLL_CTL, 1);
     return epoll_ctl(SERVER.epollfd, EPOLL_CTL_MOD, sock->fd, &event);
 }
 
+/*
+ * Интерес к записи, который сейчас нужен сокету: есть что дописать или ждём connect
+ */
+static int sock_wants_write(const sock_t *sock)
+{
+    return buffer_readable(sock->write_buffer) > 0 || sock->state == sock_connecting;
+}
+
+/*
+ * Пауза чтения по причине reason
+ */
+void sock_pause(sock_t *sock, int reason)
+{
+    sock->paused |= reason;
+    epoll_modify(sock, sock_wants_write(sock), 0);
+}
+
+/*
+ * Снятие паузы по причине reason
+ */
+void sock_resume(sock_t *sock, int reason)
+{
+    sock->paused &= ~reason;
+    epoll_modify(sock, sock_wants_write(sock), sock->state != sock_halfclosed);
+}
+
 /*
  * Создаёт и инициализирует структуру sock_t, выделяя буферы
  */
@@ -93,21 +127,41 @@ sock_t* sock_create(int fd, sock_state_t state, int is_client, tunnel_t *tunnel)
 }
 
 /*
- * Вспомогательная функция полного освобождения sock_t и связанных ресурсов
+ * Полное освобождение sock_t и связанных ресурсов
  */
-static void sock_release(sock_t *sock)
+void sock_release(sock_t *sock)
 {
     // Логируем закрытие сокета
-    LOG_INFO("Closed and released sock fd=%d", sock->fd);
+    LOG_DEBUG("Closed and released sock fd=%d", sock->fd);
 
-    tunnel_t *tunnel = sock->tunnel;
+    tunnel_t *tunnel    = sock->tunnel;
+    int       is_client = sock->is_client;
+
+    if (sock->paused & SOCK_PAUSE_FREEZE)
+    {
+        freeze_forget(sock);
+    }
 
     // Освобождаем внутренние буферы
     buffer_release(sock->write_buffer);
     buffer_release(sock->read_buffer);
 
+    // Удаляем дескриптор из epoll и закрываем его. Саму структуру освободит sock_reap —
+    // в текущей пачке epoll-событий на неё ещё могут ссылаться
+    epoll_del(sock);
+    close(sock->fd);
+    sock->state       = sock_closed;
+    sock->next_closed = closed_socks;
+    closed_socks      = sock;
+
+    // Сокет вне туннеля (пул и т.п.) — больше чистить нечего
+    if (tunnel == NULL)
+    {
+        return;
+    }
+
     // Обнуляем указатель в структуре туннеля
-    if (sock->is_client)
+    if (is_client)
     {
         tunnel->client_sock = NULL;
     }
@@ -116,11 +170,6 @@ static void sock_release(sock_t *sock)
         tunnel->remote_sock = NULL;
     }
 
-    // Удаляем дескриптор из epoll и закрываем его
-    epoll_del(sock);
-    close(sock->fd);
-    free(sock);
-
     // Если оба сокета туннеля закрыты, освобождаем сам туннель
     if (tunnel->remote_sock == NULL && tunnel->client_sock == NULL)
     {
@@ -128,6 +177,19 @@ static void sock_release(sock_t *sock)
     }
 }
 
+/*
+ * Добиваем сокеты, закрытые за прошедшую пачку событий
+ */
+void sock_reap(void)
+{
+    while (closed_socks != NULL)
+    {
+        sock_t *sock = closed_socks;
+        closed_socks = sock->next_closed;
+        free(sock);
+    }
+}
+
 /*
  * Принудительное немедленное закрытие соединения и очистка ресурсов
  */
@@ -137,6 +199,16 @@ void sock_force_shutdown(sock_t *sock)
     sock_release(sock);
 }
 
+void sock_hangup(sock_t *sock)
+{
+    if (sock->tunnel != NULL)
+    {
+        tunnel_close_reason(sock->tunnel, close_read_error);
+    }
+    // sock_release заодно вынимает сокет из списка замороженных
+    sock_force_shutdown(sock);
+}
+
 /*
  * Полухлопок соединения: прекращаем чтение, форвардим остаток и закрываем при пустом буфере
  */
@@ -145,21 +217,15 @@ void sock_shutdown(sock_t *sock)
     // Переводим состояние в полузакрытое
     sock->state = sock_halfclosed;
 
-    LOG_INFO("Half-closing fd=%d", sock->fd);
+    LOG_DEBUG("Half-closing fd=%d", sock->fd);
 
     tunnel_t *tunnel = sock->tunnel;
 
     // Если туннель уже в состоянии connected, форвардим накопленные данные
-    if (tunnel->state == connected_state)
+    // (в сокет другой стороны или в стрим мультиплексора)
+    if (tunnel->state == connected_state && buffer_readable(sock->read_buffer) > 0)
     {
-        if (sock->is_client && tunnel->remote_sock)
-        {
-            buffer_concat(tunnel->remote_sock->write_buffer, sock->read_buffer);
-        }
-        else if (tunnel->client_sock)
-        {
-            buffer_concat(tunnel->client_sock->write_buffer, sock->read_buffer);
-        }
+        tunnel_forward(tunnel, sock->is_client);
     }
 
     // Определяем, остались ли данные для записи
@@ -169,11 +235,12 @@ void sock_shutdown(sock_t *sock)
         // Если да, переключаем epoll на отслеживание записи
         epoll_modify(sock, 1, 0);
     }
-    else
+    else if (!(sock->paused & SOCK_PAUSE_WINDOW))
     {
         // Если буфер пуст, закрываем сразу
         sock_force_shutdown(sock);
     }
+    // На паузе по окну стрима: хвост read_buffer ещё не отправлен, закроет WINDOW (mux.c)
 }
 
 /*
@@ -0,0 +1,502 @@
+/*
+ * cliproxy-stat: живые скорости прокси из сегмента статистики (CLIProxyServer -G),
+ * без сокетов и без участия потоков сервера — только чтение разделяемой памяти.
+ *
+ *   cliproxy-stat [-i мс] [-r мс] [-n строк] [-a] [pid | путь]
+ *     -i  строка раз в столько мс (по умолчанию 1000)
+ *     -r  шаг замера пиков, мс (по умолчанию — период публикации сервера)
+ *     -n  выйти после стольких строк
+ *     -a  вывести все поля сегмента один раз и выйти
+ *
+ * Без pid берётся единственный /dev/shm/cliproxy.*. В строке — средние скорости
+ * за интервал и пики (^) по шагам -r: всплеск на 10 мс не размазывается по секунде.
+ */
+#define _GNU_SOURCE  // kill, localtime_r, sched_yield при -std=c11
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmstat.h"
+
+
+#define STAT_HEADER_EVERY  20    // Повтор шапки на терминале, строк
+#define STAT_READ_SPINS    1000  // Попыток прочитать под seqlock'ом до sched_yield
+
+/*
+ * Согласованная копия изменяемой части сегмента
+ */
+typedef struct snap
+{
+    uint64_t  now_us;
+    uint64_t  publishes;
+    uint64_t  value[SHMSTAT_FIELDS_MAX];
+} snap_t;
+
+/*
+ * Что показываем в строке: индексы полей сегмента (-1 — у этого сервера поля нет)
+ */
+typedef struct columns
+{
+    int  accepts;
+    int  ok;
+    int  fail[4];
+    int  connect_sum;
+    int  connect_count;
+    int  down;
+    int  up;
+    int  wakeups;
+    int  events;
+    int  sys[6];
+    int  states[5];
+    int  connected;
+    int  buffer_mem;
+} columns_t;
+
+static const shmstat_segment_t *segment;
+static uint32_t                 nfields;
+
+
+static unsigned long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+static void sleep_us(unsigned long long us)
+{
+    struct timespec ts = {.tv_sec = (time_t)(us / 1000000ULL), .tv_nsec = (long)(us % 1000000ULL) * 1000L};
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    {
+    }
+}
+
+/*
+ * Читает seqlock: повторяем, пока сервер не допишет. Системный вызов — только
+ * если писатель вытеснен посреди записи и крутиться дальше бессмысленно
+ */
+static void snap_read(snap_t *snap)
+{
+    unsigned before;
+    unsigned after;
+    int      spins = 0;
+    for (;;)
+    {
+        before = atomic_load_explicit(&segment->seq, memory_order_acquire);
+        if ((before & 1) == 0)
+        {
+            memcpy(snap->value, segment->value, nfields * sizeof(uint64_t));
+            snap->now_us    = segment->now_us;
+            snap->publishes = segment->publishes;
+            atomic_thread_fence(memory_order_acquire);
+            after = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+            if (before == after)
+            {
+                return;
+            }
+        }
+        if (++spins == STAT_READ_SPINS)
+        {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+static int field_find(const char *name)
+{
+    for (uint32_t i = 0; i < nfields; ++i)
+    {
+        if (strncmp(segment->field[i].name, name, SHMSTAT_NAME) == 0)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static uint64_t field_value(const snap_t *snap, int field)
+{
+    return field >= 0 ? snap->value[field] : 0;
+}
+
+/*
+ * Прирост поля (или суммы полей) между слепками
+ */
+static uint64_t delta(const snap_t *a, const snap_t *b, const int *fields, int n)
+{
+    uint64_t d = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        d += field_value(b, fields[i]) - field_value(a, fields[i]);
+    }
+    return d;
+}
+
+/*
+ * Коротко: 1.5K, 12.3M... base — 1000 для штук, 1024 для байт
+ */
+static const char *human(char *buf, size_t size, double v, double base)
+{
+    static const char units[] = " KMGTP";
+    int u = 0;
+    while (v >= 999.5 && u < 5)
+    {
+        v /= base;
+        ++u;
+    }
+    if (u == 0)
+    {
+        snprintf(buf, size, "%.0f", v);
+    }
+    else
+    {
+        snprintf(buf, size, v < 9.95 ? "%.1f%c" : "%.0f%c", v, units[u]);
+    }
+    return buf;
+}
+
+/*
+ * Находит сегмент: pid, путь или единственный /dev/shm/cliproxy.*
+ */
+static int segment_path(const char *arg, char *path, size_t size)
+{
+    if (arg != NULL)
+    {
+        if (strchr(arg, '/') != NULL)
+        {
+            snprintf(path, size, "%s", arg);
+        }
+        else
+        {
+            snprintf(path, size, SHMSTAT_PATH, atoi(arg));
+        }
+        return 0;
+    }
+
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL)
+    {
+        fprintf(stderr, "cliproxy-stat: /dev/shm: %s\n", strerror(errno));
+        return -1;
+    }
+    int            found = 0;
+    int            first = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, "cliproxy.", 9) != 0 || !isdigit((unsigned char)entry->d_name[9]))
+        {
+            continue;
+        }
+        int pid = atoi(entry->d_name + 9);
+        if (++found == 1)
+        {
+            first = pid;
+            snprintf(path, size, "/dev/shm/%s", entry->d_name);
+            continue;
+        }
+        if (found == 2)
+        {
+            fprintf(stderr, "cliproxy-stat: several servers, pass a pid:\n");
+            fprintf(stderr, "  %d%s\n", first, kill(first, 0) < 0 && errno == ESRCH ? " (gone)" : "");
+        }
+        fprintf(stderr, "  %d%s\n", pid, kill(pid, 0) < 0 && errno == ESRCH ? " (gone)" : "");
+    }
+    closedir(dir);
+    if (found == 0)
+    {
+        fprintf(stderr, "cliproxy-stat: no /dev/shm/cliproxy.* (is the server running with -G?)\n");
+        return -1;
+    }
+    return found == 1 ? 0 : -1;
+}
+
+static int segment_map(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "cliproxy-stat: %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(shmstat_segment_t))
+    {
+        fprintf(stderr, "cliproxy-stat: %s: too small for a stats segment\n", path);
+        close(fd);
+        return -1;
+    }
+    segment = mmap(NULL, sizeof(shmstat_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        fprintf(stderr, "cliproxy-stat: mmap %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Сервер мог только что стартовать: magic появляется последним
+    for (int i = 0; i < 100 && memcmp(segment->magic, SHMSTAT_MAGIC, sizeof(segment->magic)) != 0; ++i)
+    {
+        sleep_us(10000);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (memcmp(segment->magic, SHMSTAT_MAGIC, sizeof(segment->magic)) != 0)
+    {
+        fprintf(stderr, "cliproxy-stat: %s: not a stats segment\n", path);
+        return -1;
+    }
+    if (segment->version != SHMSTAT_VERSION || segment->size < sizeof(shmstat_segment_t))
+    {
+        fprintf(stderr, "cliproxy-stat: %s: segment version %u, this tool reads %d\n", path, segment->version,
+                SHMSTAT_VERSION);
+        return -1;
+    }
+    nfields = segment->nfields < SHMSTAT_FIELDS_MAX ? segment->nfields : SHMSTAT_FIELDS_MAX;
+    return 0;
+}
+
+static void columns_init(columns_t *c)
+{
+    static const char *fail[]   = {"handshake_auth_failed", "handshake_protocol_error", "handshake_connect_failed",
+                                   "handshake_abandoned"};
+    static const char *sys[]    = {"sys_read", "sys_write", "sys_accept", "sys_connect", "sys_epoll_ctl",
+                                   "sys_epoll_wait"};
+    static const char *states[] = {"tunnels_open", "tunnels_auth", "tunnels_request", "tunnels_connecting",
+                                   "tunnels_connected"};
+
+    c->accepts       = field_find("accepts");
+    c->ok            = field_find("handshake_ok");
+    c->connect_sum   = field_find("connect_us_sum");
+    c->connect_count = field_find("connect_count");
+    c->down          = field_find("bytes_to_client");
+    c->up            = field_find("bytes_to_remote");
+    c->wakeups       = field_find("epoll_wakeups");
+    c->events        = field_find("epoll_events");
+    c->connected     = field_find("tunnels_connected");
+    c->buffer_mem    = field_find("buffer_mem");
+    for (int i = 0; i < 4; ++i)
+    {
+        c->fail[i] = field_find(fail[i]);
+    }
+    for (int i = 0; i < 6; ++i)
+    {
+        c->sys[i] = field_find(sys[i]);
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        c->states[i] = field_find(states[i]);
+    }
+}
+
+static void print_all(void)
+{
+    snap_t snap;
+    snap_read(&snap);
+    printf("pid %lld, period %u us, publishes %llu\n", (long long)segment->pid, segment->period_us,
+           (unsigned long long)snap.publishes);
+    for (uint32_t i = 0; i < nfields; ++i)
+    {
+        printf("%-28.*s %-7s %llu\n", SHMSTAT_NAME, segment->field[i].name,
+               segment->field[i].kind == SHMSTAT_GAUGE ? "gauge" : "counter", (unsigned long long)snap.value[i]);
+    }
+}
+
+static void print_header(void)
+{
+    printf("%-12s %6s %6s %6s %6s %6s %6s %7s %7s %7s %7s %7s %6s %5s %6s %6s\n",
+           "time", "open", "conn", "acc/s", "acc^", "ok/s", "fail/s", "conn_ms",
+           "down/s", "down^", "up/s", "up^", "wake/s", "ev/wk", "sys/s", "mem");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: cliproxy-stat [-i interval_ms] [-r resolution_ms] [-n count] [-a] [pid | path]\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long interval_ms   = 1000;
+    unsigned long long resolution_ms = 0;
+    long               count         = -1;
+    int                all           = 0;
+    int                opt;
+
+    while ((opt = getopt(argc, argv, "i:r:n:a")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i':
+            {
+                interval_ms = strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 'r':
+            {
+                resolution_ms = strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 'n':
+            {
+                count = strtol(optarg, NULL, 10);
+                break;
+            }
+            case 'a':
+            {
+                all = 1;
+                break;
+            }
+            default:
+            {
+                usage();
+                return 2;
+            }
+        }
+    }
+    if (interval_ms == 0)
+    {
+        usage();
+        return 2;
+    }
+
+    char path[512];
+    if (segment_path(optind < argc ? argv[optind] : NULL, path, sizeof(path)) < 0 || segment_map(path) < 0)
+    {
+        return 1;
+    }
+    if (all)
+    {
+        print_all();
+        return 0;
+    }
+
+    columns_t c;
+    columns_init(&c);
+    if (resolution_ms == 0)
+    {
+        resolution_ms = segment->period_us >= 1000 ? segment->period_us / 1000 : 1;
+    }
+    if (resolution_ms > interval_ms)
+    {
+        resolution_ms = interval_ms;
+    }
+
+    int    tty   = isatty(STDOUT_FILENO);
+    long   lines = 0;
+    snap_t start;
+    snap_read(&start);
+    unsigned long long next = now_us();
+
+    while (count < 0 || lines < count)
+    {
+        // Шагаем по -r до конца интервала, запоминая пиковые скорости между публикациями
+        snap_t prev     = start;
+        snap_t cur      = start;
+        double peak[3]  = {0, 0, 0};  // accepts, down, up в секунду
+        unsigned long long end = next + interval_ms * 1000ULL;
+        while ((next += resolution_ms * 1000ULL) <= end)
+        {
+            unsigned long long now = now_us();
+            if (next > now)
+            {
+                sleep_us(next - now);
+            }
+            snap_read(&cur);
+            if (cur.now_us == prev.now_us)
+            {
+                continue;  // Сервер ещё не публиковал — шаг короче периода
+            }
+            double secs = (double)(cur.now_us - prev.now_us) / 1e6;
+            double rate[3] = {(double)delta(&prev, &cur, &c.accepts, 1) / secs,
+                              (double)delta(&prev, &cur, &c.down, 1) / secs,
+                              (double)delta(&prev, &cur, &c.up, 1) / secs};
+            for (int i = 0; i < 3; ++i)
+            {
+                peak[i] = rate[i] > peak[i] ? rate[i] : peak[i];
+            }
+            prev = cur;
+        }
+        next = end;
+
+        if (lines % STAT_HEADER_EVERY == 0 && (tty || lines == 0))
+        {
+            print_header();
+        }
+
+        char           stamp[16];
+        struct timespec ts;
+        struct tm       tm;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        localtime_r(&ts.tv_sec, &tm);
+        size_t len = strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+        snprintf(stamp + len, sizeof(stamp) - len, ".%03ld", ts.tv_nsec / 1000000L);
+
+        if (cur.publishes == start.publishes)
+        {
+            if (kill((pid_t)segment->pid, 0) < 0 && errno == ESRCH)
+            {
+                printf("%-12s server %lld exited\n", stamp, (long long)segment->pid);
+                return 0;
+            }
+            printf("%-12s no updates for %llu ms\n", stamp, interval_ms);
+            ++lines;
+            fflush(stdout);
+            continue;
+        }
+
+        double   secs     = (double)(cur.now_us - start.now_us) / 1e6;
+        uint64_t opened   = 0;
+        for (int i = 0; i < 5; ++i)
+        {
+            opened += field_value(&cur, c.states[i]);
+        }
+        uint64_t connects = delta(&start, &cur, &c.connect_count, 1);
+        uint64_t wakeups  = delta(&start, &cur, &c.wakeups, 1);
+        char     b[13][16];
+        char     conn_ms[16];
+        if (connects > 0)
+        {
+            snprintf(conn_ms, sizeof(conn_ms), "%.2f", (double)delta(&start, &cur, &c.connect_sum, 1) / 1e3 / (double)connects);
+        }
+        else
+        {
+            snprintf(conn_ms, sizeof(conn_ms), "-");
+        }
+
+        printf("%-12s %6s %6s %6s %6s %6s %6s %7s %7s %7s %7s %7s %6s %5.1f %6s %6s\n", stamp,
+               human(b[0], 16, (double)opened, 1000),
+               human(b[1], 16, (double)field_value(&cur, c.connected), 1000),
+               human(b[2], 16, (double)delta(&start, &cur, &c.accepts, 1) / secs, 1000),
+               human(b[3], 16, peak[0], 1000),
+               human(b[4], 16, (double)delta(&start, &cur, &c.ok, 1) / secs, 1000),
+               human(b[5], 16, (double)delta(&start, &cur, c.fail, 4) / secs, 1000),
+               conn_ms,
+               human(b[6], 16, (double)delta(&start, &cur, &c.down, 1) / secs, 1024),
+               human(b[7], 16, peak[1], 1024),
+               human(b[8], 16, (double)delta(&start, &cur, &c.up, 1) / secs, 1024),
+               human(b[9], 16, peak[2], 1024),
+               human(b[10], 16, (double)wakeups / secs, 1000),
+               wakeups > 0 ? (double)delta(&start, &cur, &c.events, 1) / (double)wakeups : 0.0,
+               human(b[11], 16, (double)delta(&start, &cur, c.sys, 6) / secs, 1000),
+               human(b[12], 16, (double)field_value(&cur, c.buffer_mem), 1024));
+        fflush(stdout);
+        ++lines;
+        start = cur;
+    }
+    return 0;
+}
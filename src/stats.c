@@ -0,0 +1,451 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "logger.h"
+
+
+#define STATS_CHUNK       256   // Слотов в куске реестра
+#define STATS_CHUNKS_MAX  1024  // Кусков максимум — 262144 туннелей одновременно
+#define STATS_WINDOW_SEC  1     // Окно замера скоростей, секунд
+
+/*
+ * Слот реестра. seq — seqlock: нечётный, пока event loop переписывает
+ * id, состояние и подписи; rx — атомики сами по себе
+ */
+struct stats_slot
+{
+    atomic_uint         seq;
+    unsigned long long  id;          // 0 — слот свободен
+    tunnel_state_t      state;
+    unsigned long long  start_us;    // Монотонное время создания туннеля
+    char                peer[64];
+    char                user[64];
+    char                target[272]; // host:port назначения
+    atomic_ullong       rx[2];       // Прочитано со стороны, индекс как у is_client
+    tunnel_t           *tunnel;      // Только event loop — для stats_tunnel_find
+    stats_slot_t       *next_free;   // Список свободных — только event loop
+};
+
+
+
+static const char *state_names[] = {"open", "auth", "request", "connecting", "connected"};
+
+// Глобальные счётчики
+static atomic_ullong  opened;
+static atomic_ullong  closed;
+static atomic_ullong  bytes_rx[2];
+static atomic_llong   buffer_mem;
+static atomic_uint    states[connected_state + 1];  // Туннели со слотом по состояниям
+
+// Реестр: куски публикуются через nchunks (release), дальше не меняются
+static stats_slot_t  *chunks[STATS_CHUNKS_MAX];
+static atomic_int     nchunks;
+// Дальше — только event loop
+static int            chunk_used;  // Занято слотов в последнем куске
+static stats_slot_t  *free_slots;
+
+
+static unsigned long long stats_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+/*
+ * Счётчик с единственным писателем: обычные load + store, без атомарного RMW
+ */
+static void counter_add(atomic_ullong *counter, unsigned long long n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static stats_slot_t *slot_alloc(void)
+{
+    stats_slot_t *slot = free_slots;
+    if (slot != NULL)
+    {
+        free_slots = slot->next_free;
+        return slot;
+    }
+    int n = atomic_load_explicit(&nchunks, memory_order_relaxed);
+    if (n == 0 || chunk_used == STATS_CHUNK)
+    {
+        if (n == STATS_CHUNKS_MAX)
+        {
+            return NULL;
+        }
+        chunks[n] = calloc(STATS_CHUNK, sizeof(stats_slot_t));
+        if (chunks[n] == NULL)
+        {
+            return NULL;
+        }
+        atomic_store_explicit(&nchunks, ++n, memory_order_release);
+        chunk_used = 0;
+    }
+    return &chunks[n - 1][chunk_used++];
+}
+
+/*
+ * Туннелей в состоянии state стало на delta больше — пишет только event loop
+ */
+static void state_count(tunnel_state_t state, int delta)
+{
+    atomic_store_explicit(&states[state], atomic_load_explicit(&states[state], memory_order_relaxed) + (unsigned)delta,
+                          memory_order_relaxed);
+}
+
+static void slot_write_begin(stats_slot_t *slot)
+{
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void slot_write_end(stats_slot_t *slot)
+{
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+/*
+ * Переписывает состояние и подписи слота из туннеля
+ */
+static void slot_fill(stats_slot_t *slot, const tunnel_t *tunnel)
+{
+    int ulen = (int)tunnel->ap.ulen;
+
+    slot->state = tunnel->state;
+    snprintf(slot->peer, sizeof(slot->peer), "%s", tunnel->peer[0] != '\0' ? tunnel->peer : "-");
+    snprintf(slot->user, sizeof(slot->user), "%.*s", ulen > 0 ? ulen : 1, ulen > 0 ? tunnel->ap.uname : "-");
+    if (tunnel->dst_host[0] != '\0')
+    {
+        snprintf(slot->target, sizeof(slot->target), "%s:%s", tunnel->dst_host, tunnel->dst_port);
+    }
+    else
+    {
+        snprintf(slot->target, sizeof(slot->target), "-");
+    }
+}
+
+void stats_tunnel_open(tunnel_t *tunnel)
+{
+    counter_add(&opened, 1);
+
+    stats_slot_t *slot = slot_alloc();
+    tunnel->slot = slot;
+    if (slot == NULL)
+    {
+        return;  // Реестр полон — туннель есть только в общих счётчиках
+    }
+    slot->tunnel = tunnel;
+    state_count(tunnel->state, 1);
+    slot_write_begin(slot);
+    slot->id       = tunnel->id;
+    slot->start_us = tunnel->stats.start_us;
+    atomic_store_explicit(&slot->rx[0], 0, memory_order_relaxed);
+    atomic_store_explicit(&slot->rx[1], 0, memory_order_relaxed);
+    slot_fill(slot, tunnel);
+    slot_write_end(slot);
+}
+
+void stats_tunnel_update(tunnel_t *tunnel)
+{
+    stats_slot_t *slot = tunnel->slot;
+    if (slot == NULL)
+    {
+        return;
+    }
+    if (slot->state != tunnel->state)
+    {
+        state_count(slot->state, -1);
+        state_count(tunnel->state, 1);
+    }
+    slot_write_begin(slot);
+    slot_fill(slot, tunnel);
+    slot_write_end(slot);
+}
+
+void stats_tunnel_read(tunnel_t *tunnel, int is_client, size_t n)
+{
+    counter_add(&bytes_rx[is_client], n);
+    if (tunnel->slot != NULL)
+    {
+        counter_add(&tunnel->slot->rx[is_client], n);
+    }
+}
+
+void stats_tunnel_close(tunnel_t *tunnel)
+{
+    stats_slot_t *slot = tunnel->slot;
+
+    counter_add(&closed, 1);
+    if (slot == NULL)
+    {
+        return;
+    }
+    state_count(slot->state, -1);
+    slot_write_begin(slot);
+    slot->id = 0;
+    slot_write_end(slot);
+    slot->tunnel    = NULL;
+    slot->next_free = free_slots;
+    free_slots      = slot;
+    tunnel->slot    = NULL;
+}
+
+void stats_buffer_mem(ssize_t delta)
+{
+    atomic_fetch_add_explicit(&buffer_mem, delta, memory_order_relaxed);
+}
+
+tunnel_t *stats_tunnel_find(unsigned long long id)
+{
+    int n = atomic_load_explicit(&nchunks, memory_order_relaxed);
+    for (int chunk = 0; chunk < n; ++chunk)
+    {
+        for (int i = 0; i < STATS_CHUNK; ++i)
+        {
+            if (chunks[chunk][i].tunnel != NULL && chunks[chunk][i].id == id)
+            {
+                return chunks[chunk][i].tunnel;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Дальше — читатели, любой поток
+ */
+
+static void totals_load(stats_summary_t *totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    totals->opened     = atomic_load_explicit(&opened, memory_order_relaxed);
+    totals->closed     = atomic_load_explicit(&closed, memory_order_relaxed);
+    totals->rx[0]      = atomic_load_explicit(&bytes_rx[0], memory_order_relaxed);
+    totals->rx[1]      = atomic_load_explicit(&bytes_rx[1], memory_order_relaxed);
+    totals->buffer_mem = atomic_load_explicit(&buffer_mem, memory_order_relaxed);
+    for (int state = open_state; state <= connected_state; ++state)
+    {
+        totals->states[state] = atomic_load_explicit(&states[state], memory_order_relaxed);
+    }
+}
+
+/*
+ * Согласованная копия слота: повторяем, пока писатель не закончит
+ */
+static void slot_read(stats_slot_t *slot, stats_tunnel_t *view)
+{
+    unsigned before;
+    unsigned after;
+    do
+    {
+        before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (before & 1)
+        {
+            continue;
+        }
+        view->id       = slot->id;
+        view->state    = slot->state;
+        view->start_us = slot->start_us;
+        memcpy(view->peer, slot->peer, sizeof(view->peer));
+        memcpy(view->user, slot->user, sizeof(view->user));
+        memcpy(view->target, slot->target, sizeof(view->target));
+        view->rx[0] = atomic_load_explicit(&slot->rx[0], memory_order_relaxed);
+        view->rx[1] = atomic_load_explicit(&slot->rx[1], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    }
+    while ((before & 1) || before != after);
+}
+
+/*
+ * Слепок реестра: views[i] — копия i-го слота (id 0 — свободен).
+ * Возвращает число слотов или 0 (пусто или нет памяти)
+ */
+static size_t registry_snapshot(stats_tunnel_t **views)
+{
+    int                n     = atomic_load_explicit(&nchunks, memory_order_acquire);
+    size_t             total = (size_t)n * STATS_CHUNK;
+    unsigned long long now   = stats_now_us();
+
+    *views = NULL;
+    if (total == 0 || (*views = malloc(total * sizeof(stats_tunnel_t))) == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < total; ++i)
+    {
+        stats_tunnel_t *view = &(*views)[i];
+        slot_read(&chunks[i / STATS_CHUNK][i % STATS_CHUNK], view);
+        view->age_ms = now > view->start_us ? (now - view->start_us) / 1000ULL : 0;
+    }
+    return total;
+}
+
+void stats_summary(stats_summary_t *summary)
+{
+    totals_load(summary);
+}
+
+size_t stats_tunnels(stats_tunnel_t **tunnels)
+{
+    size_t n      = registry_snapshot(tunnels);
+    size_t active = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if ((*tunnels)[i].id != 0)
+        {
+            (*tunnels)[active++] = (*tunnels)[i];
+        }
+    }
+    return active;
+}
+
+/*
+ * 1536 -> "1.5 KiB"
+ */
+static const char *human(char *text, size_t size, double bytes)
+{
+    static const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4)
+    {
+        bytes /= 1024;
+        ++unit;
+    }
+    snprintf(text, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+    return text;
+}
+
+/*
+ * Секунда замера: слепки счётчиков и, если old/now не NULL, реестра — до и после
+ */
+static double sample(stats_summary_t *before, stats_summary_t *after,
+                     stats_tunnel_t **old, size_t *nold, stats_tunnel_t **now, size_t *nnow)
+{
+    struct timespec    window = {.tv_sec = STATS_WINDOW_SEC};
+    unsigned long long start  = stats_now_us();
+
+    totals_load(before);
+    if (old != NULL)
+    {
+        *nold = registry_snapshot(old);
+    }
+    nanosleep(&window, NULL);
+    totals_load(after);
+    if (now != NULL)
+    {
+        *nnow = registry_snapshot(now);
+    }
+    return (double)(stats_now_us() - start) / 1e6;
+}
+
+void stats_print(void)
+{
+    stats_summary_t before;
+    stats_summary_t after;
+    char            up[32], down[32], up_total[32], down_total[32], mem[32];
+
+    double secs = sample(&before, &after, NULL, NULL, NULL, NULL);
+    unsigned *states = after.states;
+
+    EXTRA_LOG_WARN("Stats → tunnels %llu open (open %u, auth %u, request %u, connecting %u, connected %u)",
+                   after.opened - after.closed, states[open_state], states[auth_state], states[request_state],
+                   states[connecting_state], states[connected_state]);
+    EXTRA_LOG_WARN("Stats → opened %.0f/s, closed %.0f/s (since start %llu / %llu)",
+                   (double)(after.opened - before.opened) / secs, (double)(after.closed - before.closed) / secs,
+                   after.opened, after.closed);
+    EXTRA_LOG_WARN("Stats → client→proxy %s/s, remote→proxy %s/s (since start %s / %s)",
+                   human(up, sizeof(up), (double)(after.rx[1] - before.rx[1]) / secs),
+                   human(down, sizeof(down), (double)(after.rx[0] - before.rx[0]) / secs),
+                   human(up_total, sizeof(up_total), (double)after.rx[1]),
+                   human(down_total, sizeof(down_total), (double)after.rx[0]));
+    EXTRA_LOG_WARN("Stats → buffer memory %s", human(mem, sizeof(mem), (double)after.buffer_mem));
+}
+
+/*
+ * Сколько туннель прокачал за окно замера
+ */
+typedef struct top_entry
+{
+    const stats_tunnel_t *view;
+    unsigned long long  delta[2];
+} top_entry_t;
+
+static int top_compare(const void *a, const void *b)
+{
+    const top_entry_t *x = a;
+    const top_entry_t *y = b;
+    unsigned long long sx = x->delta[0] + x->delta[1];
+    unsigned long long sy = y->delta[0] + y->delta[1];
+    return sx < sy ? 1 : sx > sy ? -1 : (x->view->id > y->view->id) - (x->view->id < y->view->id);
+}
+
+void stats_top(int n)
+{
+    stats_summary_t before;
+    stats_summary_t after;
+    stats_tunnel_t *old     = NULL;
+    stats_tunnel_t *now     = NULL;
+    size_t          nold    = 0;
+    size_t          nnow    = 0;
+    size_t          nactive = 0;
+
+    double secs = sample(&before, &after, &old, &nold, &now, &nnow);
+    top_entry_t *entries = nnow > 0 ? malloc(nnow * sizeof(top_entry_t)) : NULL;
+    if (entries == NULL)
+    {
+        EXTRA_LOG_WARN("Top → no tunnels");
+        free(old);
+        free(now);
+        return;
+    }
+
+    for (size_t i = 0; i < nnow; ++i)
+    {
+        if (now[i].id == 0)
+        {
+            continue;
+        }
+        top_entry_t *entry = &entries[nactive++];
+        entry->view = &now[i];
+        for (int side = 0; side < 2; ++side)
+        {
+            // Слот за окно сменил хозяина (или его куска ещё не было) — весь счётчик набран в окне
+            bool same = i < nold && old[i].id == now[i].id;
+            entry->delta[side] = now[i].rx[side] - (same ? old[i].rx[side] : 0);
+        }
+    }
+    qsort(entries, nactive, sizeof(top_entry_t), top_compare);
+
+    EXTRA_LOG_WARN("Top → %zu busiest of %zu tunnels over %.1f s", nactive < (size_t)n ? nactive : (size_t)n,
+                   nactive, secs);
+    EXTRA_LOG_WARN("Top → %8s %-10s %12s %12s %10s %8s  %s", "ID", "STATE", "UP/s", "DOWN/s", "TOTAL", "AGE",
+                   "PEER USER TARGET");
+    for (size_t i = 0; i < nactive && i < (size_t)n; ++i)
+    {
+        const stats_tunnel_t *view = entries[i].view;
+        char up[32], down[32], total[32];
+        EXTRA_LOG_WARN("Top → %8llu %-10s %10s/s %10s/s %10s %7llus  %s %s %s",
+                       view->id, state_names[view->state],
+                       human(up, sizeof(up), (double)entries[i].delta[1] / secs),
+                       human(down, sizeof(down), (double)entries[i].delta[0] / secs),
+                       human(total, sizeof(total), (double)(view->rx[0] + view->rx[1])),
+                       view->age_ms / 1000ULL, view->peer, view->user, view->target);
+    }
+    free(entries);
+    free(old);
+    free(now);
+}
@@ -1,26 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <pthread.h>
 
 #include "terminal.h"
+#include "freeze.h"
+#include "stats.h"
 #include "logger.h"
 
-/*
- * Флаг режима «freeze» для приостановки пересылки трафика.
- */
-static volatile sig_atomic_t freeze_flag = 0;
-
 /*
  * Функция-обработчик фонового потока терминала.
  * Читает команды из stdin и реагирует следующим образом:
- *   • "freeze" — переключает состояние freeze_flag и выводит предупреждение
+ *   • "freeze [selector]" — без селектора переключает заморозку всего прокси,
+ *     с селектором (tunnel=ID, user=U, host=H, port=P) — замораживает только его
+ *   • "unfreeze [selector]" — снимает заморозку селектора или всю
  *   • "stop"   — выводит предупреждение и генерирует SIGINT для graceful shutdown
+ *   • "level [spec]" — показывает или меняет уровни логирования (log_set_levels)
+ *   • "stats"  — туннели по состояниям, скорости и память буферов (stats_print)
+ *   • "top [N]" — N самых нагруженных туннелей за секунду (по умолчанию 10)
  *   • остальное — выводит предупреждение об неизвестной команде
 */
 static void *terminal_thread(void *arg)
 {
-    char line[64];
+    char line[300];
     (void)arg;  // чтобы не ругался компилятор на неиспользуемый параметр
 
     // Постоянно читаем строки из консоли
@@ -29,12 +32,19 @@ static void *terminal_thread(void *arg)
         // Удаляем символы новой строки и возврата каретки
         line[strcspn(line, "\r\n")] = '\0';
 
-        if (strcmp(line, "freeze") == 0)
+        if ((strncmp(line, "freeze", 6) == 0 && (line[6] == ' ' || line[6] == '\0'))
+            || (strncmp(line, "unfreeze", 8) == 0 && (line[8] == ' ' || line[8] == '\0')))
         {
-            // Меняем режим заморозки: если был включён — выключаем, и наоборот
-            freeze_flag = !freeze_flag;
-            EXTRA_LOG_WARN("Terminal → freeze %s",
-                           freeze_flag ? "ON" : "OFF");
+            // Применит event loop и сам скажет, что теперь заморожено
+            bool        off      = line[0] == 'u';
+            const char *selector = line + (off ? 8 : 6);
+            selector += *selector == ' ';
+            freeze_op_t op = off ? FREEZE_OFF : *selector == '\0' ? FREEZE_TOGGLE : FREEZE_ON;
+            if (freeze_request(op, selector) < 0)
+            {
+                EXTRA_LOG_WARN("Terminal → bad freeze selector '%s' (all, tunnel=ID, user=U, host=H, port=P)",
+                               selector);
+            }
         }
         else if (strcmp(line, "stop") == 0)
         {
@@ -43,6 +53,31 @@ static void *terminal_thread(void *arg)
             raise(SIGINT);
             break;  // выходим из цикла и завершаем поток
         }
+        else if (strncmp(line, "level", 5) == 0 && (line[5] == ' ' || line[5] == '\0'))
+        {
+            // "level" — показать уровни, "level error,protocol=info" — поменять на ходу
+            const char *spec = line[5] == ' ' ? line + 6 : "";
+            if (*spec != '\0' && log_set_levels(spec) < 0)
+            {
+                EXTRA_LOG_WARN("Terminal → bad log levels '%s' (e.g. \"warning,protocol=info\")", spec);
+            }
+            else
+            {
+                char levels[LOG_SPEC_MAX];
+                log_get_levels(levels, sizeof(levels));
+                EXTRA_LOG_WARN("Terminal → log levels %s", levels);
+            }
+        }
+        else if (strcmp(line, "stats") == 0)
+        {
+            // Счётчики читаются без локов — event loop об этом не узнает
+            stats_print();
+        }
+        else if (strncmp(line, "top", 3) == 0 && (line[3] == ' ' || line[3] == '\0'))
+        {
+            int n = line[3] == ' ' ? atoi(line + 4) : 0;
+            stats_top(n > 0 ? n : 10);
+        }
         else
         {
             // Логируем, что команда неизвестна
@@ -68,13 +103,3 @@ void terminal_start(void)
     }
     pthread_detach(tid);
 }
-
-/*
- * Возвращает текущее состояние freeze_flag.
- * Основной код туннеля вызывает эту функцию, чтобы решить,
- * форвардить пакеты или нет.
- */
-bool terminal_is_frozen(void)
-{
-    return (bool)freeze_flag;
-}
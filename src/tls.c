@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "tls.h"
+
+
+#define TLS_CONTENT_HANDSHAKE  0x16
+#define TLS_HS_CLIENT_HELLO    0x01
+#define TLS_RECORD_MAX         (16384 + 2048)   // Payload записи с запасом на расширения
+#define TLS_HELLO_MAX          (64 * 1024)      // Длиннее ClientHello не бывает на практике
+
+#define TLS_EXT_SNI            0
+#define TLS_EXT_ALPN           16
+#define TLS_EXT_VERSIONS       43
+
+
+/*
+ * Какое поле ClientHello ждём в acc
+ */
+enum
+{
+    HS_HEAD,        // type(1) + length(3)
+    HS_VERSION,     // legacy_version(2), дальше random(32) пропускается
+    HS_SID_LEN,     // session_id: длина(1)
+    HS_CS_LEN,      // cipher_suites: длина(2)
+    HS_COMP_LEN,    // compression_methods: длина(1)
+    HS_EXT_LEN,     // Длина блока расширений(2)
+    HS_EXT_HEAD,    // type(2) + length(2)
+    HS_EXT_DATA,    // Тело нужного расширения
+    HS_END          // Всё прочитано
+};
+
+void tls_parser_init(tls_parser_t *p)
+{
+    // acc заполняется до чтения — чистить его незачем
+    memset(p, 0, offsetof(tls_parser_t, acc));
+    memset(&p->hello, 0, sizeof(p->hello));
+    p->state = HS_HEAD;
+    p->want  = 4;
+}
+
+static uint16_t be16(const uint8_t *b)
+{
+    return (uint16_t)(b[0] << 8 | b[1]);
+}
+
+/*
+ * GREASE (RFC 8701): 0x0a0a, 0x1a1a, ... 0xfafa — мусор для проверки серверов
+ */
+static int is_grease(uint16_t v)
+{
+    return (v & 0x0f0f) == 0x0a0a && (v >> 8) == (v & 0xff);
+}
+
+/*
+ * server_name: список (длина 2), элементы type(1) + length(2) + имя; берём host_name
+ */
+static int parse_sni(tls_hello_t *h, const uint8_t *b, size_t n)
+{
+    if (n < 2 || be16(b) != n - 2)
+    {
+        return -1;
+    }
+    for (size_t i = 2; i + 3 <= n; )
+    {
+        uint8_t type = b[i];
+        size_t  len  = be16(b + i + 1);
+        i += 3;
+        if (len > n - i)
+        {
+            return -1;
+        }
+        if (type == 0 && h->sni[0] == '\0')
+        {
+            if (len == 0 || len >= sizeof(h->sni))
+            {
+                return -1;
+            }
+            for (size_t k = 0; k < len; ++k)
+            {
+                // Имя хоста — печатный ASCII без пробелов
+                if (b[i + k] <= 0x20 || b[i + k] >= 0x7f)
+                {
+                    return -1;
+                }
+            }
+            memcpy(h->sni, b + i, len);
+            h->sni[len] = '\0';
+        }
+        i += len;
+    }
+    return 0;
+}
+
+/*
+ * ALPN: список (длина 2), элементы length(1) + имя; склеиваем через запятую
+ */
+static int parse_alpn(tls_hello_t *h, const uint8_t *b, size_t n)
+{
+    if (n < 2 || be16(b) != n - 2)
+    {
+        return -1;
+    }
+    size_t out = 0;
+    for (size_t i = 2; i < n; )
+    {
+        size_t len = b[i++];
+        if (len == 0 || len > n - i)
+        {
+            return -1;
+        }
+        // Не влезает целиком — обрезаем список, протокол пополам не режем
+        if (out + len + 2 <= sizeof(h->alpn))
+        {
+            if (out > 0)
+            {
+                h->alpn[out++] = ',';
+            }
+            for (size_t k = 0; k < len; ++k)
+            {
+                uint8_t c = b[i + k];
+                h->alpn[out++] = c > 0x20 && c < 0x7f ? (char)c : '?';
+            }
+        }
+        i += len;
+    }
+    h->alpn[out] = '\0';
+    return 0;
+}
+
+/*
+ * supported_versions у клиента: длина(1) + версии по 2 байта
+ */
+static int parse_versions(tls_hello_t *h, const uint8_t *b, size_t n)
+{
+    if (n < 1 || b[0] != n - 1 || (b[0] & 1))
+    {
+        return -1;
+    }
+    for (size_t i = 1; i + 2 <= n; i += 2)
+    {
+        uint16_t v = be16(b + i);
+        if (!is_grease(v) && h->nversions < TLS_VERSIONS_MAX)
+        {
+            h->versions[h->nversions++] = v;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Дальше — следующий заголовок расширения или конец
+ */
+static void next_ext(tls_parser_t *p)
+{
+    if (p->ext_left == 0)
+    {
+        p->state = HS_END;
+        p->want  = 0;
+        return;
+    }
+    p->state = HS_EXT_HEAD;
+    p->want  = 4;
+}
+
+/*
+ * Поле state целиком (want байт) лежит в b — в acc или прямо во входном куске:
+ * разбираем и решаем, что ждать дальше.
+ * Длины проверяются против объемлющих (hs_left уже уменьшен на собранное)
+ */
+static tls_result_t hs_step(tls_parser_t *p, const uint8_t *b, size_t n)
+{
+    switch (p->state)
+    {
+        case HS_HEAD:
+        {
+            size_t len = (size_t)b[1] << 16 | (size_t)b[2] << 8 | b[3];
+            if (b[0] != TLS_HS_CLIENT_HELLO || len < 2 + 32 + 1 + 2 + 1 || len > TLS_HELLO_MAX)
+            {
+                return TLS_NOT;
+            }
+            p->hs_left = len;
+            p->state   = HS_VERSION;
+            p->want    = 2;
+            return TLS_MORE;
+        }
+        case HS_VERSION:
+        {
+            p->hello.legacy_version = be16(b);
+            if (b[0] != 0x03)
+            {
+                return TLS_NOT;
+            }
+            p->skip  = 32;
+            p->state = HS_SID_LEN;
+            p->want  = 1;
+            return TLS_MORE;
+        }
+        case HS_SID_LEN:
+        {
+            if (b[0] > 32)
+            {
+                return TLS_NOT;
+            }
+            p->skip  = b[0];
+            p->state = HS_CS_LEN;
+            p->want  = 2;
+            return TLS_MORE;
+        }
+        case HS_CS_LEN:
+        {
+            size_t len = be16(b);
+            if (len < 2 || (len & 1))
+            {
+                return TLS_NOT;
+            }
+            p->skip  = len;
+            p->state = HS_COMP_LEN;
+            p->want  = 1;
+            return TLS_MORE;
+        }
+        case HS_COMP_LEN:
+        {
+            if (b[0] < 1)
+            {
+                return TLS_NOT;
+            }
+            p->skip = b[0];
+            if (p->hs_left < p->skip)
+            {
+                return TLS_NOT;
+            }
+            // Старые клиенты шлют ClientHello вовсе без расширений
+            p->state = p->hs_left == p->skip ? HS_END : HS_EXT_LEN;
+            p->want  = p->hs_left == p->skip ? 0 : 2;
+            return TLS_MORE;
+        }
+        case HS_EXT_LEN:
+        {
+            p->ext_left = be16(b);
+            if (p->ext_left != p->hs_left)
+            {
+                return TLS_NOT;
+            }
+            next_ext(p);
+            return TLS_MORE;
+        }
+        case HS_EXT_HEAD:
+        {
+            size_t len = be16(b + 2);
+            if (p->ext_left < 4 || len > p->ext_left - 4)
+            {
+                return TLS_NOT;
+            }
+            p->ext_left -= 4 + len;
+            p->ext_type  = be16(b);
+            if ((p->ext_type == TLS_EXT_SNI || p->ext_type == TLS_EXT_ALPN
+                 || p->ext_type == TLS_EXT_VERSIONS) && len <= TLS_FIELD_MAX)
+            {
+                p->state = HS_EXT_DATA;
+                p->want  = len;
+                return TLS_MORE;
+            }
+            p->skip = len;
+            next_ext(p);
+            return TLS_MORE;
+        }
+        case HS_EXT_DATA:
+        {
+            int rc = 0;
+            if (p->ext_type == TLS_EXT_SNI)
+            {
+                rc = parse_sni(&p->hello, b, n);
+            }
+            else if (p->ext_type == TLS_EXT_ALPN)
+            {
+                rc = parse_alpn(&p->hello, b, n);
+            }
+            else
+            {
+                rc = parse_versions(&p->hello, b, n);
+            }
+            if (rc < 0)
+            {
+                return TLS_NOT;
+            }
+            next_ext(p);
+            return TLS_MORE;
+        }
+        default:
+        {
+            return TLS_DONE;
+        }
+    }
+}
+
+/*
+ * Байты ClientHello без заголовков записей: пропускаем skip, собираем want байт
+ * поля (в acc, только если поле режется стыком) и на каждом — hs_step
+ */
+static tls_result_t hs_feed(tls_parser_t *p, const uint8_t *data, size_t len)
+{
+    for (;;)
+    {
+        if (p->skip > 0)
+        {
+            if (len == 0)
+            {
+                return TLS_MORE;
+            }
+            size_t k = len < p->skip ? len : p->skip;
+            if (k > p->hs_left)
+            {
+                return TLS_NOT;
+            }
+            p->skip    -= k;
+            p->hs_left -= k;
+            data       += k;
+            len        -= k;
+            continue;
+        }
+        const uint8_t *field = p->acc;
+        if (p->acc_len == 0 && len >= p->want)
+        {
+            // Обычный случай: поле целиком во входном куске — разбираем на месте
+            if (p->state != HS_HEAD)
+            {
+                if (p->want > p->hs_left)
+                {
+                    return TLS_NOT;
+                }
+                p->hs_left -= p->want;
+            }
+            field  = data;
+            data  += p->want;
+            len   -= p->want;
+        }
+        else if (p->acc_len < p->want)
+        {
+            if (len == 0)
+            {
+                return TLS_MORE;
+            }
+            size_t k = p->want - p->acc_len;
+            k = len < k ? len : k;
+            // Заголовок ClientHello в hs_left не входит
+            if (p->state != HS_HEAD)
+            {
+                if (k > p->hs_left)
+                {
+                    return TLS_NOT;
+                }
+                p->hs_left -= k;
+            }
+            memcpy(p->acc + p->acc_len, data, k);
+            p->acc_len += k;
+            data       += k;
+            len        -= k;
+            continue;
+        }
+        size_t n   = p->want;
+        p->acc_len = 0;
+        tls_result_t r = hs_step(p, field, n);
+        if (r != TLS_MORE)
+        {
+            return r;
+        }
+    }
+}
+
+tls_result_t tls_parser_feed(tls_parser_t *p, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (p->rec_left == 0)
+        {
+            // Заголовок записи: type(1) + version(2) + length(2)
+            size_t k = sizeof(p->rec_hdr) - p->rec_hdr_len;
+            k = len < k ? len : k;
+            memcpy(p->rec_hdr + p->rec_hdr_len, data, k);
+            p->rec_hdr_len += k;
+            data           += k;
+            len            -= k;
+            // Первый же байт не handshake — не TLS, дальше не ждём
+            if (p->rec_hdr[0] != TLS_CONTENT_HANDSHAKE || (p->rec_hdr_len >= 2 && p->rec_hdr[1] != 0x03))
+            {
+                return TLS_NOT;
+            }
+            if (p->rec_hdr_len < sizeof(p->rec_hdr))
+            {
+                return TLS_MORE;
+            }
+            p->rec_hdr_len = 0;
+            p->rec_left    = be16(p->rec_hdr + 3);
+            if (p->rec_left == 0 || p->rec_left > TLS_RECORD_MAX)
+            {
+                return TLS_NOT;
+            }
+            continue;
+        }
+        size_t       k = len < p->rec_left ? len : p->rec_left;
+        tls_result_t r = hs_feed(p, data, k);
+        p->rec_left -= k;
+        data        += k;
+        len         -= k;
+        if (r != TLS_MORE)
+        {
+            return r;
+        }
+    }
+    return TLS_MORE;
+}
+
+const char *tls_version_name(uint16_t version, char *buf, size_t size)
+{
+    switch (version)
+    {
+        case 0x0300: return "SSL3.0";
+        case 0x0301: return "TLS1.0";
+        case 0x0302: return "TLS1.1";
+        case 0x0303: return "TLS1.2";
+        case 0x0304: return "TLS1.3";
+        default:
+        {
+            snprintf(buf, size, "0x%04x", version);
+            return buf;
+        }
+    }
+}
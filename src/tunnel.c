@@ -12,13 +12,21 @@
 #include <malloc.h>
 #include <signal.h>
 #include <assert.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "tunnel.h"
 #include "sock.h"
 #include "logger.h"
-#include "protocol_parser.h"
-#include "terminal.h"
+#include "inspect.h"
+#include "capture.h"
+#include "freeze.h"
+#include "stats.h"
+#include "metrics.h"
+#include "upstream.h"
+#include "preconnect.h"
+#include "mux.h"
+#include "http_proxy.h"
 
 
 /**
@@ -47,13 +55,98 @@ typedef struct sockaddr_in6 sockaddr_in6_t;
 
 typedef struct addrinfo addrinfo_t;
 
+static unsigned long long tunnel_ids; // Последний выданный номер туннеля
+
+static const char *close_names[] = {
+	"none", "client_eof", "remote_eof", "read_error", "write_error",
+	"protocol", "auth", "connect", "forward", "aborted", "killed"
+};
+
+/**
+ * Монотонные микросекунды — для таймингов сессии.
+ */
+static unsigned long long tunnel_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+}
+
+/**
+ * Интервал между этапами в мкс или -1, если какой-то из них не наступил.
+ */
+static long long tunnel_span(unsigned long long from, unsigned long long to)
+{
+	return from != 0 && to != 0 ? (long long)(to - from) : -1;
+}
+
+/**
+ * Адрес клиента "ip:port" для access-записи.
+ */
+static void tunnel_peer(tunnel_t *tunnel, const struct sockaddr *peer)
+{
+	char ip[INET6_ADDRSTRLEN];
+
+	if (peer == NULL)
+	{
+		return;
+	}
+	if (peer->sa_family == AF_INET)
+	{
+		const sockaddr_in_t *in = (const sockaddr_in_t*)peer;
+		inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+		snprintf(tunnel->peer, sizeof(tunnel->peer), "%s:%u", ip, ntohs(in->sin_port));
+	}
+	else if (peer->sa_family == AF_INET6)
+	{
+		const sockaddr_in6_t *in6 = (const sockaddr_in6_t*)peer;
+		inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+		snprintf(tunnel->peer, sizeof(tunnel->peer), "[%s]:%u", ip, ntohs(in6->sin6_port));
+	}
+}
+
+/**
+ * Одна access-запись на сессию вместо строки на каждое чтение и запись:
+ * кто, куда, сколько байт и вызовов в каждую сторону, сколько шли этапы
+ * и почему всё кончилось. Тайминги: handshake — от accept до запроса,
+ * connect — от запроса до ответа клиенту, ttfb — от него до первого байта сервера.
+ */
+static void tunnel_log_session(tunnel_t *tunnel)
+{
+	const tunnel_stats_t *st = &tunnel->stats;
+	int                   ulen = (int)tunnel->ap.ulen;
+
+	LOG_INFO("Session %llu peer=%s user=%.*s target=%s:%s close=%s"
+		 " client_rx=%llu client_tx=%llu remote_rx=%llu remote_tx=%llu reads=%u/%u writes=%u/%u"
+		 " handshake_us=%lld connect_us=%lld ttfb_us=%lld duration_us=%lld",
+		 tunnel->id, tunnel->peer[0] != '\0' ? tunnel->peer : "-",
+		 ulen > 0 ? ulen : 1, ulen > 0 ? tunnel->ap.uname : "-",
+		 tunnel->dst_host[0] != '\0' ? tunnel->dst_host : "-",
+		 tunnel->dst_port[0] != '\0' ? tunnel->dst_port : "-",
+		 close_names[st->close],
+		 st->rx[1], st->tx[1], st->rx[0], st->tx[0],
+		 st->reads[1], st->reads[0], st->writes[1], st->writes[0],
+		 tunnel_span(st->start_us, st->request_us),
+		 tunnel_span(st->request_us, st->connected_us),
+		 tunnel_span(st->connected_us, st->first_us),
+		 tunnel_span(st->start_us, tunnel_now_us()));
+}
+
+void tunnel_close_reason(tunnel_t *tunnel, tunnel_close_t reason)
+{
+	if (tunnel->stats.close == close_none)
+	{
+		tunnel->stats.close = reason;
+	}
+}
+
 /**
  * Создаёт структуру туннеля для вновь принятого клиентского соединения.
  * Переходит в состояние 'open_state' (ожидание Client Greeting).
  * Настраивает клиентский сокет неблокирующим и с keepalive.
  * В случае ошибки освобождает ресурсы и закрывает дескриптор.
  */
-tunnel_t* tunnel_create(int fd)
+tunnel_t* tunnel_create(int fd, const struct sockaddr *peer)
 {
 	// Переводим клиентский FD в неблокирующий режим
 	sock_nonblocking(fd);
@@ -69,6 +162,9 @@ tunnel_t* tunnel_create(int fd)
 	}
 	// Обнуляем все поля структуры для корректной инициализации
 	memset(tunnel, 0, sizeof(*tunnel));
+	tunnel->id = ++tunnel_ids;
+	tunnel->stats.start_us = tunnel_now_us();
+	tunnel_peer(tunnel, peer);
 
 	// Создаём обёртку sock_t для клиентского сокета
 	sock_t *client_sock = sock_create(fd, sock_connected, 1, tunnel);
@@ -84,6 +180,7 @@ tunnel_t* tunnel_create(int fd)
 	tunnel->client_sock = client_sock;      // сохраняем клиентский сокет
 	tunnel->read_count = 0;                 // сбрасываем счётчик прочитанных байт
 	tunnel->closed = 0;                     // флаг закрытия туннеля
+	stats_tunnel_open(tunnel);
 
 	// Регистрируем клиентский сокет в epoll для чтения
 	epoll_add(client_sock);
@@ -91,35 +188,134 @@ tunnel_t* tunnel_create(int fd)
 	return tunnel;
 }
 
+/**
+ * Создаёт туннель, у которого клиентская сторона — стрим мультиплексора.
+ */
+tunnel_t* tunnel_create_virtual(void)
+{
+	tunnel_t *tunnel = (tunnel_t*)malloc(sizeof(*tunnel));
+	if (tunnel == NULL)
+	{
+		return NULL;
+	}
+	memset(tunnel, 0, sizeof(*tunnel));
+	tunnel->id = ++tunnel_ids;
+	tunnel->stats.start_us = tunnel_now_us();
+
+	// Greeting и аутентификацию прошёл edge-инстанс, нам остаётся только коннект
+	tunnel->state = request_state;
+	stats_tunnel_open(tunnel);
+	return tunnel;
+}
+
 /**
  * Полностью освобождает память, занятую структурой туннеля.
  */
 void tunnel_release(tunnel_t *tunnel)
 {
+	tunnel_log_session(tunnel);
+	stats_tunnel_close(tunnel);
+	// Так и не установился — хэндшейк провален, чем именно — по причине закрытия
+	if (tunnel->stats.connected_us == 0)
+	{
+		tunnel_close_t close = tunnel->stats.close;
+		// Отказ в коннекте приходит в connecting_state ошибкой чтения удалённого сокета
+		if (tunnel->state == connecting_state && close == close_read_error)
+		{
+			close = close_connect;
+		}
+		metrics_add(close == close_auth ? METRIC_HANDSHAKE_AUTH
+			    : close == close_protocol ? METRIC_HANDSHAKE_PROTOCOL
+			    : close == close_connect ? METRIC_HANDSHAKE_CONNECT : METRIC_HANDSHAKE_ABANDONED, 1);
+	}
+
+	// Хэндшейк с родителем мог не успеть доехать — его сокет уже закрыт вместе с туннелем
+	if (tunnel->upstream != NULL)
+	{
+		upstream_conn_release(tunnel->upstream);
+	}
+	// Виртуальная сторона туннеля — закрываем стрим у соседа
+	if (tunnel->stream != NULL)
+	{
+		mux_stream_detach(tunnel->stream);
+	}
+	if (tunnel->http != NULL)
+	{
+		http_front_release(tunnel->http);
+	}
+	if (tunnel->inspect != NULL)
+	{
+		inspect_flow_release(tunnel->inspect);
+	}
+	if (tunnel->inspect_held != NULL)
+	{
+		inspect_held_release(tunnel->inspect_held);
+	}
+	if (tunnel->capture != NULL)
+	{
+		capture_flow_release(tunnel->capture);
+	}
+	free(tunnel->tls);
 	free(tunnel);
 }
 
+/**
+ * Жёстко гасит оба сокета; если сокетов нет (только стрим) — освобождает туннель сам.
+ */
+void tunnel_abort(tunnel_t *tunnel)
+{
+	sock_t *client_sock = tunnel->client_sock;
+	sock_t *remote_sock = tunnel->remote_sock;
+
+	tunnel_close_reason(tunnel, close_aborted);
+	if (client_sock == NULL && remote_sock == NULL)
+	{
+		tunnel_release(tunnel);
+		return;
+	}
+	// Последний закрытый сокет сам освободит туннель
+	if (client_sock != NULL && remote_sock != NULL)
+	{
+		sock_force_shutdown(client_sock);
+		sock_force_shutdown(remote_sock);
+	}
+	else
+	{
+		sock_force_shutdown(client_sock != NULL ? client_sock : remote_sock);
+	}
+}
+
 /**
  * Закрывает оба сокета (клиента и удалённого) мягко,
  * позволяя завершить отправку накопленных данных.
  */
 static void tunnel_shutdown(tunnel_t *tunnel)
 {
-	if (tunnel->client_sock != NULL)
+	// Запоминаем оба сокета заранее: закрытие последнего освобождает туннель
+	sock_t *client_sock = tunnel->client_sock;
+	sock_t *remote_sock = tunnel->remote_sock;
+
+	if (client_sock != NULL)
 	{
-		sock_shutdown(tunnel->client_sock);
+		sock_shutdown(client_sock);
 	}
-	if (tunnel->remote_sock != NULL)
+	if (remote_sock != NULL)
 	{
-		sock_shutdown(tunnel->remote_sock);
+		sock_shutdown(remote_sock);
 	}
 }
 
 // Прототипы внутренних обработчиков состояний
-static int tunnel_connected_handle(tunnel_t *tunnel, int is_client);
+static int tunnel_connected_handle(tunnel_t *tunnel, int is_client, size_t fresh);
 
 static int tunnel_connecting_handle(tunnel_t *tunnel);
 
+static int tunnel_established(tunnel_t *tunnel);
+
+static int tunnel_flush_pending(tunnel_t *tunnel);
+
+static int tunnel_reply_client(tunnel_t *tunnel, const uint8_t *bnd, size_t len);
+
 
 /**
  * Обработчик EPOLLIN: получение данных из сокета.
@@ -131,6 +327,12 @@ void tunnel_read_handle(int fd, void *ud)
 	sock_t *sock = (sock_t*)ud;
 	tunnel_t *tunnel = sock->tunnel;
 
+	// Замороженный туннель не читает: данные ждут в ядре, окно TCP тормозит отправителя
+	if (tunnel->state == connected_state && freeze_check(tunnel, sock))
+	{
+		return;
+	}
+
 	// Считываем доступные данные в buffer_read_buffer
 	int n = buffer_readfd(sock->read_buffer, fd);
 	if (n < 0)
@@ -142,16 +344,46 @@ void tunnel_read_handle(int fd, void *ud)
 			case EAGAIN_EWOULDBLOCK:
 				break;
 			default:
+				tunnel_close_reason(tunnel, close_read_error);
 				goto shutdown; // критическая ошибка
 		}
 
 	}
 	else if (n == 0)
 	{
+		tunnel_close_reason(tunnel, sock->is_client ? close_client_eof : close_remote_eof);
+		// Пока коннект не доехал, полухлопок бессмысленен — клиент так и не получит ответ
+		if (tunnel->state == connecting_state)
+		{
+			goto tunnel_shutdown;
+		}
+		// HTTP-фронт: origin закрылся — клиенту тоже пора (тело могло быть «до закрытия»)
+		if (tunnel->http != NULL && !sock->is_client && tunnel->client_sock != NULL)
+		{
+			sock_t *client_sock = tunnel->client_sock;
+			LOG_DEBUG("Read returned %d on fd=%d – initiating shutdown", n, fd);
+			sock_shutdown(sock);
+			sock_shutdown(client_sock);
+			return;
+		}
 		// peer выполнил shutdown -> полухлопок
 		goto shutdown;
 	}
 
+	// Считаем чтение (до хэндлера — он может освободить туннель)
+	if (n > 0)
+	{
+		tunnel->stats.rx[sock->is_client] += (unsigned)n;
+		++tunnel->stats.reads[sock->is_client];
+		stats_tunnel_read(tunnel, sock->is_client, (size_t)n);
+		if (!sock->is_client && tunnel->stats.first_us == 0 && tunnel->state == connected_state)
+		{
+			tunnel->stats.first_us = tunnel_now_us();
+		}
+	}
+	LOG_DEBUG("Read %d bytes from %s (fd=%d), state=%d",
+		  n, sock->is_client ? "client" : "remote", fd, tunnel->state);
+
 	// В зависимости от состояния туннеля вызываем соответствующий хэндлер
 	switch (tunnel->state)
 	{
@@ -172,13 +404,15 @@ void tunnel_read_handle(int fd, void *ud)
 		}
 		case connecting_state:
 		{
-			assert(sock->is_client == 0);
+			// Данные клиента, пришедшие раньше ответа, ждут в read_buffer до установки туннеля
+			if (sock->is_client) break;
 			if (tunnel_connecting_handle(tunnel) < 0) goto tunnel_shutdown;
 			break;
 		}
 		case connected_state:
 		{
-			if (tunnel_connected_handle(tunnel, sock->is_client) < 0) goto tunnel_shutdown;
+			// EAGAIN/EINTR (n < 0) — нового ничего; то, что ждёт в буфере, уже публиковали
+			if (tunnel_connected_handle(tunnel, sock->is_client, n > 0 ? (size_t)n : 0) < 0) goto tunnel_shutdown;
 			break;
 		}
 		default:
@@ -188,23 +422,21 @@ void tunnel_read_handle(int fd, void *ud)
 		}
 	}
 
-	// Логируем факт чтения и текущее состояние
-	LOG_INFO("Read %d bytes from %s (fd=%d), state=%d",
-		 n, sock->is_client ? "client" : "remote", fd, tunnel->state);
-
 	return;
 
 force_shutdown: // команда peer некорректна, принудительное завершение
+	tunnel_close_reason(tunnel, close_protocol);
 	LOG_WARN("Read returned %d on fd=%d – initiating shutdown", n, fd);
 	sock_force_shutdown(sock);
 	return;
 
-shutdown: // мягкое завершение после EOF или ошибки
-	LOG_WARN("Read returned %d on fd=%d – initiating shutdown", n, fd);
+shutdown: // мягкое завершение после EOF или ошибки (причина уже в stats.close)
+	LOG_DEBUG("Read returned %d on fd=%d – initiating shutdown", n, fd);
 	sock_shutdown(sock);
 	return;
 
 tunnel_shutdown: // завершение всего туннеля при ошибке
+	tunnel_close_reason(tunnel, tunnel->state == connected_state ? close_forward : close_connect);
 	LOG_WARN("Read returned %d on fd=%d – initiating shutdown", n, fd);
 	tunnel_shutdown(tunnel);
 }
@@ -231,13 +463,26 @@ void tunnel_write_handle(int fd, void *ud)
 				case EAGAIN_EWOULDBLOCK:
 					break;
 				default:
+					tunnel_close_reason(tunnel, close_write_error);
 					goto force_shutdown;
 			}
 		}
-		LOG_INFO("Wrote %d bytes to %s (fd=%d)", n, sock->is_client ? "client" : "remote", fd);
+		else
+		{
+			tunnel->stats.tx[sock->is_client] += (unsigned)n;
+			++tunnel->stats.writes[sock->is_client];
+			metrics_add(sock->is_client ? METRIC_BYTES_TO_CLIENT : METRIC_BYTES_TO_REMOTE, (unsigned)n);
+		}
+		LOG_DEBUG("Wrote %d bytes to %s (fd=%d)", n, sock->is_client ? "client" : "remote", fd);
+
+		// Данные из стрима ушли в настоящий сокет — возвращаем окно соседу
+		if (n > 0 && tunnel->stream != NULL)
+		{
+			mux_stream_consumed(tunnel->stream, n);
+		}
 
 	}
-	else if (sock->state == sock_halfclosed)
+	else if (sock->state == sock_halfclosed && !(sock->paused & SOCK_PAUSE_WINDOW))
 	{
 		// Если удалённый сокет закрыл запись — принудительно завершаем
 		goto force_shutdown;
@@ -256,12 +501,22 @@ void tunnel_write_handle(int fd, void *ud)
 
 	// Обновляем события epoll: интерес к записи, если остались данные
 	int writable = buffer_readable(sock->write_buffer) > 0;
+
+	// Полузакрытый сокет дописал всё — закрываем сразу (FIN из стрима мультиплексора
+	// не сопровождается EOF на самом сокете, и повторного события может не быть).
+	// Если он ждёт окна стрима, чтобы отправить свой хвост, — закроет WINDOW (mux.c)
+	if (!writable && sock->state == sock_halfclosed && !(sock->paused & SOCK_PAUSE_WINDOW))
+	{
+		sock_force_shutdown(sock);
+		return;
+	}
 	epoll_modify(sock, writable, 1);
 
 	return;
 
 // Закрываем весь туннель при серьёзной ошибке записи
 tunnel_shutdown:
+	tunnel_close_reason(tunnel, close_connect);
 	tunnel_shutdown(tunnel);
 	LOG_ERROR("Write error on fd=%d: %s", fd, strerror(errno));
 	return;
@@ -273,66 +528,62 @@ force_shutdown: // принудительное завершение тольк
 }
 
 /**
- * Вспомогательный вывод данных в шестнадцатеричном виде.
- * Ограничиваем логирование первыми 128 байтами для читаемости.
+ * Обработка уже установленного туннеля: анализ, захват и форвардинг данных.
+ * На анализ и в pcapng-захват уходят только fresh последних байт read_buffer — то,
+ * что пришло сейчас (остальное уже видели, оно ждёт отправки). Разбирают их потоки
+ * анализа и записи по снимку буфера, здесь только публикация — форвардинг их не ждёт.
+ * Туннель, который по политике не разбирается и не пишется (или уже исчерпал бюджет),
+ * стоит одной проверки флага.
+ * Заморозка сюда не доходит: замороженный туннель не читает вовсе (freeze_check).
  */
-static void dump_hex(const char *label, const uint8_t *buf, size_t len)
+static int tunnel_connected_handle(tunnel_t *tunnel, int is_client, size_t fresh)
 {
-	size_t max = len < 128 ? len : 128;
-	char hexstr[3 * 128 + 1] = {0};
-	char *p = hexstr;
-	for (size_t i = 0; i < max; i++)
+	if (!tunnel->inspect_off)
+	{
+		inspect_publish(tunnel, is_client, fresh);
+	}
+	if (!tunnel->capture_off)
 	{
-		// Формируем текст вида "ab cd ef ..."
-		p += sprintf(p, "%02x ", buf[i]);
+		capture_publish(tunnel, is_client, fresh);
 	}
-	LOG_INFO("%s hex (%zu bytes): %s% s", label, len, hexstr,
-			 (len > max ? "...(truncated)" : ""));
+
+	return tunnel_forward(tunnel, is_client);
 }
 
 /**
- * Обработка уже установленного туннеля: анализ и форвардинг данных.
- * Если не удалось распарсить HTTP/WebSocket — делаем hex-dump.
- * При активном флаге freeze пропускаем форвардинг.
+ * Форвардинг: read_buffer стороны is_client уезжает на противоположную сторону.
  */
-static int tunnel_connected_handle(tunnel_t *tunnel, int is_client)
+int tunnel_forward(tunnel_t *tunnel, int is_client)
 {
-	// Определяем направления read/write: front - куда писать, rear - откуда читать
-	sock_t *sock_front = is_client ? tunnel->remote_sock : tunnel->client_sock;
 	sock_t *sock_rear = is_client ? tunnel->client_sock : tunnel->remote_sock;
 
-	char *label = is_client ? "Forwarded client → remote" : "Forwarded remote → client";
-
-	if (sock_front == NULL)
+	// Противоположная сторона — стрим мультиплексора: он сам следит за окном
+	if (tunnel->stream != NULL && mux_stream_client_side(tunnel->stream) != is_client)
 	{
-		// Отсутствие противоположного сокета — фатальная ошибка
-		return -1;
+		return mux_stream_send(tunnel->stream, sock_rear);
 	}
 
-	buffer_t *rear_buffer = sock_rear->read_buffer;
-	uint8_t *buffer_data = (uint8_t *) rear_buffer->data + rear_buffer->read_index;
-	size_t length = buffer_readable(rear_buffer);
-
-	// Пытаемся логировать HTTP или WebSocket
-	if (!parse_and_log_http(buffer_data, length, is_client) &&
-		!parse_and_log_websocket(buffer_data, length, is_client))
+	// HTTP-прокси с обычными запросами: пересылаем по границам сообщений
+	if (tunnel->http != NULL && http_framed(tunnel->http))
 	{
-		// Если оба разбора не сработали — выводим hex
-		dump_hex(label, buffer_data, length);
+		return http_forward(tunnel, is_client);
 	}
 
-	// Если пользователь заморозил туннель — не пересылаем данные дальше
-	if (terminal_is_frozen())
+	sock_t *sock_front = is_client ? tunnel->remote_sock : tunnel->client_sock;
+	if (sock_front == NULL)
 	{
-		return 0;
+		// Отсутствие противоположного сокета — фатальная ошибка
+		return -1;
 	}
 
+	buffer_t *rear_buffer = sock_rear->read_buffer;
+
 	// Переносим данные из read_buffer в write_buffer противопололожного сокета
 	if (buffer_concat(sock_front->write_buffer, rear_buffer) < 0)
 	{
 		return -1;
 	}
-    buffer_clear(rear_buffer);  // очищаем буфер после успешной конкатенации
+	buffer_clear(rear_buffer);  // очищаем буфер после успешной конкатенации
 
 	// Обновляем epoll: включаем интерес к записи на front-сокете
 	epoll_modify(sock_front, 1, 1);
@@ -343,54 +594,71 @@ static int tunnel_connected_handle(tunnel_t *tunnel, int is_client)
 /**
  * Отправляет клиенту ответ о успешном подключении SOCKS5.
  * В зависимости от семейства адреса (IPv4/IPv6) формирует тело ответа.
+ * Если клиент — стрим мультиплексора, хвост ответа (ATYP, BND.ADDR, BND.PORT) уходит в OPEN_OK.
  */
 static int tunnel_notify_connected(tunnel_t *tunnel)
 {
-	sockaddr_t sa;
+	struct sockaddr_storage sa;
 	socklen_t len = sizeof(sa);
-	uint8_t header[4];
+	uint8_t reply[4 + 16 + 2];
+	size_t size;
 
-	header[0] = 0x05;  // версия SOCKS5
-	header[1] = 0x00;  // статус: успех
-	header[2] = 0x00;  // зарезервировано
+	reply[0] = 0x05;  // версия SOCKS5
+	reply[1] = 0x00;  // статус: успех
+	reply[2] = 0x00;  // зарезервировано
 
 	// Извлекаем локальный адрес удалённого сокета
-	if (getsockname(tunnel->remote_sock->fd, &sa, &len) < 0)
+	if (getsockname(tunnel->remote_sock->fd, (sockaddr_t*)&sa, &len) < 0)
 	{
 		return -1;
 	}
 
-	if (sa.sa_family == AF_INET)
+	if (sa.ss_family == AF_INET)
 	{
-        header[3] = IPV4; // тип адреса: IPv4
-		if (tunnel_write_client(tunnel, header, sizeof(header)) < 0)
-		{
-			return -1;
-		}
-
 		sockaddr_in_t *sa_in = (sockaddr_in_t*)&sa;
-		if (tunnel_write_client(tunnel, &sa_in->sin_addr, sizeof(sa_in->sin_addr)) < 0)
-		{
-			return -1;
-		}
-		if (tunnel_write_client(tunnel, &sa_in->sin_port, sizeof(sa_in->sin_port)) < 0)
-		{
-			return -1;
-		}
+		reply[3] = IPV4; // тип адреса: IPv4
+		memcpy(reply + 4, &sa_in->sin_addr, 4);
+		memcpy(reply + 4 + 4, &sa_in->sin_port, 2);
+		size = 4 + 4 + 2;
 	}
-	else if (sa.sa_family == AF_INET6)
+	else if (sa.ss_family == AF_INET6)
 	{
-        header[3] = IPV6; // тип адреса: IPv6
-		tunnel_write_client(tunnel, header, sizeof(header));
-
 		sockaddr_in6_t *sa_in6 = (sockaddr_in6_t*)&sa;
-		tunnel_write_client(tunnel, &sa_in6->sin6_addr, sizeof(sa_in6->sin6_addr));
-		tunnel_write_client(tunnel, &sa_in6->sin6_port, sizeof(sa_in6->sin6_port));
+		reply[3] = IPV6; // тип адреса: IPv6
+		memcpy(reply + 4, &sa_in6->sin6_addr, 16);
+		memcpy(reply + 4 + 16, &sa_in6->sin6_port, 2);
+		size = 4 + 16 + 2;
 	}
 	else
 	{
 		// Неподдерживаемое семейство адресов
-		LOG_ERROR("Failed tunnel_notify_connected, unexpected family=%d", sa.sa_family);
+		LOG_ERROR("Failed tunnel_notify_connected, unexpected family=%d", sa.ss_family);
+		return -1;
+	}
+
+	if (tunnel->stream != NULL && mux_stream_client_side(tunnel->stream))
+	{
+		return mux_stream_open_ok(tunnel->stream, reply + 3, size - 3);
+	}
+
+	return tunnel_reply_client(tunnel, reply + 3, size - 3);
+}
+
+/**
+ * Отвечает клиенту об успешном коннекте на его протоколе:
+ * SOCKS5 — VER, REP, RSV + bnd (ATYP, BND.ADDR, BND.PORT), HTTP — через фронт.
+ */
+static int tunnel_reply_client(tunnel_t *tunnel, const uint8_t *bnd, size_t len)
+{
+	if (tunnel->http != NULL)
+	{
+		return http_connected(tunnel);
+	}
+
+	uint8_t header[3] = { 0x05, 0x00, 0x00 };  // VER, REP=успех, RSV
+	if (tunnel_write_client(tunnel, header, sizeof(header)) < 0
+		|| tunnel_write_client(tunnel, (void*)bnd, len) < 0)
+	{
 		return -1;
 	}
 
@@ -425,6 +693,17 @@ int tunnel_write_client(tunnel_t *tunnel, void *src, size_t size)
  */
 static int tunnel_connecting_handle(tunnel_t *tunnel)
 {
+	if (tunnel->upstream != NULL)
+	{
+		// Через родителя: коннект закончен, только когда он ответил на наш CONNECT
+		int status = upstream_connecting_handle(tunnel);
+		if (status <= 0)
+		{
+			return status;
+		}
+		return tunnel_established(tunnel);
+	}
+
 	int error;
 	socklen_t len = sizeof(error);
 	int code = getsockopt(tunnel->remote_sock->fd, SOL_SOCKET, SO_ERROR, &error, &len);
@@ -440,9 +719,83 @@ static int tunnel_connecting_handle(tunnel_t *tunnel)
 
 	LOG_INFO("Remote connection established on fd=%d", tunnel->remote_sock->fd);
 
+	return tunnel_established(tunnel);
+}
+
+/**
+ * Туннель установлен: состояние, тайминг сессии, слот stats, метрики хэндшейка.
+ */
+static void tunnel_mark_connected(tunnel_t *tunnel)
+{
 	tunnel->state = connected_state;
+	tunnel->stats.connected_us = tunnel_now_us();
+	stats_tunnel_update(tunnel);
+	metrics_add(METRIC_HANDSHAKE_OK, 1);
+	if (tunnel->stats.request_us != 0)
+	{
+		metrics_connect_time(tunnel->stats.connected_us - tunnel->stats.request_us);
+	}
+}
+
+/**
+ * Переводит туннель в connected_state, шлёт клиенту ответ и форвардит всё,
+ * что успело скопиться в буферах с обеих сторон, пока шёл коннект.
+ */
+static int tunnel_established(tunnel_t *tunnel)
+{
+	tunnel_mark_connected(tunnel);
 	tunnel->remote_sock->state = sock_connected;
-	return tunnel_notify_connected(tunnel);
+	if (tunnel_notify_connected(tunnel) < 0)
+	{
+		return -1;
+	}
+	return tunnel_flush_pending(tunnel);
+}
+
+/**
+ * Форвардит то, что скопилось в read_buffer'ах, пока туннель не был установлен.
+ */
+static int tunnel_flush_pending(tunnel_t *tunnel)
+{
+	if (tunnel->client_sock != NULL
+		&& buffer_readable(tunnel->client_sock->read_buffer) > 0
+		&& tunnel_connected_handle(tunnel, 1, buffer_readable(tunnel->client_sock->read_buffer)) < 0)
+	{
+		return -1;
+	}
+	if (tunnel->remote_sock != NULL
+		&& buffer_readable(tunnel->remote_sock->read_buffer) > 0
+		&& tunnel_connected_handle(tunnel, 0, buffer_readable(tunnel->remote_sock->read_buffer)) < 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Edge: core подтвердил стрим — отвечаем клиенту его BND-адресом.
+ */
+int tunnel_stream_opened(tunnel_t *tunnel, const uint8_t *bnd, size_t len)
+{
+	tunnel_mark_connected(tunnel);
+	if (tunnel_reply_client(tunnel, bnd, len) < 0)
+	{
+		return -1;
+	}
+	return tunnel_flush_pending(tunnel);
+}
+
+/**
+ * Подхватывает уже открытый сокет как удалённый сокет туннеля.
+ */
+void tunnel_attach_remote(tunnel_t *tunnel, sock_t *sock)
+{
+	sock->tunnel       = tunnel;
+	sock->context      = NULL;
+	sock->is_client    = 0;
+	sock->read_handle  = tunnel_read_handle;
+	sock->write_handle = tunnel_write_handle;
+	tunnel->remote_sock = sock;
 }
 
 /**
@@ -456,6 +809,8 @@ int tunnel_connect_to_remote(tunnel_t *tunnel)
 	char ip[64];
 	char port[16];
 
+	tunnel->stats.request_us = tunnel_now_us();
+
 	// Преобразуем порт в строковый формат
 	snprintf(port, sizeof(port),"%d", ntohs(tunnel->rp.port));
 	switch(atyp)
@@ -484,6 +839,46 @@ int tunnel_connect_to_remote(tunnel_t *tunnel)
 		}
 	}
 
+	// Запоминаем назначение строкой — пригодится для апстрима, пулов и логов
+	snprintf(tunnel->dst_host, sizeof(tunnel->dst_host), "%s", addr);
+	snprintf(tunnel->dst_port, sizeof(tunnel->dst_port), "%s", port);
+	stats_tunnel_update(tunnel);
+	LOG_INFO("Tunnel %llu to %s:%s", tunnel->id, addr, port);
+
+	// HTTP-прокси: простаивающее keep-alive соединение к этому origin'у лучше любого коннекта
+	if (tunnel->http != NULL)
+	{
+		sock_t *idle = http_pool_take(tunnel);
+		if (idle != NULL)
+		{
+			tunnel_attach_remote(tunnel, idle);
+			epoll_modify(idle, 0, 1);
+			return tunnel_established(tunnel);
+		}
+	}
+
+	// Edge-режим: коннект делает core-инстанс на том конце линка
+	if (mux_edge_enabled() && tunnel->stream == NULL)
+	{
+		return mux_connect(tunnel);
+	}
+
+	// В режиме апстрима сами не резолвим и не коннектимся — это делает родитель
+	if (upstream_enabled())
+	{
+		return upstream_connect(tunnel);
+	}
+
+	// Горячее назначение: берём уже подключённый сокет из пула и отвечаем клиенту сразу
+	sock_t *pooled = preconnect_take(tunnel);
+	if (pooled != NULL)
+	{
+		LOG_INFO("Using pre-connected fd=%d for %s:%s", pooled->fd, addr, port);
+		tunnel_attach_remote(tunnel, pooled);
+		epoll_modify(pooled, 0, 1);
+		return tunnel_established(tunnel);
+	}
+
 	LOG_INFO("Resolving %s:%s", addr, port);
 
 	// Настраиваем параметры getaddrinfo
@@ -500,10 +895,14 @@ int tunnel_connect_to_remote(tunnel_t *tunnel)
     // Перебираем все возможные адреса до первого успешного connect()
 	if (getaddrinfo(addr, port, &ai_hint, &ai_list) != 0)
 	{
+		metrics_add(METRIC_DNS_ERROR, 1);
 		LOG_ERROR("Failed getaddrinfo, addr=%s,port=%s, error=%s", addr, port, gai_strerror(errno));
+		tunnel_close_reason(tunnel, close_connect);
 		return -1;
 	}
 
+	metrics_add(METRIC_DNS_OK, 1);
+
 	int newfd = -1;
 	int status;
 	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
@@ -517,6 +916,7 @@ int tunnel_connect_to_remote(tunnel_t *tunnel)
 		sock_keepalive(newfd);
 
 		status = connect(newfd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+		metrics_add(METRIC_SYS_CONNECT, 1);
 
 		LOG_INFO("Connecting to remote %s:%s → fd=%d (status=%s)", addr, port, newfd,
 			(status == 0 ? "immediate" : "in progress"));
@@ -536,6 +936,7 @@ int tunnel_connect_to_remote(tunnel_t *tunnel)
 
 	if (newfd < 0)
 	{
+		tunnel_close_reason(tunnel, close_connect);
 		return -1;
 	}
 
@@ -554,15 +955,14 @@ int tunnel_connect_to_remote(tunnel_t *tunnel)
 	if (status == 0)
 	{
 		// Соединение завершилось мгновенно
-		tunnel->state = connected_state;
-		sock->state = sock_connected;
-		return tunnel_notify_connected(tunnel);
+		return tunnel_established(tunnel);
 	}
 	else
 	{
 		// Ожидаем завершения неблокирующего connect
 		tunnel->state = connecting_state;
 		sock->state = sock_connecting;
+		stats_tunnel_update(tunnel);
 	}
 
 	return 0;
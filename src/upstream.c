@@ -0,0 +1,852 @@
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "upstream.h"
+#include "buffer.h"
+#include "logger.h"
+#include "server.h"
+#include "sock.h"
+#include "metrics.h"
+
+
+#define UPSTREAM_MAX_PARENTS  64     // Максимум родителей в списке
+#define UPSTREAM_VNODES       128    // Виртуальных узлов на родителя в кольце
+#define UPSTREAM_POOL_SIZE    4      // Тёплых соединений на родителя
+#define UPSTREAM_MAX_FAILS    3      // Ошибок подряд, после которых родителя выкидываем
+#define UPSTREAM_EJECT_MS     2000   // Стартовая пауза перед активной пробой
+#define UPSTREAM_EJECT_MAX_MS 60000  // Потолок экспоненциальной паузы
+#define UPSTREAM_HANDSHAKE_MS 5000   // Сколько ждём хэндшейк тёплого соединения
+#define UPSTREAM_IDLE_MS      30000  // Сколько тёплое соединение может простаивать в пуле
+#define UPSTREAM_TICK_MS      500    // Период таймера пулов и проб
+
+#define SOCKS5_VERSION   0x05
+#define SOCKS5_NO_AUTH   0x00
+#define SOCKS5_USER_PASS 0x02
+#define SOCKS5_CONNECT   0x01
+#define AUTH_VERSION     0x01
+
+#define ATYP_IPV4   0x01
+#define ATYP_DOMAIN 0x03
+#define ATYP_IPV6   0x04
+
+
+/*
+ * Этапы клиентского SOCKS5-хэндшейка с родителем
+ */
+typedef enum upstream_step
+{
+    up_connecting,  // Ждём завершения неблокирующего connect
+    up_greeting,    // Отправили greeting, ждём [VER, METHOD]
+    up_auth,        // Отправили USER/PASS, ждём [VER, STATUS]
+    up_ready,       // Хэндшейк пройден — соединение тёплое, можно слать CONNECT
+    up_request,     // Отправили CONNECT, ждём ответ родителя
+    up_done         // Родитель подтвердил CONNECT
+} upstream_step_t;
+
+typedef struct upstream_parent upstream_parent_t;
+
+/*
+ * Одно соединение с родителем: либо лежит в пуле, либо висит на туннеле
+ */
+struct upstream_conn
+{
+    sock_t             *sock;      // Сокет к родителю
+    upstream_parent_t  *parent;    // Чей это сокет
+    upstream_step_t     step;      // Где мы в хэндшейке
+    int                 probe;     // 1 — активная проба выкинутого родителя
+    unsigned long long  deadline;  // Дедлайн хэндшейка или простоя в пуле
+    upstream_conn_t    *prev;      // Соседи по пулу родителя
+    upstream_conn_t    *next;
+};
+
+/*
+ * Родительский прокси и его здоровье
+ */
+struct upstream_parent
+{
+    char                    host[256];
+    char                    port[16];
+    char                    username[255];
+    char                    passwd[255];
+    struct sockaddr_storage addr;         // Зарезолвленный адрес (резолвим один раз на старте)
+    socklen_t               addrlen;
+    int                     healthy;      // 1 — в кольце, 0 — выкинут
+    int                     fails;        // Ошибок подряд
+    int                     eject_ms;     // Текущая пауза до пробы (растёт экспонентой)
+    unsigned long long      eject_until;  // Когда можно пробовать вернуть
+    upstream_conn_t        *pool;         // Тёплые и прогревающиеся соединения
+    int                     npool;        // Сколько всего в пуле
+    int                     nready;       // Из них готовы к CONNECT
+};
+
+/*
+ * Точка на кольце консистентного хэширования
+ */
+typedef struct ring_node
+{
+    uint64_t hash;
+    int      parent;
+} ring_node_t;
+
+
+static upstream_parent_t parents[UPSTREAM_MAX_PARENTS];
+static int               nparents = 0;
+static ring_node_t      *ring     = NULL;
+static size_t            nring    = 0;
+
+
+static void upstream_pool_read_handle(int fd, void *ud);
+
+static void upstream_pool_write_handle(int fd, void *ud);
+
+
+/*
+ * FNV-1a с финальным перемешиванием (splitmix64), чтобы виртуальные узлы
+ * с похожими именами не слипались на кольце
+ */
+static uint64_t upstream_hash(const char *str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *str; ++str)
+    {
+        h ^= (uint8_t)*str;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static int ring_node_cmp(const void *a, const void *b)
+{
+    uint64_t ha = ((const ring_node_t *)a)->hash;
+    uint64_t hb = ((const ring_node_t *)b)->hash;
+    return ha < hb ? -1 : ha > hb;
+}
+
+/*
+ * Строит кольцо: по UPSTREAM_VNODES точек на каждого родителя
+ */
+static int ring_build(void)
+{
+    nring = (size_t)nparents * UPSTREAM_VNODES;
+    ring  = malloc(nring * sizeof(*ring));
+    if (ring == NULL)
+    {
+        return -1;
+    }
+
+    // "хост:порт#узел": оба поля с нулём, плюс ':', '#' и номер узла
+    char name[sizeof(parents->host) + sizeof(parents->port) + 16];
+    for (int i = 0; i < nparents; ++i)
+    {
+        for (int v = 0; v < UPSTREAM_VNODES; ++v)
+        {
+            int n = snprintf(name, sizeof(name), "%s:%s#%d", parents[i].host, parents[i].port, v);
+            if (n < 0 || (size_t)n >= sizeof(name))
+            {
+                free(ring);
+                ring = NULL;
+                return -1;
+            }
+            ring[i * UPSTREAM_VNODES + v].hash   = upstream_hash(name);
+            ring[i * UPSTREAM_VNODES + v].parent = i;
+        }
+    }
+    qsort(ring, nring, sizeof(*ring), ring_node_cmp);
+    return 0;
+}
+
+/*
+ * Ищет живого родителя для ключа: первая точка кольца >= hash и дальше по часовой,
+ * пропуская выкинутых — так падение одного родителя двигает только его ключи
+ */
+static upstream_parent_t *ring_lookup(const char *key)
+{
+    uint64_t h  = upstream_hash(key);
+    size_t   lo = 0;
+    size_t   hi = nring;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (ring[mid].hash < h)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    for (size_t i = 0; i < nring; ++i)
+    {
+        upstream_parent_t *p = &parents[ring[(lo + i) % nring].parent];
+        if (p->healthy)
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Разбирает "[user:pass@]host:port" (host может быть [IPv6]) и резолвит адрес
+ */
+static int upstream_parse_parent(char *spec, upstream_parent_t *p)
+{
+    memset(p, 0, sizeof(*p));
+
+    char *hostport = spec;
+    char *at       = strrchr(spec, '@');
+    if (at != NULL)
+    {
+        *at = '\0';
+        hostport = at + 1;
+        char *colon = strchr(spec, ':');
+        if (colon == NULL)
+        {
+            return -1;
+        }
+        *colon = '\0';
+        snprintf(p->username, sizeof(p->username), "%s", spec);
+        snprintf(p->passwd,   sizeof(p->passwd),   "%s", colon + 1);
+    }
+
+    char *colon = strrchr(hostport, ':');
+    if (colon == NULL || colon == hostport)
+    {
+        return -1;
+    }
+    *colon = '\0';
+    if (hostport[0] == '[' && colon[-1] == ']')
+    {
+        colon[-1] = '\0';
+        ++hostport;
+    }
+    snprintf(p->host, sizeof(p->host), "%s", hostport);
+    snprintf(p->port, sizeof(p->port), "%s", colon + 1);
+
+    struct addrinfo hint;
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family   = AF_UNSPEC;
+    hint.ai_socktype = SOCK_STREAM;
+    hint.ai_protocol = IPPROTO_TCP;
+
+    struct addrinfo *ai = NULL;
+    int rc = getaddrinfo(p->host, p->port, &hint, &ai);
+    if (rc != 0)
+    {
+        LOG_ERROR("Failed upstream resolve %s:%s, error=%s", p->host, p->port, gai_strerror(rc));
+        return -1;
+    }
+    memcpy(&p->addr, ai->ai_addr, ai->ai_addrlen);
+    p->addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+
+    p->healthy  = 1;
+    p->eject_ms = UPSTREAM_EJECT_MS;
+    return 0;
+}
+
+/*
+ * Пул родителя: двусвязный список
+ */
+static void pool_link(upstream_parent_t *p, upstream_conn_t *uc)
+{
+    uc->prev = NULL;
+    uc->next = p->pool;
+    if (p->pool != NULL)
+    {
+        p->pool->prev = uc;
+    }
+    p->pool = uc;
+    ++p->npool;
+}
+
+static void pool_unlink(upstream_parent_t *p, upstream_conn_t *uc)
+{
+    if (uc->prev != NULL)
+    {
+        uc->prev->next = uc->next;
+    }
+    else
+    {
+        p->pool = uc->next;
+    }
+    if (uc->next != NULL)
+    {
+        uc->next->prev = uc->prev;
+    }
+    uc->prev = uc->next = NULL;
+    --p->npool;
+    if (uc->step == up_ready)
+    {
+        --p->nready;
+    }
+}
+
+/*
+ * Открывает неблокирующее соединение к родителю. Сокет сразу в epoll
+ * с пуловыми хэндлерами; туннель, если заберёт его, переназначит их на свои
+ */
+static upstream_conn_t *upstream_dial(upstream_parent_t *p)
+{
+    int fd = socket(p->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+    {
+        LOG_ERROR("Failed upstream socket for %s:%s: %s", p->host, p->port, strerror(errno));
+        return NULL;
+    }
+    sock_nonblocking(fd);
+    sock_keepalive(fd);
+
+    metrics_add(METRIC_SYS_CONNECT, 1);
+    if (connect(fd, (struct sockaddr *)&p->addr, p->addrlen) != 0 && errno != EINPROGRESS)
+    {
+        LOG_ERROR("Connect failed to parent %s:%s: %s", p->host, p->port, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    upstream_conn_t *uc = malloc(sizeof(*uc));
+    if (uc == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    memset(uc, 0, sizeof(*uc));
+
+    sock_t *sock = sock_create(fd, sock_connecting, 0, NULL);
+    if (sock == NULL)
+    {
+        free(uc);
+        close(fd);
+        return NULL;
+    }
+    sock->context      = uc;
+    sock->read_handle  = upstream_pool_read_handle;
+    sock->write_handle = upstream_pool_write_handle;
+
+    uc->sock     = sock;
+    uc->parent   = p;
+    uc->step     = up_connecting;
+    uc->deadline = server_now_ms() + UPSTREAM_HANDSHAKE_MS;
+
+    // Ждём EPOLLOUT — он скажет, что connect доехал (или упал)
+    epoll_add(sock);
+    epoll_modify(sock, 1, 1);
+    return uc;
+}
+
+/*
+ * Родитель отработал нормально — сбрасываем счётчик и возвращаем в кольцо, если был выкинут
+ */
+static void upstream_parent_ok(upstream_parent_t *p)
+{
+    p->fails = 0;
+    if (!p->healthy)
+    {
+        p->healthy  = 1;
+        p->eject_ms = UPSTREAM_EJECT_MS;
+        EXTRA_LOG_WARN("Upstream parent %s:%s is back in rotation", p->host, p->port);
+    }
+}
+
+static void upstream_pool_drop(upstream_conn_t *uc, int failure);
+
+/*
+ * Ошибка коннекта/хэндшейка. После UPSTREAM_MAX_FAILS подряд (или проваленной пробы)
+ * выкидываем родителя из кольца и гасим его пул
+ */
+static void upstream_parent_failed(upstream_parent_t *p, int probe)
+{
+    ++p->fails;
+    if (!probe && (!p->healthy || p->fails < UPSTREAM_MAX_FAILS))
+    {
+        return;
+    }
+
+    if (probe)
+    {
+        // Проба не прошла — ждём дольше, но не больше потолка
+        p->eject_ms *= 2;
+        if (p->eject_ms > UPSTREAM_EJECT_MAX_MS)
+        {
+            p->eject_ms = UPSTREAM_EJECT_MAX_MS;
+        }
+    }
+    else
+    {
+        EXTRA_LOG_WARN("Upstream parent %s:%s ejected after %d failures",
+                       p->host, p->port, p->fails);
+    }
+    p->healthy     = 0;
+    p->eject_until = server_now_ms() + p->eject_ms;
+
+    while (p->pool != NULL)
+    {
+        upstream_pool_drop(p->pool, 0);
+    }
+}
+
+/*
+ * Убирает соединение из пула и закрывает его; failure=1 — засчитать родителю ошибку
+ */
+static void upstream_pool_drop(upstream_conn_t *uc, int failure)
+{
+    upstream_parent_t *p     = uc->parent;
+    int                probe = uc->probe;
+
+    pool_unlink(p, uc);
+    sock_release(uc->sock);
+    free(uc);
+
+    if (failure)
+    {
+        upstream_parent_failed(p, probe);
+    }
+}
+
+/*
+ * Шаг клиентского хэндшейка по тому, что уже лежит в буферах сокета.
+ * Возвращает <0 при ошибке, 0 — ждём дальше, >0 — дошли до up_ready или up_done
+ */
+static int upstream_advance(upstream_conn_t *uc)
+{
+    sock_t            *sock = uc->sock;
+    buffer_t          *buff = sock->read_buffer;
+    upstream_parent_t *p    = uc->parent;
+    int                auth = p->username[0] != '\0';
+
+    switch (uc->step)
+    {
+        case up_connecting:
+        {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error)
+            {
+                if (error)
+                {
+                    errno = error;
+                }
+                return -1;
+            }
+            sock->state = sock_connected;
+
+            // Greeting: [VER, NMETHODS, METHODS...] — USER/PASS предлагаем, только если есть креды
+            uint8_t greeting[3] = { SOCKS5_VERSION, 1, auth ? SOCKS5_USER_PASS : SOCKS5_NO_AUTH };
+            if (buffer_write(sock->write_buffer, greeting, sizeof(greeting)) < 0)
+            {
+                return -1;
+            }
+            uc->step = up_greeting;
+            return 0;
+        }
+        case up_greeting:
+        {
+            if (buffer_readable(buff) < 2)
+            {
+                return 0;
+            }
+            uint8_t reply[2];
+            buffer_read(buff, reply, sizeof(reply));
+            if (reply[0] != SOCKS5_VERSION)
+            {
+                return -1;
+            }
+            if (reply[1] == SOCKS5_NO_AUTH)
+            {
+                uc->step = up_ready;
+                return 1;
+            }
+            if (reply[1] != SOCKS5_USER_PASS || !auth)
+            {
+                LOG_ERROR("Parent %s:%s offered unsupported method 0x%02x", p->host, p->port, reply[1]);
+                return -1;
+            }
+
+            // RFC1929: [VER, ULEN, UNAME, PLEN, PASSWD]
+            uint8_t ulen = (uint8_t)strlen(p->username);
+            uint8_t plen = (uint8_t)strlen(p->passwd);
+            uint8_t ver  = AUTH_VERSION;
+            if (buffer_write(sock->write_buffer, &ver, 1) < 0
+             || buffer_write(sock->write_buffer, &ulen, 1) < 0
+             || buffer_write(sock->write_buffer, p->username, ulen) < 0
+             || buffer_write(sock->write_buffer, &plen, 1) < 0
+             || buffer_write(sock->write_buffer, p->passwd, plen) < 0)
+            {
+                return -1;
+            }
+            uc->step = up_auth;
+            return 0;
+        }
+        case up_auth:
+        {
+            if (buffer_readable(buff) < 2)
+            {
+                return 0;
+            }
+            uint8_t reply[2];
+            buffer_read(buff, reply, sizeof(reply));
+            if (reply[1] != 0x00)
+            {
+                LOG_ERROR("Parent %s:%s rejected credentials", p->host, p->port);
+                return -1;
+            }
+            uc->step = up_ready;
+            return 1;
+        }
+        case up_request:
+        {
+            // Ответ: [VER, REP, RSV, ATYP, BND.ADDR, BND.PORT] — адрес переменной длины
+            size_t readable = buffer_readable(buff);
+            if (readable < 5)
+            {
+                return 0;
+            }
+            const uint8_t *data = (const uint8_t *)buff->data + buff->read_index;
+            size_t need;
+            switch (data[3])
+            {
+                case ATYP_IPV4:   need = 4 + 4 + 2;           break;
+                case ATYP_IPV6:   need = 4 + 16 + 2;          break;
+                case ATYP_DOMAIN: need = 4 + 1 + data[4] + 2; break;
+                default:          return -1;
+            }
+            if (data[0] != SOCKS5_VERSION || data[1] != 0x00)
+            {
+                LOG_ERROR("Parent %s:%s refused CONNECT, rep=0x%02x", p->host, p->port, data[1]);
+                return -1;
+            }
+            if (readable < need)
+            {
+                return 0;
+            }
+            // Всё, что после ответа, — уже данные назначения, их оставляем в буфере
+            buffer_skip(buff, need);
+            uc->step = up_done;
+            return 1;
+        }
+        case up_ready:
+        case up_done:
+        {
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Кладёт в сокет CONNECT на назначение туннеля — адрес передаём как прислал клиент,
+ * без локального резолва (резолвит родитель)
+ */
+static int upstream_send_request(upstream_conn_t *uc, tunnel_t *tunnel)
+{
+    request_protocol_t *rp     = &tunnel->rp;
+    buffer_t           *out    = uc->sock->write_buffer;
+    uint8_t             head[4] = { SOCKS5_VERSION, SOCKS5_CONNECT, 0x00, rp->atyp };
+
+    if (buffer_write(out, head, sizeof(head)) < 0)
+    {
+        return -1;
+    }
+    switch (rp->atyp)
+    {
+        case ATYP_IPV4:
+            if (buffer_write(out, rp->addr, 4) < 0) return -1;
+            break;
+        case ATYP_IPV6:
+            if (buffer_write(out, rp->addr, 16) < 0) return -1;
+            break;
+        case ATYP_DOMAIN:
+            if (buffer_write(out, &rp->domainlen, 1) < 0
+             || buffer_write(out, rp->addr, rp->domainlen) < 0) return -1;
+            break;
+        default:
+            return -1;
+    }
+    if (buffer_write(out, &rp->port, sizeof(rp->port)) < 0)
+    {
+        return -1;
+    }
+    uc->step = up_request;
+    return 0;
+}
+
+/*
+ * Общий шаг для пуловых соединений: двигаем хэндшейк и обновляем epoll
+ */
+static void upstream_pool_progress(upstream_conn_t *uc)
+{
+    int status = upstream_advance(uc);
+    if (status < 0)
+    {
+        LOG_WARN("Warm connection to parent %s:%s failed", uc->parent->host, uc->parent->port);
+        upstream_pool_drop(uc, 1);
+        return;
+    }
+    if (status > 0)
+    {
+        // Соединение прогрелось: теперь оно ждёт туннель не дольше UPSTREAM_IDLE_MS
+        ++uc->parent->nready;
+        uc->deadline = server_now_ms() + UPSTREAM_IDLE_MS;
+        uc->probe    = 0;
+        upstream_parent_ok(uc->parent);
+    }
+    epoll_modify(uc->sock, buffer_readable(uc->sock->write_buffer) > 0, 1);
+}
+
+/*
+ * EPOLLIN на пуловом соединении: ответы хэндшейка или закрытие со стороны родителя
+ */
+static void upstream_pool_read_handle(int fd, void *ud)
+{
+    sock_t          *sock = (sock_t *)ud;
+    upstream_conn_t *uc   = (upstream_conn_t *)sock->context;
+
+    int n = buffer_readfd(sock->read_buffer, fd);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    if (n <= 0 || uc->step == up_ready)
+    {
+        // Родитель закрыл простаивающее соединение (это не ошибка) или оборвал хэндшейк (ошибка)
+        upstream_pool_drop(uc, uc->step != up_ready);
+        return;
+    }
+    upstream_pool_progress(uc);
+}
+
+/*
+ * EPOLLOUT на пуловом соединении: дописываем хэндшейк или ловим окончание connect
+ */
+static void upstream_pool_write_handle(int fd, void *ud)
+{
+    sock_t          *sock = (sock_t *)ud;
+    upstream_conn_t *uc   = (upstream_conn_t *)sock->context;
+
+    if (buffer_readable(sock->write_buffer) > 0
+        && buffer_writefd(sock->write_buffer, fd) < 0
+        && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        upstream_pool_drop(uc, 1);
+        return;
+    }
+    if (uc->step == up_connecting)
+    {
+        upstream_pool_progress(uc);
+        return;
+    }
+    epoll_modify(sock, buffer_readable(sock->write_buffer) > 0, 1);
+}
+
+/*
+ * Таймер: протухшие хэндшейки и простои, доливка пулов, пробы выкинутых родителей
+ */
+static void upstream_tick(void *ud)
+{
+    (void)ud;
+    unsigned long long now = server_now_ms();
+
+    for (int i = 0; i < nparents; ++i)
+    {
+        upstream_parent_t *p = &parents[i];
+
+        // По одному, т.к. drop с ошибкой может снести весь пул целиком
+        upstream_conn_t *uc = p->pool;
+        while (uc != NULL)
+        {
+            if (now < uc->deadline)
+            {
+                uc = uc->next;
+                continue;
+            }
+            int timeout = uc->step != up_ready;
+            if (timeout)
+            {
+                LOG_WARN("Handshake with parent %s:%s timed out", p->host, p->port);
+            }
+            upstream_pool_drop(uc, timeout);
+            uc = p->pool;
+        }
+
+        if (!p->healthy)
+        {
+            // Активная проверка: одна проба за раз, когда пауза вышла
+            if (now >= p->eject_until && p->npool == 0)
+            {
+                LOG_INFO("Probing ejected parent %s:%s", p->host, p->port);
+                upstream_conn_t *probe = upstream_dial(p);
+                if (probe == NULL)
+                {
+                    upstream_parent_failed(p, 1);
+                    continue;
+                }
+                probe->probe = 1;
+                pool_link(p, probe);
+            }
+            continue;
+        }
+
+        while (p->npool < UPSTREAM_POOL_SIZE)
+        {
+            upstream_conn_t *warm = upstream_dial(p);
+            if (warm == NULL)
+            {
+                upstream_parent_failed(p, 0);
+                break;
+            }
+            pool_link(p, warm);
+        }
+    }
+}
+
+int upstream_init(const char *list)
+{
+    char  copy[4096];
+    char *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", list);
+
+    for (char *spec = strtok_r(copy, ",", &save); spec != NULL; spec = strtok_r(NULL, ",", &save))
+    {
+        if (nparents >= UPSTREAM_MAX_PARENTS)
+        {
+            LOG_ERROR("Too many upstream parents, max=%d", UPSTREAM_MAX_PARENTS);
+            return -1;
+        }
+        if (upstream_parse_parent(spec, &parents[nparents]) < 0)
+        {
+            LOG_ERROR("Bad upstream parent \"%s\", expected [user:pass@]host:port", spec);
+            return -1;
+        }
+        LOG_INFO("Upstream parent #%d: %s:%s%s", nparents,
+                 parents[nparents].host, parents[nparents].port,
+                 parents[nparents].username[0] ? " (USER/PASS)" : "");
+        ++nparents;
+    }
+
+    if (nparents == 0 || ring_build() < 0)
+    {
+        LOG_ERROR("Failed upstream_init, parents=\"%s\"", list);
+        return -1;
+    }
+
+    // Сразу прогреваем пулы, дальше их держит таймер
+    upstream_tick(NULL);
+    return server_timer_add(UPSTREAM_TICK_MS, upstream_tick, NULL);
+}
+
+bool upstream_enabled(void)
+{
+    return nparents > 0;
+}
+
+int upstream_connect(tunnel_t *tunnel)
+{
+    char key[300];
+    snprintf(key, sizeof(key), "%s:%s", tunnel->dst_host, tunnel->dst_port);
+
+    upstream_parent_t *p = ring_lookup(key);
+    if (p == NULL)
+    {
+        LOG_ERROR("No healthy upstream parent for %s", key);
+        return -1;
+    }
+
+    // Ищем тёплое соединение; нет — открываем новое и проходим хэндшейк прямо в туннеле
+    upstream_conn_t *uc = p->pool;
+    while (uc != NULL && uc->step != up_ready)
+    {
+        uc = uc->next;
+    }
+
+    if (uc != NULL)
+    {
+        pool_unlink(p, uc);
+        if (upstream_send_request(uc, tunnel) < 0)
+        {
+            sock_release(uc->sock);
+            free(uc);
+            return -1;
+        }
+        LOG_INFO("Tunnel to %s via parent %s:%s (warm fd=%d)", key, p->host, p->port, uc->sock->fd);
+    }
+    else
+    {
+        uc = upstream_dial(p);
+        if (uc == NULL)
+        {
+            upstream_parent_failed(p, 0);
+            return -1;
+        }
+        LOG_INFO("Tunnel to %s via parent %s:%s (cold fd=%d)", key, p->host, p->port, uc->sock->fd);
+    }
+
+    tunnel->upstream = uc;
+    tunnel->state    = connecting_state;
+    tunnel_attach_remote(tunnel, uc->sock);
+    epoll_modify(uc->sock, 1, 1);
+    return 0;
+}
+
+int upstream_connecting_handle(tunnel_t *tunnel)
+{
+    upstream_conn_t   *uc     = tunnel->upstream;
+    upstream_parent_t *p      = uc->parent;
+    upstream_step_t    before = uc->step;
+
+    int status = upstream_advance(uc);
+    if (status < 0)
+    {
+        // Отказ на CONNECT — проблема назначения, а не родителя
+        if (before < up_ready)
+        {
+            upstream_parent_failed(p, 0);
+        }
+        return -1;
+    }
+
+    if (status > 0 && uc->step == up_ready)
+    {
+        // Холодное соединение прогрелось — теперь сам CONNECT
+        upstream_parent_ok(p);
+        if (upstream_send_request(uc, tunnel) < 0)
+        {
+            return -1;
+        }
+        status = 0;
+    }
+
+    if (buffer_readable(uc->sock->write_buffer) > 0)
+    {
+        epoll_modify(uc->sock, 1, 1);
+    }
+    if (status == 0)
+    {
+        return 0;
+    }
+
+    LOG_INFO("Parent %s:%s connected tunnel to %s:%s", p->host, p->port,
+             tunnel->dst_host, tunnel->dst_port);
+    tunnel->upstream = NULL;
+    upstream_conn_release(uc);
+    return 1;
+}
+
+void upstream_conn_release(upstream_conn_t *conn)
+{
+    free(conn);
+}
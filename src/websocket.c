@@ -0,0 +1,312 @@
+#include <string.h>
+
+#include "websocket.h"
+#include "scan.h"
+
+
+#define WS_BLOCK 4096  // Сколько текста снимаем с маски за раз (буфер на стеке)
+
+
+void ws_flow_init(ws_flow_t *ws)
+{
+    memset(ws, 0, sizeof(*ws));
+}
+
+/*
+ * Полный размер заголовка фрейма по первым двум байтам
+ */
+static size_t header_size(const uint8_t *hdr)
+{
+    uint8_t l7 = hdr[1] & 0x7f;
+    return 2 + (l7 == 126 ? 2 : l7 == 127 ? 8 : 0) + (hdr[1] & 0x80 ? 4 : 0);
+}
+
+/*
+ * Потоковая проверка UTF-8: ASCII-прогоны пропускаются векторно,
+ * многобайтные последовательности — автоматом с диапазоном следующего байта
+ */
+static void utf8_feed(ws_stream_t *s, const uint8_t *p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && !s->utf8_bad)
+    {
+        if (s->utf8_need == 0)
+        {
+            i += scan_ascii(p + i, n - i);
+            if (i >= n)
+            {
+                break;
+            }
+            uint8_t c = p[i++];
+            s->utf8_lo = 0x80;
+            s->utf8_hi = 0xbf;
+            if (c >= 0xc2 && c <= 0xdf)
+            {
+                s->utf8_need = 1;
+            }
+            else if (c >= 0xe0 && c <= 0xef)
+            {
+                s->utf8_need = 2;
+                // Без overlong (E0 A0..) и суррогатов (ED ..9F)
+                s->utf8_lo   = c == 0xe0 ? 0xa0 : 0x80;
+                s->utf8_hi   = c == 0xed ? 0x9f : 0xbf;
+            }
+            else if (c >= 0xf0 && c <= 0xf4)
+            {
+                s->utf8_need = 3;
+                // Без overlong (F0 90..) и выше U+10FFFF (F4 ..8F)
+                s->utf8_lo   = c == 0xf0 ? 0x90 : 0x80;
+                s->utf8_hi   = c == 0xf4 ? 0x8f : 0xbf;
+            }
+            else
+            {
+                s->utf8_bad = 1;
+            }
+        }
+        else
+        {
+            uint8_t c = p[i++];
+            if (c < s->utf8_lo || c > s->utf8_hi)
+            {
+                s->utf8_bad = 1;
+                break;
+            }
+            s->utf8_need--;
+            s->utf8_lo = 0x80;
+            s->utf8_hi = 0xbf;
+        }
+    }
+}
+
+/*
+ * Кусок payload'а текстового сообщения: снять маску, проверить UTF-8, набрать превью
+ */
+static void text_feed(ws_stream_t *s, const uint8_t *p, size_t n)
+{
+    uint8_t block[WS_BLOCK];
+    while (n > 0)
+    {
+        size_t         b     = n < sizeof(block) ? n : sizeof(block);
+        const uint8_t *plain = p;
+        if (s->masked)
+        {
+            scan_unmask(block, p, b, s->key, (size_t)s->offset);
+            plain = block;
+        }
+        if (s->preview_len < sizeof(s->preview))
+        {
+            size_t c = sizeof(s->preview) - s->preview_len;
+            c = c < b ? c : b;
+            memcpy(s->preview + s->preview_len, plain, c);
+            s->preview_len += c;
+        }
+        utf8_feed(s, plain, b);
+        s->offset += b;
+        p         += b;
+        n         -= b;
+    }
+}
+
+static void broken(ws_stream_t *s, int is_client, const char *what,
+                   const ws_flow_cb_t *cb, void *ud)
+{
+    s->state = WS_BROKEN;
+    cb->on_error(ud, is_client, what);
+}
+
+/*
+ * Заголовок фрейма собран: проверяем и готовимся к payload'у. Возвращает 0 или <0
+ */
+static int frame_begin(ws_stream_t *s, int is_client, const ws_flow_cb_t *cb, void *ud)
+{
+    const uint8_t *h  = s->hdr;
+    uint8_t        l7 = h[1] & 0x7f;
+    size_t         at = 2;
+
+    s->fin    = (h[0] & 0x80) != 0;
+    s->opcode = h[0] & 0x0f;
+    s->masked = (h[1] & 0x80) != 0;
+    if (l7 == 126)
+    {
+        s->left = (uint64_t)h[2] << 8 | h[3];
+        at      = 4;
+    }
+    else if (l7 == 127)
+    {
+        s->left = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            s->left = s->left << 8 | h[2 + i];
+        }
+        at = 10;
+        if (s->left >> 63)
+        {
+            broken(s, is_client, "64-bit length with the high bit set", cb, ud);
+            return -1;
+        }
+    }
+    else
+    {
+        s->left = l7;
+    }
+    if (s->masked)
+    {
+        memcpy(s->key, h + at, 4);
+    }
+    s->offset  = 0;
+    s->hdr_len = 0;
+
+    if (s->opcode >= 0x8)
+    {
+        if (s->opcode > WS_OP_PONG || !s->fin || s->left > WS_CONTROL_MAX)
+        {
+            broken(s, is_client, "bad control frame", cb, ud);
+            return -1;
+        }
+        s->ctrl_len = 0;
+        return 0;
+    }
+
+    if (s->opcode == WS_OP_CONT)
+    {
+        if (s->msg_opcode == 0)
+        {
+            broken(s, is_client, "continuation without a message", cb, ud);
+            return -1;
+        }
+    }
+    else if (s->opcode == WS_OP_TEXT || s->opcode == WS_OP_BINARY)
+    {
+        if (s->msg_opcode != 0)
+        {
+            broken(s, is_client, "new message inside a fragmented one", cb, ud);
+            return -1;
+        }
+        s->msg_opcode  = s->opcode;
+        s->msg_deflate = (h[0] & 0x40) != 0;
+        s->msg_len     = 0;
+        s->msg_frames  = 0;
+        s->utf8_need   = 0;
+        s->utf8_bad    = 0;
+        s->preview_len = 0;
+    }
+    else
+    {
+        broken(s, is_client, "reserved opcode", cb, ud);
+        return -1;
+    }
+    s->msg_frames++;
+    return 0;
+}
+
+/*
+ * Payload фрейма кончился
+ */
+static void frame_end(ws_stream_t *s, int is_client, const ws_flow_cb_t *cb, void *ud)
+{
+    s->state = WS_HEADER;
+    if (s->opcode >= 0x8)
+    {
+        cb->on_control(ud, is_client, s->opcode, s->ctrl, s->ctrl_len);
+        return;
+    }
+    if (!s->fin)
+    {
+        return;
+    }
+
+    ws_message_t msg;
+    msg.opcode      = s->msg_opcode;
+    msg.len         = s->msg_len;
+    msg.frames      = s->msg_frames;
+    msg.deflate     = s->msg_deflate;
+    msg.utf8_ok     = !s->utf8_bad && s->utf8_need == 0;
+    msg.preview     = s->preview;
+    msg.preview_len = s->preview_len;
+    s->messages++;
+    cb->on_message(ud, is_client, &msg);
+    s->msg_opcode = 0;
+}
+
+void ws_flow_feed(ws_flow_t *ws, const uint8_t *data, size_t len, int is_client,
+                  const ws_flow_cb_t *cb, void *ud)
+{
+    ws_stream_t *s = &ws->dir[is_client ? 1 : 0];
+
+    while (len > 0)
+    {
+        switch (s->state)
+        {
+            case WS_BROKEN:
+            {
+                return;
+            }
+            case WS_HEADER:
+            {
+                size_t need = s->hdr_len < 2 ? 2 : header_size(s->hdr);
+                while (len > 0 && s->hdr_len < need)
+                {
+                    s->hdr[s->hdr_len++] = *data++;
+                    --len;
+                    if (s->hdr_len == 2)
+                    {
+                        need = header_size(s->hdr);
+                    }
+                }
+                if (s->hdr_len < need)
+                {
+                    return;
+                }
+                if (frame_begin(s, is_client, cb, ud) < 0)
+                {
+                    return;
+                }
+                s->state = WS_PAYLOAD;
+                if (s->left == 0)
+                {
+                    frame_end(s, is_client, cb, ud);
+                }
+                break;
+            }
+            case WS_PAYLOAD:
+            {
+                size_t n = len < s->left ? len : (size_t)s->left;
+                if (s->opcode >= 0x8)
+                {
+                    // Управляющий фрейм (<= 125 байт) — снимаем маску целиком
+                    if (s->masked)
+                    {
+                        scan_unmask(s->ctrl + s->ctrl_len, data, n, s->key, (size_t)s->offset);
+                    }
+                    else
+                    {
+                        memcpy(s->ctrl + s->ctrl_len, data, n);
+                    }
+                    s->ctrl_len += n;
+                    s->offset   += n;
+                }
+                else if (s->msg_opcode == WS_OP_TEXT && !s->msg_deflate)
+                {
+                    text_feed(s, data, n);
+                }
+                else
+                {
+                    // Бинарное или сжатое — только считаем
+                    s->offset += n;
+                }
+                if (s->opcode < 0x8)
+                {
+                    s->msg_len += n;
+                }
+                s->left -= n;
+                data    += n;
+                len     -= n;
+                if (s->left == 0)
+                {
+                    frame_end(s, is_client, cb, ud);
+                }
+                break;
+            }
+        }
+    }
+}